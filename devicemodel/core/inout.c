@@ -28,7 +28,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
+#include "dm.h"
 #include "inout.h"
 #include "log.h"
 SET_DECLARE(inout_port_set, struct inout_port);
@@ -45,6 +47,18 @@ static struct {
 	void		*arg;
 } inout_handlers[MAX_IOPORTS];
 
+/*
+ * Protects inout_handlers[], which the dispatch threads read while a BAR
+ * reprogram on another thread registers or unregisters ports.
+ */
+static pthread_rwlock_t inout_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * Serializes the handlers which are not thread safe when the I/O requests
+ * are handled by several dispatch threads.
+ */
+static pthread_mutex_t inout_emul_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int
 default_inout(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	      uint32_t *eax, void *arg)
@@ -102,9 +116,11 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 		((bytes != 1) && (bytes != 2) && (bytes != 4)))
 		return -1;
 
+	pthread_rwlock_rdlock(&inout_rwlock);
 	handler = inout_handlers[port].handler;
 	flags = inout_handlers[port].flags;
 	arg = inout_handlers[port].arg;
+	pthread_rwlock_unlock(&inout_rwlock);
 
 	if (pio_request->direction == REQUEST_READ) {
 		if (!(flags & IOPORT_F_IN))
@@ -113,8 +129,15 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 		if (!(flags & IOPORT_F_OUT))
 			return -1;
 	}
-	retval = handler(ctx, *pvcpu, in, port, bytes,
-		(uint32_t *)&(pio_request->value), arg);
+
+	if (ioreq_dispatch_enabled && !(flags & IOPORT_F_MT_SAFE)) {
+		pthread_mutex_lock(&inout_emul_lock);
+		retval = handler(ctx, *pvcpu, in, port, bytes,
+			(uint32_t *)&(pio_request->value), arg);
+		pthread_mutex_unlock(&inout_emul_lock);
+	} else
+		retval = handler(ctx, *pvcpu, in, port, bytes,
+			(uint32_t *)&(pio_request->value), arg);
 	return retval;
 }
 
@@ -156,14 +179,18 @@ register_inout(struct inout_port *iop)
 		return -1;
 	}
 
+	pthread_rwlock_wrlock(&inout_rwlock);
+
 	/*
 	 * Verify that the new registration is not overwriting an already
 	 * allocated i/o range.
 	 */
 	if ((iop->flags & IOPORT_F_DEFAULT) == 0) {
 		for (i = iop->port; i < iop->port + iop->size; i++) {
-			if ((inout_handlers[i].flags & IOPORT_F_DEFAULT) == 0)
+			if ((inout_handlers[i].flags & IOPORT_F_DEFAULT) == 0) {
+				pthread_rwlock_unlock(&inout_rwlock);
 				return -1;
+			}
 		}
 	}
 
@@ -174,6 +201,8 @@ register_inout(struct inout_port *iop)
 		inout_handlers[i].arg = iop->arg;
 	}
 
+	pthread_rwlock_unlock(&inout_rwlock);
+
 	return 0;
 }
 
@@ -34,6 +34,7 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 #include <sysexits.h>
 #include <stdbool.h>
 #include <getopt.h>
@@ -89,6 +90,9 @@ bool lapic_pt;
 bool is_rtvm;
 bool is_winvm;
 bool skip_pci_mem64bar_workaround = false;
+bool ioreq_dispatch_enabled;
+bool virtio_eventfd_enabled;
+bool hyperv_vendor_id;
 
 static int guest_ncpus;
 static int virtio_msix = 1;
@@ -110,6 +114,38 @@ static char vhm_request_page[4096] __aligned(4096);
 static struct vhm_request *vhm_req_buf =
 				(struct vhm_request *)&vhm_request_page;
 
+/*
+ * Optional parallel dispatch of I/O requests. By default vm_loop() handles
+ * the pending requests of all vCPUs one after another, so one slow device
+ * emulation delays the I/O completion of every other vCPU. With
+ * "--ioreq_dispatch", vm_loop() only hands the pending requests off to the
+ * dispatch threads; each one serves a group of "ioreq_vcpus_per_thread"
+ * vCPUs.
+ */
+struct ioreq_dispatcher {
+	pthread_t	tid;
+	int		id;
+	struct vmctx	*ctx;
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cond;
+	uint32_t	pending;	/* bitmap of vCPUs to be handled */
+	bool		stop;
+};
+
+static int ioreq_vcpus_per_thread;
+static int ioreq_nr_dispatchers;
+static struct ioreq_dispatcher ioreq_dispatchers[VM_MAXCPU];
+
+/* bitmap of vCPUs whose request was handed off and is not yet completed */
+static uint32_t ioreq_inflight;
+/* number of handed-off requests completed so far, under ioreq_done_mtx */
+static uint64_t ioreq_done_seq;
+static pthread_mutex_t ioreq_done_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ioreq_done_cond;
+
+/* how long vm_loop() sleeps between checks for new requests, in ns */
+#define IOREQ_DISPATCH_POLL_NS	20000L
+
 struct dmstats {
 	uint64_t	vmexit_bogus;
 	uint64_t	vmexit_reqidle;
@@ -138,10 +174,11 @@ usage(int code)
 		"       %*s [-l lpc] [-m mem] [-r ramdisk_image_path]\n"
 		"       %*s [-s pci] [-U uuid] [--vsbl vsbl_file_name] [--ovmf ovmf_file_path]\n"
 		"       %*s [--part_info part_info_name] [--enable_trusty] [--intr_monitor param_setting]\n"
-		"       %*s [--vtpm2 sock_path] [--virtio_poll interval] [--mac_seed seed_string]\n"
+		"       %*s [--vtpm2 sock_path] [--virtio_poll [adaptive,]interval] [--mac_seed seed_string]\n"
 		"       %*s [--vmcfg sub_options] [--dump vm_idx] [--debugexit] \n"
 		"       %*s [--logger-setting param_setting] [--pm_notify_channel]\n"
-		"       %*s [--pm_by_vuart vuart_node] <vm>\n"
+		"       %*s [--pm_by_vuart vuart_node] [--ioreq_dispatch vcpus]\n"
+		"       %*s [--mevent_loops loops] [--virtio_eventfd] [--hyperv_vendor_id] <vm>\n"
 		"       -A: create ACPI tables\n"
 		"       -B: bootargs for kernel\n"
 		"       -E: elf image path\n"
@@ -170,6 +207,7 @@ usage(int code)
 		"       --intr_monitor: enable interrupt storm monitor\n"
 		"            its params: threshold/s,probe-period(s),delay_time(ms),delay_duration(ms)\n"
 		"       --virtio_poll: enable virtio poll mode with poll interval with ns\n"
+		"            adaptive: poll a virtqueue only while the guest kicks it at a high rate\n"
 		"       --vtpm2: Virtual TPM2 args: sock_path=$PATH_OF_SWTPM_SOCKET\n"
 		"       --lapic_pt: enable local apic passthrough\n"
 		"       --rtvm: indicate that the guest is rtvm\n"
@@ -177,11 +215,20 @@ usage(int code)
 		"       --pm_notify_channel: define the channel used to notify guest about power event\n"
 		"       --pm_by_vuart:pty,/run/acrn/vuart_vmname or tty,/dev/ttySn\n"
 		"       --windows: support Oracle virtio-blk, virtio-net and virtio-input devices\n"
-		"            for windows guest with secure boot\n",
+		"            for windows guest with secure boot\n"
+		"       --ioreq_dispatch: handle I/O requests in dispatch threads,\n"
+		"            each one serving the given number of vCPUs\n"
+		"       --mevent_loops: number of event dispatch loops (1-5), the net,\n"
+		"            timer, console and virtio kick events are spread over them\n"
+		"       --virtio_eventfd: deliver the kicks and interrupts of the userspace\n"
+		"            virtio devices through ioeventfd and irqfd\n"
+		"       --hyperv_vendor_id: report the Hyper-V vendor ID to the guest, so a\n"
+		"            Linux guest uses the Hyper-V enlightenments\n",
 		progname, (int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
-		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "");
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "");
 
 	exit(code);
 }
@@ -397,7 +444,10 @@ handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
 		exit(1);
 	}
 
+	/* MSIs raised by the emulation are injected before the completion */
+	vm_msi_batch_begin();
 	(*handler[exitcode])(ctx, vhm_req, &vcpu);
+	vm_msi_batch_end();
 
 	/* We cannot notify the VHM/hypervisor on the request completion at this
 	 * point if the UOS is in suspend or system reset mode, as the VM is
@@ -413,6 +463,217 @@ handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
 	vm_notify_request_done(ctx, vcpu);
 }
 
+static void *
+ioreq_dispatch_thread(void *param)
+{
+	struct ioreq_dispatcher *disp = param;
+	uint32_t pending;
+	int vcpu;
+
+	while (1) {
+		pthread_mutex_lock(&disp->mtx);
+		while (!disp->pending && !disp->stop)
+			pthread_cond_wait(&disp->cond, &disp->mtx);
+		if (disp->stop) {
+			pthread_mutex_unlock(&disp->mtx);
+			break;
+		}
+		pending = disp->pending;
+		disp->pending = 0;
+		pthread_mutex_unlock(&disp->mtx);
+
+		while (pending) {
+			vcpu = ffs(pending) - 1;
+			pending &= ~(1U << vcpu);
+
+			handle_vmexit(disp->ctx, &vhm_req_buf[vcpu], vcpu);
+
+			/*
+			 * Only drop the in-flight mark after the request is
+			 * completed, otherwise vm_loop() may see the stale
+			 * request still in PROCESSING state and hand it off
+			 * twice.
+			 */
+			atomic_and_fetch(&ioreq_inflight, ~(1U << vcpu));
+			pthread_mutex_lock(&ioreq_done_mtx);
+			ioreq_done_seq++;
+			pthread_cond_signal(&ioreq_done_cond);
+			pthread_mutex_unlock(&ioreq_done_mtx);
+		}
+	}
+
+	return NULL;
+}
+
+static int
+ioreq_dispatch_init(struct vmctx *ctx)
+{
+	struct ioreq_dispatcher *disp;
+	char tname[MAXCOMLEN + 1];
+	pthread_condattr_t attr;
+	int i, error;
+
+	ioreq_inflight = 0;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ioreq_done_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	ioreq_nr_dispatchers = (guest_ncpus + ioreq_vcpus_per_thread - 1) /
+				ioreq_vcpus_per_thread;
+
+	for (i = 0; i < ioreq_nr_dispatchers; i++) {
+		disp = &ioreq_dispatchers[i];
+		disp->id = i;
+		disp->ctx = ctx;
+		disp->pending = 0;
+		disp->stop = false;
+		pthread_mutex_init(&disp->mtx, NULL);
+		pthread_cond_init(&disp->cond, NULL);
+
+		error = pthread_create(&disp->tid, NULL,
+				ioreq_dispatch_thread, disp);
+		if (error) {
+			pr_err("%s: failed to create dispatch thread %d\n",
+				__func__, i);
+			ioreq_nr_dispatchers = i;
+			return -1;
+		}
+		snprintf(tname, sizeof(tname), "ioreq %d", i);
+		pthread_setname_np(disp->tid, tname);
+	}
+
+	return 0;
+}
+
+static void
+ioreq_dispatch_deinit(void)
+{
+	struct ioreq_dispatcher *disp;
+	int i;
+
+	for (i = 0; i < ioreq_nr_dispatchers; i++) {
+		disp = &ioreq_dispatchers[i];
+		pthread_mutex_lock(&disp->mtx);
+		disp->stop = true;
+		pthread_cond_signal(&disp->cond);
+		pthread_mutex_unlock(&disp->mtx);
+		pthread_join(disp->tid, NULL);
+		pthread_mutex_destroy(&disp->mtx);
+		pthread_cond_destroy(&disp->cond);
+	}
+	ioreq_nr_dispatchers = 0;
+	pthread_cond_destroy(&ioreq_done_cond);
+}
+
+/*
+ * Hand off the new pending requests to the dispatch threads. Returns the
+ * number of requests handed off.
+ */
+static int
+ioreq_dispatch_pending(struct vmctx *ctx)
+{
+	struct ioreq_dispatcher *disp;
+	struct vhm_request *vhm_req;
+	int vcpu_id, count = 0;
+
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+		vhm_req = &vhm_req_buf[vcpu_id];
+		if ((atomic_load(&ioreq_inflight) & (1U << vcpu_id)) ||
+		    (atomic_load(&vhm_req->processed) != REQ_STATE_PROCESSING) ||
+		    (vhm_req->client != ctx->ioreq_client))
+			continue;
+
+		atomic_or_fetch(&ioreq_inflight, 1U << vcpu_id);
+
+		disp = &ioreq_dispatchers[vcpu_id / ioreq_vcpus_per_thread];
+		pthread_mutex_lock(&disp->mtx);
+		disp->pending |= 1U << vcpu_id;
+		pthread_cond_signal(&disp->cond);
+		pthread_mutex_unlock(&disp->mtx);
+		count++;
+	}
+
+	return count;
+}
+
+static uint64_t
+ioreq_dispatch_seq(void)
+{
+	uint64_t seq;
+
+	pthread_mutex_lock(&ioreq_done_mtx);
+	seq = ioreq_done_seq;
+	pthread_mutex_unlock(&ioreq_done_mtx);
+
+	return seq;
+}
+
+/*
+ * The VHM keeps a request pending until it is completed, so the attach
+ * returns right away as long as any handed-off request is still being
+ * emulated. Sleep until a request completes after "seq" (sampled before
+ * the attach) instead of spinning on the attach. The VHM gives no wakeup
+ * for a new request while another one is pending, so the sleep is bounded
+ * by IOREQ_DISPATCH_POLL_NS: a new request from a vCPU which is not in
+ * flight is picked up within that time, not after the slow emulation.
+ */
+static void
+ioreq_dispatch_wait(uint64_t seq)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_nsec += IOREQ_DISPATCH_POLL_NS;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&ioreq_done_mtx);
+	while ((ioreq_done_seq == seq) && atomic_load(&ioreq_inflight)) {
+		if (pthread_cond_timedwait(&ioreq_done_cond, &ioreq_done_mtx,
+				&deadline) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&ioreq_done_mtx);
+}
+
+/* Wait until all the handed-off requests are emulated. */
+static void
+ioreq_dispatch_drain(void)
+{
+	pthread_mutex_lock(&ioreq_done_mtx);
+	while (atomic_load(&ioreq_inflight))
+		pthread_cond_wait(&ioreq_done_cond, &ioreq_done_mtx);
+	pthread_mutex_unlock(&ioreq_done_mtx);
+}
+
+static int
+parse_ioreq_dispatch(char *arg)
+{
+	int vcpus;
+
+	if (dm_strtoi(arg, NULL, 10, &vcpus) || vcpus <= 0 ||
+	    vcpus > VM_MAXCPU)
+		return -1;
+
+	ioreq_vcpus_per_thread = vcpus;
+	ioreq_dispatch_enabled = true;
+	return 0;
+}
+
+static int
+parse_mevent_loops(char *arg)
+{
+	int loops;
+
+	if (dm_strtoi(arg, NULL, 10, &loops))
+		return -1;
+
+	return mevent_set_loops(loops);
+}
+
 static void
 guest_pm_notify_init(struct vmctx *ctx)
 {
@@ -666,19 +927,42 @@ vm_loop(struct vmctx *ctx)
 		return;
 	}
 
+	if (ioreq_dispatch_enabled && ioreq_dispatch_init(ctx) != 0) {
+		pr_err("%s, failed to init ioreq dispatch.\n", __func__);
+		ioreq_dispatch_deinit();
+		return;
+	}
+
 	while (1) {
 		int vcpu_id;
 		struct vhm_request *vhm_req;
+		uint64_t done_seq = 0;
+
+		if (ioreq_dispatch_enabled)
+			done_seq = ioreq_dispatch_seq();
 
 		error = vm_attach_ioreq_client(ctx);
 		if (error)
 			break;
 
-		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
-			vhm_req = &vhm_req_buf[vcpu_id];
-			if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
-				&& (vhm_req->client == ctx->ioreq_client))
-				handle_vmexit(ctx, vhm_req, vcpu_id);
+		if (ioreq_dispatch_enabled) {
+			if (ioreq_dispatch_pending(ctx) == 0)
+				ioreq_dispatch_wait(done_seq);
+
+			/*
+			 * The requests triggering the suspend mode changes
+			 * are not completed until the reset/resume, so drain
+			 * the in-flight ones before touching the devices.
+			 */
+			if (vm_get_suspend_mode() != VM_SUSPEND_NONE)
+				ioreq_dispatch_drain();
+		} else {
+			for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+				vhm_req = &vhm_req_buf[vcpu_id];
+				if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
+					&& (vhm_req->client == ctx->ioreq_client))
+					handle_vmexit(ctx, vhm_req, vcpu_id);
+			}
 		}
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
@@ -694,6 +978,11 @@ vm_loop(struct vmctx *ctx)
 			vm_suspend_resume(ctx);
 		}
 	}
+
+	if (ioreq_dispatch_enabled) {
+		ioreq_dispatch_drain();
+		ioreq_dispatch_deinit();
+	}
 	pr_err("VM loop exit\n");
 }
 
@@ -732,6 +1021,10 @@ enum {
 	CMD_OPT_PM_NOTIFY_CHANNEL,
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
+	CMD_OPT_IOREQ_DISPATCH,
+	CMD_OPT_MEVENT_LOOPS,
+	CMD_OPT_VIRTIO_EVENTFD,
+	CMD_OPT_HYPERV_VENDOR_ID,
 };
 
 static struct option long_options[] = {
@@ -770,6 +1063,10 @@ static struct option long_options[] = {
 	{"pm_notify_channel",	required_argument,	0, CMD_OPT_PM_NOTIFY_CHANNEL},
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
+	{"ioreq_dispatch",	required_argument,	0, CMD_OPT_IOREQ_DISPATCH},
+	{"mevent_loops",	required_argument,	0, CMD_OPT_MEVENT_LOOPS},
+	{"virtio_eventfd",	no_argument,		0, CMD_OPT_VIRTIO_EVENTFD},
+	{"hyperv_vendor_id",	no_argument,		0, CMD_OPT_HYPERV_VENDOR_ID},
 	{0,			0,			0,  0  },
 };
 
@@ -933,6 +1230,20 @@ main(int argc, char *argv[])
 		case CMD_OPT_WINDOWS:
 			is_winvm = true;
 			break;
+		case CMD_OPT_IOREQ_DISPATCH:
+			if (parse_ioreq_dispatch(optarg) != 0)
+				errx(EX_USAGE, "invalid ioreq dispatch param %s", optarg);
+			break;
+		case CMD_OPT_MEVENT_LOOPS:
+			if (parse_mevent_loops(optarg) != 0)
+				errx(EX_USAGE, "invalid mevent loops %s", optarg);
+			break;
+		case CMD_OPT_VIRTIO_EVENTFD:
+			virtio_eventfd_enabled = true;
+			break;
+		case CMD_OPT_HYPERV_VENDOR_ID:
+			hyperv_vendor_id = true;
+			break;
 		case 'h':
 			usage(0);
 		default:
@@ -38,6 +38,8 @@
 #include <string.h>
 #include <pthread.h>
 
+#include "atomic.h"
+#include "dm.h"
 #include "vmm.h"
 #include "mem.h"
 #include "tree.h"
@@ -49,6 +51,7 @@ struct mmio_rb_range {
 	struct mem_range	mr_param;
 	uint64_t                mr_base;
 	uint64_t                mr_end;
+	int			mr_refcnt;	/* tree + running handlers */
 };
 
 static RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
@@ -63,6 +66,12 @@ static struct mmio_rb_range	*mmio_hint __aligned(sizeof(struct mmio_rb_range *))
 
 static pthread_rwlock_t mmio_rwlock;
 
+/*
+ * Serializes the handlers which are not thread safe when the I/O requests
+ * are handled by several dispatch threads.
+ */
+static pthread_mutex_t mmio_emul_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int
 mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
 {
@@ -128,6 +137,18 @@ mmio_rb_dump(struct mmio_rb_tree *rbt)
 
 RB_GENERATE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
+/*
+ * With the I/O request dispatch threads, a handler may still be running on
+ * one thread when the range is unregistered on another one, so the range
+ * is only freed when its last user drops it.
+ */
+static void
+mmio_rb_range_put(struct mmio_rb_range *entry)
+{
+	if (atomic_sub_fetch(&entry->mr_refcnt, 1) == 0)
+		free(entry);
+}
+
 static int
 mem_read(void *ctx, int vcpu, uint64_t gpa, uint64_t *rval, int size, void *arg)
 {
@@ -156,6 +177,7 @@ emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
 	uint64_t paddr = mmio_req->address;
 	int size = mmio_req->size;
 	struct mmio_rb_range *hint, *entry = NULL;
+	bool serialize;
 	int err;
 
 	pthread_rwlock_rdlock(&mmio_rwlock);
@@ -175,11 +197,19 @@ emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
 		return -ESRCH;
 	}
 
+	if (entry != NULL)
+		atomic_add_fetch(&entry->mr_refcnt, 1);
+
 	pthread_rwlock_unlock(&mmio_rwlock);
 
 	if (entry == NULL)
 		return -EINVAL;
 
+	serialize = ioreq_dispatch_enabled &&
+			!(entry->mr_param.flags & MEM_F_MT_SAFE);
+	if (serialize)
+		pthread_mutex_lock(&mmio_emul_lock);
+
 	if (mmio_req->direction == REQUEST_READ)
 		err = mem_read(ctx, 0, paddr, (uint64_t *)&mmio_req->value,
 				size, &entry->mr_param);
@@ -187,6 +217,11 @@ emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
 		err = mem_write(ctx, 0, paddr, mmio_req->value,
 				size, &entry->mr_param);
 
+	if (serialize)
+		pthread_mutex_unlock(&mmio_emul_lock);
+
+	mmio_rb_range_put(entry);
+
 	return err;
 }
 
@@ -204,6 +239,7 @@ register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		mrp->mr_param = *memp;
 		mrp->mr_base = memp->base;
 		mrp->mr_end = memp->base + memp->size - 1;
+		mrp->mr_refcnt = 1;
 		pthread_rwlock_wrlock(&mmio_rwlock);
 		if (mmio_rb_lookup(rbt, memp->base, &entry) != 0)
 			err = mmio_rb_add(rbt, mrp);
@@ -252,8 +288,8 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 	}
 	pthread_rwlock_unlock(&mmio_rwlock);
 
-	if (entry)
-		free(entry);
+	if (err == 0)
+		mmio_rb_range_put(entry);
 
 	return err;
 }
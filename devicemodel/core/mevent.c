@@ -29,14 +29,26 @@
 /*
  * Micro event library for FreeBSD, designed for a single i/o thread
  * using EPOLL, and having events be persistent by default.
+ *
+ * The events can optionally be spread over several dispatch loops, each
+ * one with its own epoll fd and thread, so that hot fds (e.g. the
+ * virtio-net tap, timers and the console) don't queue up behind each
+ * other. Loop 0 runs in the thread which calls mevent_dispatch().
+ *
+ * Registration and deletion don't take a lock: new and deleted events
+ * are pushed onto per-loop lock-free stacks, and only the thread of the
+ * loop touches its list of events.
  */
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/queue.h>
 #include <pthread.h>
 
@@ -46,15 +58,7 @@
 
 #define	MEVENT_MAX	64
 
-#define	MEV_ADD		1
-#define	MEV_ENABLE	2
-#define	MEV_DISABLE	3
-#define	MEV_DEL_PENDING	4
-
-static int epoll_fd;
-static pthread_t mevent_tid;
-static int mevent_pipefd[2];
-static pthread_mutex_t mevent_lmutex = PTHREAD_MUTEX_INITIALIZER;
+struct mevent_loop;
 
 struct mevent {
 	void			(*run)(int, enum ev_type, void *);
@@ -64,64 +68,104 @@ struct mevent {
 
 	int			me_fd;
 	enum			ev_type me_type;
-	int			me_cq;
-	int			me_state;
+	volatile int		me_state;
 
 	int			closefd;
+	struct mevent_loop	*me_loop;
+	struct mevent		*me_next;	/* link in reg/del stack */
 	LIST_ENTRY(mevent)	me_list;
 };
 
-static LIST_HEAD(listhead, mevent) global_head;
-/* List holds the mevent node which is requested to deleted */
-static LIST_HEAD(del_listhead, mevent) del_head;
+struct mevent_loop {
+	int			epoll_fd;
+	int			wake_fd;	/* eventfd to kick epoll_wait */
+	pthread_t		tid;
+	volatile bool		running;
+	volatile bool		stop;
 
-static void
-mevent_qlock(void)
+	struct mevent		*reg_head;	/* added, not yet on list */
+	struct mevent		*del_head;	/* deleted, not yet freed */
+	LIST_HEAD(listhead, mevent) list;	/* owned by the loop thread */
+
+	struct mevent_stats	stats;
+};
+
+static struct mevent_loop mevent_loops[MEVENT_MAX_LOOPS];
+static int mevent_nr_loops = 1;
+
+static inline uint64_t
+mevent_now_ns(void)
 {
-	pthread_mutex_lock(&mevent_lmutex);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
 }
 
-static void
-mevent_qunlock(void)
+static struct mevent_loop *
+mevent_class_loop(enum mevent_class cls)
 {
-	pthread_mutex_unlock(&mevent_lmutex);
+	return &mevent_loops[cls % mevent_nr_loops];
 }
 
 static bool
-is_dispatch_thread(void)
+is_dispatch_thread(struct mevent_loop *loop)
+{
+	return loop->running && pthread_equal(pthread_self(), loop->tid);
+}
+
+/*
+ * Lock-free push onto a reg/del stack. Only the loop thread pops, and it
+ * always takes the whole stack, so there is no ABA problem.
+ */
+static void
+mevent_stack_push(struct mevent **head, struct mevent *mevp)
+{
+	struct mevent *old = __atomic_load_n(head, __ATOMIC_RELAXED);
+
+	do {
+		mevp->me_next = old;
+	} while (!__atomic_compare_exchange_n(head, &old, mevp, true,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static struct mevent *
+mevent_stack_take(struct mevent **head)
 {
-	return (pthread_self() == mevent_tid);
+	return __atomic_exchange_n(head, NULL, __ATOMIC_ACQUIRE);
 }
 
 static void
-mevent_pipe_read(int fd, enum ev_type type, void *param)
+mevent_wake_read(int fd, enum ev_type type, void *param)
 {
-	char buf[MEVENT_MAX];
+	uint64_t val;
 	ssize_t status;
 
-	/*
-	 * Drain the pipe read side. The fd is non-blocking so this is
-	 * safe to do.
-	 */
-	do {
-		status = read(fd, buf, sizeof(buf));
-	} while (status == MEVENT_MAX);
+	/* The fd is non-blocking so this is safe to do. */
+	status = read(fd, &val, sizeof(val));
+	(void)status;
+}
+
+static int
+mevent_wake(struct mevent_loop *loop)
+{
+	uint64_t val = 1;
+
+	if (loop->wake_fd >= 0 && !is_dispatch_thread(loop))
+		if (write(loop->wake_fd, &val, sizeof(val)) <= 0)
+			return -1;
+	return 0;
 }
 
 /* On error, -1 is returned, else return zero */
 int
 mevent_notify(void)
 {
-	char c;
-
 	/*
-	 * If calling from outside the i/o thread, write a byte on the
-	 * pipe to force the i/o thread to exit the blocking epoll call.
+	 * If calling from outside the i/o thread, kick the eventfd to
+	 * force the i/o thread to exit the blocking epoll call.
 	 */
-	if (mevent_pipefd[1] != 0 && !is_dispatch_thread())
-		if (write(mevent_pipefd[1], &c, 1) <= 0)
-			return -1;
-	return 0;
+	return mevent_wake(&mevent_loops[0]);
 }
 
 static int
@@ -147,71 +191,134 @@ mevent_kq_filter(struct mevent *mevp)
 }
 
 static void
-mevent_destroy(void)
+mevent_free(struct mevent *mevp)
 {
-	struct mevent *mevp, *tmpp;
+	if (mevp->closefd)
+		close(mevp->me_fd);
 
-	mevent_qlock();
-	list_foreach_safe(mevp, &global_head, me_list, tmpp) {
-		LIST_REMOVE(mevp, me_list);
-		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
+	if (mevp->teardown)
+		mevp->teardown(mevp->teardown_param);
 
-               if ((mevp->me_type == EVF_READ ||
-                    mevp->me_type == EVF_READ_ET ||
-                    mevp->me_type == EVF_WRITE ||
-                    mevp->me_type == EVF_WRITE_ET) &&
-                    mevp->me_fd != STDIN_FILENO)
-                       close(mevp->me_fd);
+	free(mevp);
+}
 
-		if (mevp->teardown)
-			mevp->teardown(mevp->teardown_param);
+/*
+ * Move the newly added events onto the list. Only called by the loop
+ * thread, or when no loop thread runs.
+ */
+static void
+mevent_sync_reg(struct mevent_loop *loop)
+{
+	struct mevent *mevp, *next;
 
-		free(mevp);
+	for (mevp = mevent_stack_take(&loop->reg_head); mevp; mevp = next) {
+		next = mevp->me_next;
+		LIST_INSERT_HEAD(&loop->list, mevp, me_list);
 	}
+}
 
-	/* the mevp in del_head was removed from epoll when add it
-	 * to del_head already.
-	 */
-	list_foreach_safe(mevp, &del_head, me_list, tmpp) {
+/*
+ * Move the newly added events onto the list and free the deleted ones.
+ * The deleted events are taken first: an event is always added before
+ * it is deleted, so it is on the list by the time it is freed.
+ */
+static void
+mevent_sync_lists(struct mevent_loop *loop)
+{
+	struct mevent *mevp, *del, *next;
+
+	del = mevent_stack_take(&loop->del_head);
+	mevent_sync_reg(loop);
+
+	for (mevp = del; mevp; mevp = next) {
+		next = mevp->me_next;
 		LIST_REMOVE(mevp, me_list);
+		mevent_free(mevp);
+	}
+}
+
+static void
+mevent_destroy(struct mevent_loop *loop)
+{
+	struct mevent *mevp, *tmpp;
+
+	mevent_sync_lists(loop);
 
-               if ((mevp->me_type == EVF_READ ||
-                    mevp->me_type == EVF_READ_ET ||
-                    mevp->me_type == EVF_WRITE ||
-                    mevp->me_type == EVF_WRITE_ET) &&
-                    mevp->me_fd != STDIN_FILENO)
-                       close(mevp->me_fd);
+	list_foreach_safe(mevp, &loop->list, me_list, tmpp) {
+		LIST_REMOVE(mevp, me_list);
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
 
-		if (mevp->teardown)
-			mevp->teardown(mevp->teardown_param);
+		if ((mevp->me_type == EVF_READ ||
+		     mevp->me_type == EVF_READ_ET ||
+		     mevp->me_type == EVF_WRITE ||
+		     mevp->me_type == EVF_WRITE_ET) &&
+		     mevp->me_fd != STDIN_FILENO)
+			mevp->closefd = 1;
 
-		free(mevp);
+		mevent_free(mevp);
 	}
-	mevent_qunlock();
 }
 
 static void
-mevent_handle(struct epoll_event *kev, int numev)
+mevent_account(struct mevent_stats *st, uint64_t lat, uint64_t run)
+{
+	int bucket;
+
+	st->events++;
+	st->lat_total_ns += lat;
+	if (lat > st->lat_max_ns)
+		st->lat_max_ns = lat;
+	st->run_total_ns += run;
+	if (run > st->run_max_ns)
+		st->run_max_ns = run;
+
+	/* buckets of <1us, <4us, <16us, ... */
+	lat /= 1000;
+	for (bucket = 0; lat && bucket < MEVENT_HIST_BUCKETS - 1; bucket++)
+		lat >>= 2;
+	st->lat_hist[bucket]++;
+}
+
+static void
+mevent_handle(struct mevent_loop *loop, struct epoll_event *kev, int numev)
 {
 	int i;
 	struct mevent *mevp;
+	uint64_t wake, start, end;
 
+	loop->stats.wakeups++;
+	wake = start = mevent_now_ns();
+
+	/* coalesce the MSIs raised by the handlers of one epoll round */
+	vm_msi_batch_begin();
 	for (i = 0; i < numev; i++) {
 		mevp = kev[i].data.ptr;
 
-		if (mevp->me_state)
+		if (mevp->me_state) {
 			(*mevp->run)(mevp->me_fd, mevp->me_type, mevp->run_param);
+
+			/*
+			 * The dispatch latency of an event is the time it
+			 * waited behind the other handlers of the round.
+			 */
+			end = mevent_now_ns();
+			mevent_account(&loop->stats, start - wake, end - start);
+			start = end;
+		}
 	}
+	vm_msi_batch_end();
 }
 
 struct mevent *
-mevent_add(int tfd, enum ev_type type,
+mevent_add_class(int tfd, enum ev_type type,
 	   void (*run)(int, enum ev_type, void *), void *run_param,
-	   void (*teardown)(void *), void *teardown_param)
+	   void (*teardown)(void *), void *teardown_param,
+	   enum mevent_class cls)
 {
 	int ret;
 	struct epoll_event ee;
-	struct mevent *lp, *mevp;
+	struct mevent *mevp;
+	struct mevent_loop *loop;
 
 	if (tfd < 0 || run == NULL)
 		return NULL;
@@ -219,16 +326,6 @@ mevent_add(int tfd, enum ev_type type,
 	if (type == EVF_TIMER)
 		return NULL;
 
-	mevent_qlock();
-	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
-		if (lp->me_fd == tfd && lp->me_type == type) {
-			mevent_qunlock();
-			return lp;
-		}
-	}
-	mevent_qunlock();
-
 	/*
 	 * Allocate an entry, populate it, and add it to the list.
 	 */
@@ -236,24 +333,27 @@ mevent_add(int tfd, enum ev_type type,
 	if (mevp == NULL)
 		return NULL;
 
+	loop = mevent_class_loop(cls);
 	mevp->me_fd = tfd;
 	mevp->me_type = type;
 	mevp->me_state = 1;
+	mevp->me_loop = loop;
 
 	mevp->run = run;
 	mevp->run_param = run_param;
 	mevp->teardown = teardown;
 	mevp->teardown_param = teardown_param;
 
+	/*
+	 * A fd/type tuple can be registered only once, epoll_ctl fails
+	 * with EEXIST for the second one.
+	 */
 	ee.events = mevent_kq_filter(mevp);
 	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ret = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
 
 	if (ret == 0) {
-		mevent_qlock();
-		LIST_INSERT_HEAD(&global_head, mevp, me_list);
-		mevent_qunlock();
-
+		mevent_stack_push(&loop->reg_head, mevp);
 		return mevp;
 	} else {
 		free(mevp);
@@ -261,29 +361,27 @@ mevent_add(int tfd, enum ev_type type,
 	}
 }
 
+struct mevent *
+mevent_add(int tfd, enum ev_type type,
+	   void (*run)(int, enum ev_type, void *), void *run_param,
+	   void (*teardown)(void *), void *teardown_param)
+{
+	return mevent_add_class(tfd, type, run, run_param, teardown,
+			teardown_param, MEVENT_CLASS_DEFAULT);
+}
+
 int
 mevent_enable(struct mevent *evp)
 {
 	int ret;
 	struct epoll_event ee;
-	struct mevent *lp, *mevp = NULL;
-
-	mevent_qlock();
-	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
-		if (lp == evp) {
-			mevp = lp;
-			break;
-		}
-	}
-	mevent_qunlock();
 
-	if (!mevp)
+	if (!evp || !evp->me_state)
 		return -1;
 
-	ee.events = mevent_kq_filter(mevp);
-	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ee.events = mevent_kq_filter(evp);
+	ee.data.ptr = evp;
+	ret = epoll_ctl(evp->me_loop->epoll_fd, EPOLL_CTL_ADD, evp->me_fd, &ee);
 	if (ret < 0 && errno == EEXIST)
 		ret = 0;
 
@@ -295,63 +393,36 @@ mevent_disable(struct mevent *evp)
 {
 	int ret;
 
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
+	ret = epoll_ctl(evp->me_loop->epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
 	if (ret < 0 && errno == ENOENT)
 		ret = 0;
 
 	return ret;
 }
 
-static void
-mevent_add_to_del_list(struct mevent *evp, int closefd)
-{
-	mevent_qlock();
-	LIST_INSERT_HEAD(&del_head, evp, me_list);
-	mevent_qunlock();
-
-	mevent_notify();
-}
-
-static void
-mevent_drain_del_list(void)
-{
-	struct mevent *evp, *tmpp;
-
-	mevent_qlock();
-	list_foreach_safe(evp, &del_head, me_list, tmpp) {
-		LIST_REMOVE(evp, me_list);
-		if (evp->closefd) {
-			close(evp->me_fd);
-		}
-
-		if (evp->teardown)
-			evp->teardown(evp->teardown_param);
-		free(evp);
-	}
-	mevent_qunlock();
-}
-
 static int
 mevent_delete_event(struct mevent *evp, int closefd)
 {
-	mevent_qlock();
-	LIST_REMOVE(evp, me_list);
-	mevent_qunlock();
+	struct mevent_loop *loop = evp->me_loop;
+
 	evp->me_state = 0;
 	evp->closefd = closefd;
 
-	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
-	if (!is_dispatch_thread() && evp->teardown != NULL) {
-		mevent_add_to_del_list(evp, closefd);
-	} else {
-		if (evp->closefd) {
-			close(evp->me_fd);
-		}
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
 
-		if (evp->teardown)
-			evp->teardown(evp->teardown_param);
-		free(evp);
+	/*
+	 * Only the loop thread may unlink the event, others hand it over
+	 * through the del stack and the teardown runs on the loop thread.
+	 */
+	if (is_dispatch_thread(loop)) {
+		mevent_sync_reg(loop);
+		LIST_REMOVE(evp, me_list);
+		mevent_free(evp);
+	} else {
+		mevent_stack_push(&loop->del_head, evp);
+		mevent_wake(loop);
 	}
+
 	return 0;
 }
 
@@ -367,70 +438,47 @@ mevent_delete_close(struct mevent *evp)
 	return mevent_delete_event(evp, 1);
 }
 
-static void
-mevent_set_name(void)
+int
+mevent_set_loops(int nr_loops)
 {
-	pthread_setname_np(mevent_tid, "mevent");
+	if (nr_loops < 1 || nr_loops > MEVENT_MAX_LOOPS)
+		return -1;
+
+	mevent_nr_loops = nr_loops;
+	return 0;
 }
 
 int
-mevent_init(void)
+mevent_get_stats(int idx, struct mevent_stats *st)
 {
-	epoll_fd = epoll_create1(0);
-
-	if (epoll_fd >= 0)
-		return 0;
-	else
+	if (idx < 0 || idx >= mevent_nr_loops)
 		return -1;
-}
 
-void
-mevent_deinit(void)
-{
-	mevent_destroy();
-	close(epoll_fd);
-	if (mevent_pipefd[1] != 0)
-		close(mevent_pipefd[1]);
+	*st = mevent_loops[idx].stats;
+	return 0;
 }
 
-void
-mevent_dispatch(void)
+/*
+ * Wait for and handle events until the VM is suspended (loop 0) or
+ * mevent_deinit stops the loop (the others).
+ */
+static void
+mevent_loop_run(struct mevent_loop *loop)
 {
 	struct epoll_event eventlist[MEVENT_MAX];
+	int ret, suspend_mode;
 
-	struct mevent *pipev;
-	int ret;
-
-	mevent_tid = pthread_self();
-	mevent_set_name();
-
-	/*
-	 * Open the pipe that will be used for other threads to force
-	 * the blocking kqueue call to exit by writing to it. Set the
-	 * descriptor to non-blocking.
-	 */
-	ret = pipe2(mevent_pipefd, O_NONBLOCK);
-	if (ret < 0) {
-		pr_err("pipe");
-		exit(0);
-	}
-
-	/*
-	 * Add internal event handler for the pipe write fd
-	 */
-	pipev = mevent_add(mevent_pipefd[0], EVF_READ, mevent_pipe_read, NULL, NULL, NULL);
-	if (!pipev) {
-		pr_err("pipefd mevent_add failed\n");
-		exit(0);
-	}
+	loop->tid = pthread_self();
+	loop->running = true;
+	pthread_setname_np(loop->tid, loop->stats.name);
 
 	for (;;) {
-		int suspend_mode;
+		mevent_sync_lists(loop);
 
 		/*
 		 * Block awaiting events
 		 */
-		ret = epoll_wait(epoll_fd, eventlist, MEVENT_MAX, -1);
+		ret = epoll_wait(loop->epoll_fd, eventlist, MEVENT_MAX, -1);
 
 		if (ret == -1 && errno != EINTR)
 			pr_err("Error return from epoll_wait");
@@ -438,8 +486,15 @@ mevent_dispatch(void)
 		/*
 		 * Handle reported events
 		 */
-		mevent_handle(eventlist, ret);
-		mevent_drain_del_list();
+		if (ret > 0)
+			mevent_handle(loop, eventlist, ret);
+		mevent_sync_lists(loop);
+
+		if (loop != &mevent_loops[0]) {
+			if (loop->stop)
+				break;
+			continue;
+		}
 
 		suspend_mode = vm_get_suspend_mode();
 		if ((suspend_mode != VM_SUSPEND_NONE) &&
@@ -447,4 +502,124 @@ mevent_dispatch(void)
 		    (suspend_mode != VM_SUSPEND_SUSPEND))
 			break;
 	}
+
+	loop->running = false;
+}
+
+static void *
+mevent_loop_thread(void *param)
+{
+	mevent_loop_run(param);
+	return NULL;
+}
+
+static int
+mevent_loop_init(struct mevent_loop *loop, int idx)
+{
+	memset(loop, 0, sizeof(*loop));
+	LIST_INIT(&loop->list);
+	loop->wake_fd = -1;
+	if (idx == 0)
+		snprintf(loop->stats.name, sizeof(loop->stats.name), "mevent");
+	else
+		snprintf(loop->stats.name, sizeof(loop->stats.name),
+			"mevent-%d", idx);
+
+	loop->epoll_fd = epoll_create1(0);
+	if (loop->epoll_fd < 0)
+		return -1;
+
+	/*
+	 * The eventfd is used by other threads to force the blocking
+	 * epoll call to exit.
+	 */
+	loop->wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (loop->wake_fd < 0) {
+		pr_err("eventfd");
+		goto fail;
+	}
+
+	if (mevent_add_class(loop->wake_fd, EVF_READ, mevent_wake_read,
+			NULL, NULL, NULL, idx) == NULL) {
+		pr_err("eventfd mevent_add failed\n");
+		close(loop->wake_fd);
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	close(loop->epoll_fd);
+	loop->epoll_fd = -1;
+	loop->wake_fd = -1;
+	return -1;
+}
+
+static void
+mevent_loop_deinit(struct mevent_loop *loop)
+{
+	mevent_destroy(loop);
+	if (loop->epoll_fd >= 0)
+		close(loop->epoll_fd);
+	loop->epoll_fd = -1;
+	loop->wake_fd = -1;
+}
+
+int
+mevent_init(void)
+{
+	struct mevent_loop *loop;
+	int i;
+
+	for (i = 0; i < mevent_nr_loops; i++) {
+		if (mevent_loop_init(&mevent_loops[i], i) < 0)
+			goto fail;
+	}
+
+	/* loop 0 is run by mevent_dispatch, the others by own threads */
+	for (i = 1; i < mevent_nr_loops; i++) {
+		loop = &mevent_loops[i];
+		if (pthread_create(&loop->tid, NULL, mevent_loop_thread,
+				loop) != 0) {
+			pr_err("mevent loop %d thread create failed\n", i);
+			goto fail_thread;
+		}
+	}
+
+	return 0;
+
+fail_thread:
+	while (--i > 0) {
+		mevent_loops[i].stop = true;
+		mevent_wake(&mevent_loops[i]);
+		pthread_join(mevent_loops[i].tid, NULL);
+	}
+	i = mevent_nr_loops;
+fail:
+	while (--i >= 0)
+		mevent_loop_deinit(&mevent_loops[i]);
+	return -1;
+}
+
+void
+mevent_deinit(void)
+{
+	struct mevent_loop *loop;
+	int i;
+
+	for (i = 1; i < mevent_nr_loops; i++) {
+		loop = &mevent_loops[i];
+		loop->stop = true;
+		mevent_wake(loop);
+		pthread_join(loop->tid, NULL);
+	}
+
+	for (i = 0; i < mevent_nr_loops; i++)
+		mevent_loop_deinit(&mevent_loops[i]);
+}
+
+void
+mevent_dispatch(void)
+{
+	mevent_loop_run(&mevent_loops[0]);
 }
@@ -23,6 +23,9 @@
 #include "acrn_mngr.h"
 #include "pm.h"
 #include "vmmapi.h"
+#include "mevent.h"
+#include "pci_core.h"
+#include "virtio.h"
 #include "log.h"
 
 #define INTR_STORM_MONITOR_PERIOD	10 /* 10 seconds */
@@ -451,6 +454,66 @@ static void handle_blkrescan(struct mngr_msg *msg, int client_fd, void *param)
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
 }
 
+static void handle_evstats(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct dm_evstats *ev = &ack.data.evstats;
+	struct mevent_stats st;
+	int i;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	ev->loop = msg->data.evstats.loop;
+	if (mevent_get_stats(ev->loop, &st) != 0) {
+		ev->err = -1;
+	} else {
+		memcpy(ev->name, st.name, sizeof(ev->name));
+		ev->wakeups = st.wakeups;
+		ev->events = st.events;
+		ev->lat_total_ns = st.lat_total_ns;
+		ev->lat_max_ns = st.lat_max_ns;
+		ev->run_total_ns = st.run_total_ns;
+		ev->run_max_ns = st.run_max_ns;
+		for (i = 0; i < MEVENT_HIST_BUCKETS; i++)
+			ev->lat_hist[i] = st.lat_hist[i];
+	}
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_vqstats(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct dm_vqstats *vs = &ack.data.vqstats;
+	struct virtio_vq_stats_info info;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	vs->idx = msg->data.vqstats.idx;
+	if (virtio_get_vq_stats(vs->idx, &info) != 0) {
+		vs->err = -1;
+	} else {
+		memcpy(vs->name, info.name, sizeof(vs->name));
+		vs->slot = info.slot;
+		vs->queue = info.queue;
+		vs->polling = info.polling;
+		vs->kicks = info.stats.kicks;
+		vs->kicks_avoided = info.stats.kicks_avoided;
+		vs->poll_hits = info.stats.poll_hits;
+		vs->poll_misses = info.stats.poll_misses;
+		vs->poll_enter = info.stats.poll_enter;
+		vs->poll_exit = info.stats.poll_exit;
+	}
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
 static struct monitor_vm_ops pmc_ops = {
 	.stop       = NULL,
 	.resume     = vm_monitor_resume,
@@ -493,6 +556,8 @@ int monitor_init(struct vmctx *ctx)
 	ret += mngr_add_handler(monitor_fd, DM_CONTINUE, handle_continue, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_QUERY, handle_query, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_BLKRESCAN, handle_blkrescan, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_EVSTATS, handle_evstats, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_VQSTATS, handle_vqstats, NULL);
 
 	if (ret) {
 		pr_err("%s %d\r\n", __func__, __LINE__);
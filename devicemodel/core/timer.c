@@ -82,7 +82,8 @@ acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *, uint64_t),
 		return -1;
 	}
 
-	timer->mevp = mevent_add(timer->fd, EVF_READ, timer_handler, timer, NULL, NULL);
+	timer->mevp = mevent_add_class(timer->fd, EVF_READ, timer_handler, timer,
+			NULL, NULL, MEVENT_CLASS_TIMER);
 	if (timer->mevp == NULL) {
 		close(timer->fd);
 		pr_err("acrn_timer mevent add failed.\n");
@@ -34,6 +34,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -155,6 +156,9 @@ vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 		create_vm.vm_flag |= GUEST_FLAG_IO_COMPLETION_POLLING;
 	}
 
+	if (hyperv_vendor_id)
+		create_vm.vm_flag |= GUEST_FLAG_HYPERV_VENDOR_ID;
+
 	create_vm.req_buf = req_buf;
 	while (retry > 0) {
 		error = ioctl(ctx->fd, IC_CREATE_VM, &create_vm);
@@ -433,16 +437,89 @@ vm_suspend(struct vmctx *ctx, enum vm_suspend_how how)
 	return 0;
 }
 
+/*
+ * MSIs raised by one thread between vm_msi_batch_begin() and
+ * vm_msi_batch_end() are queued and injected by one IC_INJECT_MSI_BATCH
+ * ioctl, in the order they were raised.
+ */
+struct vm_msi_batch {
+	struct vmctx *ctx;
+	int depth;
+	struct acrn_msi_batch batch;
+};
+
+static __thread struct vm_msi_batch msi_batch;
+static bool msi_batch_unsupported;
+
+static int
+vm_msi_batch_flush(struct vm_msi_batch *mb)
+{
+	uint32_t i;
+	int error = 0;
+
+	if (mb->batch.count == 0)
+		return 0;
+
+	if (mb->batch.count > 1 && !msi_batch_unsupported) {
+		error = ioctl(mb->ctx->fd, IC_INJECT_MSI_BATCH, &mb->batch);
+		if (error == 0 || (errno != ENOTTY && errno != EINVAL))
+			goto done;
+
+		/* VHM without batch support, inject them one by one */
+		msi_batch_unsupported = true;
+	}
+
+	for (i = 0; i < mb->batch.count; i++) {
+		if (ioctl(mb->ctx->fd, IC_INJECT_MSI,
+				&mb->batch.entries[i].msi) != 0)
+			error = -1;
+	}
+
+done:
+	mb->batch.count = 0;
+	return error;
+}
+
+void
+vm_msi_batch_begin(void)
+{
+	msi_batch.depth++;
+}
+
+int
+vm_msi_batch_end(void)
+{
+	int error = 0;
+
+	if (msi_batch.depth > 0 && --msi_batch.depth == 0)
+		error = vm_msi_batch_flush(&msi_batch);
+
+	return error;
+}
+
 int
 vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg)
 {
 	struct acrn_msi_entry msi;
+	struct acrn_msi_batch_entry *entry;
 
 	bzero(&msi, sizeof(msi));
 	msi.msi_addr = addr;
 	msi.msi_data = msg;
 
-	return ioctl(ctx->fd, IC_INJECT_MSI, &msi);
+	if (msi_batch.depth == 0)
+		return ioctl(ctx->fd, IC_INJECT_MSI, &msi);
+
+	if (msi_batch.ctx != ctx || msi_batch.batch.count == ACRN_MSI_BATCH_MAX) {
+		vm_msi_batch_flush(&msi_batch);
+		msi_batch.ctx = ctx;
+	}
+
+	entry = &msi_batch.batch.entries[msi_batch.batch.count++];
+	entry->vmid = (uint16_t)ctx->vmid;
+	entry->msi = msi;
+
+	return 0;
 }
 
 int
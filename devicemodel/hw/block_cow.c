@@ -0,0 +1,920 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Copy-on-write image backend of block_if, using the qcow2 format so the
+ * images can be created and inspected with qemu-img.
+ *
+ * A guest offset is mapped to a cluster of the image file through the L1
+ * table, which is kept in memory, and an L2 table, a few of which are
+ * cached. A cluster which is not allocated in the image is read from the
+ * backing file, or as zeros if there is none. The first write to such a
+ * cluster allocates a new one at the end of the file, fills it from the
+ * backing file and then points the L2 entry to it.
+ *
+ * The refcount tables are not maintained, the image is marked dirty before
+ * the first allocation instead, so qemu-img rebuilds them if needed. That's
+ * why only version 3 images can be written, version 2 has no dirty bit.
+ * Compressed clusters, encryption, external data files and extended L2
+ * entries are not supported.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block_if.h"
+#include "block_cow.h"
+#include "log.h"
+
+#define QCOW_MAGIC		0x514649fbU	/* "QFI\xfb" */
+#define QCOW_MIN_CLUSTER_BITS	9U
+#define QCOW_MAX_CLUSTER_BITS	21U
+#define QCOW_MAX_L1_SIZE	(32U * 1024U * 1024U)
+#define QCOW_MAX_BACKING_NAME	1023U
+#define QCOW_MAX_BACKING_DEPTH	16
+#define QCOW_L2_CACHE_SIZE	16
+
+#define QCOW_INCOMPAT_DIRTY	(1UL << 0)
+
+#define QCOW_OFLAG_COPIED	(1UL << 63)
+#define QCOW_OFLAG_COMPRESSED	(1UL << 62)
+#define QCOW_OFLAG_ZERO		(1UL << 0)
+#define QCOW_OFFSET_MASK	0x00fffffffffffe00UL
+
+#define QCOW_EXT_END		0U
+#define QCOW_EXT_BACKING_FMT	0xe2792acaU
+
+/* All the fields are big endian */
+struct qcow_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	backing_file_offset;
+	uint32_t	backing_file_size;
+	uint32_t	cluster_bits;
+	uint64_t	size;
+	uint32_t	crypt_method;
+	uint32_t	l1_size;
+	uint64_t	l1_table_offset;
+	uint64_t	refcount_table_offset;
+	uint32_t	refcount_table_clusters;
+	uint32_t	nb_snapshots;
+	uint64_t	snapshots_offset;
+
+	/* version 3 */
+	uint64_t	incompatible_features;
+	uint64_t	compatible_features;
+	uint64_t	autoclear_features;
+	uint32_t	refcount_order;
+	uint32_t	header_length;
+} __attribute__((packed));
+
+struct qcow_ext {
+	uint32_t	type;
+	uint32_t	len;
+} __attribute__((packed));
+
+/* how a guest cluster is mapped */
+enum qcow_cluster {
+	QCOW_CL_UNALLOC,	/* read from the backing file */
+	QCOW_CL_ZERO,
+	QCOW_CL_DATA,		/* allocated and owned by the active layer */
+	QCOW_CL_SHARED,		/* allocated and shared with a snapshot */
+	QCOW_CL_COMPRESSED,
+	QCOW_CL_ERROR
+};
+
+struct qcow_l2 {
+	uint64_t	offset;		/* of the table in the file, 0 if unused */
+	uint64_t	lru;
+	uint64_t	*table;		/* CPU endian */
+};
+
+struct blockcow {
+	int		fd;
+	int		own_fd;
+	int		ro;
+	uint32_t	version;
+	uint32_t	cluster_bits;
+	uint64_t	cluster_size;
+	uint32_t	l2_bits;	/* of the number of entries of a L2 table */
+	uint64_t	size;
+	uint64_t	incompat;
+	int		dirty;
+	uint64_t	end;		/* the next cluster is allocated here */
+
+	uint64_t	*l1;		/* CPU endian */
+	uint32_t	l1_size;
+	uint64_t	l1_offset;
+	struct qcow_l2	l2[QCOW_L2_CACHE_SIZE];
+	uint64_t	l2_tick;
+	uint8_t		*cbuf;		/* one cluster to build a new one */
+
+	struct blockcow	*backing;	/* qcow2 backing file */
+	int		bfd;		/* raw backing file */
+	uint64_t	bsize;
+
+	int		refs;
+	pthread_mutex_t	mtx;
+};
+
+static struct blockcow *qcow_open(int fd, const char *path, int ro,
+		int depth);
+static ssize_t qcow_rw(struct blockcow *bcow, const struct iovec *iov,
+		int iovcnt, off_t offset, int write);
+
+/*
+ * Build in out the iovec of the len bytes of iov after the first skip
+ * ones, return its number of elements, which is at most iovcnt.
+ */
+static int
+iov_slice(const struct iovec *iov, int iovcnt, size_t skip, size_t len,
+		struct iovec *out)
+{
+	size_t l;
+	int i, n;
+
+	n = 0;
+	for (i = 0; i < iovcnt && len > 0; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		l = MIN(iov[i].iov_len - skip, len);
+		out[n].iov_base = (uint8_t *)iov[i].iov_base + skip;
+		out[n].iov_len = l;
+		n++;
+		len -= l;
+		skip = 0;
+	}
+	return n;
+}
+
+static void
+iov_zero(const struct iovec *iov, int iovcnt, size_t skip, size_t len)
+{
+	struct iovec siov[BLOCKIF_IOV_MAX];
+	int i, n;
+
+	n = iov_slice(iov, iovcnt, skip, len, siov);
+	for (i = 0; i < n; i++)
+		memset(siov[i].iov_base, 0, siov[i].iov_len);
+}
+
+static void
+iov_to_buf(const struct iovec *iov, int iovcnt, uint8_t *buf)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(buf, iov[i].iov_base, iov[i].iov_len);
+		buf += iov[i].iov_len;
+	}
+}
+
+static int
+qcow_check_io(ssize_t ret, size_t len)
+{
+	if (ret < 0)
+		return -1;
+	if ((size_t)ret != len) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Return the L2 table at offset of the file, from the cache or read into
+ * the least recently used slot.
+ *
+ * @pre bcow->mtx is held
+ */
+static uint64_t *
+qcow_l2_load(struct blockcow *bcow, uint64_t offset)
+{
+	struct qcow_l2 *l2, *victim;
+	uint64_t i, n;
+	ssize_t ret;
+
+	victim = &bcow->l2[0];
+	for (l2 = bcow->l2; l2 < bcow->l2 + QCOW_L2_CACHE_SIZE; l2++) {
+		if (l2->offset == offset) {
+			l2->lru = ++bcow->l2_tick;
+			return l2->table;
+		}
+		if (l2->lru < victim->lru)
+			victim = l2;
+	}
+
+	victim->offset = 0;
+	victim->lru = 0;
+	ret = pread(bcow->fd, victim->table, bcow->cluster_size, offset);
+	if (qcow_check_io(ret, bcow->cluster_size) < 0) {
+		pr_err("qcow2: failed to read L2 table at 0x%lx\n", offset);
+		return NULL;
+	}
+
+	n = bcow->cluster_size / sizeof(uint64_t);
+	for (i = 0; i < n; i++)
+		victim->table[i] = be64toh(victim->table[i]);
+	victim->offset = offset;
+	victim->lru = ++bcow->l2_tick;
+	return victim->table;
+}
+
+/*
+ * Map the guest offset off, host is set to the offset in the file for the
+ * allocated clusters.
+ *
+ * @pre bcow->mtx is held
+ * @pre off < bcow->size
+ */
+static enum qcow_cluster
+qcow_lookup(struct blockcow *bcow, uint64_t off, uint64_t *host)
+{
+	uint64_t l1_idx, l2_idx, l2_off, entry, *table;
+
+	*host = 0;
+	l1_idx = off >> (bcow->cluster_bits + bcow->l2_bits);
+	l2_idx = (off >> bcow->cluster_bits) & ((1UL << bcow->l2_bits) - 1);
+
+	l2_off = bcow->l1[l1_idx] & QCOW_OFFSET_MASK;
+	if (l2_off == 0)
+		return QCOW_CL_UNALLOC;
+
+	table = qcow_l2_load(bcow, l2_off);
+	if (table == NULL)
+		return QCOW_CL_ERROR;
+
+	entry = table[l2_idx];
+	if (entry & QCOW_OFLAG_COMPRESSED)
+		return QCOW_CL_COMPRESSED;
+	if (bcow->version >= 3 && (entry & QCOW_OFLAG_ZERO))
+		return QCOW_CL_ZERO;
+
+	*host = entry & QCOW_OFFSET_MASK;
+	if (*host == 0)
+		return QCOW_CL_UNALLOC;
+
+	*host += off & (bcow->cluster_size - 1);
+	return (entry & QCOW_OFLAG_COPIED) ? QCOW_CL_DATA : QCOW_CL_SHARED;
+}
+
+/*
+ * Map the guest range [off, off + len), return the length of its leading
+ * part which is mapped the same way and, for allocated clusters, is
+ * contiguous in the file, so it can be accessed with one syscall.
+ */
+static uint64_t
+qcow_map(struct blockcow *bcow, uint64_t off, uint64_t len,
+		enum qcow_cluster *kind, uint64_t *host)
+{
+	enum qcow_cluster k;
+	uint64_t run, h;
+
+	run = 0;
+	pthread_mutex_lock(&bcow->mtx);
+	while (run < len) {
+		k = qcow_lookup(bcow, off + run, &h);
+		if (run == 0) {
+			*kind = k;
+			*host = h;
+		} else if (k != *kind || (h != 0 && h != *host + run))
+			break;
+
+		run += MIN(bcow->cluster_size -
+				((off + run) & (bcow->cluster_size - 1)),
+				len - run);
+		if (k == QCOW_CL_ERROR)
+			break;
+	}
+	pthread_mutex_unlock(&bcow->mtx);
+
+	return run;
+}
+
+/*
+ * Read the guest range [off, off + len) from the backing file, the part
+ * beyond the end of the backing file is read as zeros.
+ */
+static int
+qcow_backing_read(struct blockcow *bcow, const struct iovec *iov, int iovcnt,
+		uint64_t off, uint64_t len)
+{
+	ssize_t ret;
+
+	if (bcow->backing)
+		ret = qcow_rw(bcow->backing, iov, iovcnt, off, 0);
+	else if (bcow->bfd >= 0 && off < bcow->bsize)
+		ret = preadv(bcow->bfd, iov, iovcnt, off);
+	else
+		ret = 0;
+
+	if (ret < 0)
+		return -1;
+	if ((uint64_t)ret < len)
+		iov_zero(iov, iovcnt, ret, len - ret);
+	return 0;
+}
+
+/*
+ * Make the header changes required before the image is modified: set the
+ * dirty bit, as the refcounts won't be updated, and clear the autoclear
+ * features, which are not maintained either.
+ *
+ * @pre bcow->mtx is held
+ */
+static int
+qcow_mark_dirty(struct blockcow *bcow)
+{
+	uint64_t val;
+	ssize_t ret;
+
+	if (bcow->dirty)
+		return 0;
+
+	val = htobe64(bcow->incompat | QCOW_INCOMPAT_DIRTY);
+	ret = pwrite(bcow->fd, &val, sizeof(val),
+			offsetof(struct qcow_header, incompatible_features));
+	if (qcow_check_io(ret, sizeof(val)) < 0)
+		return -1;
+
+	val = 0;
+	ret = pwrite(bcow->fd, &val, sizeof(val),
+			offsetof(struct qcow_header, autoclear_features));
+	if (qcow_check_io(ret, sizeof(val)) < 0)
+		return -1;
+
+	/* the dirty bit must be on the storage before any allocation */
+	if (fdatasync(bcow->fd) < 0)
+		return -1;
+
+	bcow->incompat |= QCOW_INCOMPAT_DIRTY;
+	bcow->dirty = 1;
+	return 0;
+}
+
+/*
+ * Return the L2 table of the guest offset off, which is allocated in the
+ * image and owned by the active layer. A table shared with a snapshot is
+ * copied first.
+ *
+ * @pre bcow->mtx is held
+ */
+static uint64_t *
+qcow_l2_alloc(struct blockcow *bcow, uint64_t off, uint64_t *l2_off)
+{
+	uint64_t l1_idx, entry, new, i, n, *table;
+	ssize_t ret;
+
+	l1_idx = off >> (bcow->cluster_bits + bcow->l2_bits);
+	entry = bcow->l1[l1_idx];
+	*l2_off = entry & QCOW_OFFSET_MASK;
+	if (*l2_off != 0 && (entry & QCOW_OFLAG_COPIED))
+		return qcow_l2_load(bcow, *l2_off);
+
+	n = bcow->cluster_size / sizeof(uint64_t);
+	if (*l2_off != 0) {
+		table = qcow_l2_load(bcow, *l2_off);
+		if (table == NULL)
+			return NULL;
+		for (i = 0; i < n; i++)
+			((uint64_t *)bcow->cbuf)[i] = htobe64(table[i]);
+	} else
+		memset(bcow->cbuf, 0, bcow->cluster_size);
+
+	new = bcow->end;
+	ret = pwrite(bcow->fd, bcow->cbuf, bcow->cluster_size, new);
+	if (qcow_check_io(ret, bcow->cluster_size) < 0)
+		return NULL;
+	bcow->end += bcow->cluster_size;
+
+	entry = htobe64(new | QCOW_OFLAG_COPIED);
+	ret = pwrite(bcow->fd, &entry, sizeof(entry),
+			bcow->l1_offset + l1_idx * sizeof(entry));
+	if (qcow_check_io(ret, sizeof(entry)) < 0)
+		return NULL;
+	bcow->l1[l1_idx] = new | QCOW_OFLAG_COPIED;
+
+	*l2_off = new;
+	return qcow_l2_load(bcow, new);
+}
+
+/*
+ * Write the len bytes of iov at the guest offset off to a newly allocated
+ * cluster, the rest of which is copied from where it was mapped.
+ *
+ * @pre [off, off + len) is within one cluster
+ */
+static int
+qcow_cow_write(struct blockcow *bcow, const struct iovec *iov, int iovcnt,
+		uint64_t off, uint64_t len)
+{
+	uint64_t coff, start, host, new, l2_off, l2_idx, entry, *table;
+	enum qcow_cluster kind;
+	struct iovec biov;
+	ssize_t ret;
+	int err;
+
+	err = -1;
+	coff = off & (bcow->cluster_size - 1);
+	start = off - coff;
+	l2_idx = (off >> bcow->cluster_bits) & ((1UL << bcow->l2_bits) - 1);
+
+	pthread_mutex_lock(&bcow->mtx);
+
+	/* another request may have allocated it meanwhile */
+	kind = qcow_lookup(bcow, start, &host);
+	if (kind == QCOW_CL_ERROR)
+		goto out;
+	if (kind == QCOW_CL_DATA) {
+		ret = pwritev(bcow->fd, iov, iovcnt, host + coff);
+		err = qcow_check_io(ret, len);
+		goto out;
+	}
+	if (kind == QCOW_CL_COMPRESSED && len < bcow->cluster_size) {
+		errno = ENOTSUP;
+		goto out;
+	}
+
+	if (qcow_mark_dirty(bcow) < 0)
+		goto out;
+	table = qcow_l2_alloc(bcow, start, &l2_off);
+	if (table == NULL)
+		goto out;
+
+	new = bcow->end;
+	if (len == bcow->cluster_size) {
+		ret = pwritev(bcow->fd, iov, iovcnt, new);
+	} else {
+		switch (kind) {
+		case QCOW_CL_SHARED:
+			ret = pread(bcow->fd, bcow->cbuf, bcow->cluster_size,
+					host);
+			if (qcow_check_io(ret, bcow->cluster_size) < 0)
+				goto out;
+			break;
+		case QCOW_CL_UNALLOC:
+			/* the last cluster may go beyond the virtual size */
+			memset(bcow->cbuf, 0, bcow->cluster_size);
+			biov.iov_base = bcow->cbuf;
+			biov.iov_len = MIN(bcow->cluster_size,
+					bcow->size - start);
+			if (qcow_backing_read(bcow, &biov, 1, start,
+						biov.iov_len) < 0)
+				goto out;
+			break;
+		default:
+			memset(bcow->cbuf, 0, bcow->cluster_size);
+			break;
+		}
+		iov_to_buf(iov, iovcnt, bcow->cbuf + coff);
+		ret = pwrite(bcow->fd, bcow->cbuf, bcow->cluster_size, new);
+		len = bcow->cluster_size;
+	}
+	if (qcow_check_io(ret, len) < 0)
+		goto out;
+	bcow->end += bcow->cluster_size;
+
+	/* point the L2 entry to the cluster only when its data is written */
+	entry = htobe64(new | QCOW_OFLAG_COPIED);
+	ret = pwrite(bcow->fd, &entry, sizeof(entry),
+			l2_off + l2_idx * sizeof(entry));
+	err = qcow_check_io(ret, sizeof(entry));
+	if (err == 0)
+		table[l2_idx] = new | QCOW_OFLAG_COPIED;
+
+out:
+	pthread_mutex_unlock(&bcow->mtx);
+	return err;
+}
+
+/*
+ * @pre off + len <= bcow->size
+ */
+static int
+qcow_read(struct blockcow *bcow, const struct iovec *iov, int iovcnt,
+		uint64_t off, uint64_t len)
+{
+	struct iovec siov[BLOCKIF_IOV_MAX];
+	enum qcow_cluster kind;
+	uint64_t done, run, host;
+	ssize_t ret;
+	int n;
+
+	for (done = 0; done < len; done += run) {
+		run = qcow_map(bcow, off + done, len - done, &kind, &host);
+		n = iov_slice(iov, iovcnt, done, run, siov);
+
+		switch (kind) {
+		case QCOW_CL_DATA:
+		case QCOW_CL_SHARED:
+			ret = preadv(bcow->fd, siov, n, host);
+			if (qcow_check_io(ret, run) < 0)
+				return -1;
+			break;
+		case QCOW_CL_ZERO:
+			iov_zero(siov, n, 0, run);
+			break;
+		case QCOW_CL_UNALLOC:
+			if (qcow_backing_read(bcow, siov, n, off + done,
+						run) < 0)
+				return -1;
+			break;
+		case QCOW_CL_COMPRESSED:
+			errno = ENOTSUP;
+			return -1;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * @pre off + len <= bcow->size
+ */
+static int
+qcow_write(struct blockcow *bcow, const struct iovec *iov, int iovcnt,
+		uint64_t off, uint64_t len)
+{
+	struct iovec siov[BLOCKIF_IOV_MAX];
+	enum qcow_cluster kind;
+	uint64_t done, run, host;
+	ssize_t ret;
+	int n;
+
+	for (done = 0; done < len; done += run) {
+		run = qcow_map(bcow, off + done, len - done, &kind, &host);
+		if (kind == QCOW_CL_ERROR)
+			return -1;
+
+		if (kind == QCOW_CL_DATA) {
+			n = iov_slice(iov, iovcnt, done, run, siov);
+			ret = pwritev(bcow->fd, siov, n, host);
+			if (qcow_check_io(ret, run) < 0)
+				return -1;
+			continue;
+		}
+
+		/* the clusters to allocate are written one by one */
+		run = MIN(bcow->cluster_size -
+				((off + done) & (bcow->cluster_size - 1)),
+				len - done);
+		n = iov_slice(iov, iovcnt, done, run, siov);
+		if (qcow_cow_write(bcow, siov, n, off + done, run) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static ssize_t
+qcow_rw(struct blockcow *bcow, const struct iovec *iov, int iovcnt,
+		off_t offset, int write)
+{
+	uint64_t len;
+	int i, err;
+
+	if (iovcnt < 0 || iovcnt > BLOCKIF_IOV_MAX || offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (write && bcow->ro) {
+		errno = EROFS;
+		return -1;
+	}
+
+	len = 0;
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if ((uint64_t)offset >= bcow->size)
+		return 0;
+	len = MIN(len, bcow->size - offset);
+
+	if (write)
+		err = qcow_write(bcow, iov, iovcnt, offset, len);
+	else
+		err = qcow_read(bcow, iov, iovcnt, offset, len);
+
+	return (err < 0) ? -1 : (ssize_t)len;
+}
+
+static void
+qcow_free(struct blockcow *bcow)
+{
+	int i;
+
+	if (bcow->backing)
+		blockcow_close(bcow->backing);
+	if (bcow->bfd >= 0)
+		close(bcow->bfd);
+	if (bcow->own_fd)
+		close(bcow->fd);
+	for (i = 0; i < QCOW_L2_CACHE_SIZE; i++)
+		free(bcow->l2[i].table);
+	free(bcow->cbuf);
+	free(bcow->l1);
+	pthread_mutex_destroy(&bcow->mtx);
+	free(bcow);
+}
+
+/*
+ * Find the format of the backing file in the header extensions, which
+ * follow the header in the first cluster. fmt is left empty if there is
+ * none.
+ */
+static void
+qcow_backing_fmt(struct blockcow *bcow, uint64_t off, char *fmt, size_t size)
+{
+	struct qcow_ext ext;
+	uint32_t len;
+
+	fmt[0] = '\0';
+	while (off + sizeof(ext) <= bcow->cluster_size) {
+		if (pread(bcow->fd, &ext, sizeof(ext), off) != sizeof(ext))
+			break;
+		len = be32toh(ext.len);
+		off += sizeof(ext);
+		if (be32toh(ext.type) == QCOW_EXT_END)
+			break;
+		if (be32toh(ext.type) == QCOW_EXT_BACKING_FMT) {
+			len = MIN(len, size - 1);
+			if (pread(bcow->fd, fmt, len, off) == len)
+				fmt[len] = '\0';
+			else
+				fmt[0] = '\0';
+			break;
+		}
+		off += roundup(len, 8);
+	}
+}
+
+/*
+ * Open the backing file name, relative to the directory of the image path
+ * if it isn't absolute. Without its format in the header extensions, it's
+ * probed like qemu does.
+ */
+static int
+qcow_open_backing(struct blockcow *bcow, const char *path, const char *name,
+		const char *fmt, int depth)
+{
+	char file[PATH_MAX], *tmp;
+	uint32_t magic;
+	int fd, len;
+
+	if (name[0] == '/')
+		len = snprintf(file, sizeof(file), "%s", name);
+	else {
+		tmp = strdup(path);
+		if (tmp == NULL)
+			return -1;
+		len = snprintf(file, sizeof(file), "%s/%s", dirname(tmp), name);
+		free(tmp);
+	}
+	if (len >= sizeof(file)) {
+		pr_err("qcow2: backing file name is too long\n");
+		return -1;
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		pr_err("qcow2: could not open backing file %s\n", file);
+		return -1;
+	}
+
+	if (fmt[0] == '\0') {
+		if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+				be32toh(magic) == QCOW_MAGIC)
+			fmt = "qcow2";
+		else
+			fmt = "raw";
+	}
+
+	if (!strcmp(fmt, "qcow2")) {
+		bcow->backing = qcow_open(fd, file, 1, depth + 1);
+		if (bcow->backing == NULL) {
+			close(fd);
+			return -1;
+		}
+		bcow->backing->own_fd = 1;
+	} else if (!strcmp(fmt, "raw")) {
+		bcow->bsize = lseek(fd, 0, SEEK_END);
+		if (bcow->bsize == (uint64_t)-1) {
+			close(fd);
+			return -1;
+		}
+		bcow->bfd = fd;
+	} else {
+		pr_err("qcow2: backing file format %s is not supported\n", fmt);
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct blockcow *
+qcow_open(int fd, const char *path, int ro, int depth)
+{
+	char name[QCOW_MAX_BACKING_NAME + 1], fmt[16];
+	struct qcow_header hdr;
+	struct blockcow *bcow;
+	uint64_t i, l1_need, hdr_len, name_off;
+	uint32_t name_len;
+	struct stat sbuf;
+	ssize_t ret;
+
+	if (depth > QCOW_MAX_BACKING_DEPTH) {
+		pr_err("qcow2: backing file chain of %s is too long\n", path);
+		return NULL;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	ret = pread(fd, &hdr, sizeof(hdr), 0);
+	if (ret < (ssize_t)offsetof(struct qcow_header, incompatible_features) ||
+			be32toh(hdr.magic) != QCOW_MAGIC) {
+		pr_err("qcow2: %s is not a qcow2 image\n", path);
+		return NULL;
+	}
+
+	bcow = calloc(1, sizeof(struct blockcow));
+	if (bcow == NULL)
+		return NULL;
+	pthread_mutex_init(&bcow->mtx, NULL);
+	bcow->fd = fd;
+	bcow->bfd = -1;
+	bcow->refs = 1;
+	bcow->ro = ro;
+
+	bcow->version = be32toh(hdr.version);
+	bcow->cluster_bits = be32toh(hdr.cluster_bits);
+	bcow->size = be64toh(hdr.size);
+	bcow->l1_size = be32toh(hdr.l1_size);
+	bcow->l1_offset = be64toh(hdr.l1_table_offset);
+
+	if (bcow->version != 2 && bcow->version != 3) {
+		pr_err("qcow2: version %u of %s is not supported\n",
+				bcow->version, path);
+		goto err;
+	}
+	if (bcow->cluster_bits < QCOW_MIN_CLUSTER_BITS ||
+			bcow->cluster_bits > QCOW_MAX_CLUSTER_BITS) {
+		pr_err("qcow2: invalid cluster size of %s\n", path);
+		goto err;
+	}
+	if (hdr.crypt_method != 0) {
+		pr_err("qcow2: encrypted image %s is not supported\n", path);
+		goto err;
+	}
+	bcow->cluster_size = 1UL << bcow->cluster_bits;
+	bcow->l2_bits = bcow->cluster_bits - 3;
+
+	if (bcow->version == 3) {
+		bcow->incompat = be64toh(hdr.incompatible_features);
+		if (bcow->incompat & ~QCOW_INCOMPAT_DIRTY) {
+			pr_err("qcow2: features 0x%lx of %s are not supported\n",
+					bcow->incompat & ~QCOW_INCOMPAT_DIRTY,
+					path);
+			goto err;
+		}
+		bcow->dirty = !!(bcow->incompat & QCOW_INCOMPAT_DIRTY);
+		hdr_len = be32toh(hdr.header_length);
+	} else {
+		hdr_len = offsetof(struct qcow_header, incompatible_features);
+		if (!bcow->ro) {
+			pr_warn("qcow2: version 2 image %s is opened read-only\n",
+					path);
+			bcow->ro = 1;
+		}
+	}
+
+	if (bcow->size == 0 || (bcow->size & (DEV_BSIZE - 1))) {
+		pr_err("qcow2: size of %s should be multiple of %d\n",
+				path, DEV_BSIZE);
+		goto err;
+	}
+	l1_need = howmany(bcow->size,
+			1UL << (bcow->cluster_bits + bcow->l2_bits));
+	if (bcow->l1_size < l1_need || bcow->l1_size > QCOW_MAX_L1_SIZE ||
+			(bcow->l1_offset & (bcow->cluster_size - 1))) {
+		pr_err("qcow2: invalid L1 table of %s\n", path);
+		goto err;
+	}
+
+	bcow->l1 = calloc(bcow->l1_size, sizeof(uint64_t));
+	bcow->cbuf = malloc(bcow->cluster_size);
+	if (bcow->l1 == NULL || bcow->cbuf == NULL)
+		goto err;
+	for (i = 0; i < QCOW_L2_CACHE_SIZE; i++) {
+		bcow->l2[i].table = malloc(bcow->cluster_size);
+		if (bcow->l2[i].table == NULL)
+			goto err;
+	}
+
+	ret = pread(fd, bcow->l1, bcow->l1_size * sizeof(uint64_t),
+			bcow->l1_offset);
+	if (qcow_check_io(ret, bcow->l1_size * sizeof(uint64_t)) < 0) {
+		pr_err("qcow2: failed to read L1 table of %s\n", path);
+		goto err;
+	}
+	for (i = 0; i < bcow->l1_size; i++)
+		bcow->l1[i] = be64toh(bcow->l1[i]);
+
+	if (fstat(fd, &sbuf) < 0)
+		goto err;
+	bcow->end = roundup(sbuf.st_size, bcow->cluster_size);
+
+	name_off = be64toh(hdr.backing_file_offset);
+	name_len = be32toh(hdr.backing_file_size);
+	if (name_off != 0) {
+		if (name_len == 0 || name_len > QCOW_MAX_BACKING_NAME) {
+			pr_err("qcow2: invalid backing file name of %s\n",
+					path);
+			goto err;
+		}
+		if (pread(fd, name, name_len, name_off) != name_len)
+			goto err;
+		name[name_len] = '\0';
+
+		qcow_backing_fmt(bcow, hdr_len, fmt, sizeof(fmt));
+		if (qcow_open_backing(bcow, path, name, fmt, depth) < 0)
+			goto err;
+	}
+
+	return bcow;
+
+err:
+	qcow_free(bcow);
+	return NULL;
+}
+
+struct blockcow *
+blockcow_open(int fd, const char *path, int ro)
+{
+	return qcow_open(fd, path, ro, 0);
+}
+
+struct blockcow *
+blockcow_get(struct blockcow *bcow)
+{
+	pthread_mutex_lock(&bcow->mtx);
+	bcow->refs++;
+	pthread_mutex_unlock(&bcow->mtx);
+	return bcow;
+}
+
+void
+blockcow_close(struct blockcow *bcow)
+{
+	int refs;
+
+	pthread_mutex_lock(&bcow->mtx);
+	refs = --bcow->refs;
+	pthread_mutex_unlock(&bcow->mtx);
+
+	if (refs == 0)
+		qcow_free(bcow);
+}
+
+off_t
+blockcow_size(struct blockcow *bcow)
+{
+	return bcow->size;
+}
+
+int
+blockcow_is_ro(struct blockcow *bcow)
+{
+	return bcow->ro;
+}
+
+ssize_t
+blockcow_preadv(struct blockcow *bcow, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	return qcow_rw(bcow, iov, iovcnt, offset, 0);
+}
+
+ssize_t
+blockcow_pwritev(struct blockcow *bcow, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	return qcow_rw(bcow, iov, iovcnt, offset, 1);
+}
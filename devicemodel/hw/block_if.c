@@ -30,8 +30,13 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
 #include <linux/falloc.h>
 #include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <poll.h>
 #include <errno.h>
 #include <err.h>
 #include <fcntl.h>
@@ -44,9 +49,11 @@
 
 #include "dm.h"
 #include "block_if.h"
+#include "block_cow.h"
 #include "ahci.h"
 #include "dm_string.h"
 #include "log.h"
+#include "tree.h"
 
 /*
  * Notes:
@@ -66,6 +73,17 @@
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 #define MAX_DISCARD_SEGMENT	256
 
+/* user_data of the eventfd poll request in the io_uring */
+#define BLOCKIF_URING_POLL_TAG	0UL
+
+/* the contiguous requests are merged into one I/O up to this size */
+#define BLOCKIF_MERGE_MAX	(512 * 1024)
+
+/* the writes appended to a cached extent are merged up to this size */
+#define BLOCKIF_WB_EXT_MAX	(1024 * 1024)
+/* default dirty limit of the write-back cache, in MB */
+#define BLOCKIF_WB_LIMIT	32
+
 /*
  * Debug printf
  */
@@ -88,6 +106,34 @@ enum blockstat {
 	BST_DONE
 };
 
+enum blockaio {
+	BAIO_THREADS,
+	BAIO_IO_URING
+};
+
+/*
+ * Mappings of an io_uring instance, accessed with the raw syscalls as
+ * liburing is not required to build the device model.
+ */
+struct blockif_uring {
+	int			fd;
+	unsigned int		sq_entries;
+	unsigned int		*sq_head;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ptr;
+	void			*cq_ptr;
+	size_t			sq_sz;
+	size_t			cq_sz;
+	size_t			sqes_sz;
+};
+
 struct blockif_elem {
 	TAILQ_ENTRY(blockif_elem) link;
 	struct blockif_req  *req;
@@ -95,10 +141,49 @@ struct blockif_elem {
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+
+	/*
+	 * The requests merged with this one are chained from it, the iovec
+	 * of all of them is in miov.
+	 */
+	struct blockif_elem  *mnext;
+	size_t		     mlen;
+	int		     miovcnt;
+	struct iovec	     miov[BLOCKIF_IOV_MAX];
+};
+
+/*
+ * The DM write-back cache keeps the written data in extents of a RB tree
+ * sorted by offset, which never overlap. They are written to the image
+ * when the guest flushes the cache or the dirty data exceeds the limit,
+ * the adjacent ones with one pwritev().
+ */
+struct blockif_wb_ext {
+	RB_ENTRY(blockif_wb_ext) link;
+	off_t			off;
+	size_t			len;
+	size_t			cap;
+	uint8_t			*buf;
+};
+
+struct blockif_wbcache {
+	/* protects the tree, held for read by the reads of the image */
+	pthread_rwlock_t	lock;
+	RB_HEAD(blockif_wb_tree, blockif_wb_ext) tree;
+	size_t			dirty;
+	size_t			limit;
+
+	pthread_mutex_t		sync_mtx;
+	uint64_t		gen;	/* bumped by each write to the image */
+	uint64_t		synced;	/* gen made durable by the last fsync */
+	int			refs;
 };
 
 struct blockif_ctxt {
 	int			fd;
+	int			bfd;	/* buffered fd for unaligned I/O in direct mode */
+	int			direct;
+	int			dio_align;
 	int			isblk;
 	int			candiscard;
 	int			rdonly;
@@ -117,6 +202,13 @@ struct blockif_ctxt {
 	pthread_mutex_t		mtx;
 	pthread_cond_t		cond;
 
+	/* io_uring engine */
+	enum blockaio		aio;
+	struct blockif_uring	ring;
+	int			evfd;	/* kicks the io_uring thread */
+	int			qdepth;
+	int			inflight;
+
 	/* Request elements and free/pending/busy queues */
 	TAILQ_HEAD(, blockif_elem) freeq;
 	TAILQ_HEAD(, blockif_elem) pendq;
@@ -125,6 +217,12 @@ struct blockif_ctxt {
 
 	/* write cache enable */
 	uint8_t			wce;
+
+	/* copy-on-write image, NULL for a raw one */
+	struct blockcow		*cow;
+
+	/* DM write-back cache, NULL if not enabled */
+	struct blockif_wbcache	*wbc;
 };
 
 static pthread_once_t blockif_once = PTHREAD_ONCE_INIT;
@@ -204,6 +302,60 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 	return (be->status == BST_PEND);
 }
 
+static void
+blockif_busy(struct blockif_ctxt *bc, struct blockif_elem *be, pthread_t t)
+{
+	TAILQ_REMOVE(&bc->pendq, be, link);
+	be->status = BST_BUSY;
+	be->tid = t;
+	be->mnext = NULL;
+	TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+}
+
+/*
+ * Merge the pending reads or writes which continue the request of be, so
+ * they are served with one vectored I/O. A run of sequential requests is
+ * blocked behind its first one, so they are found in the pending queue
+ * when it is dequeued.
+ */
+static void
+blockif_merge(struct blockif_ctxt *bc, struct blockif_elem *be, pthread_t t)
+{
+	struct blockif_elem *tbe, *last;
+	struct blockif_req *br;
+
+	be->mlen = be->req->resid;
+	be->miovcnt = be->req->iovcnt;
+	if (be->op != BOP_READ && be->op != BOP_WRITE)
+		return;
+
+	last = be;
+	for (;;) {
+		TAILQ_FOREACH(tbe, &bc->pendq, link) {
+			br = tbe->req;
+			if (tbe->op == be->op && br->offset == last->block &&
+					br->resid > 0 &&
+					be->mlen + br->resid <= BLOCKIF_MERGE_MAX &&
+					be->miovcnt + br->iovcnt <= BLOCKIF_IOV_MAX)
+				break;
+		}
+		if (tbe == NULL)
+			break;
+
+		if (last == be)
+			memcpy(be->miov, be->req->iov,
+					be->req->iovcnt * sizeof(struct iovec));
+		memcpy(&be->miov[be->miovcnt], br->iov,
+				br->iovcnt * sizeof(struct iovec));
+		be->miovcnt += br->iovcnt;
+		be->mlen += br->resid;
+
+		blockif_busy(bc, tbe, t);
+		last->mnext = tbe;
+		last = tbe;
+	}
+}
+
 static int
 blockif_dequeue(struct blockif_ctxt *bc, pthread_t t, struct blockif_elem **bep)
 {
@@ -215,10 +367,8 @@ blockif_dequeue(struct blockif_ctxt *bc, pthread_t t, struct blockif_elem **bep)
 	}
 	if (be == NULL)
 		return 0;
-	TAILQ_REMOVE(&bc->pendq, be, link);
-	be->status = BST_BUSY;
-	be->tid = t;
-	TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+	blockif_busy(bc, be, t);
+	blockif_merge(bc, be, t);
 	*bep = be;
 	return 1;
 }
@@ -242,6 +392,52 @@ blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
 	TAILQ_INSERT_TAIL(&bc->freeq, be, link);
 }
 
+/*
+ * The iovec of the request of be, or of the requests merged with it.
+ */
+static const struct iovec *
+blockif_iov(struct blockif_elem *be, int *iovcnt)
+{
+	*iovcnt = be->miovcnt;
+	return be->mnext ? be->miov : be->req->iov;
+}
+
+/*
+ * Report the completion of the request of be and the ones merged with it,
+ * the first n bytes of which have been transferred. The caller releases
+ * be afterwards, as when nothing is merged. The merged requests are
+ * released here before their callback: the callback may submit new
+ * requests at once, and the queue has room for one busy element per
+ * thread only, not for a whole merged run.
+ */
+static void
+blockif_done(struct blockif_ctxt *bc, struct blockif_elem *be, int err,
+		size_t n)
+{
+	struct blockif_elem *tbe, *next;
+	struct blockif_req *br;
+	size_t len;
+
+	next = be->mnext;
+	be->mnext = NULL;
+	for (tbe = be; tbe != NULL; tbe = next) {
+		br = tbe->req;
+		len = MIN(n, (size_t)br->resid);
+		br->resid -= len;
+		n -= len;
+
+		if (tbe == be)
+			tbe->status = BST_DONE;
+		else {
+			next = tbe->mnext;
+			pthread_mutex_lock(&bc->mtx);
+			blockif_complete(bc, tbe);
+			pthread_mutex_unlock(&bc->mtx);
+		}
+		(*br->callback)(br, err);
+	}
+}
+
 static int
 discard_range_validate(struct blockif_ctxt *bc, off_t start, off_t size)
 {
@@ -326,23 +522,437 @@ blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
 	return 0;
 }
 
+/*
+ * O_DIRECT requires the file offset and the buffers to be aligned to the
+ * logical block size. Requests which are not go to the buffered fd.
+ */
+static int
+blockif_dio_aligned(struct blockif_ctxt *bc, const struct iovec *iov,
+		int iovcnt, off_t offset)
+{
+	int i;
+
+	if ((offset + bc->sub_file_start_lba) % bc->dio_align)
+		return 0;
+	for (i = 0; i < iovcnt; i++) {
+		if (((uintptr_t)iov[i].iov_base % bc->dio_align) ||
+				(iov[i].iov_len % bc->dio_align))
+			return 0;
+	}
+	return 1;
+}
+
+static int
+blockif_io_fd(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	if (bc->direct && !blockif_dio_aligned(bc, iov, iovcnt, offset))
+		return bc->bfd;
+	return bc->fd;
+}
+
+/* Read from the image, bypassing the write-back cache */
+static ssize_t
+blockif_preadv(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	if (bc->cow)
+		return blockcow_preadv(bc->cow, iov, iovcnt, offset);
+	return preadv(blockif_io_fd(bc, iov, iovcnt, offset), iov, iovcnt,
+			offset + bc->sub_file_start_lba);
+}
+
+/* Write to the image, bypassing the write-back cache */
+static ssize_t
+blockif_pwritev(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	if (bc->cow)
+		return blockcow_pwritev(bc->cow, iov, iovcnt, offset);
+	return pwritev(blockif_io_fd(bc, iov, iovcnt, offset), iov, iovcnt,
+			offset + bc->sub_file_start_lba);
+}
+
+static int
+blockif_wb_ext_cmp(struct blockif_wb_ext *a, struct blockif_wb_ext *b)
+{
+	if (a->off < b->off)
+		return -1;
+	else if (a->off > b->off)
+		return 1;
+	return 0;
+}
+
+RB_GENERATE_STATIC(blockif_wb_tree, blockif_wb_ext, link, blockif_wb_ext_cmp);
+
+static struct blockif_wb_ext *
+blockif_wb_ext_new(off_t off, size_t len)
+{
+	struct blockif_wb_ext *ext;
+
+	ext = calloc(1, sizeof(struct blockif_wb_ext));
+	if (ext == NULL)
+		return NULL;
+	ext->buf = malloc(len);
+	if (ext->buf == NULL) {
+		free(ext);
+		return NULL;
+	}
+	ext->off = off;
+	ext->len = len;
+	ext->cap = len;
+	return ext;
+}
+
+static void
+blockif_wb_ext_free(struct blockif_wbcache *wbc, struct blockif_wb_ext *ext)
+{
+	RB_REMOVE(blockif_wb_tree, &wbc->tree, ext);
+	wbc->dirty -= ext->len;
+	free(ext->buf);
+	free(ext);
+}
+
+/*
+ * Return the first extent which ends after off.
+ *
+ * @pre wbc->lock is held
+ */
+static struct blockif_wb_ext *
+blockif_wb_first(struct blockif_wbcache *wbc, off_t off)
+{
+	struct blockif_wb_ext key, *ext, *prev;
+
+	key.off = off;
+	ext = RB_NFIND(blockif_wb_tree, &wbc->tree, &key);
+	if (ext != NULL)
+		prev = RB_PREV(blockif_wb_tree, &wbc->tree, ext);
+	else
+		prev = RB_MAX(blockif_wb_tree, &wbc->tree);
+	if (prev != NULL && prev->off + prev->len > off)
+		ext = prev;
+	return ext;
+}
+
+/*
+ * Drop the cached data of [off, end) which is overwritten. If there is no
+ * memory to split an extent around the range, its tail is written to the
+ * image instead, so nothing of the range is left in the cache.
+ *
+ * @pre wbc->lock is held for write
+ */
+static int
+blockif_wb_trim(struct blockif_ctxt *bc, off_t off, off_t end)
+{
+	struct blockif_wbcache *wbc = bc->wbc;
+	struct blockif_wb_ext *ext, *next, *tail;
+	struct iovec iov;
+	off_t ext_end;
+	ssize_t ret;
+
+	for (ext = blockif_wb_first(wbc, off);
+			ext != NULL && ext->off < end; ext = next) {
+		next = RB_NEXT(blockif_wb_tree, &wbc->tree, ext);
+		ext_end = ext->off + ext->len;
+		if (ext->off < off && ext_end > end) {
+			/* split it, the tail gets its own buffer */
+			tail = blockif_wb_ext_new(end, ext_end - end);
+			if (tail != NULL) {
+				memcpy(tail->buf, ext->buf + (end - ext->off),
+						tail->len);
+				RB_INSERT(blockif_wb_tree, &wbc->tree, tail);
+				wbc->dirty -= end - off;
+			} else {
+				iov.iov_base = ext->buf + (end - ext->off);
+				iov.iov_len = ext_end - end;
+				ret = blockif_pwritev(bc, &iov, 1, end);
+				if (ret != iov.iov_len)
+					return (ret < 0) ? errno : EIO;
+				wbc->gen++;
+				wbc->dirty -= ext_end - off;
+			}
+			ext->len = off - ext->off;
+			break;
+		} else if (ext->off < off) {
+			ext->len = off - ext->off;
+			wbc->dirty -= ext_end - off;
+		} else if (ext_end > end) {
+			/* the order in the tree doesn't change */
+			memmove(ext->buf, ext->buf + (end - ext->off),
+					ext_end - end);
+			wbc->dirty -= end - ext->off;
+			ext->len = ext_end - end;
+			ext->off = end;
+		} else
+			blockif_wb_ext_free(wbc, ext);
+	}
+	return 0;
+}
+
+/*
+ * Write all the dirty extents to the image, the adjacent ones with one
+ * pwritev().
+ */
+static int
+blockif_wb_writeout(struct blockif_ctxt *bc)
+{
+	struct blockif_wbcache *wbc = bc->wbc;
+	struct blockif_wb_ext *ext, *next, *tmp;
+	struct iovec iov[BLOCKIF_IOV_MAX];
+	off_t start;
+	size_t len;
+	ssize_t ret;
+	int n, err;
+
+	err = 0;
+	pthread_rwlock_wrlock(&wbc->lock);
+	ext = RB_MIN(blockif_wb_tree, &wbc->tree);
+	while (ext != NULL) {
+		start = ext->off;
+		len = 0;
+		for (n = 0, next = ext; next != NULL && n < BLOCKIF_IOV_MAX &&
+				next->off == start + len; n++) {
+			iov[n].iov_base = next->buf;
+			iov[n].iov_len = next->len;
+			len += next->len;
+			next = RB_NEXT(blockif_wb_tree, &wbc->tree, next);
+		}
+
+		ret = blockif_pwritev(bc, iov, n, start);
+		if (ret != len) {
+			err = (ret < 0) ? errno : EIO;
+			WPRINTF(("block_if: write back of offset %ld failed, "
+				"err %d\n", start, err));
+			break;
+		}
+		wbc->gen++;
+
+		while (ext != next) {
+			tmp = RB_NEXT(blockif_wb_tree, &wbc->tree, ext);
+			blockif_wb_ext_free(wbc, ext);
+			ext = tmp;
+		}
+	}
+	pthread_rwlock_unlock(&wbc->lock);
+
+	return err;
+}
+
+/*
+ * Keep the written data in the cache, appended to the extent which ends
+ * where it starts if there is room. It's written through if
+ * there is no memory for it.
+ */
+static int
+blockif_wb_write(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+		off_t off, size_t len)
+{
+	struct blockif_wbcache *wbc = bc->wbc;
+	struct blockif_wb_ext *ext, *prev;
+	size_t pos, cap;
+	off_t end;
+	uint8_t *buf;
+	ssize_t ret;
+	int i, err, over;
+
+	end = off + len;
+	over = 0;
+
+	pthread_rwlock_wrlock(&wbc->lock);
+	err = blockif_wb_trim(bc, off, end);
+	if (err) {
+		/* the range still has the old data, in the cache or the image */
+		pthread_rwlock_unlock(&wbc->lock);
+		return err;
+	}
+
+	prev = blockif_wb_first(wbc, off);
+	prev = (prev != NULL) ? RB_PREV(blockif_wb_tree, &wbc->tree, prev) :
+		RB_MAX(blockif_wb_tree, &wbc->tree);
+	if (prev != NULL && prev->off + prev->len == off &&
+			prev->len + len <= BLOCKIF_WB_EXT_MAX) {
+		if (prev->len + len > prev->cap) {
+			cap = MIN(MAX(prev->cap * 2, prev->len + len),
+					BLOCKIF_WB_EXT_MAX);
+			buf = realloc(prev->buf, cap);
+			if (buf == NULL)
+				goto write_through;
+			prev->buf = buf;
+			prev->cap = cap;
+		}
+		ext = prev;
+		pos = prev->len;
+		prev->len += len;
+	} else {
+		ext = blockif_wb_ext_new(off, len);
+		if (ext == NULL)
+			goto write_through;
+		RB_INSERT(blockif_wb_tree, &wbc->tree, ext);
+		pos = 0;
+	}
+
+	for (i = 0; i < iovcnt && pos < ext->len; i++) {
+		memcpy(ext->buf + pos, iov[i].iov_base,
+				MIN(iov[i].iov_len, ext->len - pos));
+		pos += iov[i].iov_len;
+	}
+	wbc->dirty += len;
+	over = (wbc->dirty > wbc->limit);
+	pthread_rwlock_unlock(&wbc->lock);
+
+	/* the writer which exceeds the dirty limit writes the cache out */
+	if (over)
+		err = blockif_wb_writeout(bc);
+	return err;
+
+write_through:
+	/*
+	 * Nothing of the range is in the cache any more. With the lock
+	 * held, so no read sees the trimmed range stale.
+	 */
+	err = 0;
+	ret = blockif_pwritev(bc, iov, iovcnt, off);
+	if (ret < 0)
+		err = errno;
+	else if (ret != len)
+		err = EIO;
+	else
+		wbc->gen++;
+	pthread_rwlock_unlock(&wbc->lock);
+	return err;
+}
+
+/*
+ * Copy the cached data of [off, off + len) over what has been read from
+ * the image into iov.
+ *
+ * @pre wbc->lock is held
+ */
+static void
+blockif_wb_overlay(struct blockif_wbcache *wbc, const struct iovec *iov,
+		int iovcnt, off_t off, size_t len)
+{
+	struct blockif_wb_ext *ext;
+	off_t from, to, end, pos;
+	size_t l;
+	int i;
+
+	end = off + len;
+	for (ext = blockif_wb_first(wbc, off);
+			ext != NULL && ext->off < end;
+			ext = RB_NEXT(blockif_wb_tree, &wbc->tree, ext)) {
+		from = MAX(ext->off, off);
+		to = MIN(ext->off + (off_t)ext->len, end);
+
+		/* pos is the offset of the iov element i in the disk */
+		for (i = 0, pos = off; i < iovcnt && from < to;
+				pos += iov[i].iov_len, i++) {
+			if (pos + (off_t)iov[i].iov_len <= from)
+				continue;
+			l = MIN(pos + (off_t)iov[i].iov_len, to) - from;
+			memcpy((uint8_t *)iov[i].iov_base + (from - pos),
+					ext->buf + (from - ext->off), l);
+			from += l;
+		}
+	}
+}
+
+/*
+ * Make the cached data durable. The flushes which come together share one
+ * fsync(): those which find nothing written since the last one return at
+ * once.
+ */
+static int
+blockif_wb_sync(struct blockif_ctxt *bc)
+{
+	struct blockif_wbcache *wbc = bc->wbc;
+	uint64_t gen;
+	int err;
+
+	err = blockif_wb_writeout(bc);
+	if (err)
+		return err;
+
+	pthread_mutex_lock(&wbc->sync_mtx);
+	pthread_rwlock_rdlock(&wbc->lock);
+	gen = wbc->gen;
+	pthread_rwlock_unlock(&wbc->lock);
+	if (gen != wbc->synced) {
+		if (fsync(bc->fd))
+			err = errno;
+		else
+			wbc->synced = gen;
+	}
+	pthread_mutex_unlock(&wbc->sync_mtx);
+
+	return err;
+}
+
+static struct blockif_wbcache *
+blockif_wb_init(size_t limit)
+{
+	struct blockif_wbcache *wbc;
+
+	wbc = calloc(1, sizeof(struct blockif_wbcache));
+	if (wbc == NULL)
+		return NULL;
+	pthread_rwlock_init(&wbc->lock, NULL);
+	pthread_mutex_init(&wbc->sync_mtx, NULL);
+	RB_INIT(&wbc->tree);
+	wbc->limit = limit;
+	wbc->refs = 1;
+	return wbc;
+}
+
+/*
+ * Drop a reference of the cache of bc, the last one writes it out and
+ * releases it.
+ */
+static void
+blockif_wb_put(struct blockif_ctxt *bc)
+{
+	struct blockif_wbcache *wbc = bc->wbc;
+	int refs;
+
+	pthread_mutex_lock(&wbc->sync_mtx);
+	refs = --wbc->refs;
+	pthread_mutex_unlock(&wbc->sync_mtx);
+	if (refs > 0)
+		return;
+
+	if (blockif_wb_sync(bc))
+		pr_err("block_if: failed to write back the cache\n");
+	while (!RB_EMPTY(&wbc->tree))
+		blockif_wb_ext_free(wbc, RB_MIN(blockif_wb_tree, &wbc->tree));
+	pthread_rwlock_destroy(&wbc->lock);
+	pthread_mutex_destroy(&wbc->sync_mtx);
+	free(wbc);
+}
+
 static void
 blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
 	struct blockif_req *br;
+	const struct iovec *iov;
 	ssize_t len;
-	int err;
+	int err, iovcnt;
 
 	br = be->req;
+	iov = blockif_iov(be, &iovcnt);
 	err = 0;
+	len = 0;
 	switch (be->op) {
 	case BOP_READ:
-		len = preadv(bc->fd, br->iov, br->iovcnt,
-				 br->offset + bc->sub_file_start_lba);
+		if (bc->wbc)
+			pthread_rwlock_rdlock(&bc->wbc->lock);
+		len = blockif_preadv(bc, iov, iovcnt, br->offset);
 		if (len < 0)
 			err = errno;
-		else
-			br->resid -= len;
+		else if (bc->wbc)
+			blockif_wb_overlay(bc->wbc, iov, iovcnt, br->offset,
+					be->mlen);
+		if (bc->wbc)
+			pthread_rwlock_unlock(&bc->wbc->lock);
 		break;
 	case BOP_WRITE:
 		if (bc->rdonly) {
@@ -350,30 +960,43 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 			break;
 		}
 
-		len = pwritev(bc->fd, br->iov, br->iovcnt,
-				  br->offset + bc->sub_file_start_lba);
+		if (bc->wbc) {
+			err = blockif_wb_write(bc, iov, iovcnt, br->offset,
+					be->mlen);
+			if (!err) {
+				len = be->mlen;
+				/* writethru: the guest disabled the cache */
+				if (!bc->wce)
+					err = blockif_wb_sync(bc);
+			}
+			break;
+		}
+
+		len = blockif_pwritev(bc, iov, iovcnt, br->offset);
 		if (len < 0)
 			err = errno;
-		else {
-			br->resid -= len;
+		else
 			err = blockif_flush_cache(bc);
-		}
 		break;
 	case BOP_FLUSH:
-		if (fsync(bc->fd))
+		if (bc->wbc)
+			err = blockif_wb_sync(bc);
+		else if (fsync(bc->fd))
 			err = errno;
 		break;
 	case BOP_DISCARD:
-		err = blockif_process_discard(bc, br);
+		/* the cached data of the range must not be written later */
+		if (bc->wbc)
+			err = blockif_wb_writeout(bc);
+		if (!err)
+			err = blockif_process_discard(bc, br);
 		break;
 	default:
 		err = EINVAL;
 		break;
 	}
 
-	be->status = BST_DONE;
-
-	(*br->callback)(br, err);
+	blockif_done(bc, be, err, (len > 0) ? len : 0);
 }
 
 static void *
@@ -406,6 +1029,295 @@ blockif_thr(void *arg)
 	return NULL;
 }
 
+static int
+blockif_uring_init(struct blockif_uring *ring, unsigned int entries)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_entries = p.sq_entries;
+	ring->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED ||
+			ring->sqes == MAP_FAILED)
+		goto fail;
+
+	ring->sq_head = ring->sq_ptr + p.sq_off.head;
+	ring->sq_tail = ring->sq_ptr + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ptr + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ptr + p.sq_off.array;
+	ring->cq_head = ring->cq_ptr + p.cq_off.head;
+	ring->cq_tail = ring->cq_ptr + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ptr + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ptr + p.cq_off.cqes;
+	return 0;
+
+fail:
+	if (ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_sz);
+	if (ring->cq_ptr != MAP_FAILED)
+		munmap(ring->cq_ptr, ring->cq_sz);
+	if (ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_sz);
+	close(ring->fd);
+	ring->fd = -1;
+	return -1;
+}
+
+static void
+blockif_uring_deinit(struct blockif_uring *ring)
+{
+	munmap(ring->sq_ptr, ring->sq_sz);
+	munmap(ring->cq_ptr, ring->cq_sz);
+	munmap(ring->sqes, ring->sqes_sz);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+/*
+ * Return a cleared sqe at the tail of the submission queue, it is visible
+ * to the kernel after blockif_uring_commit().
+ */
+static struct io_uring_sqe *
+blockif_uring_get_sqe(struct blockif_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	tail = *ring->sq_tail;
+	if (tail - head >= ring->sq_entries)
+		return NULL;
+
+	idx = tail & *ring->sq_mask;
+	ring->sq_array[idx] = idx;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static void
+blockif_uring_commit(struct blockif_uring *ring)
+{
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static int
+blockif_uring_arm_poll(struct blockif_ctxt *bc)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = blockif_uring_get_sqe(&bc->ring);
+	if (sqe == NULL)
+		return 0;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = bc->evfd;
+	sqe->poll_events = POLLIN;
+	sqe->user_data = BLOCKIF_URING_POLL_TAG;
+	blockif_uring_commit(&bc->ring);
+	return 1;
+}
+
+/*
+ * Queue the request to the io_uring. Return 0 if it has to be processed
+ * synchronously by blockif_proc().
+ */
+static int
+blockif_uring_prep(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_req *br = be->req;
+	const struct iovec *iov;
+	struct io_uring_sqe *sqe;
+	int iovcnt;
+
+	iov = blockif_iov(be, &iovcnt);
+
+	switch (be->op) {
+	case BOP_READ:
+	case BOP_WRITE:
+		if ((be->op == BOP_WRITE && bc->rdonly) ||
+				blockif_io_fd(bc, iov, iovcnt, br->offset) != bc->fd)
+			return 0;
+		break;
+	case BOP_FLUSH:
+		break;
+	default:
+		return 0;
+	}
+
+	sqe = blockif_uring_get_sqe(&bc->ring);
+	if (sqe == NULL)
+		return 0;
+
+	sqe->fd = bc->fd;
+	sqe->user_data = (uintptr_t)be;
+	switch (be->op) {
+	case BOP_READ:
+		sqe->opcode = IORING_OP_READV;
+		sqe->addr = (uintptr_t)iov;
+		sqe->len = iovcnt;
+		sqe->off = br->offset + bc->sub_file_start_lba;
+		break;
+	case BOP_WRITE:
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->addr = (uintptr_t)iov;
+		sqe->len = iovcnt;
+		sqe->off = br->offset + bc->sub_file_start_lba;
+		/* writethru: complete the write when the data is on the storage */
+		if (!bc->wce)
+			sqe->rw_flags = RWF_DSYNC;
+		break;
+	default:
+		sqe->opcode = IORING_OP_FSYNC;
+		break;
+	}
+	blockif_uring_commit(&bc->ring);
+	return 1;
+}
+
+static void
+blockif_uring_done(struct blockif_ctxt *bc, struct blockif_elem *be, int res)
+{
+	int err;
+
+	err = 0;
+	if (res < 0)
+		err = -res;
+
+	blockif_done(bc, be, err, (res > 0 && be->op != BOP_FLUSH) ? res : 0);
+}
+
+/*
+ * The io_uring thread submits all the pending requests with one
+ * io_uring_enter() and waits for completions. New requests are signalled
+ * through the eventfd polled in the same ring.
+ */
+static void *
+blockif_uring_thr(void *arg)
+{
+	struct blockif_ctxt *bc;
+	struct blockif_uring *ring;
+	struct blockif_elem *be;
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	uint64_t user_data, val;
+	pthread_t t;
+	int res, ret, submit, poll_armed;
+
+	bc = arg;
+	ring = &bc->ring;
+	t = pthread_self();
+	submit = 0;
+	poll_armed = 0;
+
+	pthread_mutex_lock(&bc->mtx);
+
+	for (;;) {
+		if (!poll_armed && blockif_uring_arm_poll(bc)) {
+			poll_armed = 1;
+			submit++;
+		}
+
+		while (bc->inflight < bc->qdepth && blockif_dequeue(bc, t, &be)) {
+			if (blockif_uring_prep(bc, be)) {
+				bc->inflight++;
+				submit++;
+				continue;
+			}
+			pthread_mutex_unlock(&bc->mtx);
+			blockif_proc(bc, be);
+			pthread_mutex_lock(&bc->mtx);
+			blockif_complete(bc, be);
+		}
+
+		/* Check ctxt status here to see if exit requested */
+		if (bc->closing && bc->inflight == 0)
+			break;
+
+		pthread_mutex_unlock(&bc->mtx);
+
+		ret = syscall(__NR_io_uring_enter, ring->fd, submit, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret >= 0)
+			submit -= ret;
+		else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			pr_err("%s: io_uring_enter failed, errno %d\n",
+					__func__, errno);
+
+		pthread_mutex_lock(&bc->mtx);
+
+		head = *ring->cq_head;
+		while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			user_data = cqe->user_data;
+			res = cqe->res;
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+			if (user_data == BLOCKIF_URING_POLL_TAG) {
+				if (read(bc->evfd, &val, sizeof(val)) < 0 &&
+						errno != EAGAIN)
+					pr_err("%s: eventfd read failed\n", __func__);
+				poll_armed = 0;
+				continue;
+			}
+
+			be = (struct blockif_elem *)(uintptr_t)user_data;
+			bc->inflight--;
+			pthread_mutex_unlock(&bc->mtx);
+			blockif_uring_done(bc, be, res);
+			pthread_mutex_lock(&bc->mtx);
+			blockif_complete(bc, be);
+		}
+	}
+
+	pthread_mutex_unlock(&bc->mtx);
+	pthread_exit(NULL);
+	return NULL;
+}
+
+static void
+blockif_kick(struct blockif_ctxt *bc)
+{
+	uint64_t val = 1;
+
+	if (bc->aio == BAIO_IO_URING) {
+		if (write(bc->evfd, &val, sizeof(val)) < 0)
+			pr_err("%s: eventfd write failed\n", __func__);
+	} else
+		pthread_cond_broadcast(&bc->cond);
+}
+
+static int
+blockif_uring_setup(struct blockif_ctxt *bc)
+{
+	bc->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (bc->evfd < 0)
+		return -1;
+
+	/* one more entry for the eventfd poll request */
+	if (blockif_uring_init(&bc->ring, bc->qdepth + 1) < 0) {
+		close(bc->evfd);
+		bc->evfd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
 static void
 blockif_sigcont_handler(int signal)
 {
@@ -487,18 +1399,60 @@ sub_file_unlock(struct blockif_ctxt *bc)
 }
 
 
+/*
+ * Initialize the request queues and start the i/o thread(s) of the
+ * context. bc->aio is the requested engine.
+ */
+static void
+blockif_start(struct blockif_ctxt *bc, const char *ident)
+{
+	char tname[MAXCOMLEN + 1];
+	int i, nthr;
+
+	pthread_mutex_init(&bc->mtx, NULL);
+	pthread_cond_init(&bc->cond, NULL);
+	TAILQ_INIT(&bc->freeq);
+	TAILQ_INIT(&bc->pendq);
+	TAILQ_INIT(&bc->busyq);
+	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
+		bc->reqs[i].status = BST_FREE;
+		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
+	}
+
+	if (bc->aio == BAIO_IO_URING && blockif_uring_setup(bc) < 0) {
+		WPRINTF(("io_uring is unavailable, errno %d, use thread pool\n",
+					errno));
+		bc->aio = BAIO_THREADS;
+	}
+
+	/* one thread drives the io_uring, the thread pool needs all of them */
+	nthr = (bc->aio == BAIO_IO_URING) ? 1 : BLOCKIF_NUMTHR;
+	for (i = 0; i < nthr; i++) {
+		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
+					ident, i) >= sizeof(tname)) {
+			pr_err("blk thread name too long");
+		}
+		pthread_create(&bc->btid[i], NULL,
+				(bc->aio == BAIO_IO_URING) ?
+				blockif_uring_thr : blockif_thr, bc);
+		pthread_setname_np(bc->btid[i], tname);
+	}
+}
+
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident)
 {
-	char tname[MAXCOMLEN + 1];
 	/* char name[MAXPATHLEN]; */
 	char *nopt, *xopts, *cp;
 	struct blockif_ctxt *bc;
+	struct blockcow *cow;
 	struct stat sbuf;
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
-	int fd, i, sectsz;
+	int fd, sectsz;
 	int writeback, ro, candiscard, ssopt, pssopt;
+	int direct, qdepth, qcow, wbcache;
+	enum blockaio aio;
 	long sz;
 	long long b;
 	int err_code = -1;
@@ -510,6 +1464,7 @@ blockif_open(const char *optstr, const char *ident)
 	pthread_once(&blockif_once, blockif_init);
 
 	fd = -1;
+	cow = NULL;
 	ssopt = 0;
 	pssopt = 0;
 	ro = 0;
@@ -526,6 +1481,17 @@ blockif_open(const char *optstr, const char *ident)
 
 	candiscard = 0;
 
+	/* the thread pool engine is used by default */
+	aio = BAIO_THREADS;
+	qdepth = BLOCKIF_MAXREQ;
+	direct = 0;
+
+	/* the image is raw unless qcow2 is specified */
+	qcow = 0;
+
+	/* dirty limit of the write-back cache in MB, 0 if not enabled */
+	wbcache = 0;
+
 	/*
 	 * The first element in the optstring is always a pathname.
 	 * Optional elements follow
@@ -545,6 +1511,36 @@ blockif_open(const char *optstr, const char *ident)
 			writeback = 0;
 		else if (!strcmp(cp, "ro"))
 			ro = 1;
+		else if (!strcmp(cp, "direct"))
+			direct = 1;
+		else if (!strcmp(cp, "aio=threads"))
+			aio = BAIO_THREADS;
+		else if (!strcmp(cp, "aio=io_uring"))
+			aio = BAIO_IO_URING;
+		else if (!strcmp(cp, "format=raw"))
+			qcow = 0;
+		else if (!strcmp(cp, "format=qcow2"))
+			qcow = 1;
+		else if (!strncmp(cp, "wbcache", strlen("wbcache"))) {
+			/* wbcache[=<dirty limit in MB>] */
+			wbcache = BLOCKIF_WB_LIMIT;
+			if (strsep(&cp, "=") && cp != NULL &&
+				(dm_strtoi(cp, &cp, 10, &wbcache) ||
+				 wbcache <= 0)) {
+				pr_err("Invalid wbcache dirty limit\n");
+				goto err;
+			}
+		}
+		else if (!strncmp(cp, "qdepth", strlen("qdepth"))) {
+			/* qdepth=<max in-flight requests of io_uring> */
+			if (!(strsep(&cp, "=") &&
+				!dm_strtoi(cp, &cp, 10, &qdepth) &&
+				qdepth > 0 && qdepth <= BLOCKIF_MAXREQ)) {
+				pr_err("Invalid qdepth, range is 1 to %d\n",
+						BLOCKIF_MAXREQ);
+				goto err;
+			}
+		}
 		else if (!strncmp(cp, "discard", strlen("discard"))) {
 			strsep(&cp, "=");
 			if (cp != NULL) {
@@ -585,6 +1581,34 @@ blockif_open(const char *optstr, const char *ident)
 		}
 	}
 
+	if (qcow) {
+		/*
+		 * The copy-on-write image is served by the thread pool with
+		 * buffered I/O, and the guest sees the virtual disk only.
+		 */
+		if (direct || aio == BAIO_IO_URING || sub_file_assign ||
+				candiscard) {
+			WPRINTF(("direct, aio=io_uring, range and discard are "
+				"ignored for qcow2 image\n"));
+			direct = 0;
+			aio = BAIO_THREADS;
+			sub_file_assign = 0;
+			candiscard = 0;
+		}
+	}
+
+	if (wbcache) {
+		/*
+		 * The guest is told the write cache is enabled so it flushes
+		 * it, and the requests go through blockif_proc().
+		 */
+		writeback = 1;
+		if (aio == BAIO_IO_URING) {
+			WPRINTF(("aio=io_uring is ignored with wbcache\n"));
+			aio = BAIO_THREADS;
+		}
+	}
+
 	/*
 	 * To support "writeback" and "writethru" mode switch during runtime,
 	 * O_SYNC is not used directly, as O_SYNC flag cannot dynamic change
@@ -592,10 +1616,16 @@ blockif_open(const char *optstr, const char *ident)
 	 * operation to emulate it.
 	 */
 
-	fd = open(nopt, ro ? O_RDONLY : O_RDWR);
+	fd = open(nopt, (ro ? O_RDONLY : O_RDWR) | (direct ? O_DIRECT : 0));
+	if (fd < 0 && direct && errno == EINVAL) {
+		WPRINTF(("%s doesn't support O_DIRECT, use buffered I/O\n",
+					nopt));
+		direct = 0;
+		fd = open(nopt, ro ? O_RDONLY : O_RDWR);
+	}
 	if (fd < 0 && !ro) {
 		/* Attempt a r/w fail with a r/o open */
-		fd = open(nopt, O_RDONLY);
+		fd = open(nopt, O_RDONLY | (direct ? O_DIRECT : 0));
 		ro = 1;
 	}
 
@@ -616,7 +1646,17 @@ blockif_open(const char *optstr, const char *ident)
 	sectsz = DEV_BSIZE;
 	psectsz = psectoff = 0;
 
-	if (S_ISBLK(sbuf.st_mode)) {
+	if (qcow) {
+		cow = blockcow_open(fd, nopt, ro);
+		if (cow == NULL) {
+			pr_err("Could not open qcow2 image %s\n", nopt);
+			goto err;
+		}
+		if (blockcow_is_ro(cow))
+			ro = 1;
+		size = blockcow_size(cow);
+		psectsz = sbuf.st_blksize;
+	} else if (S_ISBLK(sbuf.st_mode)) {
 		/* get size */
 		err_code = ioctl(fd, BLKGETSIZE, &sz);
 		if (err_code) {
@@ -720,7 +1760,25 @@ blockif_open(const char *optstr, const char *ident)
 	}
 
 	bc->fd = fd;
+	bc->bfd = -1;
+	bc->evfd = -1;
+	bc->ring.fd = -1;
 	bc->isblk = S_ISBLK(sbuf.st_mode);
+	if (direct) {
+		/* unaligned requests can't be served by the O_DIRECT fd */
+		bc->bfd = open(nopt, ro ? O_RDONLY : O_RDWR);
+		if (bc->bfd < 0) {
+			warn("Could not open backing file: %s", nopt);
+			free(bc);
+			goto err;
+		}
+		if (bc->isblk) {
+			if (ioctl(fd, BLKSSZGET, &bc->dio_align) || bc->dio_align <= 0)
+				bc->dio_align = DEV_BSIZE;
+		} else
+			bc->dio_align = sbuf.st_blksize;
+		bc->direct = 1;
+	}
 	bc->candiscard = candiscard;
 	if (candiscard) {
 		bc->max_discard_sectors =
@@ -737,24 +1795,20 @@ blockif_open(const char *optstr, const char *ident)
 	bc->psectsz = psectsz;
 	bc->psectoff = psectoff;
 	bc->wce = writeback;
-	pthread_mutex_init(&bc->mtx, NULL);
-	pthread_cond_init(&bc->cond, NULL);
-	TAILQ_INIT(&bc->freeq);
-	TAILQ_INIT(&bc->pendq);
-	TAILQ_INIT(&bc->busyq);
-	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
-		bc->reqs[i].status = BST_FREE;
-		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
-	}
-
-	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
-		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
-					ident, i) >= sizeof(tname)) {
-			pr_err("blk thread name too long");
+	bc->qdepth = qdepth;
+	bc->aio = aio;
+	bc->cow = cow;
+	if (wbcache) {
+		bc->wbc = blockif_wb_init((size_t)wbcache * 1024 * 1024);
+		if (bc->wbc == NULL) {
+			pr_err("Failed to init the write-back cache\n");
+			if (bc->bfd >= 0)
+				close(bc->bfd);
+			free(bc);
+			goto err;
 		}
-		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
-		pthread_setname_np(bc->btid[i], tname);
 	}
+	blockif_start(bc, ident);
 
 	/* free strdup memory */
 	if (nopt) {
@@ -768,18 +1822,80 @@ err:
 	if (nopt)
 		free(nopt);
 
+	if (cow)
+		blockcow_close(cow);
 	if (fd >= 0)
 		close(fd);
 	return NULL;
 }
 
+/*
+ * Create another context on the same backing file, with its own request
+ * queues and i/o thread(s), e.g. for a multi-queue device. It shares the
+ * configuration and the open file descriptions of bc, and must be closed
+ * before bc.
+ */
+struct blockif_ctxt *
+blockif_dup(struct blockif_ctxt *bc, const char *ident)
+{
+	struct blockif_ctxt *nbc;
+
+	nbc = calloc(1, sizeof(struct blockif_ctxt));
+	if (nbc == NULL) {
+		pr_err("calloc");
+		return NULL;
+	}
+
+	nbc->fd = dup(bc->fd);
+	nbc->bfd = (bc->bfd >= 0) ? dup(bc->bfd) : -1;
+	if (nbc->fd < 0 || (bc->bfd >= 0 && nbc->bfd < 0)) {
+		pr_err("blockif: failed to dup backing file fd\n");
+		if (nbc->fd >= 0)
+			close(nbc->fd);
+		free(nbc);
+		return NULL;
+	}
+	nbc->evfd = -1;
+	nbc->ring.fd = -1;
+	nbc->direct = bc->direct;
+	nbc->dio_align = bc->dio_align;
+	nbc->isblk = bc->isblk;
+	nbc->candiscard = bc->candiscard;
+	nbc->rdonly = bc->rdonly;
+	nbc->size = bc->size;
+	/* the sub file lock is owned and released by bc */
+	nbc->sub_file_assign = 0;
+	nbc->sub_file_start_lba = bc->sub_file_start_lba;
+	nbc->sectsz = bc->sectsz;
+	nbc->psectsz = bc->psectsz;
+	nbc->psectoff = bc->psectoff;
+	nbc->max_discard_sectors = bc->max_discard_sectors;
+	nbc->max_discard_seg = bc->max_discard_seg;
+	nbc->discard_sector_alignment = bc->discard_sector_alignment;
+	nbc->wce = bc->wce;
+	nbc->qdepth = bc->qdepth;
+	nbc->aio = bc->aio;
+	nbc->cow = bc->cow ? blockcow_get(bc->cow) : NULL;
+	if (bc->wbc) {
+		/* the contexts share the cache, the reads must see all writes */
+		pthread_mutex_lock(&bc->wbc->sync_mtx);
+		bc->wbc->refs++;
+		pthread_mutex_unlock(&bc->wbc->sync_mtx);
+		nbc->wbc = bc->wbc;
+	}
+	blockif_start(nbc, ident);
+
+	return nbc;
+}
+
 static int
 blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
 {
-	int err;
+	int err, kick;
 
 	err = 0;
+	kick = 0;
 
 	pthread_mutex_lock(&bc->mtx);
 	if (!TAILQ_EMPTY(&bc->freeq)) {
@@ -787,8 +1903,12 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		 * Enqueue and inform the block i/o thread
 		 * that there is work available
 		 */
-		if (blockif_enqueue(bc, breq, op))
-			pthread_cond_signal(&bc->cond);
+		if (blockif_enqueue(bc, breq, op)) {
+			if (bc->aio == BAIO_IO_URING)
+				kick = 1;
+			else
+				pthread_cond_signal(&bc->cond);
+		}
 	} else {
 		/*
 		 * Callers are not allowed to enqueue more than
@@ -800,6 +1920,9 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 	}
 	pthread_mutex_unlock(&bc->mtx);
 
+	if (kick)
+		blockif_kick(bc);
+
 	return err;
 }
 
@@ -865,6 +1988,15 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		return -1;
 	}
 
+	/*
+	 * A request in the io_uring can't be interrupted, it will be
+	 * completed via the normal callback path.
+	 */
+	if (bc->aio == BAIO_IO_URING) {
+		pthread_mutex_unlock(&bc->mtx);
+		return -EBUSY;
+	}
+
 	/*
 	 * Interrupt the processing thread to force it return
 	 * prematurely via it's normal callback path.
@@ -906,7 +2038,7 @@ int
 blockif_close(struct blockif_ctxt *bc)
 {
 	void *jval;
-	int i;
+	int i, nthr;
 
 	sub_file_unlock(bc);
 
@@ -915,10 +2047,11 @@ blockif_close(struct blockif_ctxt *bc)
 	 */
 	pthread_mutex_lock(&bc->mtx);
 	bc->closing = 1;
-	pthread_cond_broadcast(&bc->cond);
 	pthread_mutex_unlock(&bc->mtx);
+	blockif_kick(bc);
 
-	for (i = 0; i < BLOCKIF_NUMTHR; i++)
+	nthr = (bc->aio == BAIO_IO_URING) ? 1 : BLOCKIF_NUMTHR;
+	for (i = 0; i < nthr; i++)
 		pthread_join(bc->btid[i], &jval);
 
 	/* XXX Cancel queued i/o's ??? */
@@ -926,6 +2059,16 @@ blockif_close(struct blockif_ctxt *bc)
 	/*
 	 * Release resources
 	 */
+	if (bc->aio == BAIO_IO_URING) {
+		blockif_uring_deinit(&bc->ring);
+		close(bc->evfd);
+	}
+	if (bc->wbc)
+		blockif_wb_put(bc);
+	if (bc->cow)
+		blockcow_close(bc->cow);
+	if (bc->bfd >= 0)
+		close(bc->bfd);
 	close(bc->fd);
 	free(bc);
 
@@ -1046,6 +2189,9 @@ blockif_get_wce(struct blockif_ctxt *bc)
 void
 blockif_set_wce(struct blockif_ctxt *bc, uint8_t wce)
 {
+	/* the cached data must be durable once writethru is set */
+	if (bc->wbc && bc->wce && !wce && blockif_wb_sync(bc))
+		pr_err("block_if: failed to write back the cache\n");
 	bc->wce = wce;
 }
 
@@ -1055,7 +2201,9 @@ blockif_flush_all(struct blockif_ctxt *bc)
 	int err;
 
 	err=0;
-	if (fsync(bc->fd))
+	if (bc->wbc)
+		err = blockif_wb_sync(bc);
+	else if (fsync(bc->fd))
 		err = errno;
 	return err;
 }
@@ -46,6 +46,7 @@
 #include "lpc.h"
 #include "sw_load.h"
 #include "log.h"
+#include "virtio.h"
 
 #define CONF1_ADDR_PORT    0x0cf8
 #define CONF1_DATA_PORT    0x0cfc
@@ -480,6 +481,25 @@ bar_value(int size, uint64_t val)
 	return val & mask;
 }
 
+/*
+ * The device emulations are not thread safe. When the I/O requests are
+ * handled by several dispatch threads, serialize the accesses to each
+ * device with its own lock.
+ */
+static inline void
+pci_vdev_emul_lock(struct pci_vdev *dev)
+{
+	if (ioreq_dispatch_enabled)
+		pthread_mutex_lock(&dev->emul_lock);
+}
+
+static inline void
+pci_vdev_emul_unlock(struct pci_vdev *dev)
+{
+	if (ioreq_dispatch_enabled)
+		pthread_mutex_unlock(&dev->emul_lock);
+}
+
 static int
 pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		    uint32_t *eax, void *arg)
@@ -494,6 +514,7 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		    port >= pdi->bar[i].addr &&
 		    port + bytes <= pdi->bar[i].addr + pdi->bar[i].size) {
 			offset = port - pdi->bar[i].addr;
+			pci_vdev_emul_lock(pdi);
 			if (in) {
 				*eax = (*ops->vdev_barread)(ctx, vcpu, pdi, i,
 				                            offset, bytes);
@@ -501,6 +522,7 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 			} else
 				(*ops->vdev_barwrite)(ctx, vcpu, pdi, i, offset,
 				                      bytes, bar_value(bytes, *eax));
+			pci_vdev_emul_unlock(pdi);
 			return 0;
 		}
 	}
@@ -523,6 +545,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 
 	offset = addr - pdi->bar[bidx].addr;
 
+	pci_vdev_emul_lock(pdi);
 	if (dir == MEM_F_WRITE) {
 		if (size == 8) {
 			(*ops->vdev_barwrite)(ctx, vcpu, pdi, bidx, offset,
@@ -551,6 +574,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 			*val = bar_value(size, *val);
 		}
 	}
+	pci_vdev_emul_unlock(pdi);
 
 	return 0;
 }
@@ -609,7 +633,7 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		iop.port = dev->bar[idx].addr;
 		iop.size = dev->bar[idx].size;
 		if (registration) {
-			iop.flags = IOPORT_F_INOUT;
+			iop.flags = IOPORT_F_INOUT | IOPORT_F_MT_SAFE;
 			iop.handler = pci_emul_io_handler;
 			iop.arg = dev;
 			error = register_inout(&iop);
@@ -623,7 +647,7 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		mr.base = dev->bar[idx].addr;
 		mr.size = dev->bar[idx].size;
 		if (registration) {
-			mr.flags = MEM_F_RW;
+			mr.flags = MEM_F_RW | MEM_F_MT_SAFE;
 			mr.handler = pci_emul_mem_handler;
 			mr.arg1 = dev;
 			mr.arg2 = idx;
@@ -1007,6 +1031,7 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	pdi->slot = slot;
 	pdi->func = func;
 	pthread_mutex_init(&pdi->lintr.lock, NULL);
+	pthread_mutex_init(&pdi->emul_lock, NULL);
 	pdi->lintr.pin = 0;
 	pdi->lintr.state = IDLE;
 	pdi->lintr.pirq_pin = 0;
@@ -1028,8 +1053,10 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	err = (*ops->vdev_init)(ctx, pdi, fi->fi_param);
 	if (err == 0)
 		fi->fi_devi = pdi;
-	else
+	else {
+		pthread_mutex_destroy(&pdi->emul_lock);
 		free(pdi);
+	}
 
 	return err;
 }
@@ -1038,6 +1065,9 @@ static void
 pci_emul_deinit(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		int func, struct funcinfo *fi)
 {
+	/* a virtio device may still be polled or have eventfds bound */
+	if (fi->fi_devi)
+		virtio_release_dev(fi->fi_devi);
 	if (ops->vdev_deinit && fi->fi_devi)
 		(*ops->vdev_deinit)(ctx, fi->fi_devi, fi->fi_param);
 	if (fi->fi_param)
@@ -1047,6 +1077,7 @@ pci_emul_deinit(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		pci_lintr_release(fi->fi_devi);
 		pci_emul_free_bars(fi->fi_devi);
 		pci_emul_free_msixcap(fi->fi_devi);
+		pthread_mutex_destroy(&fi->fi_devi->emul_lock);
 		free(fi->fi_devi);
 	}
 }
@@ -2257,6 +2288,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 	}
 
 	ops = dev->dev_ops;
+	pci_vdev_emul_lock(dev);
 
 	/*
 	 * For non-passthru device, extended config space is NOT supported.
@@ -2280,7 +2312,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 				if (coff <= PCI_REGMAX + 4)
 					*eax = 0x00000000;
 			}
-			return;
+			goto out;
 		}
 	}
 
@@ -2305,7 +2337,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 		if (ops->vdev_cfgwrite != NULL &&
 		    (*ops->vdev_cfgwrite)(ctx, vcpu, dev,
 					  coff, bytes, *eax) == 0)
-			return;
+			goto out;
 
 		/*
 		 * Special handling for write to BAR registers
@@ -2316,7 +2348,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 			 * 4-byte aligned.
 			 */
 			if (bytes != 4 || (coff & 0x3) != 0)
-				return;
+				goto out;
 			idx = (coff - PCIR_BAR(0)) / 4;
 			mask = ~(dev->bar[idx].size - 1);
 
@@ -2397,7 +2429,7 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 				break;
 			default:
 				pr_err("%s: invalid bar type %d\n", __func__, dev->bar[idx].type);
-				return;
+				goto out;
 			}
 			pci_set_cfgdata32(dev, coff, bar);
 
@@ -2411,6 +2443,9 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 			CFGWRITE(dev, coff, *eax, bytes);
 		}
 	}
+
+out:
+	pci_vdev_emul_unlock(dev);
 }
 
 int
@@ -25,14 +25,19 @@
  */
 
 #include <sys/uio.h>
+#include <sys/eventfd.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "dm.h"
 #include "pci_core.h"
+#include "vmmapi.h"
+#include "mevent.h"
 #include "virtio.h"
 #include "timer.h"
 #include <atomic.h>
@@ -52,6 +57,26 @@
 static uint8_t virtio_poll_enabled;
 static size_t virtio_poll_interval;
 
+static void vq_sync_notify(struct virtio_vq_info *vq);
+
+/*
+ * In the adaptive poll mode, each virtqueue starts in the notify mode and is
+ * switched to the poll mode when the guest kicks it at a high rate, and back
+ * when polling doesn't find enough requests. The rates are sampled in windows
+ * of VIRTIO_POLL_WINDOW_NS, the gap between the two thresholds keeps a queue
+ * from flapping between the modes.
+ */
+static uint8_t virtio_poll_adaptive;
+
+#define VIRTIO_POLL_DEFAULT_INTERVAL	50000	/* ns */
+#define VIRTIO_POLL_WINDOW_NS		10000000
+#define VIRTIO_POLL_ENTER_KICKS		20	/* 2000 kicks/s */
+#define VIRTIO_POLL_EXIT_REQS		5	/* 500 requests/s */
+
+static LIST_HEAD(, virtio_base) virtio_poll_list =
+	LIST_HEAD_INITIALIZER(virtio_poll_list);
+static pthread_mutex_t virtio_poll_list_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static void
 virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 {
@@ -69,43 +94,482 @@ virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 	}
 }
 
+static void
+virtio_vq_notify(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	struct virtio_ops *vops = base->vops;
+
+	if (vq->notify)
+		(*vq->notify)(DEV_STRUCT(base), vq);
+	else if (vops->qnotify)
+		(*vops->qnotify)(DEV_STRUCT(base), vq);
+	else
+		pr_err("%s: qnotify queue %d: missing vq/vops notify\r\n",
+			vops->name, vq->num);
+}
+
+static inline void
+virtio_vq_count_kick(struct virtio_vq_info *vq)
+{
+	vq->stats.kicks++;
+	vq->win_kicks++;
+}
+
+static void
+virtio_vq_poll_enter(struct virtio_vq_info *vq)
+{
+	vq->polling = true;
+	vq->poll_avail = vq->packed ? 0 : vq->avail->idx;
+	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	vq_sync_notify(vq);
+	vq->stats.poll_enter++;
+}
+
+static void
+virtio_vq_poll_exit(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	vq->polling = false;
+	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	vq_sync_notify(vq);
+	vq->stats.poll_exit++;
+
+	/*
+	 * The guest may have queued requests without a kick just before it
+	 * saw the flag cleared, pick them up here.
+	 */
+	mb();
+	if (vq_has_descs(vq))
+		virtio_vq_notify(base, vq);
+}
+
+/*
+ * Poll the queues in the poll mode and switch the modes at the end of a
+ * window. Return true if any queue of the device is polled.
+ */
+static bool
+virtio_poll_adapt(struct virtio_base *base)
+{
+	struct virtio_vq_info *vq;
+	struct timespec ts;
+	uint64_t now;
+	uint16_t idx, reqs;
+	bool win_end, polling = false;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+	win_end = (now - base->poll_win_start) >= VIRTIO_POLL_WINDOW_NS;
+
+	for (i = 0; i < base->vops->nvq; i++) {
+		vq = &base->queues[i];
+		if (!vq_ring_ready(vq))
+			continue;
+
+		if (vq->polling) {
+			/* a packed ring has no index, count a hit as 1 */
+			if (vq->packed)
+				reqs = vq_has_descs(vq) ? 1 : 0;
+			else {
+				idx = vq->avail->idx;
+				reqs = idx - vq->poll_avail;
+				vq->poll_avail = idx;
+			}
+			if (reqs) {
+				vq->stats.poll_hits++;
+				vq->stats.kicks_avoided += reqs;
+				vq->win_reqs += reqs;
+			} else
+				vq->stats.poll_misses++;
+
+			if (vq_has_descs(vq))
+				virtio_vq_notify(base, vq);
+		}
+
+		if (win_end) {
+			if (!vq->polling && vq->win_kicks >= VIRTIO_POLL_ENTER_KICKS)
+				virtio_vq_poll_enter(vq);
+			else if (vq->polling && vq->win_reqs < VIRTIO_POLL_EXIT_REQS)
+				virtio_vq_poll_exit(base, vq);
+			vq->win_kicks = 0;
+			vq->win_reqs = 0;
+		}
+
+		if (vq->polling)
+			polling = true;
+	}
+
+	if (win_end)
+		base->poll_win_start = now;
+
+	return polling;
+}
+
 static void
 virtio_poll_timer(void *arg, uint64_t nexp)
 {
 	struct virtio_base *base;
-	struct virtio_ops *vops;
 	struct virtio_vq_info *vq;
-	const char *name;
+	bool polling = true;
 	int i;
 
 	base = arg;
-	vops = base->vops;
-	name = vops->name;
 
 	if (base->mtx)
 		pthread_mutex_lock(base->mtx);
 
 	base->polling_in_progress = 1;
 
-	for (i = 0; i < base->vops->nvq; i++) {
-		vq = &base->queues[i];
-		if(!vq_ring_ready(vq))
-			continue;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		/* TODO: call notify when necessary */
-		if (vq->notify)
-			(*vq->notify)(DEV_STRUCT(base), vq);
-		else if (vops->qnotify)
-			(*vops->qnotify)(DEV_STRUCT(base), vq);
-		else
-			pr_err("%s: qnotify queue %d: missing vq/vops notify\r\n",
-				name, i);
+	if (virtio_poll_adaptive)
+		polling = virtio_poll_adapt(base);
+	else {
+		for (i = 0; i < base->vops->nvq; i++) {
+			vq = &base->queues[i];
+			if(!vq_ring_ready(vq))
+				continue;
+			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+			vq_sync_notify(vq);
+			/* TODO: call notify when necessary */
+			virtio_vq_notify(base, vq);
+		}
 	}
 
 	if (base->mtx)
 		pthread_mutex_unlock(base->mtx);
 
-	virtio_start_timer(&base->polling_timer, 0, virtio_poll_interval);
+	/* only the rates are sampled if no queue is polled */
+	virtio_start_timer(&base->polling_timer, 0,
+		polling ? virtio_poll_interval : VIRTIO_POLL_WINDOW_NS);
+}
+
+static void
+virtio_poll_start(struct virtio_base *base)
+{
+	if (base->poll_listed)
+		return;
+
+	base->polling_timer.clockid = CLOCK_MONOTONIC;
+	acrn_timer_init(&base->polling_timer, virtio_poll_timer, base);
+	/* wait 5s to start virtio poll mode
+	 * skip vsbl and make sure device initialization completed
+	 * FIXME: Need optimization in the future
+	 */
+	virtio_start_timer(&base->polling_timer, 5, 0);
+
+	pthread_mutex_lock(&virtio_poll_list_mtx);
+	LIST_INSERT_HEAD(&virtio_poll_list, base, poll_link);
+	base->poll_listed = true;
+	pthread_mutex_unlock(&virtio_poll_list_mtx);
+}
+
+static void
+virtio_poll_stop(struct virtio_base *base)
+{
+	acrn_timer_deinit(&base->polling_timer);
+	base->polling_in_progress = 0;
+
+	pthread_mutex_lock(&virtio_poll_list_mtx);
+	if (base->poll_listed) {
+		LIST_REMOVE(base, poll_link);
+		base->poll_listed = false;
+	}
+	pthread_mutex_unlock(&virtio_poll_list_mtx);
+}
+
+/*
+ * With --virtio_eventfd, the queue notifies of the userspace backends are
+ * bound to ioeventfds and their MSI-X vectors to irqfds once the driver is
+ * ready. A kick is then an event of the mevent loop instead of an I/O request
+ * handled by a vCPU thread, and an interrupt is an eventfd write instead of
+ * a hypercall.
+ */
+static pthread_mutex_t virtio_irqfd_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* the devices with bound eventfds, to unbind them when they are removed */
+static LIST_HEAD(, virtio_base) virtio_eventfd_list =
+	LIST_HEAD_INITIALIZER(virtio_eventfd_list);
+static pthread_mutex_t virtio_eventfd_list_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+virtio_kick_handler(int fd, enum ev_type t, void *arg)
+{
+	struct virtio_vq_info *vq = arg;
+	struct virtio_base *base = vq->base;
+	uint64_t cnt;
+
+	if (read(fd, &cnt, sizeof(cnt)) != sizeof(cnt))
+		return;
+
+	if (base->mtx)
+		pthread_mutex_lock(base->mtx);
+
+	if (vq->flags & VQ_KICKFD) {
+		virtio_vq_count_kick(vq);
+		virtio_vq_notify(base, vq);
+	}
+
+	if (base->mtx)
+		pthread_mutex_unlock(base->mtx);
+}
+
+/*
+ * Same notify addresses as vhost_vq_register_eventfd(). A transitional
+ * device is kicked through the legacy BAR unless VERSION_1 was
+ * negotiated, which is settled once the driver is ready.
+ */
+static int
+virtio_vq_ioeventfd(struct virtio_base *base, struct virtio_vq_info *vq,
+		    bool assign)
+{
+	struct acrn_ioeventfd ioeventfd = {0};
+	struct pcibar *bar;
+
+	if (base->negotiated_caps & (1UL << VIRTIO_F_VERSION_1)) {
+		if (base->modern_pio_bar_idx) {
+			bar = &base->dev->bar[base->modern_pio_bar_idx];
+			ioeventfd.addr = bar->addr;
+			ioeventfd.data = vq->num;
+			ioeventfd.flags = ACRN_IOEVENTFD_FLAG_DATAMATCH |
+				ACRN_IOEVENTFD_FLAG_PIO;
+		} else if (base->modern_mmio_bar_idx) {
+			bar = &base->dev->bar[base->modern_mmio_bar_idx];
+			ioeventfd.addr = bar->addr + VIRTIO_CAP_NOTIFY_OFFSET
+				+ vq->num * VIRTIO_MODERN_NOTIFY_OFF_MULT;
+		} else
+			return -1;
+	} else {
+		bar = &base->dev->bar[base->legacy_pio_bar_idx];
+		ioeventfd.addr = bar->addr + VIRTIO_PCI_QUEUE_NOTIFY;
+		ioeventfd.data = vq->num;
+		ioeventfd.flags = ACRN_IOEVENTFD_FLAG_DATAMATCH |
+			ACRN_IOEVENTFD_FLAG_PIO;
+	}
+
+	/* the BAR may have been moved since the ioeventfd was assigned */
+	if (!assign) {
+		ioeventfd.addr = vq->kick_addr;
+		ioeventfd.flags |= ACRN_IOEVENTFD_FLAG_DEASSIGN;
+	}
+	ioeventfd.fd = vq->kick_fd;
+	ioeventfd.len = 2;
+
+	if (vm_ioeventfd(base->dev->vmctx, &ioeventfd) < 0) {
+		pr_err("%s: vm_ioeventfd of queue %d failed, errno %d\n",
+			base->vops->name, vq->num, errno);
+		return -1;
+	}
+
+	vq->kick_addr = ioeventfd.addr;
+	return 0;
+}
+
+static int
+virtio_vq_irqfd(struct virtio_base *base, struct virtio_vq_info *vq,
+		uint64_t addr, uint32_t data, bool assign)
+{
+	struct acrn_irqfd irqfd = {0};
+
+	irqfd.fd = vq->call_fd;
+	irqfd.flags = assign ? 0 : ACRN_IRQFD_FLAG_DEASSIGN;
+	irqfd.msi.msi_addr = addr;
+	irqfd.msi.msi_data = data;
+
+	if (vm_irqfd(base->dev->vmctx, &irqfd) < 0) {
+		pr_err("%s: vm_irqfd of queue %d failed, errno %d\n",
+			base->vops->name, vq->num, errno);
+		return -1;
+	}
+
+	if (assign) {
+		vq->call_addr = addr;
+		vq->call_data = data;
+	}
+	return 0;
+}
+
+static void
+virtio_vq_eventfd_start(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	struct msix_table_entry *mte;
+
+	vq->kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (vq->kick_fd < 0)
+		return;
+
+	vq->kick_mevp = mevent_add_class(vq->kick_fd, EVF_READ,
+			virtio_kick_handler, vq, NULL, NULL, MEVENT_CLASS_VIRTIO);
+	if (vq->kick_mevp == NULL) {
+		close(vq->kick_fd);
+		return;
+	}
+
+	if (virtio_vq_ioeventfd(base, vq, true) != 0) {
+		mevent_delete_close(vq->kick_mevp);
+		vq->kick_mevp = NULL;
+		return;
+	}
+	vq->flags |= VQ_KICKFD;
+
+	if (!pci_msix_enabled(base->dev) ||
+	    vq->msix_idx >= base->dev->msix.table_count)
+		return;
+
+	vq->call_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (vq->call_fd < 0)
+		return;
+
+	mte = &base->dev->msix.table[vq->msix_idx];
+	if (virtio_vq_irqfd(base, vq, mte->addr, mte->msg_data, true) != 0) {
+		close(vq->call_fd);
+		return;
+	}
+	vq->flags |= VQ_CALLFD;
+}
+
+static void
+virtio_vq_eventfd_stop(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (vq->flags & VQ_CALLFD) {
+		pthread_mutex_lock(&virtio_irqfd_mtx);
+		vq->flags &= ~VQ_CALLFD;
+		virtio_vq_irqfd(base, vq, vq->call_addr, vq->call_data, false);
+		close(vq->call_fd);
+		pthread_mutex_unlock(&virtio_irqfd_mtx);
+	}
+
+	if (vq->flags & VQ_KICKFD) {
+		vq->flags &= ~VQ_KICKFD;
+		virtio_vq_ioeventfd(base, vq, false);
+		mevent_delete_close(vq->kick_mevp);
+		vq->kick_mevp = NULL;
+	}
+}
+
+static void
+virtio_eventfd_start(struct virtio_base *base)
+{
+	struct virtio_vq_info *vq;
+	int i;
+
+	for (i = 0; i < base->vops->nvq; i++) {
+		vq = &base->queues[i];
+		if (vq_ring_ready(vq) && !(vq->flags & VQ_KICKFD))
+			virtio_vq_eventfd_start(base, vq);
+	}
+
+	pthread_mutex_lock(&virtio_eventfd_list_mtx);
+	if (!base->eventfd_listed) {
+		LIST_INSERT_HEAD(&virtio_eventfd_list, base, eventfd_link);
+		base->eventfd_listed = true;
+	}
+	pthread_mutex_unlock(&virtio_eventfd_list_mtx);
+}
+
+static void
+virtio_eventfd_stop(struct virtio_base *base)
+{
+	int i;
+
+	for (i = 0; i < base->vops->nvq; i++)
+		virtio_vq_eventfd_stop(base, &base->queues[i]);
+
+	pthread_mutex_lock(&virtio_eventfd_list_mtx);
+	if (base->eventfd_listed) {
+		LIST_REMOVE(base, eventfd_link);
+		base->eventfd_listed = false;
+	}
+	pthread_mutex_unlock(&virtio_eventfd_list_mtx);
+}
+
+/**
+ * @brief Stop the poll mode and unbind the eventfds of a device being
+ * removed.
+ *
+ * A device can be removed without its driver resetting it first, so the
+ * PCI core calls this before the deinit of every device. Otherwise the
+ * freed virtio_base would stay on virtio_poll_list, and its kick handlers
+ * registered. The device is looked up by its pointer on both lists, so dev
+ * may be any PCI device.
+ *
+ * @param dev Pointer to struct pci_vdev being removed.
+ *
+ * @return None
+ */
+void
+virtio_release_dev(struct pci_vdev *dev)
+{
+	struct virtio_base *base, *polled = NULL, *bound = NULL;
+
+	pthread_mutex_lock(&virtio_poll_list_mtx);
+	LIST_FOREACH(base, &virtio_poll_list, poll_link) {
+		if (base->dev == dev) {
+			polled = base;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&virtio_poll_list_mtx);
+
+	pthread_mutex_lock(&virtio_eventfd_list_mtx);
+	LIST_FOREACH(base, &virtio_eventfd_list, eventfd_link) {
+		if (base->dev == dev) {
+			bound = base;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&virtio_eventfd_list_mtx);
+
+	if (polled != NULL)
+		virtio_poll_stop(polled);
+	if (bound != NULL)
+		virtio_eventfd_stop(bound);
+}
+
+/**
+ * @brief Deliver the MSI-X interrupt of a virtqueue through its irqfd.
+ *
+ * The irqfd is rebound if the guest has reprogrammed the vector.
+ *
+ * @param vb Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return 0 on success, -1 if the interrupt must be generated by
+ * pci_generate_msix().
+ */
+int
+vq_irqfd_signal(struct virtio_base *vb, struct virtio_vq_info *vq)
+{
+	struct pci_vdev *dev = vb->dev;
+	struct msix_table_entry *mte;
+	uint64_t cnt = 1;
+	int ret = -1;
+
+	if (dev->msix.function_mask || vq->msix_idx >= dev->msix.table_count)
+		return -1;
+
+	/* a masked vector is left to pci_generate_msix() */
+	mte = &dev->msix.table[vq->msix_idx];
+	if (mte->vector_control & PCIM_MSIX_VCTRL_MASK)
+		return -1;
+
+	/* the irqfd may be closed by a reset or a failed rebind meanwhile */
+	pthread_mutex_lock(&virtio_irqfd_mtx);
+	if (!(vq->flags & VQ_CALLFD))
+		goto done;
+
+	if (mte->addr != vq->call_addr || mte->msg_data != vq->call_data) {
+		virtio_vq_irqfd(vb, vq, vq->call_addr, vq->call_data, false);
+		if (virtio_vq_irqfd(vb, vq, mte->addr, mte->msg_data, true) != 0) {
+			vq->flags &= ~VQ_CALLFD;
+			close(vq->call_fd);
+			goto done;
+		}
+	}
+
+	if (write(vq->call_fd, &cnt, sizeof(cnt)) == sizeof(cnt))
+		ret = 0;
+
+done:
+	pthread_mutex_unlock(&virtio_irqfd_mtx);
+	return ret;
 }
 
 /**
@@ -168,8 +632,8 @@ virtio_reset_dev(struct virtio_base *base)
 /* if (base->mtx) */
 /* assert(pthread_mutex_isowned_np(base->mtx)); */
 
-	acrn_timer_deinit(&base->polling_timer);
-	base->polling_in_progress = 0;
+	virtio_poll_stop(base);
+	virtio_eventfd_stop(base);
 
 	nvq = base->vops->nvq;
 	for (vq = base->queues, i = 0; i < nvq; vq++, i++) {
@@ -185,6 +649,12 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		vq->polling = false;
+		vq->win_kicks = 0;
+		vq->win_reqs = 0;
+		vq->packed = false;
+		free(vq->chain_len);
+		vq->chain_len = NULL;
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -320,6 +790,74 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 	vq->flags = VQ_ALLOC;
 }
 
+/*
+ * The features offered to the driver. The packed ring is handled here
+ * for every userspace modern device, vhost and the kernel backends
+ * only know the split ring.
+ */
+static inline uint64_t
+virtio_offered_caps(struct virtio_base *base)
+{
+	uint64_t caps = base->device_caps;
+
+	if (base->backend_type == BACKEND_VBSU &&
+	    (caps & (1UL << VIRTIO_F_VERSION_1)))
+		caps |= 1UL << VIRTIO_F_RING_PACKED;
+
+	return caps;
+}
+
+/*
+ * Initialize a packed virtqueue. The guest gave us the gpa of the
+ * descriptor ring, the driver and the device event suppression areas
+ * in place of desc array, avail ring and used ring.
+ */
+static void
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint16_t qsz = vq->qsize;
+	uint64_t phys;
+
+	free(vq->chain_len);
+	vq->chain_len = calloc(qsz, sizeof(uint16_t));
+	if (vq->chain_len == NULL) {
+		pr_err("%s: failed to enable packed queue %d\r\n",
+			base->vops->name, vq->num);
+		return;
+	}
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vq->pdesc = paddr_guest2host(base->dev->vmctx, phys,
+			qsz * sizeof(struct vring_packed_desc));
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vq->driver_event = paddr_guest2host(base->dev->vmctx, phys,
+			sizeof(struct vring_packed_desc_event));
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vq->device_event = paddr_guest2host(base->dev->vmctx, phys,
+			sizeof(struct vring_packed_desc_event));
+
+	vq->desc = NULL;
+	vq->avail = NULL;
+	vq->used_shadow = 0;
+	vq->used = (struct vring_used *)&vq->used_shadow;
+
+	/* Both wrap counters start at 1, see 2.7.1 of the spec. */
+	vq->last_avail = 0;
+	vq->avail_wrap = true;
+	vq->used_pos = 0;
+	vq->used_wrap = true;
+	vq->used_cnt = 0;
+	vq->save_used = 0;
+	vq->packed = true;
+
+	vq->enabled = true;
+
+	mb();
+	vq->flags = VQ_ALLOC;
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -338,6 +876,11 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED)) {
+		virtio_vq_enable_packed(base, vq);
+		return;
+	}
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -385,6 +928,262 @@ _vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
 }
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
+#define	VQ_PACKED_F_AVAIL	(1 << VRING_PACKED_DESC_F_AVAIL)
+#define	VQ_PACKED_F_USED	(1 << VRING_PACKED_DESC_F_USED)
+#define	VQ_PACKED_F_MASK	(VRING_DESC_F_NEXT | VRING_DESC_F_WRITE | \
+				 VRING_DESC_F_INDIRECT)
+
+/*
+ * Helper inline for vq_packed_getchain(): record the i'th "real"
+ * descriptor of a packed ring.
+ */
+static inline void
+_vq_record_packed(int i, volatile struct vring_packed_desc *vd,
+		  struct vmctx *ctx, struct iovec *iov, int n_iov,
+		  uint16_t *flags)
+{
+	if (i >= n_iov)
+		return;
+	iov[i].iov_base = paddr_guest2host(ctx, vd->addr, vd->len);
+	iov[i].iov_len = vd->len;
+	if (flags != NULL)
+		flags[i] = vd->flags & VQ_PACKED_F_MASK;
+}
+
+/*
+ * A packed descriptor is available if its AVAIL flag matches the wrap
+ * counter and its USED flag doesn't.
+ */
+static inline bool
+vq_packed_desc_avail(volatile struct vring_packed_desc *vd, bool wrap)
+{
+	uint16_t dflags = vd->flags;
+
+	return !!(dflags & VQ_PACKED_F_AVAIL) == wrap &&
+		!!(dflags & VQ_PACKED_F_USED) != wrap;
+}
+
+/*
+ * The device event suppression of a packed ring follows
+ * VRING_USED_F_NO_NOTIFY which the backends set in vq->used.
+ */
+static inline void
+vq_packed_sync_notify(struct virtio_vq_info *vq)
+{
+	uint16_t evflags;
+
+	evflags = (vq->used->flags & VRING_USED_F_NO_NOTIFY) ?
+		VRING_PACKED_EVENT_FLAG_DISABLE : VRING_PACKED_EVENT_FLAG_ENABLE;
+	if (vq->device_event->flags != evflags)
+		vq->device_event->flags = evflags;
+}
+
+static void
+vq_sync_notify(struct virtio_vq_info *vq)
+{
+	if (vq->packed && vq_ring_ready(vq))
+		vq_packed_sync_notify(vq);
+}
+
+bool
+vq_packed_has_descs(struct virtio_vq_info *vq)
+{
+	if (!vq_ring_ready(vq))
+		return false;
+
+	vq_packed_sync_notify(vq);
+	return vq_packed_desc_avail(&vq->pdesc[vq->last_avail],
+			vq->avail_wrap);
+}
+
+/*
+ * vq_getchain() of a packed ring. The descriptors of a chain are in
+ * consecutive positions of the ring, the buffer id is in the last one.
+ * The number of descriptors is saved per buffer id, as the used
+ * position is advanced by it in vq_relchain().
+ */
+static int
+vq_packed_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct vring_packed_desc *vd, *vindir;
+	struct virtio_base *base = vq->base;
+	const char *name = base->vops->name;
+	struct vmctx *ctx = base->dev->vmctx;
+	uint16_t pos, dflags, id, ndesc = 0;
+	u_int n_indir, j;
+	bool wrap;
+	int i = 0;
+
+	vq_packed_sync_notify(vq);
+
+	pos = vq->last_avail;
+	wrap = vq->avail_wrap;
+	if (!vq_packed_desc_avail(&vq->pdesc[pos], wrap))
+		return 0;
+
+	/*
+	 * Read the descriptors only after their flags. An acquire fence is
+	 * enough, and costs no instruction on x86, unlike a full fence per
+	 * chain.
+	 */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	for (;;) {
+		vd = &vq->pdesc[pos];
+		if (ndesc > 0 && !vq_packed_desc_avail(vd, wrap)) {
+			pr_err("%s: packed chain broken at %u, "
+			    "driver confused?\r\n", name, pos);
+			return -1;
+		}
+		dflags = vd->flags;
+		if (++ndesc > vq->qsize)
+			goto loopy;
+		if (++pos == vq->qsize) {
+			pos = 0;
+			wrap = !wrap;
+		}
+
+		if ((dflags & VRING_DESC_F_INDIRECT) == 0) {
+			_vq_record_packed(i, vd, ctx, iov, n_iov, flags);
+			if (++i > VQ_MAX_DESCRIPTORS)
+				goto loopy;
+		} else if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) {
+			pr_err("%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n",
+			    name);
+			return -1;
+		} else {
+			n_indir = vd->len / 16;
+			if ((vd->len & 0xf) || n_indir == 0) {
+				pr_err("%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n",
+				    name, (u_int)vd->len);
+				return -1;
+			}
+			/* the indirect table is read in order, no NEXT */
+			vindir = paddr_guest2host(ctx, vd->addr, vd->len);
+			for (j = 0; j < n_indir; j++) {
+				if (vindir[j].flags & VRING_DESC_F_INDIRECT) {
+					pr_err("%s: indirect desc has INDIR flag,"
+					    " driver confused?\r\n",
+					    name);
+					return -1;
+				}
+				_vq_record_packed(i, &vindir[j], ctx, iov,
+					n_iov, flags);
+				if (++i > VQ_MAX_DESCRIPTORS)
+					goto loopy;
+			}
+		}
+
+		if ((dflags & VRING_DESC_F_NEXT) == 0)
+			break;
+	}
+
+	id = vd->id;
+	if (id >= vq->qsize) {
+		pr_err("%s: buffer id %u out of range, driver confused?\r\n",
+		    name, id);
+		return -1;
+	}
+
+	vq->chain_len[id] = ndesc;
+	vq->last_avail = pos;
+	vq->avail_wrap = wrap;
+	*pidx = id;
+	return i;
+
+loopy:
+	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
+	    name, i);
+	return -1;
+}
+
+/*
+ * vq_retchain() of a packed ring. The backends may return several
+ * chains in the reverse order they got them, so the last chain is found
+ * from the ring: the descriptor before its first one, used or the end of
+ * another chain, has no NEXT flag.
+ */
+static void
+vq_packed_retchain(struct virtio_vq_info *vq)
+{
+	uint16_t pos = vq->last_avail, prev, n = 0;
+	bool wrap = vq->avail_wrap;
+
+	do {
+		if (pos == 0) {
+			pos = vq->qsize;
+			wrap = !wrap;
+		}
+		pos--;
+		prev = (pos == 0) ? vq->qsize - 1 : pos - 1;
+	} while (++n < vq->qsize && (vq->pdesc[prev].flags & VRING_DESC_F_NEXT));
+
+	vq->last_avail = pos;
+	vq->avail_wrap = wrap;
+}
+
+/*
+ * Write the used descriptor of buffer id at the used position of a
+ * packed ring and advance the position, the flags are written by the
+ * caller.
+ */
+static uint16_t
+vq_packed_put_used(struct virtio_vq_info *vq, uint16_t id, uint32_t iolen)
+{
+	volatile struct vring_packed_desc *vd;
+	uint16_t pos = vq->used_pos;
+	uint16_t n = vq->chain_len[id];
+
+	vd = &vq->pdesc[pos];
+	vd->id = id;
+	vd->len = iolen;
+
+	vq->used_cnt += n;
+	vq->used_pos += n;
+	if (vq->used_pos >= vq->qsize) {
+		vq->used_pos -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+
+	return pos;
+}
+
+static inline uint16_t
+vq_packed_used_flags(bool wrap)
+{
+	return wrap ? (VQ_PACKED_F_AVAIL | VQ_PACKED_F_USED) : 0;
+}
+
+/*
+ * Return n chains of a packed ring. The flags of the first used
+ * descriptor are written last, so the guest sees all of them at once.
+ */
+static void
+vq_packed_relchains(struct virtio_vq_info *vq, uint16_t *idx, uint32_t *iolen,
+		    int n)
+{
+	uint16_t pos, first = 0, first_flags = 0, uflags;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		uflags = vq_packed_used_flags(vq->used_wrap);
+		pos = vq_packed_put_used(vq, idx[i], iolen[i]);
+		if (i == 0) {
+			first = pos;
+			first_flags = uflags;
+		} else
+			vq->pdesc[pos].flags = uflags;
+	}
+
+	/* publish id and len before the flags, a release fence is enough */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	vq->pdesc[first].flags = first_flags;
+}
+
 /*
  * Examine the chain of descriptors starting at the "next one" to
  * make sure that they describe a sensible request.  If so, return
@@ -437,6 +1236,9 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	struct virtio_base *base;
 	const char *name;
 
+	if (vq->packed)
+		return vq_packed_getchain(vq, pidx, iov, n_iov, flags);
+
 	base = vq->base;
 	name = base->vops->name;
 
@@ -550,7 +1352,12 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
-	vq->last_avail--;
+	if (!vq->packed) {
+		vq->last_avail--;
+		return;
+	}
+
+	vq_packed_retchain(vq);
 }
 
 /*
@@ -577,6 +1384,11 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	 * (I apologize for the two fields named idx; the
 	 * virtio spec calls the one that vue points to, "id"...)
 	 */
+	if (vq->packed) {
+		vq_packed_relchains(vq, &idx, &iolen, 1);
+		return;
+	}
+
 	mask = vq->qsize - 1;
 	vuh = vq->used;
 
@@ -587,6 +1399,76 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	vuh->idx = uidx;
 }
 
+/*
+ * Return n request chains to the guest at once, for a request which
+ * was spread over several chains (e.g. a merged rx buffer). The used
+ * index is updated only after all the entries are written, so the
+ * guest never sees part of the request.
+ */
+void
+vq_relchains(struct virtio_vq_info *vq, uint16_t *idx, uint32_t *iolen,
+	     int n)
+{
+	uint16_t uidx, mask;
+	volatile struct vring_used *vuh;
+	volatile struct vring_used_elem *vue;
+	int i;
+
+	if (vq->packed) {
+		vq_packed_relchains(vq, idx, iolen, n);
+		return;
+	}
+
+	mask = vq->qsize - 1;
+	vuh = vq->used;
+
+	uidx = vuh->idx;
+	for (i = 0; i < n; i++) {
+		vue = &vuh->ring[uidx++ & mask];
+		vue->id = idx[i];
+		vue->len = iolen[i];
+	}
+	vuh->idx = uidx;
+}
+
+/*
+ * vq_endchains() of a packed ring, per the driver event suppression.
+ * With VRING_PACKED_EVENT_FLAG_DESC, the guest asks for an interrupt
+ * once the used position passes off_wrap, which is checked like
+ * EVENT_IDX of a split ring on the positions unwrapped by the counter.
+ */
+static void
+vq_packed_endchains(struct virtio_vq_info *vq)
+{
+	uint16_t off_wrap, event_idx, new_idx, old_idx, n;
+	uint16_t evflags;
+	int intr;
+
+	vq_packed_sync_notify(vq);
+
+	n = vq->used_cnt - vq->save_used;
+	vq->save_used = vq->used_cnt;
+	if (n == 0)
+		return;
+
+	evflags = vq->driver_event->flags;
+	if (evflags == VRING_PACKED_EVENT_FLAG_DESC &&
+	    (vq->base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX))) {
+		off_wrap = vq->driver_event->off_wrap;
+		event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+		if (!!(off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vq->used_wrap)
+			event_idx -= vq->qsize;
+		new_idx = vq->used_pos;
+		old_idx = new_idx - n;
+		intr = (uint16_t)(new_idx - event_idx - 1) <
+			(uint16_t)(new_idx - old_idx);
+	} else
+		intr = evflags != VRING_PACKED_EVENT_FLAG_DISABLE;
+
+	if (intr)
+		vq_interrupt(vq->base, vq);
+}
+
 /*
  * Driver has finished processing "available" chains and calling
  * vq_relchain on each one.  If driver used all the available
@@ -621,6 +1503,11 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 
 	atomic_thread_fence();
 
+	if (vq->packed) {
+		vq_packed_endchains(vq);
+		return;
+	}
+
 	base = vq->base;
 	old_idx = vq->save_used;
 	vq->save_used = new_idx = vq->used->idx;
@@ -648,7 +1535,8 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
  *
  * Driver should always use this helper function to clear used ring flags.
  * For virtio poll mode, in order to avoid trap, we should never really
- * clear used ring flags.
+ * clear used ring flags. In the adaptive poll mode, this only applies to
+ * the queues being polled.
  *
  * @param base Pointer to struct virtio_base.
  * @param vq Pointer to struct virtio_vq_info.
@@ -661,10 +1549,12 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	int polling_in_progress = base->polling_in_progress;
 
 	/* we should never unmask notification in polling mode */
-	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
+	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1 &&
+	    (!virtio_poll_adaptive || vq->polling))
 		return;
 
 	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	vq_sync_notify(vq);
 }
 
 struct config_reg {
@@ -950,13 +1840,8 @@ bad:
 			goto done;
 		}
 		vq = &base->queues[value];
-		if (vq->notify)
-			(*vq->notify)(DEV_STRUCT(base), vq);
-		else if (vops->qnotify)
-			(*vops->qnotify)(DEV_STRUCT(base), vq);
-		else
-			pr_err("%s: qnotify queue %d: missing vq/vops notify\r\n",
-				name, (int)value);
+		virtio_vq_count_kick(vq);
+		virtio_vq_notify(base, vq);
 		break;
 	case VIRTIO_PCI_STATUS:
 		base->status = value;
@@ -966,15 +1851,12 @@ bad:
 			(*vops->reset)(DEV_STRUCT(base));
 		if ((value & VIRTIO_CONFIG_S_DRIVER_OK) &&
 		     base->backend_type == BACKEND_VBSU &&
-		     virtio_poll_enabled) {
-			base->polling_timer.clockid = CLOCK_MONOTONIC;
-			acrn_timer_init(&base->polling_timer, virtio_poll_timer, base);
-			/* wait 5s to start virtio poll mode
-			 * skip vsbl and make sure device initialization completed
-			 * FIXME: Need optimization in the future
-			 */
-			virtio_start_timer(&base->polling_timer, 5, 0);
-		}
+		     virtio_poll_enabled)
+			virtio_poll_start(base);
+		if ((value & VIRTIO_CONFIG_S_DRIVER_OK) &&
+		     base->backend_type == BACKEND_VBSU &&
+		     virtio_eventfd_enabled)
+			virtio_eventfd_start(base);
 		break;
 	case VIRTIO_MSI_CONFIG_VECTOR:
 		base->msix_cfg_idx = value;
@@ -1251,9 +2133,9 @@ virtio_common_cfg_read(struct pci_vdev *dev, uint64_t offset, int size)
 		break;
 	case VIRTIO_PCI_COMMON_DF:
 		if (base->device_feature_select == 0)
-			value = base->device_caps & 0xffffffff;
+			value = virtio_offered_caps(base) & 0xffffffff;
 		else if (base->device_feature_select == 1)
-			value = (base->device_caps >> 32) & 0xffffffff;
+			value = (virtio_offered_caps(base) >> 32) & 0xffffffff;
 		else /* present 0, see 4.1.4.3.1 */
 			value = 0;
 		break;
@@ -1341,6 +2223,7 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 	struct virtio_ops *vops;
 	const struct config_reg *cr;
 	const char *name;
+	int shift;
 
 	vops = base->vops;
 	name = vops->name;
@@ -1374,10 +2257,12 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 		if (base->status & VIRTIO_CONFIG_S_DRIVER_OK)
 			break;
 		if (base->driver_feature_select < 2) {
+			/* each write sets one half of the features */
+			shift = base->driver_feature_select * 32;
 			value &= 0xffffffff;
 			base->negotiated_caps =
-				(value << (base->driver_feature_select * 32))
-				& base->device_caps;
+				((base->negotiated_caps & ~(0xffffffffUL << shift)) |
+				 (value << shift)) & virtio_offered_caps(base);
 			if (vops->apply_features)
 				(*vops->apply_features)(DEV_STRUCT(base),
 					base->negotiated_caps);
@@ -1392,7 +2277,14 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 			(*vops->set_status)(DEV_STRUCT(base), value);
 		if (base->status == 0)
 			(*vops->reset)(DEV_STRUCT(base));
-		/* TODO: virtio poll mode for modern devices */
+		if ((base->status & VIRTIO_CONFIG_S_DRIVER_OK) &&
+		     base->backend_type == BACKEND_VBSU &&
+		     virtio_poll_enabled)
+			virtio_poll_start(base);
+		if ((base->status & VIRTIO_CONFIG_S_DRIVER_OK) &&
+		     base->backend_type == BACKEND_VBSU &&
+		     virtio_eventfd_enabled)
+			virtio_eventfd_start(base);
 		break;
 	case VIRTIO_PCI_COMMON_Q_SELECT:
 		/*
@@ -1560,13 +2452,8 @@ virtio_notify_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 	}
 
 	vq = &base->queues[idx];
-	if (vq->notify)
-		(*vq->notify)(DEV_STRUCT(base), vq);
-	else if (vops->qnotify)
-		(*vops->qnotify)(DEV_STRUCT(base), vq);
-	else
-		pr_err("%s: qnotify queue %lu: missing vq/vops notify\r\n",
-			name, idx);
+	virtio_vq_count_kick(vq);
+	virtio_vq_notify(base, vq);
 }
 
 static uint32_t
@@ -1714,13 +2601,8 @@ virtio_pci_modern_pio_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		pthread_mutex_lock(base->mtx);
 
 	vq = &base->queues[idx];
-	if (vq->notify)
-		(*vq->notify)(DEV_STRUCT(base), vq);
-	else if (vops->qnotify)
-		(*vops->qnotify)(DEV_STRUCT(base), vq);
-	else
-		pr_err("%s: qnotify queue %lu: missing vq/vops notify\r\n",
-			name, idx);
+	virtio_vq_count_kick(vq);
+	virtio_vq_notify(base, vq);
 
 	if (base->mtx)
 		pthread_mutex_unlock(base->mtx);
@@ -1826,6 +2708,9 @@ virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 /**
  * @brief Get the virtio poll parameters
  *
+ * The parameters are "interval" or "adaptive[,interval]", the interval is
+ * in ns.
+ *
  * @param optarg Pointer to parameters string.
  *
  * @return fail -1 success 0
@@ -1835,7 +2720,23 @@ acrn_parse_virtio_poll_interval(const char *optarg)
 {
 	char *ptr;
 
-	virtio_poll_interval = strtoul(optarg, &ptr, 0);
+	if (strncmp(optarg, "adaptive", 8) == 0) {
+		optarg += 8;
+		if (*optarg == '\0') {
+			virtio_poll_interval = VIRTIO_POLL_DEFAULT_INTERVAL;
+			optarg = NULL;
+		} else if (*optarg == ',')
+			optarg++;
+		else
+			return -1;
+		virtio_poll_adaptive = 1;
+	}
+
+	if (optarg) {
+		virtio_poll_interval = strtoul(optarg, &ptr, 0);
+		if (ptr == optarg || *ptr != '\0')
+			return -1;
+	}
 
 	/* poll interval is limited from 1us to 10ms */
 	if (virtio_poll_interval < 1 || virtio_poll_interval > 10000000)
@@ -1845,3 +2746,40 @@ acrn_parse_virtio_poll_interval(const char *optarg)
 
 	return 0;
 }
+
+/**
+ * @brief Get the poll mode counters of the idx'th virtqueue
+ *
+ * @param idx Index of the virtqueue.
+ * @param info Pointer to the counters returned.
+ *
+ * @return 0 on success and -1 if there is no such virtqueue.
+ */
+int
+virtio_get_vq_stats(int idx, struct virtio_vq_stats_info *info)
+{
+	struct virtio_base *base;
+	struct virtio_vq_info *vq;
+	int i, ret = -1;
+
+	pthread_mutex_lock(&virtio_poll_list_mtx);
+	LIST_FOREACH(base, &virtio_poll_list, poll_link) {
+		for (i = 0; i < base->vops->nvq; i++) {
+			vq = &base->queues[i];
+			if (!vq_ring_ready(vq) || idx-- > 0)
+				continue;
+
+			memset(info, 0, sizeof(*info));
+			strncpy(info->name, base->vops->name, sizeof(info->name) - 1);
+			info->slot = base->dev->slot;
+			info->queue = i;
+			info->polling = vq->polling;
+			info->stats = vq->stats;
+			ret = 0;
+			goto done;
+		}
+	}
+done:
+	pthread_mutex_unlock(&virtio_poll_list_mtx);
+	return ret;
+}
@@ -41,6 +41,7 @@
 #include "monitor.h"
 
 #define VIRTIO_BLK_RINGSZ	64
+#define VIRTIO_BLK_MAX_QUEUES	16
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
 
 #define VIRTIO_BLK_S_OK	0
@@ -55,6 +56,7 @@
 #define	VIRTIO_BLK_F_BLK_SIZE	(1 << 6)	/* cfg block size valid */
 #define	VIRTIO_BLK_F_FLUSH	(1 << 9)	/* Cache flush support */
 #define	VIRTIO_BLK_F_TOPOLOGY	(1 << 10)	/* Optimal I/O alignment */
+#define	VIRTIO_BLK_F_MQ		(1 << 12)	/* Multiple request queues */
 
 /* Device can toggle its cache between writeback and writethrough modes */
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
@@ -98,8 +100,8 @@ struct virtio_blk_config {
 	} topology;
 	uint8_t	writeback;
 	uint8_t unused;
-	/* Reserve for num_queues when VIRTIO_BLK_F_MQ is support*/
-	uint16_t reserve;
+	/* Number of request queues, valid when VIRTIO_BLK_F_MQ is offered */
+	uint16_t num_queues;
 	/* The maximum discard sectors (in 512-byte sectors) for one segment */
 	uint32_t max_discard_sectors;
 	/* The maximum number of discard segments */
@@ -143,22 +145,33 @@ static struct monitor_vm_ops virtio_blk_rescan_ops = {
 struct virtio_blk_ioreq {
 	struct blockif_req req;
 	struct virtio_blk *blk;
+	struct virtio_blk_hdr hdr;	/* copied out of the chain */
 	uint8_t *status;
 	uint16_t idx;
+	uint16_t qidx;
 };
 
 /*
  * Per-device struct
+ *
+ * Every request queue has its own blockif context, the one of queue 0
+ * owns the backing file and the others are created by blockif_dup().
+ * The completions of a queue are serialized by its qmtx instead of the
+ * device-wide mtx, so the queues complete requests in parallel.
  */
 struct virtio_blk {
 	struct virtio_base base;
 	pthread_mutex_t mtx;
-	struct virtio_vq_info vq;
+	struct virtio_ops ops;
+	int nvq;
+	struct virtio_vq_info vqs[VIRTIO_BLK_MAX_QUEUES];
+	pthread_mutex_t qmtx[VIRTIO_BLK_MAX_QUEUES];
 	struct virtio_blk_config cfg;
 	bool dummy_bctxt; /* Used in blockrescan. Indicate if the bctxt can be used */
-	struct blockif_ctxt *bc;
+	bool modern;	/* transitional device, offers VERSION_1 */
+	struct blockif_ctxt *bc[VIRTIO_BLK_MAX_QUEUES];
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
-	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
+	struct virtio_blk_ioreq ios[VIRTIO_BLK_MAX_QUEUES][VIRTIO_BLK_RINGSZ];
 	uint8_t original_wce;
 };
 
@@ -169,7 +182,7 @@ static int virtio_blk_cfgwrite(void *, int, int, uint32_t);
 
 static struct virtio_ops virtio_blk_ops = {
 	"virtio_blk",		/* our name */
-	1,			/* we support 1 virtqueue */
+	1,			/* 1 virtqueue, updated by the mq option */
 	sizeof(struct virtio_blk_config), /* config reg size */
 	virtio_blk_reset,	/* reset */
 	virtio_blk_notify,	/* device-wide qnotify */
@@ -179,16 +192,30 @@ static struct virtio_ops virtio_blk_ops = {
 	NULL,			/* called on guest set status */
 };
 
+static void
+virtio_blk_set_wce(struct virtio_blk *blk, uint8_t wce)
+{
+	int i;
+
+	for (i = 0; i < blk->nvq; i++)
+		blockif_set_wce(blk->bc[i], wce);
+}
+
 static void
 virtio_blk_reset(void *vdev)
 {
 	struct virtio_blk *blk = vdev;
+	int i;
 
 	DPRINTF(("virtio_blk: device reset requested !\n"));
+	for (i = 0; i < blk->nvq; i++)
+		pthread_mutex_lock(&blk->qmtx[i]);
 	virtio_reset_dev(&blk->base);
+	for (i = blk->nvq - 1; i >= 0; i--)
+		pthread_mutex_unlock(&blk->qmtx[i]);
 	/* Reset virtio-blk device only on valid bctxt*/
 	if (!blk->dummy_bctxt)
-		blockif_set_wce(blk->bc, blk->original_wce);
+		virtio_blk_set_wce(blk, blk->original_wce);
 }
 
 static void
@@ -196,6 +223,8 @@ virtio_blk_done(struct blockif_req *br, int err)
 {
 	struct virtio_blk_ioreq *io = br->param;
 	struct virtio_blk *blk = io->blk;
+	struct virtio_vq_info *vq = &blk->vqs[io->qidx];
+	int msix;
 
 	if (err)
 		DPRINTF(("virtio_blk: done with error = %d\n\r", err));
@@ -212,10 +241,19 @@ virtio_blk_done(struct blockif_req *br, int err)
 	 * Return the descriptor back to the host.
 	 * We wrote 1 byte (our status) to host.
 	 */
-	pthread_mutex_lock(&blk->mtx);
-	vq_relchain(&blk->vq, io->idx, 1);
-	vq_endchains(&blk->vq, !vq_has_descs(&blk->vq));
-	pthread_mutex_unlock(&blk->mtx);
+	/*
+	 * The device-wide mtx is taken before a queue lock. Without MSI-X
+	 * the interrupt is raised under the device-wide mtx, so take it first.
+	 */
+	msix = pci_msix_enabled(blk->base.dev);
+	if (!msix)
+		pthread_mutex_lock(&blk->mtx);
+	pthread_mutex_lock(&blk->qmtx[io->qidx]);
+	vq_relchain(vq, io->idx, 1);
+	vq_endchains(vq, !vq_has_descs(vq));
+	pthread_mutex_unlock(&blk->qmtx[io->qidx]);
+	if (!msix)
+		pthread_mutex_unlock(&blk->mtx);
 }
 
 static void
@@ -230,63 +268,78 @@ virtio_blk_abort(struct virtio_vq_info *vq, uint16_t idx)
 static void
 virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 {
-	struct virtio_blk_hdr *vbh;
 	struct virtio_blk_ioreq *io;
-	int i, n;
+	int i, n, first;
 	int err;
+	size_t hlen, len;
 	ssize_t iolen;
 	int writeop, type;
 	struct iovec iov[BLOCKIF_IOV_MAX + 2];
 	uint16_t idx, flags[BLOCKIF_IOV_MAX + 2];
+	struct blockif_ctxt *bc = blk->bc[vq->num];
 
 	idx = vq->qsize;
 	n = vq_getchain(vq, &idx, iov, BLOCKIF_IOV_MAX + 2, flags);
 
 	/*
-	 * The first descriptor will be the read-only fixed header,
-	 * and the last is for status (hence +2 above and below).
-	 * The remaining iov's are the actual data I/O vectors.
-	 *
-	 * XXX - note - this fails on crash dump, which does a
-	 * VIRTIO_BLK_T_FLUSH with a zero transfer length
+	 * The chain starts with the read-only fixed header and ends with
+	 * the status byte, the data is in between (hence +2 above). A legacy
+	 * driver puts the header and the status in descriptors of their own,
+	 * but with VERSION_1 (which implies ANY_LAYOUT) they may share
+	 * descriptors with the data. So the header is copied out of the
+	 * first readable bytes, the status is the last byte of the chain,
+	 * and the data iov's are what is left.
 	 */
-	if (n < 2 || n > BLOCKIF_IOV_MAX + 2) {
+	if (n < 1 || n > BLOCKIF_IOV_MAX + 2) {
 		WPRINTF(("%s: vq_getchain failed\n", __func__));
 		virtio_blk_abort(vq, idx);
 		return;
 	}
 
-	io = &blk->ios[idx];
-	if ((flags[0] & VRING_DESC_F_WRITE) != 0) {
-		WPRINTF(("%s: the type for hdr should not be VRING_DESC_F_WRITE\n", __func__));
+	io = &blk->ios[vq->num][idx];
+	hlen = 0;
+	first = 0;
+	while (hlen < sizeof(io->hdr) && first < n &&
+			(flags[first] & VRING_DESC_F_WRITE) == 0) {
+		len = MIN(iov[first].iov_len, sizeof(io->hdr) - hlen);
+		memcpy((uint8_t *)&io->hdr + hlen, iov[first].iov_base, len);
+		hlen += len;
+		iov[first].iov_base = (uint8_t *)iov[first].iov_base + len;
+		iov[first].iov_len -= len;
+		if (iov[first].iov_len == 0)
+			first++;
+	}
+	if (hlen != sizeof(io->hdr)) {
+		WPRINTF(("%s: the readable hdr is %zu bytes, should be %zu\n",
+					__func__, hlen, sizeof(io->hdr)));
 		virtio_blk_abort(vq, idx);
 		return;
 	}
-	if (iov[0].iov_len != sizeof(struct virtio_blk_hdr)) {
-		WPRINTF(("%s: the size for hdr %ld should be %ld \n",
-						__func__,
-						iov[0].iov_len,
-						sizeof(struct virtio_blk_hdr)));
+	if (first == n || iov[n - 1].iov_len == 0 ||
+			(flags[n - 1] & VRING_DESC_F_WRITE) == 0) {
+		WPRINTF(("%s: status iov is invalid!\n", __func__));
 		virtio_blk_abort(vq, idx);
 		return;
 	}
-	vbh = iov[0].iov_base;
-	memcpy(&io->req.iov, &iov[1], sizeof(struct iovec) * (n - 2));
-	io->req.iovcnt = n - 2;
-	io->req.offset = vbh->sector * DEV_BSIZE;
-	io->status = iov[--n].iov_base;
-	if (iov[n].iov_len != 1 || ((flags[n] & VRING_DESC_F_WRITE) == 0)) {
-		WPRINTF(("%s: status iov is invalid!\n", __func__));
+	io->status = (uint8_t *)iov[n - 1].iov_base + iov[n - 1].iov_len - 1;
+	if (--iov[n - 1].iov_len == 0)
+		n--;
+	if (n - first > BLOCKIF_IOV_MAX) {
+		WPRINTF(("%s: %d data segments, more than %d\n",
+					__func__, n - first, BLOCKIF_IOV_MAX));
 		virtio_blk_abort(vq, idx);
 		return;
 	}
+	memcpy(&io->req.iov, &iov[first], sizeof(struct iovec) * (n - first));
+	io->req.iovcnt = n - first;
+	io->req.offset = io->hdr.sector * DEV_BSIZE;
 
 	/*
 	 * XXX
 	 * The guest should not be setting the BARRIER flag because
 	 * we don't advertise the capability.
 	 */
-	type = vbh->type & ~VBH_FLAG_BARRIER;
+	type = io->hdr.type & ~VBH_FLAG_BARRIER;
 	writeop = ((type == VBH_OP_WRITE) ||
 			(type == VBH_OP_DISCARD));
 
@@ -296,14 +349,14 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		return;
 	}
 
-	if (writeop && blockif_is_ro(blk->bc)) {
+	if (writeop && blockif_is_ro(bc)) {
 		WPRINTF(("Cannot write to a read-only storage!\n"));
 		virtio_blk_done(&io->req, EROFS);
 		return;
 	}
 
 	iolen = 0;
-	for (i = 1; i < n; i++) {
+	for (i = first; i < n; i++) {
 		/*
 		 * - write/discard op implies read-only descriptor,
 		 * - read/ident op implies write-only descriptor,
@@ -320,7 +373,7 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	io->req.resid = iolen;
 
 	DPRINTF(("virtio_blk: %s op, %zd bytes, %d segs, offset %ld\n\r",
-		 writeop ? "write/discard" : "read/ident", iolen, i - 1,
+		 writeop ? "write/discard" : "read/ident", iolen, n - first,
 		 io->req.offset));
 
 	switch (type) {
@@ -338,30 +391,34 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		 *   read or write beyond capacity.
 		 */
 		if ((iolen & (DEV_BSIZE - 1)) ||
-		    vbh->sector + iolen / DEV_BSIZE > blk->cfg.capacity) {
+		    io->hdr.sector + iolen / DEV_BSIZE > blk->cfg.capacity) {
 			DPRINTF(("virtio_blk: invalid request, iolen = %ld, "
 			         "sector = %lu, capacity = %lu\n\r", iolen,
-			         vbh->sector, blk->cfg.capacity));
+			         io->hdr.sector, blk->cfg.capacity));
 			virtio_blk_done(&io->req, EINVAL);
 			return;
 		}
 
 		err = ((type == VBH_OP_READ) ? blockif_read : blockif_write)
-				(blk->bc, &io->req);
+				(bc, &io->req);
 		break;
 	case VBH_OP_DISCARD:
-		err = blockif_discard(blk->bc, &io->req);
+		err = blockif_discard(bc, &io->req);
 		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
-		err = blockif_flush(blk->bc, &io->req);
+		err = blockif_flush(bc, &io->req);
 		break;
 	case VBH_OP_IDENT:
 		/* Assume a single buffer */
+		if (io->req.iovcnt < 1) {
+			virtio_blk_done(&io->req, EINVAL);
+			return;
+		}
 		/* S/n equal to buffer is not zero-terminated. */
-		memset(iov[1].iov_base, 0, iov[1].iov_len);
-		strncpy(iov[1].iov_base, blk->ident,
-		    MIN(iov[1].iov_len, sizeof(blk->ident)));
+		memset(io->req.iov[0].iov_base, 0, io->req.iov[0].iov_len);
+		strncpy(io->req.iov[0].iov_base, blk->ident,
+		    MIN(io->req.iov[0].iov_len, sizeof(blk->ident)));
 		virtio_blk_done(&io->req, 0);
 		return;
 	default:
@@ -377,8 +434,10 @@ virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_blk *blk = vdev;
 
+	pthread_mutex_lock(&blk->qmtx[vq->num]);
 	while (vq_has_descs(vq))
 		virtio_blk_proc(blk, vq);
+	pthread_mutex_unlock(&blk->qmtx[vq->num]);
 }
 
 static uint64_t
@@ -390,12 +449,18 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	if (wb)
 		caps |= VIRTIO_BLK_F_WB_BITS;
 
-	if (blockif_candiscard(blk->bc))
+	if (blockif_candiscard(blk->bc[0]))
 		caps |= VIRTIO_BLK_F_DISCARD;
 
-	if (blockif_is_ro(blk->bc))
+	if (blockif_is_ro(blk->bc[0]))
 		caps |= VIRTIO_BLK_F_RO;
 
+	if (blk->nvq > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+
+	if (blk->modern)
+		caps |= 1UL << VIRTIO_F_VERSION_1;
+
 	return caps;
 }
 
@@ -405,9 +470,9 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 	off_t size = 0;
 	int sectsz = 0, sts = 0, sto = 0;
 
-	size = blockif_size(blk->bc);
-	sectsz = blockif_sectsz(blk->bc);
-	blockif_psectsz(blk->bc, &sts, &sto);
+	size = blockif_size(blk->bc[0]);
+	sectsz = blockif_sectsz(blk->bc[0]);
+	blockif_psectsz(blk->bc[0], &sts, &sto);
 
 	/* setup virtio block config space */
 	blk->cfg.capacity = size / DEV_BSIZE; /* 512-byte units */
@@ -422,26 +487,113 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 	blk->cfg.topology.alignment_offset =
 	    (sto != 0) ? ((sts - sto) / sectsz) : 0;
 	blk->cfg.topology.min_io_size = 0;
-	blk->cfg.writeback = blockif_get_wce(blk->bc);
+	blk->cfg.num_queues = blk->nvq;
+	blk->cfg.writeback = blockif_get_wce(blk->bc[0]);
 	blk->original_wce = blk->cfg.writeback; /* save for reset */
-	if (blockif_candiscard(blk->bc)) {
-		blk->cfg.max_discard_sectors = blockif_max_discard_sectors(blk->bc);
-		blk->cfg.max_discard_seg = blockif_max_discard_seg(blk->bc);
-		blk->cfg.discard_sector_alignment = blockif_discard_sector_alignment(blk->bc);
+	if (blockif_candiscard(blk->bc[0])) {
+		blk->cfg.max_discard_sectors = blockif_max_discard_sectors(blk->bc[0]);
+		blk->cfg.max_discard_seg = blockif_max_discard_seg(blk->bc[0]);
+		blk->cfg.discard_sector_alignment = blockif_discard_sector_alignment(blk->bc[0]);
 	}
 	blk->base.device_caps =
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 }
+/*
+ * Create the blockif contexts of the queues other than queue 0.
+ */
+static int
+virtio_blk_dup_bctxt(struct virtio_blk *blk, const char *bident)
+{
+	char qident[16];
+	int i;
+
+	for (i = 1; i < blk->nvq; i++) {
+		snprintf(qident, sizeof(qident), "%s.%d", bident, i);
+		blk->bc[i] = blockif_dup(blk->bc[0], qident);
+		if (blk->bc[i] == NULL) {
+			while (--i > 0) {
+				blockif_close(blk->bc[i]);
+				blk->bc[i] = NULL;
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void
+virtio_blk_close_bctxt(struct virtio_blk *blk)
+{
+	int i;
+
+	/* the duplicated contexts must be closed before queue 0 */
+	for (i = blk->nvq - 1; i >= 0; i--) {
+		if (blk->bc[i] != NULL) {
+			blockif_close(blk->bc[i]);
+			blk->bc[i] = NULL;
+		}
+	}
+}
+
+/*
+ * Strip the "mq=<n>" option, which is consumed by virtio-blk itself,
+ * from the options passed to blockif_open().
+ */
+static int
+virtio_blk_parse_mq(char *opts, int *nvq)
+{
+	char *cp, *end;
+	int n;
+
+	*nvq = 1;
+	cp = strstr(opts, ",mq=");
+	if (cp == NULL)
+		return 0;
+
+	if (dm_strtoi(cp + strlen(",mq="), &end, 10, &n) ||
+			(*end != ',' && *end != '\0') ||
+			n < 1 || n > VIRTIO_BLK_MAX_QUEUES) {
+		pr_err("virtio_blk: invalid mq, range is 1 to %d\n",
+				VIRTIO_BLK_MAX_QUEUES);
+		return -1;
+	}
+	*nvq = n;
+
+	/* remove ",mq=<n>" from the option string */
+	memmove(cp, end, strlen(end) + 1);
+	return 0;
+}
+
+/*
+ * Strip the "modern" option, which is consumed by virtio-blk itself,
+ * from the options passed to blockif_open().
+ */
+static bool
+virtio_blk_parse_modern(char *opts)
+{
+	char *cp, *end;
+
+	for (cp = strstr(opts, ",modern"); cp != NULL;
+			cp = strstr(cp + 1, ",modern")) {
+		end = cp + strlen(",modern");
+		if (*end == ',' || *end == '\0') {
+			memmove(cp, end, strlen(end) + 1);
+			return true;
+		}
+	}
+	return false;
+}
+
 static int
 virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
-	bool dummy_bctxt;
+	bool dummy_bctxt, modern;
 	char bident[16];
 	struct blockif_ctxt *bctxt;
 	MD5_CTX mdctx;
 	u_char digest[16];
 	struct virtio_blk *blk;
-	int i;
+	int i, j, nvq;
 	pthread_mutexattr_t attr;
 	int rc;
 
@@ -454,6 +606,10 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
+	if (virtio_blk_parse_mq(opts, &nvq) < 0)
+		return -1;
+	modern = virtio_blk_parse_modern(opts);
+
 	/*
 	 * The supplied backing file has to exist
 	 */
@@ -483,17 +639,28 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
-	blk->bc = bctxt;
+	blk->nvq = nvq;
+	blk->modern = modern;
+	blk->bc[0] = bctxt;
 	/* Update virtio-blk device struct of dummy ctxt*/
 	blk->dummy_bctxt = dummy_bctxt;
+	if (!dummy_bctxt && virtio_blk_dup_bctxt(blk, bident) < 0) {
+		pr_err("virtio_blk: failed to create the queue contexts\n");
+		blockif_close(bctxt);
+		free(blk);
+		return -1;
+	}
 
-	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
-		struct virtio_blk_ioreq *io = &blk->ios[i];
+	for (i = 0; i < nvq; i++) {
+		for (j = 0; j < VIRTIO_BLK_RINGSZ; j++) {
+			struct virtio_blk_ioreq *io = &blk->ios[i][j];
 
-		io->req.callback = virtio_blk_done;
-		io->req.param = io;
-		io->blk = blk;
-		io->idx = i;
+			io->req.callback = virtio_blk_done;
+			io->req.param = io;
+			io->blk = blk;
+			io->idx = j;
+			io->qidx = i;
+		}
 	}
 
 	/* init mutex attribute properly to avoid deadlock */
@@ -509,12 +676,21 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (rc)
 		DPRINTF(("virtio_blk: pthread_mutex_init failed with "
 					"error %d!\n", rc));
+	for (i = 0; i < nvq; i++) {
+		rc = pthread_mutex_init(&blk->qmtx[i], &attr);
+		if (rc)
+			DPRINTF(("virtio_blk: pthread_mutex_init failed with "
+						"error %d!\n", rc));
+	}
 
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &virtio_blk_ops, blk, dev, &blk->vq, BACKEND_VBSU);
+	blk->ops = virtio_blk_ops;
+	blk->ops.nvq = nvq;
+	virtio_linkup(&blk->base, &blk->ops, blk, dev, blk->vqs, BACKEND_VBSU);
 	blk->base.mtx = &blk->mtx;
 
-	blk->vq.qsize = VIRTIO_BLK_RINGSZ;
+	for (i = 0; i < nvq; i++)
+		blk->vqs[i].qsize = VIRTIO_BLK_RINGSZ;
 	/* blk->vq.vq_notify = we have no per-queue notify */
 
 	/*
@@ -551,12 +727,28 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (virtio_interrupt_init(&blk->base, virtio_uses_msix())) {
 		/* call close only for valid bctxt */
 		if (!blk->dummy_bctxt)
-			blockif_close(blk->bc);
+			virtio_blk_close_bctxt(blk);
 		free(blk);
 		return -1;
 	}
 	virtio_set_io_bar(&blk->base, 0);
 
+	/*
+	 * With "modern", a transitional device: a virtio 1.0 driver finds
+	 * the modern BARs and can negotiate the packed ring. The other caps
+	 * of a dummy backend are only known after the rescan.
+	 */
+	if (modern) {
+		blk->base.device_caps |= 1UL << VIRTIO_F_VERSION_1;
+		if (virtio_set_modern_bar(&blk->base, true)) {
+			WPRINTF(("virtio_blk: failed to set the modern BARs\n"));
+			if (!blk->dummy_bctxt)
+				virtio_blk_close_bctxt(blk);
+			free(blk);
+			return -1;
+		}
+	}
+
 	/*
 	 * Register ops for virtio-blk Rescan
 	 */
@@ -582,10 +774,10 @@ virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		blk = (struct virtio_blk *) dev->arg;
 		/* De-init virtio-blk device only on valid bctxt*/
 		if (!blk->dummy_bctxt) {
-			bctxt = blk->bc;
+			bctxt = blk->bc[0];
 			if (blockif_flush_all(bctxt))
 				WPRINTF(("vrito_blk: Failed to flush before close\n"));
-			blockif_close(bctxt);
+			virtio_blk_close_bctxt(blk);
 		}
 		free(blk);
 	}
@@ -605,7 +797,7 @@ virtio_blk_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 		memcpy(ptr, &value, size);
 		/* Update write cache enable only on valid bctxt*/
 		if (!blk->dummy_bctxt)
-			blockif_set_wce(blk->bc, blkcfg->writeback);
+			virtio_blk_set_wce(blk, blkcfg->writeback);
 		if (blkcfg->writeback)
 			blk->base.device_caps |= VIRTIO_BLK_F_FLUSH;
 		else
@@ -679,7 +871,7 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 	 * user has passed empty file during VM launch and wants to update it.
 	 * If this is the case, blk->bc would be null.
 	 */
-	if (blk->bc) {
+	if (blk->bc[0]) {
 		pr_err("Replacing valid backend file not supported!\n");
 		goto end;
 	}
@@ -692,7 +884,13 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 		goto end;
 	}
 
-	blk->bc = bctxt;
+	blk->bc[0] = bctxt;
+	if (virtio_blk_dup_bctxt(blk, bident) < 0) {
+		pr_err("Error creating the queue contexts\n");
+		blockif_close(bctxt);
+		blk->bc[0] = NULL;
+		goto end;
+	}
 	blk->dummy_bctxt = false;
 
 	/* Update virtio-blk device configuration on valid file*/
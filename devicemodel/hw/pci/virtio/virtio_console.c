@@ -674,8 +674,9 @@ virtio_console_accept_new_connection(int fd __attribute__((unused)),
 		be->fd = accepted_fd;
 	}
 
-	be->conn_evp = mevent_add(be->fd, EVF_READ, virtio_console_backend_read, be,
-				NULL, NULL);
+	be->conn_evp = mevent_add_class(be->fd, EVF_READ,
+				virtio_console_backend_read, be, NULL, NULL,
+				MEVENT_CLASS_CONSOLE);
 	if (be->conn_evp == NULL) {
 		WPRINTF(("accepted fd mevent_add failed\n"));
 		return;
@@ -915,9 +916,10 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 		}
 		else if (isatty(fd) || (be->be_type == VIRTIO_CONSOLE_BE_SOCKET
 			&& !strcmp(be->socket_type,"client"))) {
-			be->evp = mevent_add(fd, EVF_READ,
+			be->evp = mevent_add_class(fd, EVF_READ,
 					virtio_console_backend_read, be,
-					virtio_console_teardown_backend, be);
+					virtio_console_teardown_backend, be,
+					MEVENT_CLASS_CONSOLE);
 			if (be->evp == NULL) {
 				WPRINTF(("vtcon: mevent_add failed\n"));
 				error = -1;
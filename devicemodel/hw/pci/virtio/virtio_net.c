@@ -48,6 +48,14 @@
 #include "dm_string.h"
 
 #define VIRTIO_NET_RINGSZ	1024
+#define VIRTIO_NET_CTRL_RINGSZ	64
+
+/*
+ * Largest frame the guest rx buffers are sized for, without and with
+ * segmentation offload, including a VLAN tag.
+ */
+#define VIRTIO_NET_RX_MAXLEN	(ETHER_MAX_LEN + 4)
+#define VIRTIO_NET_RX_MAXLEN_GSO	(65535 + ETHER_HDR_LEN + 4)
 #define VIRTIO_NET_MAXSEGS	256
 
 /*
@@ -72,6 +80,7 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* multiple rx/tx queue pairs */
 #define	VHOST_NET_F_VIRTIO_NET_HDR \
 				(1 << 27) /* vhost provides virtio_net_hdr */
 
@@ -79,6 +88,14 @@
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
 	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
 
+/*
+ * Offloads offered when the tap device handles the virtio-net header
+ */
+#define VIRTIO_NET_S_OFFLOADCAPS      \
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | \
+	VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6 | \
+	VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)
+
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	((1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
 	(1 << VIRTIO_RING_F_EVENT_IDX) | VIRTIO_NET_F_MRG_RXBUF | \
@@ -93,16 +110,35 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
- * Queue definitions.
+ * Queue definitions. Queue pair n uses virtqueue 2n for rx and 2n + 1
+ * for tx, the control queue follows the last pair when multiple queue
+ * pairs are offered.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
+#define VIRTIO_NET_PAIRQ	2	/* virtqueues per queue pair */
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_MAX_QPAIRS	8
+#define VIRTIO_NET_MAXQ	(VIRTIO_NET_MAX_QPAIRS * VIRTIO_NET_PAIRQ + 1)
+
+/*
+ * Control queue commands
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK	0
+#define VIRTIO_NET_ERR	1
+
+#define VIRTIO_NET_CTRL_MQ	4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET	0
+#define VIRTIO_NET_CTRL_MAXSEGS	4
 
 /*
  * Fixed network header size
@@ -129,50 +165,71 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[VIRTIO_NET_PAIRQ];
 	int tapfd;
 	bool vhost_started;
 };
 
+struct virtio_net;
+
+/*
+ * Per-queue-pair struct, each pair has its own tap queue, rx event
+ * and tx thread
+ */
+struct virtio_net_qpair {
+	struct virtio_net *net;
+	int		idx;
+	int		tapfd;
+	struct mevent	*mevp;
+
+	int		rx_ready;
+
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+
+	struct vhost_net *vhost_net;
+};
+
 /*
  * Per-device struct
  */
 struct virtio_net {
 	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
+	struct virtio_ops ops;
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
 	pthread_mutex_t mtx;
-	struct mevent	*mevp;
-
-	int		tapfd;
 
-	int		rx_ready;
+	struct virtio_net_qpair qpairs[VIRTIO_NET_MAX_QPAIRS];
+	int		nqpairs;	/* queue pairs offered */
+	int		curr_qpairs;	/* queue pairs enabled by the guest */
+	int		nr_mevents;	/* registered rx events */
 
 	volatile int	resetting;	/* set and checked outside lock */
-	volatile int	closing;	/* stop the tx i/o thread */
+	volatile int	closing;	/* stop the tx i/o threads */
 
 	uint64_t	features;	/* negotiated features */
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	int		rx_maxlen;	/* largest frame from the tap */
+	bool		tap_vnet_hdr;	/* tap reads/writes virtio-net header */
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	void (*virtio_net_rx)(struct virtio_net_qpair *qp);
+	void (*virtio_net_tx)(struct virtio_net_qpair *qp, struct iovec *iov,
 			     int iovcnt, int len);
 
-	struct vhost_net *vhost_net;
 	bool		use_vhost;
+	bool		modern;		/* transitional device, offers VERSION_1 */
 };
 
 static void virtio_net_reset(void *vdev);
-static void virtio_net_tx_stop(struct virtio_net *net);
+static void virtio_net_tx_stop(struct virtio_net_qpair *qp);
 static int virtio_net_cfgread(void *vdev, int offset, int size,
 	uint32_t *retval);
 static int virtio_net_cfgwrite(void *vdev, int offset, int size,
@@ -188,7 +245,7 @@ static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	VIRTIO_NET_PAIRQ,		/* one queue pair unless mq is given */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -233,36 +290,68 @@ ether_aton(const char *a, struct ether_addr *e)
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	while (qp->tx_in_progress) {
+		pthread_mutex_unlock(&qp->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	while (qp->rx_in_progress) {
+		pthread_mutex_unlock(&qp->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&qp->rx_mtx);
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
+/*
+ * Attach or detach the tap queue of a queue pair, so that the tap
+ * driver only steers packets to the queue pairs enabled by the guest.
+ */
+static void
+virtio_net_tap_set_queue(struct virtio_net_qpair *qp, bool enable)
+{
+	struct ifreq ifr;
+
+	if (qp->net->nqpairs == 1 || qp->tapfd < 0)
+		return;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = enable ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+	if (ioctl(qp->tapfd, TUNSETQUEUE, (void *)&ifr) < 0)
+		WPRINTF(("vtnet: %s tap queue %d failed: %d\n",
+			enable ? "attach" : "detach", qp->idx, errno));
+}
+
+static void
+virtio_net_set_qpairs(struct virtio_net *net, int qpairs)
+{
+	int i;
+
+	for (i = 1; i < net->nqpairs; i++)
+		if ((i < qpairs) != (i < net->curr_qpairs))
+			virtio_net_tap_set_queue(&net->qpairs[i], i < qpairs);
+
+	net->curr_qpairs = qpairs;
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -272,13 +361,18 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->nqpairs; i++) {
+		virtio_net_txwait(&net->qpairs[i]);
+		virtio_net_rxwait(&net->qpairs[i]);
+		net->qpairs[i].rx_ready = 0;
+	}
 
-	net->rx_ready = 0;
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
 
+	/* only the first queue pair is used until the guest enables more */
+	virtio_net_set_qpairs(net, 1);
+
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
 
@@ -290,29 +384,29 @@ virtio_net_reset(void *vdev)
  * Send signal to tx I/O thread and wait till it exits
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_tx_stop(struct virtio_net_qpair *qp)
 {
 	void *jval;
 
-	pthread_mutex_lock(&net->tx_mtx);
-	net->closing = 1;
-	pthread_cond_broadcast(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->net->closing = 1;
+	pthread_cond_broadcast(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 
-	pthread_join(net->tx_tid, &jval);
+	pthread_join(qp->tx_tid, &jval);
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_qpair *qp, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
 	/*
@@ -325,7 +419,7 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(qp->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
@@ -366,8 +460,9 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 }
 
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_tap_rx(struct virtio_net_qpair *qp)
 {
+	struct virtio_net *net = qp->net;
 	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
 	struct virtio_vq_info *vq;
 	void *vrx;
@@ -378,7 +473,7 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	if (net->tapfd == -1) {
+	if (qp->tapfd == -1) {
 		WPRINTF(("vtnet: tapfd == -1\n"));
 		return;
 	}
@@ -387,11 +482,11 @@ virtio_net_tap_rx(struct virtio_net *net)
 	 * But, will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
+	if (!qp->rx_ready || net->resetting) {
 		/*
 		 * Drop the packet and try later.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		return;
@@ -400,13 +495,13 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
+	vq = &net->queues[qp->idx * VIRTIO_NET_PAIRQ + VIRTIO_NET_RXQ];
 	if (!vq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
 		 * empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		vq_endchains(vq, 1);
@@ -431,7 +526,7 @@ virtio_net_tap_rx(struct virtio_net *net)
 		if (riov == NULL)
 			return;
 
-		len = readv(net->tapfd, riov, n);
+		len = readv(qp->tapfd, riov, n);
 
 		if (len < 0 && errno == EWOULDBLOCK) {
 			/*
@@ -445,11 +540,11 @@ virtio_net_tap_rx(struct virtio_net *net)
 
 		/*
 		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
+		 * number of buffers, if the header has it.
 		 */
 		memset(vrx, 0, net->rx_vhdrlen);
 
-		if (net->rx_merge) {
+		if (net->rx_vhdrlen == sizeof(struct virtio_net_rxhdr)) {
 			struct virtio_net_rxhdr *vrxh;
 
 			vrxh = vrx;
@@ -466,60 +561,189 @@ virtio_net_tap_rx(struct virtio_net *net)
 	vq_endchains(vq, 1);
 }
 
+/*
+ * Receive path for a tap device with IFF_VNET_HDR: the tap fills in the
+ * virtio-net header, so the frames are read straight into the guest
+ * buffers. With merged rx buffers, enough chains for the largest frame
+ * are collected first and the unused ones are handed back after the
+ * read.
+ */
+static void
+virtio_net_tap_rx_vhdr(struct virtio_net_qpair *qp)
+{
+	struct virtio_net *net = qp->net;
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	uint16_t idx[VIRTIO_NET_MAXSEGS];
+	uint32_t iolen[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_rxhdr *vrxh;
+	struct virtio_vq_info *vq;
+	int i, n, niov, nbufs, used, space, len;
+	ssize_t ret;
+
+	if (qp->tapfd == -1) {
+		WPRINTF(("vtnet: tapfd == -1\n"));
+		return;
+	}
+
+	vq = &net->queues[qp->idx * VIRTIO_NET_PAIRQ + VIRTIO_NET_RXQ];
+	if (!qp->rx_ready || net->resetting || !vq_has_descs(vq)) {
+		/*
+		 * Drop the packet and try later.  Interrupt on
+		 * empty, if that's negotiated.
+		 */
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
+		(void)ret; /*avoid compiler warning*/
+
+		if (qp->rx_ready && !net->resetting)
+			vq_endchains(vq, 1);
+		return;
+	}
+
+	do {
+		niov = 0;
+		nbufs = 0;
+		space = 0;
+		do {
+			n = vq_getchain(vq, &idx[nbufs], &iov[niov],
+				VIRTIO_NET_MAXSEGS - niov, NULL);
+			if (n > VIRTIO_NET_MAXSEGS - niov && nbufs > 0) {
+				/* too long to follow the others, it heads the next frame */
+				vq_retchain(vq);
+				break;
+			}
+			if (n < 1 || n > VIRTIO_NET_MAXSEGS - niov) {
+				WPRINTF(("vtnet: virtio_net_tap_rx_vhdr: "
+					"vq_getchain = %d\n", n));
+				/*
+				 * A broken chain is dropped as it is when it
+				 * comes first, the frame is received into the
+				 * chains already taken.
+				 */
+				if (nbufs > 0)
+					break;
+				return;
+			}
+
+			iolen[nbufs] = 0;
+			for (i = niov; i < niov + n; i++)
+				iolen[nbufs] += iov[i].iov_len;
+			space += iolen[nbufs];
+			niov += n;
+			nbufs++;
+		} while (net->rx_merge && niov < VIRTIO_NET_MAXSEGS &&
+			 space < net->rx_vhdrlen + net->rx_maxlen &&
+			 vq_has_descs(vq));
+
+		if (iov[0].iov_len < net->rx_vhdrlen) {
+			WPRINTF(("vtnet: rx header doesn't fit in %lu bytes\n",
+				iov[0].iov_len));
+			len = -1;
+		} else
+			len = readv(qp->tapfd, iov, niov);
+
+		if (len < 0) {
+			/*
+			 * No more packets, but still some avail ring
+			 * entries.  Interrupt if needed/appropriate.
+			 */
+			for (i = 0; i < nbufs; i++)
+				vq_retchain(vq);
+			vq_endchains(vq, 0);
+			return;
+		}
+
+		/* trim the lengths to the frame and return unused chains */
+		for (used = 0; used < nbufs && len > 0; used++) {
+			if (iolen[used] > len)
+				iolen[used] = len;
+			len -= iolen[used];
+		}
+		for (i = used; i < nbufs; i++)
+			vq_retchain(vq);
+
+		if (net->rx_vhdrlen == sizeof(struct virtio_net_rxhdr)) {
+			vrxh = iov[0].iov_base;
+			vrxh->vrh_bufs = used;
+		}
+
+		vq_relchains(vq, idx, iolen, used);
+	} while (vq_has_descs(vq));
+
+	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+	vq_endchains(vq, 1);
+}
+
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qpair *qp = param;
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	qp->net->virtio_net_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 
 }
 
+static inline struct virtio_net_qpair *
+virtio_net_vq_to_qpair(struct virtio_net *net, struct virtio_vq_info *vq)
+{
+	return &net->qpairs[(vq - net->queues) / VIRTIO_NET_PAIRQ];
+}
+
 static void
 virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 {
-	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = virtio_net_vq_to_qpair(vdev, vq);
 
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
+	if (qp->rx_ready == 0) {
+		qp->rx_ready = 1;
 		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 	}
 }
 
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
+	struct iovec iov[VIRTIO_NET_MAXSEGS + 1], *riov;
 	int i, n;
 	int plen, tlen;
 	uint16_t idx;
 
 	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
-	 * up two lengths: packet length and transfer length.
+	 * Obtain chain of descriptors.  The chain starts with the
+	 * header, so we need to sum up two lengths: packet length
+	 * and transfer length.
 	 */
 	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
 	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
 		WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
 		return;
 	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
+	tlen = 0;
+	for (i = 0; i < n; i++)
 		tlen += iov[i].iov_len;
-	}
+	plen = tlen - qp->net->rx_vhdrlen;
 
 	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	/*
+	 * The tap consumes the header itself if IFF_VNET_HDR is set.
+	 * Otherwise skip it: a VERSION_1 driver may put the header and
+	 * the packet in the same descriptor.
+	 */
+	if (plen < 0)
+		WPRINTF(("vtnet: tx chain of %d bytes, dropped\n", tlen));
+	else if (qp->net->tap_vnet_hdr)
+		qp->net->virtio_net_tx(qp, iov, n, plen);
+	else {
+		riov = rx_iov_trim(iov, &n, qp->net->rx_vhdrlen);
+		if (riov != NULL)
+			qp->net->virtio_net_tx(qp, riov, n, plen);
+	}
 
 	/* chain is processed, release it and set tlen */
 	vq_relchain(vq, idx, tlen);
@@ -528,7 +752,7 @@ virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
 static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
-	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = virtio_net_vq_to_qpair(vdev, vq);
 
 	/*
 	 * Any ring entries to process?
@@ -537,40 +761,42 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
- * Thread which will handle processing of TX desc
+ * Thread which will handle processing of TX desc of one queue pair
  */
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
-	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ];
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq =
+		&net->queues[qp->idx * VIRTIO_NET_PAIRQ + VIRTIO_NET_TXQ];
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 
 	while (!net->closing && !vq_ring_ready(vq))
-		pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+		pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
 	for (;;) {
 		/* note - tx mutex is locked here */
-		net->tx_in_progress = 0;
+		qp->tx_in_progress = 0;
 
 		/*
 		 * Checking the avail ring here serves two purposes:
@@ -584,18 +810,18 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 
 		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
 		do {
 			/*
@@ -603,7 +829,7 @@ virtio_net_tx_thread(void *param)
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			virtio_net_proctx(qp, vq);
 		} while (vq_has_descs(vq));
 
 		/*
@@ -611,17 +837,82 @@ virtio_net_tx_thread(void *param)
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
 }
 
-#ifdef notyet
+static uint8_t
+virtio_net_ctrl_mq(struct virtio_net *net, uint8_t cmd, uint8_t *data,
+		   int len)
+{
+	uint16_t qpairs;
+
+	if (cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET || len < sizeof(qpairs))
+		return VIRTIO_NET_ERR;
+
+	memcpy(&qpairs, data, sizeof(qpairs));
+	if (qpairs < 1 || qpairs > net->nqpairs) {
+		WPRINTF(("vtnet: invalid queue pairs %d\n", qpairs));
+		return VIRTIO_NET_ERR;
+	}
+
+	DPRINTF(("vtnet: %d queue pairs enabled\n\r", qpairs));
+	virtio_net_set_qpairs(net, qpairs);
+	return VIRTIO_NET_OK;
+}
+
+/*
+ * Control queue requests are made up of the readable class/command
+ * header and command data, followed by one writable ack byte.
+ */
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct iovec iov[VIRTIO_NET_CTRL_MAXSEGS];
+	uint16_t idx, flags[VIRTIO_NET_CTRL_MAXSEGS];
+	struct virtio_net_ctrl_hdr *hdr;
+	uint8_t cmd[16], *ack;
+	int i, n, len, cp;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_CTRL_MAXSEGS, flags);
+		if (n < 2 || n > VIRTIO_NET_CTRL_MAXSEGS) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: vq_getchain = %d\n",
+				n));
+			return;
+		}
+
+		len = 0;
+		for (i = 0; i < n - 1 && len < sizeof(cmd); i++) {
+			cp = iov[i].iov_len;
+			if (cp > sizeof(cmd) - len)
+				cp = sizeof(cmd) - len;
+			memcpy(&cmd[len], iov[i].iov_base, cp);
+			len += cp;
+		}
+
+		ack = iov[n - 1].iov_base;
+		if (iov[n - 1].iov_len < 1 ||
+		    (flags[n - 1] & VRING_DESC_F_WRITE) == 0 ||
+		    len < sizeof(*hdr)) {
+			WPRINTF(("vtnet: malformed control request\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		hdr = (struct virtio_net_ctrl_hdr *)cmd;
+		if (hdr->class == VIRTIO_NET_CTRL_MQ)
+			*ack = virtio_net_ctrl_mq(net, hdr->cmd,
+				&cmd[sizeof(*hdr)], len - sizeof(*hdr));
+		else
+			*ack = VIRTIO_NET_ERR;
+
+		vq_relchain(vq, idx, sizeof(*ack));
+	}
+
+	vq_endchains(vq, 1);
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -649,7 +940,7 @@ virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
 }
 
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, int flags)
 {
 	int tunfd, rc;
 	struct ifreq ifr;
@@ -662,7 +953,7 @@ virtio_net_tap_open(char *devname)
 	}
 
 	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | flags;
 
 	if (*devname) {
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -681,12 +972,92 @@ virtio_net_tap_open(char *devname)
 	return tunfd;
 }
 
+/*
+ * Set up the virtqueues of nqpairs queue pairs, plus the control queue
+ * if multiple queue pairs are offered to the guest.
+ */
+static void
+virtio_net_setup_queues(struct virtio_net *net, int nqpairs)
+{
+	struct virtio_vq_info *vq;
+	int i;
+
+	for (i = 0; i < nqpairs; i++) {
+		vq = &net->queues[i * VIRTIO_NET_PAIRQ];
+		vq[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
+		vq[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
+		vq[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
+		vq[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
+	}
+
+	net->nqpairs = nqpairs;
+	net->curr_qpairs = 1;
+	if (net->base.device_caps & VIRTIO_NET_F_MQ) {
+		vq = &net->queues[nqpairs * VIRTIO_NET_PAIRQ];
+		vq->qsize = VIRTIO_NET_CTRL_RINGSZ;
+		vq->notify = virtio_net_ping_ctlq;
+		net->ops.nvq = nqpairs * VIRTIO_NET_PAIRQ + 1;
+		net->config.max_virtqueue_pairs = nqpairs;
+	} else
+		net->ops.nvq = VIRTIO_NET_PAIRQ;
+}
+
+/*
+ * Offer the checksum and segmentation offloads if the tap device
+ * supports them. The tap offloads and header size are per device,
+ * so they are set through the first queue.
+ */
+static void
+virtio_net_tap_probe_offload(struct virtio_net *net)
+{
+	int tapfd = net->qpairs[0].tapfd;
+
+	net->tap_vnet_hdr = true;
+	net->virtio_net_rx = virtio_net_tap_rx_vhdr;
+
+	if (ioctl(tapfd, TUNSETOFFLOAD,
+		  TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) < 0) {
+		WPRINTF(("tap device offloads not supported\n"));
+		return;
+	}
+
+	ioctl(tapfd, TUNSETOFFLOAD, 0);
+	net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+}
+
+/*
+ * Apply the negotiated offloads and header size to the tap device
+ */
+static void
+virtio_net_tap_set_offload(struct virtio_net *net)
+{
+	int tapfd = net->qpairs[0].tapfd;
+	unsigned int offload = 0;
+	int hdrlen = net->rx_vhdrlen;
+
+	if (net->features & VIRTIO_NET_F_GUEST_CSUM)
+		offload |= TUN_F_CSUM;
+	if (net->features & VIRTIO_NET_F_GUEST_TSO4)
+		offload |= TUN_F_TSO4;
+	if (net->features & VIRTIO_NET_F_GUEST_TSO6)
+		offload |= TUN_F_TSO6;
+
+	if (ioctl(tapfd, TUNSETVNETHDRSZ, &hdrlen) < 0)
+		WPRINTF(("tap device set header size failed: %d\n", errno));
+	if (ioctl(tapfd, TUNSETOFFLOAD, offload) < 0)
+		WPRINTF(("tap device set offload failed: %d\n", errno));
+
+	net->rx_maxlen = (offload & (TUN_F_TSO4 | TUN_F_TSO6)) ?
+		VIRTIO_NET_RX_MAXLEN_GSO : VIRTIO_NET_RX_MAXLEN;
+}
+
 static void
 virtio_net_tap_setup(struct virtio_net *net, char *devname)
 {
 	char tbuf[IFNAMSIZ];
-	int vhost_fd = -1;
-	int rc;
+	struct virtio_net_qpair *qp;
+	int vhost_fd;
+	int i, rc, opt, flags;
 
 	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
 	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
@@ -695,53 +1066,121 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	net->virtio_net_rx = virtio_net_tap_rx;
 	net->virtio_net_tx = virtio_net_tap_tx;
 
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
-		WPRINTF(("open of tap device %s failed\n", tbuf));
-		return;
-	}
-	DPRINTF(("open of tap device %s success!\n", tbuf));
+	/*
+	 * vhost-net provides the virtio-net header itself, otherwise
+	 * let the tap device handle it to get the offloads.
+	 */
+	flags = net->use_vhost ? 0 : IFF_VNET_HDR;
+	if (net->nqpairs > 1)
+		flags |= IFF_MULTI_QUEUE;
 
 	/*
-	 * Set non-blocking and register for read
-	 * notifications with the event loop
+	 * Open one queue of the tap device per queue pair, the tap
+	 * name picked by the first open is reused by the others.
 	 */
-	int opt = 1;
+	for (i = 0; i < net->nqpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->tapfd = virtio_net_tap_open(tbuf, flags);
+		if (qp->tapfd == -1) {
+			WPRINTF(("open of tap device %s queue %d failed\n",
+				tbuf, i));
+			break;
+		}
+		DPRINTF(("open of tap device %s queue %d success!\n", tbuf, i));
 
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
-		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
+		/*
+		 * Set non-blocking and register for read
+		 * notifications with the event loop
+		 */
+		opt = 1;
+		if (ioctl(qp->tapfd, FIONBIO, &opt) < 0) {
+			WPRINTF(("tap device O_NONBLOCK failed\n"));
+			close(qp->tapfd);
+			qp->tapfd = -1;
+			break;
+		}
 	}
 
+	if (i == 0)
+		return;
+
+	if (i < net->nqpairs) {
+		WPRINTF(("vtnet: fall back to %d queue pairs\n", i));
+		virtio_net_setup_queues(net, i);
+	}
+
+	if (flags & IFF_VNET_HDR)
+		virtio_net_tap_probe_offload(net);
+
+	/* only the first queue pair is used until the guest enables more */
+	for (i = 1; i < net->nqpairs; i++)
+		virtio_net_tap_set_queue(&net->qpairs[i], false);
+
 	if (net->use_vhost) {
-		vhost_fd = open("/dev/vhost-net", O_RDWR);
-		if (vhost_fd < 0)
-			WPRINTF(("open of vhost-net failed\n"));
-		else {
-			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
-			if (!net->vhost_net) {
-				WPRINTF(("vhost_net_init failed, fallback "
-					"to userspace virtio\n"));
+		for (i = 0; i < net->nqpairs; i++) {
+			qp = &net->qpairs[i];
+			vhost_fd = open("/dev/vhost-net", O_RDWR);
+			if (vhost_fd < 0) {
+				WPRINTF(("open of vhost-net failed\n"));
+				break;
+			}
+
+			qp->vhost_net = vhost_net_init(&net->base, vhost_fd,
+				qp->tapfd, i * VIRTIO_NET_PAIRQ);
+			if (!qp->vhost_net) {
+				WPRINTF(("vhost_net_init failed\n"));
 				close(vhost_fd);
-				vhost_fd = -1;
+				break;
+			}
+		}
+
+		if (i < net->nqpairs) {
+			WPRINTF(("vhost_net setup failed, fallback "
+				"to userspace virtio\n"));
+			while (--i >= 0) {
+				qp = &net->qpairs[i];
+				vhost_net_deinit(qp->vhost_net);
+				free(qp->vhost_net);
+				qp->vhost_net = NULL;
 			}
 		}
 	}
 
-	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
-				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
+	if (net->qpairs[0].vhost_net)
+		return;
+
+	for (i = 0; i < net->nqpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->mevp = mevent_add_class(qp->tapfd, EVF_READ,
+				      virtio_net_rx_callback, qp,
+				      virtio_net_teardown, qp, MEVENT_CLASS_NET);
+		if (qp->mevp == NULL) {
 			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
-		}
+			close(qp->tapfd);
+			qp->tapfd = -1;
+		} else
+			net->nr_mevents++;
 	}
 }
 
+/*
+ * Parse the number of queue pairs from "mq=<n>"
+ */
+static int
+virtio_net_parse_mq(char *opt, int *nqpairs)
+{
+	char *cp = opt + strlen("mq=");
+
+	if (dm_strtoi(cp, &cp, 10, nqpairs) || *cp != '\0' ||
+	    *nqpairs < 1 || *nqpairs > VIRTIO_NET_MAX_QPAIRS) {
+		pr_err("Invalid queue pairs %s, range is [1, %d]\n", opt,
+			VIRTIO_NET_MAX_QPAIRS);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
 virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -754,8 +1193,10 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *vtopts;
 	char *opt;
 	int mac_provided;
+	int nqpairs = 1;
 	pthread_mutexattr_t attr;
-	int rc;
+	struct virtio_net_qpair *qp;
+	int i, rc;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -781,7 +1222,6 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 * Read the MAC address if specified
 	 */
 	mac_provided = 0;
-	net->vhost_net = NULL;
 	if (opts != NULL) {
 		int err;
 
@@ -797,7 +1237,15 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
 				net->use_vhost = true;
-			else {
+			else if (strcmp("modern", opt) == 0)
+				net->modern = true;
+			else if (strncmp("mq=", opt, 3) == 0) {
+				if (virtio_net_parse_mq(opt, &nqpairs) != 0) {
+					free(devname);
+					free(net);
+					return -1;
+				}
+			} else {
 				err = virtio_net_parsemac(opt,
 					net->config.mac);
 				if (err != 0) {
@@ -810,24 +1258,26 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		}
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
+	/* the number of virtqueues depends on the queue pairs */
+	net->ops = virtio_net_ops;
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
 	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
+	if (nqpairs > 1)
+		net->base.device_caps |= VIRTIO_NET_F_MQ | VIRTIO_NET_F_CTRL_VQ;
 
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+	virtio_net_setup_queues(net, nqpairs);
 
 	/*
 	 * Attempt to open the tap device
 	 */
-	net->tapfd = -1;
+	for (i = 0; i < VIRTIO_NET_MAX_QPAIRS; i++) {
+		qp = &net->qpairs[i];
+		qp->net = net;
+		qp->idx = i;
+		qp->tapfd = -1;
+	}
 
 	if (!devname) {
 		WPRINTF(("virtio_net: devname NULL\n"));
@@ -872,7 +1322,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	net->config.status = (opts == NULL || net->qpairs[0].tapfd >= 0);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -884,27 +1334,47 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	/* use BAR 0 to map config regs in IO space */
 	virtio_set_io_bar(&net->base, 0);
 
+	/*
+	 * With "modern", the userspace backend is a transitional device: a
+	 * virtio 1.0 driver finds the modern BARs and can negotiate the
+	 * packed ring. vhost-net stays legacy, it only knows the split ring.
+	 */
+	if (net->modern && net->use_vhost)
+		WPRINTF(("vtnet: modern is ignored with vhost\n"));
+	else if (net->modern) {
+		net->base.device_caps |= 1UL << VIRTIO_F_VERSION_1;
+		if (virtio_set_modern_bar(&net->base, true)) {
+			WPRINTF(("vtnet: failed to set the modern BARs\n"));
+			free(net);
+			return -1;
+		}
+	}
+
 	net->resetting = 0;
 	net->closing = 0;
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
+	net->rx_maxlen = VIRTIO_NET_RX_MAXLEN;
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Initialize tx semaphore & spawn one TX processing thread
+	 * per queue pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->nqpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->rx_in_progress = 0;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+
+		qp->tx_in_progress = 0;
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+		pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)qp);
+		snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d", dev->slot,
+			 dev->func, i);
+		pthread_setname_np(qp->tx_tid, tname);
+	}
 
 	return 0;
 }
@@ -951,79 +1421,116 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 
 	net->features = negotiated_features;
 
-	if (!(net->features & VIRTIO_NET_F_MRG_RXBUF)) {
-		net->rx_merge = 0;
-		/* non-merge rx header is 2 bytes shorter */
+	/*
+	 * The header has the number of buffers with merged rx bufs or
+	 * VERSION_1, it is 2 bytes shorter otherwise. A modern driver
+	 * writes the features in two halves, so start over each time.
+	 */
+	net->rx_merge = !!(net->features & VIRTIO_NET_F_MRG_RXBUF);
+	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	if (!net->rx_merge &&
+	    !(net->features & (1UL << VIRTIO_F_VERSION_1)))
 		net->rx_vhdrlen -= 2;
-	}
+
+	if (net->tap_vnet_hdr)
+		virtio_net_tap_set_offload(net);
 }
 
 static void
 virtio_net_set_status(void *vdev, uint64_t status)
 {
 	struct virtio_net *net = vdev;
-	int rc;
+	struct virtio_net_qpair *qp;
+	int i, rc;
 
-	if (!net->vhost_net)
+	if (!net->qpairs[0].vhost_net)
 		return;
 
-	if (!net->vhost_net->vhost_started &&
+	if (!net->qpairs[0].vhost_net->vhost_started &&
 		(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
-
-		rc = vhost_net_start(net->vhost_net);
-		if (rc < 0) {
-			WPRINTF(("vhost_net_start failed\n"));
-			return;
+		for (i = 0; i < net->nqpairs; i++) {
+			qp = &net->qpairs[i];
+			if (qp->mevp)
+				mevent_disable(qp->mevp);
+
+			rc = vhost_net_start(qp->vhost_net);
+			if (rc < 0) {
+				WPRINTF(("vhost_net_start failed\n"));
+				return;
+			}
 		}
-	} else if (net->vhost_net->vhost_started &&
+	} else if (net->qpairs[0].vhost_net->vhost_started &&
 		((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
-		rc = vhost_net_stop(net->vhost_net);
-		if (rc < 0)
-			WPRINTF(("vhost_net_stop failed\n"));
+		for (i = 0; i < net->nqpairs; i++) {
+			rc = vhost_net_stop(net->qpairs[i].vhost_net);
+			if (rc < 0)
+				WPRINTF(("vhost_net_stop failed\n"));
+		}
 	}
 }
 
+/*
+ * Called by the event loop for each deleted rx event, the device is
+ * freed together with the last one.
+ */
 static void
 virtio_net_teardown(void *param)
 {
-	struct virtio_net *net;
+	struct virtio_net_qpair *qp;
 
-	net = (struct virtio_net *)param;
-	if (!net)
+	qp = (struct virtio_net_qpair *)param;
+	if (!qp)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
+	if (qp->tapfd >= 0) {
+		close(qp->tapfd);
+		qp->tapfd = -1;
 	} else
-		pr_err("net->tapfd is -1!\n");
+		pr_err("qp->tapfd is -1!\n");
 
-	free(net);
+	if (__sync_sub_and_fetch(&qp->net->nr_mevents, 1) == 0)
+		free(qp->net);
 }
 
 static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	struct virtio_net_qpair *qp;
+	struct mevent *mevps[VIRTIO_NET_MAX_QPAIRS];
+	int i, nr_mevents = 0;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
 
-		virtio_net_tx_stop(net);
+		for (i = 0; i < net->nqpairs; i++)
+			virtio_net_tx_stop(&net->qpairs[i]);
 
-		if (net->vhost_net) {
-			vhost_net_stop(net->vhost_net);
-			vhost_net_deinit(net->vhost_net);
-			free(net->vhost_net);
-			net->vhost_net = NULL;
+		for (i = 0; i < net->nqpairs; i++) {
+			qp = &net->qpairs[i];
+			if (qp->vhost_net) {
+				vhost_net_stop(qp->vhost_net);
+				vhost_net_deinit(qp->vhost_net);
+				free(qp->vhost_net);
+				qp->vhost_net = NULL;
+			}
+
+			if (qp->mevp != NULL)
+				mevps[nr_mevents++] = qp->mevp;
+			else if (qp->tapfd >= 0) {
+				close(qp->tapfd);
+				qp->tapfd = -1;
+			}
 		}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
-		else
-			virtio_net_teardown(net);
+		/*
+		 * The last teardown callback frees net, so don't touch it
+		 * once the rx events are being deleted.
+		 */
+		if (nr_mevents == 0)
+			free(net);
+		for (i = 0; i < nr_mevents; i++)
+			mevent_delete(mevps[i]);
 
 		DPRINTF(("%s: done\n", __func__));
 	} else
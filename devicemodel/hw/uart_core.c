@@ -677,8 +677,8 @@ uart_sock_accept(int fd __attribute__((unused)),
 
 	uart->be.opened = true;
 	uart->be.fd2 = s;
-	uart->be.evp2 = mevent_add(s, EVF_READ, uart_drain, uart,
-		uart_mevent_teardown, uart);
+	uart->be.evp2 = mevent_add_class(s, EVF_READ, uart_drain, uart,
+		uart_mevent_teardown, uart, MEVENT_CLASS_CONSOLE);
 	if (!uart->be.evp2)
 		WPRINTF(("uart: mevent_add evp2 failed\n"));
 	DPRINTF(("uart: %s\r\n", __func__));
@@ -915,8 +915,9 @@ uart_config_backend(struct uart_vdev *uart, struct uart_backend *be, long port)
 		 * cannot be used on a regular file.
 		 */
 		if (isatty(fd)) {
-			be->evp = mevent_add(fd, EVF_READ, uart_drain, uart,
-				uart_mevent_teardown, uart);
+			be->evp = mevent_add_class(fd, EVF_READ, uart_drain,
+				uart, uart_mevent_teardown, uart,
+				MEVENT_CLASS_CONSOLE);
 			if (!be->evp) {
 				WPRINTF(("uart: mevent_add failed\n"));
 				return -1;
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/**
+ * @file block_cow.h
+ *
+ * @brief Copy-on-write qcow2 image backend of block_if
+ */
+
+#ifndef _BLOCK_COW_H_
+#define _BLOCK_COW_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct blockcow;
+
+/**
+ * @brief Open the qcow2 image of fd and its chain of backing files.
+ *
+ * @param fd File descriptor of the image, still owned by the caller.
+ * @param path Path of the image, to resolve relative backing file names.
+ * @param ro Non-zero to open the image read-only.
+ *
+ * @return Pointer to the image on success, NULL on failure.
+ */
+struct blockcow *blockcow_open(int fd, const char *path, int ro);
+
+/**
+ * @brief Take another reference on the image, e.g. for blockif_dup().
+ */
+struct blockcow *blockcow_get(struct blockcow *bcow);
+
+/**
+ * @brief Drop a reference on the image, it is released with the last one.
+ */
+void blockcow_close(struct blockcow *bcow);
+
+/**
+ * @brief Virtual size of the image in bytes.
+ */
+off_t blockcow_size(struct blockcow *bcow);
+
+/**
+ * @brief Whether the image can only be opened read-only.
+ */
+int blockcow_is_ro(struct blockcow *bcow);
+
+/**
+ * @brief Read from the virtual disk, as preadv().
+ *
+ * Unallocated clusters are read from the backing file, or as zeros if
+ * there is none.
+ *
+ * @return Number of bytes read, or -1 with errno set.
+ */
+ssize_t blockcow_preadv(struct blockcow *bcow, const struct iovec *iov,
+		int iovcnt, off_t offset);
+
+/**
+ * @brief Write to the virtual disk, as pwritev().
+ *
+ * Clusters which are not allocated in the image yet are allocated at the
+ * end of the file and filled from the backing file first.
+ *
+ * @return Number of bytes written, or -1 with errno set.
+ */
+ssize_t blockcow_pwritev(struct blockcow *bcow, const struct iovec *iov,
+		int iovcnt, off_t offset);
+
+#endif /* _BLOCK_COW_H_ */
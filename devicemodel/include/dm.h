@@ -49,6 +49,9 @@ extern char *mac_seed;
 extern bool lapic_pt;
 extern bool is_rtvm;
 extern bool is_winvm;
+extern bool ioreq_dispatch_enabled;
+extern bool virtio_eventfd_enabled;
+extern bool hyperv_vendor_id;
 
 int vmexit_task_switch(struct vmctx *ctx, struct vhm_request *vhm_req,
 		       int *vcpu);
@@ -51,6 +51,7 @@ struct inout_port {
 #define	IOPORT_F_IN		0x1
 #define	IOPORT_F_OUT		0x2
 #define	IOPORT_F_INOUT		(IOPORT_F_IN | IOPORT_F_OUT)
+#define	IOPORT_F_MT_SAFE	0x4	/* handler does its own serialization */
 
 /*
  * The following flags are used internally and must not be used by
@@ -47,6 +47,7 @@ struct mem_range {
 #define	MEM_F_WRITE		0x2
 #define	MEM_F_RW		(MEM_F_READ | MEM_F_WRITE)
 #define	MEM_F_IMMUTABLE		0x4	/* mem_range cannot be unregistered */
+#define	MEM_F_MT_SAFE		0x8	/* handler does its own serialization */
 
 int	emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req);
 int	register_mem(struct mem_range *memp);
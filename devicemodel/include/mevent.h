@@ -29,6 +29,8 @@
 #ifndef	_MEVENT_H_
 #define	_MEVENT_H_
 
+#include <stdint.h>
+
 enum ev_type {
 	EVF_READ,
 	EVF_WRITE,
@@ -38,16 +40,50 @@ enum ev_type {
 	EVF_SIGNAL		/* Not supported yet */
 };
 
+/*
+ * Classes of events which are pinned to a dedicated dispatch loop with
+ * "--mevent_loops"; the class picks loop (class % number of loops).
+ */
+enum mevent_class {
+	MEVENT_CLASS_DEFAULT,
+	MEVENT_CLASS_NET,
+	MEVENT_CLASS_TIMER,
+	MEVENT_CLASS_CONSOLE,
+	MEVENT_CLASS_VIRTIO,
+	MEVENT_CLASS_MAX
+};
+
+#define	MEVENT_MAX_LOOPS	MEVENT_CLASS_MAX
+#define	MEVENT_HIST_BUCKETS	8
+
+/* per dispatch loop counters, the times are in ns */
+struct mevent_stats {
+	char		name[16];
+	uint64_t	wakeups;	/* returns from epoll_wait */
+	uint64_t	events;		/* handled events */
+	uint64_t	lat_total_ns;	/* wait behind the other handlers */
+	uint64_t	lat_max_ns;
+	uint64_t	run_total_ns;	/* handler run time */
+	uint64_t	run_max_ns;
+	uint64_t	lat_hist[MEVENT_HIST_BUCKETS];	/* <1us, <4us, ... */
+};
+
 struct mevent;
 
 struct mevent *mevent_add(int fd, enum ev_type type,
 			  void (*run)(int, enum ev_type, void *), void *param,
 			  void (*teardown)(void *), void *teardown_param);
+struct mevent *mevent_add_class(int fd, enum ev_type type,
+			  void (*run)(int, enum ev_type, void *), void *param,
+			  void (*teardown)(void *), void *teardown_param,
+			  enum mevent_class cls);
 int	mevent_enable(struct mevent *evp);
 int	mevent_disable(struct mevent *evp);
 int	mevent_delete(struct mevent *evp);
 int	mevent_delete_close(struct mevent *evp);
 int	mevent_notify(void);
+int	mevent_set_loops(int nr_loops);
+int	mevent_get_stats(int idx, struct mevent_stats *st);
 
 void	mevent_dispatch(void);
 int	mevent_init(void);
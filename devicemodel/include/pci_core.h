@@ -175,6 +175,7 @@ struct pci_vdev {
 	} msix;
 
 	void	*arg;		/* devemu-private data */
+	pthread_mutex_t	emul_lock;	/* serializes emulation with ioreq dispatch */
 
 	uint8_t	cfgdata[PCI_REGMAX + 1];
 	struct pcibar bar[PCI_BARMAX + 1];
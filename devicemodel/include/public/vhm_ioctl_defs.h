@@ -81,6 +81,7 @@
 #define IC_INJECT_MSI                  _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x03)
 #define IC_VM_INTR_MONITOR             _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x04)
 #define IC_SET_IRQLINE                 _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x05)
+#define IC_INJECT_MSI_BATCH            _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x06)
 
 /* DM ioreq management */
 #define IC_ID_IOREQ_BASE                0x30UL
@@ -118,6 +119,11 @@
 #define IC_EVENT_IOEVENTFD		_IC_ID(IC_ID, IC_ID_EVENT_BASE + 0x00)
 #define IC_EVENT_IRQFD			_IC_ID(IC_ID, IC_ID_EVENT_BASE + 0x01)
 
+/* Debug */
+#define IC_ID_DBG_BASE			0x80UL
+#define IC_GET_VMEXIT_STATS		_IC_ID(IC_ID, IC_ID_DBG_BASE + 0x00)
+#define IC_GET_EPT_STATS		_IC_ID(IC_ID, IC_ID_DBG_BASE + 0x01)
+
 /**
  * @brief EPT memory mapping info for guest
  */
@@ -129,10 +129,13 @@
 #include <linux/virtio_ring.h>
 #include <linux/virtio_config.h>
 #include <linux/virtio_pci.h>
+#include <sys/queue.h>
 
 #include "types.h"
 #include "timer.h"
 
+struct mevent;
+
 /**
  * @brief virtio API
  *
@@ -361,6 +364,11 @@ struct virtio_base {
 	int backend_type;               /**< VBSU, VBSK or VHOST */
 	struct acrn_timer polling_timer; /**< timer for polling mode */
 	int polling_in_progress;        /**< The polling status */
+	uint64_t poll_win_start;	/**< start of the adaptive poll window, ns */
+	bool poll_listed;		/**< on the list of polled devices */
+	LIST_ENTRY(virtio_base) poll_link;
+	bool eventfd_listed;		/**< on the list of devices with eventfds */
+	LIST_ENTRY(virtio_base) eventfd_link;
 };
 
 #define	VIRTIO_BASE_LOCK(vb)					\
@@ -396,8 +404,22 @@ struct virtio_ops {
 				/**< called to set device status */
 };
 
+/**
+ * @brief Counters of the adaptive poll mode of a virtqueue
+ */
+struct virtio_vq_stats {
+	uint64_t kicks;		/**< notifications from the guest */
+	uint64_t kicks_avoided;	/**< requests found by polling */
+	uint64_t poll_hits;	/**< polls which found new requests */
+	uint64_t poll_misses;	/**< polls which found nothing */
+	uint64_t poll_enter;	/**< switches to poll mode */
+	uint64_t poll_exit;	/**< switches back to notify mode */
+};
+
 #define	VQ_ALLOC	0x01	/* set once we have a pfn */
 #define	VQ_BROKED	0x02	/* ??? */
+#define	VQ_KICKFD	0x04	/* kicks come from kick_fd */
+#define	VQ_CALLFD	0x08	/* interrupts go to call_fd */
 /**
  * @brief Virtqueue data structure
  *
@@ -444,6 +466,40 @@ struct virtio_vq_info {
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	bool polling;		/**< kicks suppressed, the queue is polled */
+	uint16_t poll_avail;	/**< avail->idx seen by the last poll */
+	uint32_t win_kicks;	/**< kicks in the current poll window */
+	uint32_t win_reqs;	/**< requests polled in the current window */
+	struct virtio_vq_stats stats;	/**< adaptive poll counters */
+
+	int kick_fd;		/**< ioeventfd of the queue notify */
+	int call_fd;		/**< irqfd of the MSI-X vector */
+	struct mevent *kick_mevp;
+				/**< mevent of kick_fd */
+	uint64_t kick_addr;	/**< notify address bound to kick_fd */
+	uint64_t call_addr;	/**< MSI address bound to call_fd */
+	uint32_t call_data;	/**< MSI data bound to call_fd */
+
+	/*
+	 * Packed ring (VIRTIO_F_RING_PACKED): last_avail is the position
+	 * of the next descriptor to read, and used points to used_shadow,
+	 * which carries VRING_USED_F_NO_NOTIFY of the backends to the
+	 * device event suppression area.
+	 */
+	bool packed;		/**< the ring is packed */
+	bool avail_wrap;	/**< wrap counter of last_avail */
+	bool used_wrap;		/**< wrap counter of used_pos */
+	uint16_t used_pos;	/**< position of the next used descriptor */
+	uint16_t used_cnt;	/**< descriptors used, mod 2**16 */
+	uint16_t *chain_len;	/**< descriptors of each buffer id */
+	uint32_t used_shadow;	/**< "used" header of a packed ring */
+	volatile struct vring_packed_desc *pdesc;
+				/**< the packed descriptor ring */
+	volatile struct vring_packed_desc_event *driver_event;
+				/**< driver event suppression */
+	volatile struct vring_packed_desc_event *device_event;
+				/**< device event suppression */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -452,6 +508,15 @@ struct virtio_vq_info {
 #define VQ_USED_EVENT_IDX(vq) \
 	((vq)->avail->ring[(vq)->qsize])
 
+/**
+ * @brief Are there "available" descriptors in the packed ring?
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return true if at least 1 descriptor is available.
+ */
+bool vq_packed_has_descs(struct virtio_vq_info *vq);
+
 /**
  * @brief Is this ring ready for I/O?
  *
@@ -477,10 +542,24 @@ vq_ring_ready(struct virtio_vq_info *vq)
 static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
+	if (vq->packed)
+		return vq_packed_has_descs(vq);
+
 	return (vq_ring_ready(vq) && vq->last_avail !=
 	    vq->avail->idx);
 }
 
+/**
+ * @brief Deliver the MSI-X interrupt of a virtqueue through its irqfd.
+ *
+ * @param vb Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return 0 on success, -1 if the interrupt must be generated by
+ * pci_generate_msix(), e.g. the vector is masked.
+ */
+int vq_irqfd_signal(struct virtio_base *vb, struct virtio_vq_info *vq);
+
 /**
  * @brief Deliver an interrupt to guest on the given virtqueue.
  *
@@ -494,9 +573,10 @@ vq_has_descs(struct virtio_vq_info *vq)
 static inline void
 vq_interrupt(struct virtio_base *vb, struct virtio_vq_info *vq)
 {
-	if (pci_msix_enabled(vb->dev))
-		pci_generate_msix(vb->dev, vq->msix_idx);
-	else {
+	if (pci_msix_enabled(vb->dev)) {
+		if (!(vq->flags & VQ_CALLFD) || vq_irqfd_signal(vb, vq) != 0)
+			pci_generate_msix(vb->dev, vq->msix_idx);
+	} else {
 		VIRTIO_BASE_LOCK(vb);
 		vb->isr |= VIRTIO_PCI_ISR_QUEUES;
 		pci_generate_msi(vb->dev, 0);
@@ -562,6 +642,42 @@ void virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
  */
 int acrn_parse_virtio_poll_interval(const char *optarg);
 
+/**
+ * @brief Poll mode counters of a virtqueue, reported by the monitor
+ */
+struct virtio_vq_stats_info {
+	char name[16];		/**< name of the virtio device */
+	uint8_t slot;		/**< PCI slot of the device */
+	uint16_t queue;		/**< index of the queue in the device */
+	bool polling;		/**< the queue is polled now */
+	struct virtio_vq_stats stats;
+};
+
+/**
+ * @brief Get the poll mode counters of the idx'th virtqueue
+ *
+ * The ready virtqueues of the devices in poll mode are numbered from 0.
+ *
+ * @param idx Index of the virtqueue.
+ * @param info Pointer to the counters returned.
+ *
+ * @return 0 on success and -1 if there is no such virtqueue.
+ */
+int virtio_get_vq_stats(int idx, struct virtio_vq_stats_info *info);
+
+/**
+ * @brief Stop the poll mode and unbind the eventfds of a device being
+ * removed.
+ *
+ * Called by the PCI core before the deinit of every device, which may
+ * not be a virtio device.
+ *
+ * @param dev Pointer to struct pci_vdev being removed.
+ *
+ * @return None
+ */
+void virtio_release_dev(struct pci_vdev *dev);
+
 /**
  * @brief Initialize MSI-X vector capabilities if we're to use MSI-X,
  * or MSI capabilities if not.
@@ -655,6 +771,22 @@ void vq_retchain(struct virtio_vq_info *vq);
  */
 void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
 
+/**
+ * @brief Return several request chains to the guest at once,
+ * setting their I/O lengths to the provided values.
+ *
+ * The used index is updated once all the chains are returned.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param idx Array of available ring positions, returned by vq_getchain().
+ * @param iolen Array of data bytes to be returned to frontend.
+ * @param n Number of chains.
+ *
+ * @return None
+ */
+void vq_relchains(struct virtio_vq_info *vq, uint16_t *idx, uint32_t *iolen,
+		  int n);
+
 /**
  * @brief Driver has finished processing "available" chains and calling
  * vq_relchain on each one.
@@ -10,6 +10,7 @@
 #include <cat.h>
 #include <pgtable.h>
 #include <vuart.h>
+#include <schedule.h>
 
 static uint8_t rtvm_uuid1[16] = RTVM_UUID1;
 static uint8_t safety_vm_uuid1[16] = SAFETY_VM_UUID1;
@@ -197,6 +198,11 @@ bool sanitize_vm_config(void)
 			ret = false;
 		}
 
+		if ((vm_config->sched_weight > SCHED_FS_MAX_WEIGHT) || (vm_config->sched_cap > 100U)) {
+			pr_err("%s: invalid scheduling weight or cap for VM %d\n", __func__, vm_id);
+			ret = false;
+		}
+
 		if (ret) {
 			/* make sure no identical UUID in following VM configurations */
 			ret = check_vm_uuid_collision(vm_id);
@@ -13,40 +13,6 @@
 #include <per_cpu.h>
 #include <ioapic.h>
 
-/*
- * lookup a ptdev entry by sid
- * Before adding a ptdev remapping, should lookup by physical sid to check
- * whether the resource has been token by others.
- * When updating a ptdev remapping, should lookup by virtual sid to check
- * whether this resource is valid.
- * @pre: vm must be NULL when lookup by physical sid, otherwise,
- * vm must not be NULL when lookup by virtual sid.
- */
-static inline struct ptirq_remapping_info *
-ptirq_lookup_entry_by_sid(uint32_t intr_type,
-		const union source_id *sid, const struct acrn_vm *vm)
-{
-	uint16_t idx;
-	struct ptirq_remapping_info *entry;
-	struct ptirq_remapping_info *entry_found = NULL;
-
-	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
-		entry = &ptirq_entries[idx];
-		if (!is_entry_active(entry)) {
-			continue;
-		}
-		if ((intr_type == entry->intr_type) &&
-			((vm == NULL) ?
-			(sid->value == entry->phys_sid.value) :
-			((vm == entry->vm) &&
-			(sid->value == entry->virt_sid.value)))) {
-			entry_found = entry;
-			break;
-		}
-	}
-	return entry_found;
-}
-
 static inline struct ptirq_remapping_info *
 ptirq_lookup_entry_by_vpin(const struct acrn_vm *vm, uint32_t virt_pin, bool pic_pin)
 {
@@ -93,16 +59,39 @@ static void ptirq_free_irte(const struct ptirq_remapping_info *entry)
 	dmar_free_irte(intr_src, (uint16_t)entry->allocated_pirq);
 }
 
+/*
+ * Return the vCPU the MSI can be posted to by VT-d, or NULL if it has to be
+ * remapped to the hypervisor and injected to the vLAPIC. Only an edge
+ * triggered, fixed or lowest priority MSI to a single vCPU can be posted.
+ */
+static struct acrn_vcpu *ptirq_get_posted_vcpu(struct acrn_vm *vm, const struct ptirq_msi_info *info,
+		uint64_t vdmask)
+{
+	struct acrn_vcpu *vcpu = NULL;
+	uint32_t delmode = info->vmsi_data.bits.delivery_mode;
+
+	if (is_apicv_advanced_feature_supported() && iommu_posted_intr_supported() &&
+			!is_lapic_pt_configured(vm) && (vdmask != 0UL) && ((vdmask & (vdmask - 1UL)) == 0UL) &&
+			((delmode == MSI_DATA_DELMODE_FIXED) || (delmode == MSI_DATA_DELMODE_LOPRI)) &&
+			(info->vmsi_data.bits.trigger_mode == MSI_DATA_TRGRMODE_EDGE) &&
+			(info->vmsi_data.bits.vector >= 16U)) {
+		vcpu = vcpu_from_vid(vm, ffs64(vdmask));
+	}
+
+	return vcpu;
+}
+
 static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_msi_info *info,
 		const struct ptirq_remapping_info *entry, uint32_t vector)
 {
-	uint64_t vdmask, pdmask;
+	uint64_t vdmask, pdmask, pid_paddr;
 	uint32_t dest, delmode, dest_mask;
 	bool phys;
 	union dmar_ir_entry irte;
 	union irte_index ir_index;
 	int32_t ret;
 	struct intr_source intr_src;
+	struct acrn_vcpu *posted_vcpu;
 
 	/* get physical destination cpu mask */
 	dest = info->vmsi_addr.bits.dest_field;
@@ -122,11 +111,25 @@ static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_msi_info *
 	/* Using phys_irq as index in the corresponding IOMMU */
 	irte.entry.lo_64 = 0UL;
 	irte.entry.hi_64 = 0UL;
-	irte.bits.vector = vector;
-	irte.bits.delivery_mode = delmode;
-	irte.bits.dest_mode = MSI_ADDR_DESTMODE_LOGICAL;
-	irte.bits.rh = MSI_ADDR_RH;
-	irte.bits.dest = dest_mask;
+	posted_vcpu = ptirq_get_posted_vcpu(vm, info, vdmask);
+	if (posted_vcpu != NULL) {
+		/*
+		 * Post the guest vector to the PI descriptor of the vCPU, the
+		 * interrupt is delivered to the guest without VM exit if the
+		 * vCPU is running.
+		 */
+		pid_paddr = apicv_get_pir_desc_paddr(posted_vcpu);
+		irte.pi_bits.vector = info->vmsi_data.bits.vector;
+		irte.pi_bits.mode = 0x1UL;
+		irte.pi_bits.pda_lo = (pid_paddr >> 6U) & 0x3FFFFFFUL;
+		irte.pi_bits.pda_hi = pid_paddr >> 32U;
+	} else {
+		irte.bits.vector = vector;
+		irte.bits.delivery_mode = delmode;
+		irte.bits.dest_mode = MSI_ADDR_DESTMODE_LOGICAL;
+		irte.bits.rh = MSI_ADDR_RH;
+		irte.bits.dest = dest_mask;
+	}
 
 	intr_src.is_msi = true;
 	intr_src.src.msi.value = entry->phys_sid.msi_id.bdf;
@@ -160,8 +163,9 @@ static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_msi_info *
 		info->pmsi_addr.bits.rh = MSI_ADDR_RH;
 		info->pmsi_addr.bits.dest_mode = MSI_ADDR_DESTMODE_LOGICAL;
 	}
-	dev_dbg(DBG_LEVEL_IRQ, "MSI %s addr:data = 0x%lx:%x(V) -> 0x%lx:%x(P)",
+	dev_dbg(DBG_LEVEL_IRQ, "MSI %s%s addr:data = 0x%lx:%x(V) -> 0x%lx:%x(P)",
 		(info->pmsi_addr.ir_bits.intr_format != 0U) ? " Remappable Format" : "Compatibility Format",
+		((ret == 0) && (posted_vcpu != NULL)) ? " Posted" : "",
 		info->vmsi_addr.full, info->vmsi_data.full,
 		info->pmsi_addr.full, info->pmsi_data.full);
 }
@@ -300,8 +304,7 @@ static struct ptirq_remapping_info *add_msix_remapping(struct acrn_vm *vm,
 		}
 	} else if (entry->vm != vm) {
 		if (is_sos_vm(entry->vm)) {
-			entry->vm = vm;
-			entry->virt_sid.msi_id.bdf = virt_bdf;
+			ptirq_update_virt_sid(entry, vm, &virt_sid);
 		} else {
 			pr_err("MSIX pbdf%x idx=%d already in vm%d with vbdf%x, not able to add into vm%d with vbdf%x",
 				entry->phys_sid.msi_id.bdf, entry->phys_sid.msi_id.entry_nr, entry->vm->vm_id,
@@ -390,8 +393,7 @@ static struct ptirq_remapping_info *add_intx_remapping(struct acrn_vm *vm, uint3
 			}
 		} else if (entry->vm != vm) {
 			if (is_sos_vm(entry->vm)) {
-				entry->vm = vm;
-				entry->virt_sid.value = virt_sid.value;
+				ptirq_update_virt_sid(entry, vm, &virt_sid);
 				entry->polarity = 0U;
 			} else {
 				pr_err("INTX pin%d already in vm%d with vpin%d, not able to add into vm%d with vpin%d",
@@ -799,7 +801,7 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint32_t virt_pin, uint32_t vpi
 				(vpin_src == 0U) ? "vPIC" : "vIOAPIC",
 				(vpin_src == 0U) ? "vIOPIC" : "vPIC",
 				virt_pin, entry->vm->vm_id);
-			entry->virt_sid.value = virt_sid.value;
+			ptirq_update_virt_sid(entry, entry->vm, &virt_sid);
 		}
 		spinlock_release(&ptdev_lock);
 		activate_physical_ioapic(vm, entry);
@@ -147,6 +147,11 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 
 	mmu_modify_or_del(pml4_page, gpa, size, local_prot, prot_clr, &(vm->arch_vm.ept_mem_ops), MR_MODIFY);
 
+	/* VT-d shares the normal world EPT, it doesn't use the execute permission */
+	if ((pml4_page == vm->arch_vm.nworld_eptp) && (((prot_set | prot_clr) & ~EPT_EXE) != 0UL)) {
+		iommu_flush_iotlb_range(vm->iommu, gpa, size);
+	}
+
 	foreach_vcpu(i, vm, vcpu) {
 		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
 	}
@@ -163,6 +168,10 @@ void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t
 
 	mmu_modify_or_del(pml4_page, gpa, size, 0UL, 0UL, &vm->arch_vm.ept_mem_ops, MR_DEL);
 
+	if (pml4_page == vm->arch_vm.nworld_eptp) {
+		iommu_flush_iotlb_range(vm->iommu, gpa, size);
+	}
+
 	foreach_vcpu(i, vm, vcpu) {
 		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
 	}
@@ -244,3 +253,69 @@ void walk_ept_table(struct acrn_vm *vm, pge_handler cb)
 		}
 	}
 }
+
+/* read a paging entry once, the walk then only follows this value */
+static inline uint64_t ept_entry_snapshot(const uint64_t *pgentry)
+{
+	return *(const volatile uint64_t *)pgentry;
+}
+
+/**
+ * The EPT is walked without a lock, as walk_ept_table() does: its updates
+ * are not serialized by a lock of their own which could be taken here.
+ * The counts are a snapshot for debugging only, a concurrent update may
+ * skew them. The walk itself stays safe: each entry is read once and
+ * only the value read is followed, and the paging structure pages of a
+ * VM are static and only ever hold its own tables, even when unlinked.
+ *
+ * @pre vm != NULL && stats != NULL.
+ */
+void get_ept_page_stats(struct acrn_vm *vm, struct acrn_ept_stats *stats)
+{
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	uint64_t *pml4_page, *pdpt_page, *pd_page, *pt_page;
+	uint64_t pml4e, pdpte, pde;
+	uint64_t i, j, k, m;
+
+	stats->pages_4k = 0UL;
+	stats->pages_2m = 0UL;
+	stats->pages_1g = 0UL;
+	stats->page_tables = 0UL;
+
+	pml4_page = (uint64_t *)vm->arch_vm.nworld_eptp;
+	for (i = 0UL; i < PTRS_PER_PML4E; i++) {
+		pml4e = ept_entry_snapshot(&pml4_page[i]);
+		if (mem_ops->pgentry_present(pml4e) == 0UL) {
+			continue;
+		}
+		pdpt_page = pml4e_page_vaddr(pml4e);
+		for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
+			pdpte = ept_entry_snapshot(&pdpt_page[j]);
+			if (mem_ops->pgentry_present(pdpte) == 0UL) {
+				continue;
+			}
+			if (pdpte_large(pdpte) != 0UL) {
+				stats->pages_1g++;
+				continue;
+			}
+			pd_page = pdpte_page_vaddr(pdpte);
+			for (k = 0UL; k < PTRS_PER_PDE; k++) {
+				pde = ept_entry_snapshot(&pd_page[k]);
+				if (mem_ops->pgentry_present(pde) == 0UL) {
+					continue;
+				}
+				if (pde_large(pde) != 0UL) {
+					stats->pages_2m++;
+					continue;
+				}
+				stats->page_tables++;
+				pt_page = pde_page_vaddr(pde);
+				for (m = 0UL; m < PTRS_PER_PTE; m++) {
+					if (mem_ops->pgentry_present(ept_entry_snapshot(&pt_page[m])) != 0UL) {
+						stats->pages_4k++;
+					}
+				}
+			}
+		}
+	}
+}
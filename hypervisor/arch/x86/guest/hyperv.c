@@ -11,12 +11,20 @@
 #include <vm.h>
 #include <logmsg.h>
 #include <vmx.h>
+#include <irq.h>
+#include <vlapic.h>
+#include <mmu.h>
+#include <guest_memory.h>
 #include <hyperv.h>
 
 #define DBG_LEVEL_HYPERV		6U
 
 /* Partition Reference Counter (HV_X64_MSR_TIME_REF_COUNT) */
 #define CPUID3A_TIME_REF_COUNT_MSR	(1U << 1U)
+/* SynIC MSRs (HV_X64_MSR_SCONTROL through HV_X64_MSR_EOM, HV_X64_MSR_SINT0 through HV_X64_MSR_SINT15) */
+#define CPUID3A_SYNIC_MSRS		(1U << 2U)
+/* Synthetic timer MSRs (HV_X64_MSR_STIMER0_CONFIG through HV_X64_MSR_STIMER3_COUNT) */
+#define CPUID3A_SYNTIMER_MSRS		(1U << 3U)
 /* Hypercall MSRs (HV_X64_MSR_GUEST_OS_ID and HV_X64_MSR_HYPERCALL) */
 #define CPUID3A_HYPERCALL_MSR		(1U << 5U)
 /* Access virtual processor index MSR (HV_X64_MSR_VP_INDEX) */
@@ -24,6 +32,79 @@
 /* Partition reference TSC MSR (HV_X64_MSR_REFERENCE_TSC) */
 #define CPUID3A_REFERENCE_TSC_MSR	(1U << 9U)
 
+/* Synthetic timers in direct mode are available */
+#define CPUID3D_STIMER_DIRECT_MODE	(1U << 19U)
+
+/* Recommend using hypercall for remote TLB flushes */
+#define CPUID4A_REMOTE_TLB_FLUSH	(1U << 2U)
+/* Recommend using hypercall for sending IPIs */
+#define CPUID4A_CLUSTER_IPI		(1U << 10U)
+
+/* Hypercall call codes */
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE	0x0002U
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST	0x0003U
+#define HVCALL_SEND_IPI				0x000bU
+
+/* Hypercall status codes */
+#define HV_STATUS_SUCCESS			0U
+#define HV_STATUS_INVALID_HYPERCALL_CODE	2U
+#define HV_STATUS_INVALID_HYPERCALL_INPUT	3U
+#define HV_STATUS_INVALID_ALIGNMENT		4U
+#define HV_STATUS_INVALID_PARAMETER		5U
+
+/* Flags of HvCallFlushVirtualAddressSpace/List */
+#define HV_FLUSH_ALL_PROCESSORS			(1UL << 0U)
+
+union hyperv_hypercall_input {
+	uint64_t val64;
+	struct {
+		uint64_t call_code:16;
+		uint64_t fast:1;
+		uint64_t rsvdz1:15;
+		uint64_t rep_count:12;
+		uint64_t rsvdz2:4;
+		uint64_t rep_start:12;
+		uint64_t rsvdz3:4;
+	};
+};
+
+/* Input of HvCallSendSyntheticClusterIpi */
+struct hyperv_send_ipi {
+	uint32_t vector;
+	uint32_t reserved;
+	uint64_t cpu_mask;
+};
+
+/* Input header of HvCallFlushVirtualAddressSpace/List */
+struct hyperv_tlb_flush {
+	uint64_t address_space;
+	uint64_t flags;
+	uint64_t processor_mask;
+};
+
+#define HV_SYNIC_VERSION		1UL
+#define HV_SYNIC_SCONTROL_ENABLE	(1UL << 0U)
+
+#define HV_MESSAGE_TIMER_EXPIRED	0x80000010U
+#define HV_MESSAGE_FLAG_PENDING		(1U << 0U)
+
+/* one message slot of the SynIC message page per SINT */
+struct hyperv_message {
+	uint32_t message_type;
+	uint8_t payload_size;
+	uint8_t message_flags;
+	uint16_t reserved;
+	uint64_t origination_id;
+	uint64_t payload[30];
+};
+
+struct hyperv_timer_message_payload {
+	uint32_t timer_index;
+	uint32_t reserved;
+	uint64_t expiration_time;
+	uint64_t delivery_time;
+};
+
 struct HV_REFERENCE_TSC_PAGE {
 	uint32_t tsc_sequence;
 	uint32_t reserved1;
@@ -113,20 +194,215 @@ hyperv_setup_tsc_page(const struct acrn_vcpu *vcpu, uint64_t val)
 	}
 }
 
+/* reference time (in 100ns units) of the guest TSC */
 static inline uint64_t
-hyperv_get_ref_count(struct acrn_vm *vm)
+hyperv_tsc_to_ref(struct acrn_vm *vm, uint64_t tsc)
 {
-	uint64_t tsc, tsc_scale, tsc_offset, ret;
+	uint64_t tsc_scale, tsc_offset;
 
+	hyperv_get_tsc_scale_offset(vm, &tsc_scale, &tsc_offset);
+
+	/* ((tsc * tsc_scale) >> 64) + tsc_offset */
+	return u64_mul_u64_shr64(tsc, tsc_scale) + tsc_offset;
+}
+
+/* TSC cycles of an interval of reference time */
+static inline uint64_t
+hyperv_ref_to_cycles(uint64_t ref)
+{
+	uint64_t khz = get_tsc_khz();
+
+	return ((ref / 10000UL) * khz) + (((ref % 10000UL) * khz) / 10000UL);
+}
+
+static inline uint64_t
+hyperv_get_ref_count(struct acrn_vm *vm)
+{
 	/* currently only "use tsc offsetting" is set to 1 */
-	tsc = rdtsc() + exec_vmread64(VMX_TSC_OFFSET_FULL);
+	return hyperv_tsc_to_ref(vm, rdtsc() + exec_vmread64(VMX_TSC_OFFSET_FULL));
+}
 
-	hyperv_get_tsc_scale_offset(vm, &tsc_scale, &tsc_offset);
+/*
+ * Post the expiration message of a synthetic timer in message mode to the
+ * message slot of its SINT. If the slot is still taken by the previous
+ * message, the message is left pending and posted again at the next EOM.
+ */
+static void
+hyperv_stimer_post_msg(struct hyperv_stimer *stimer)
+{
+	struct acrn_vcpu *vcpu = stimer->vcpu;
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	union hyperv_sint_msr sint = hv->sint[stimer->config.sintx];
+	struct hyperv_timer_message_payload *payload;
+	struct hyperv_message *msg;
+	bool posted = false;
+
+	stimer->msg_pending = false;
+	if (((hv->scontrol & HV_SYNIC_SCONTROL_ENABLE) != 0UL) && (hv->simp.enabled != 0UL) && (sint.masked == 0UL)) {
+		msg = (struct hyperv_message *)gpa2hva(vcpu->vm,
+			(hv->simp.gpfn << PAGE_SHIFT) + (stimer->config.sintx * sizeof(struct hyperv_message)));
+		if (msg != NULL) {
+			stac();
+			if (msg->message_type != 0U) {
+				msg->message_flags |= HV_MESSAGE_FLAG_PENDING;
+				stimer->msg_pending = true;
+			} else {
+				payload = (struct hyperv_timer_message_payload *)msg->payload;
+				payload->timer_index = stimer->index;
+				payload->reserved = 0U;
+				payload->expiration_time = stimer->exp_time;
+				payload->delivery_time = hyperv_tsc_to_ref(vcpu->vm, rdtsc() + stimer->tsc_offset);
+				msg->payload_size = (uint8_t)sizeof(struct hyperv_timer_message_payload);
+				msg->message_flags = 0U;
+				msg->origination_id = 0UL;
+				/* the slot is taken by the write of the message type */
+				cpu_write_memory_barrier();
+				msg->message_type = HV_MESSAGE_TIMER_EXPIRED;
+				posted = true;
+			}
+			clac();
+		}
+	}
+
+	if (posted) {
+		vlapic_set_intr(vcpu, (uint32_t)sint.vector, LAPIC_TRIG_EDGE);
+	}
+}
 
-	/* ret = ((tsc * tsc_scale) >> 64) + tsc_offset */
-	ret = u64_mul_u64_shr64(tsc, tsc_scale) + tsc_offset;
+/* timer callback, on the pCPU of the vCPU */
+static void
+hyperv_stimer_expired(void *data)
+{
+	struct hyperv_stimer *stimer = (struct hyperv_stimer *)data;
 
-	return ret;
+	if (stimer->config.direct_mode != 0UL) {
+		vlapic_set_intr(stimer->vcpu, (uint32_t)stimer->config.apic_vector, LAPIC_TRIG_EDGE);
+	} else {
+		hyperv_stimer_post_msg(stimer);
+	}
+
+	if (stimer->config.periodic != 0UL) {
+		stimer->exp_time += stimer->count;
+	} else {
+		/* a one-shot timer is disabled when it expires */
+		stimer->config.enabled = 0UL;
+	}
+}
+
+/*
+ * Stop the synthetic timer and restart it if it's still enabled after the
+ * write of its config or count MSR. The count of a one-shot timer is its
+ * absolute expiration time, the one of a periodic timer is its period, both
+ * in reference time.
+ *
+ * @pre it is called on the pCPU of stimer->vcpu, with its VMCS loaded
+ */
+static void
+hyperv_stimer_update(struct hyperv_stimer *stimer)
+{
+	struct hv_timer *timer = &stimer->timer;
+	uint64_t now_tsc, now, delta;
+
+	del_timer(timer);
+	stimer->msg_pending = false;
+
+	/* a timer with a zero count, or in message mode with SINT 0, is disabled */
+	if ((stimer->count == 0UL) || ((stimer->config.direct_mode == 0UL) && (stimer->config.sintx == 0UL))) {
+		stimer->config.enabled = 0UL;
+	}
+
+	if (stimer->config.enabled != 0UL) {
+		now_tsc = rdtsc();
+		stimer->tsc_offset = exec_vmread64(VMX_TSC_OFFSET_FULL);
+		now = hyperv_tsc_to_ref(stimer->vcpu->vm, now_tsc + stimer->tsc_offset);
+
+		if (stimer->config.periodic != 0UL) {
+			stimer->exp_time = now + stimer->count;
+			delta = stimer->count;
+			timer->mode = TICK_MODE_PERIODIC;
+			timer->period_in_cycle = hyperv_ref_to_cycles(stimer->count);
+		} else {
+			stimer->exp_time = stimer->count;
+			delta = (stimer->count > now) ? (stimer->count - now) : 0UL;
+			timer->mode = TICK_MODE_ONESHOT;
+			timer->period_in_cycle = 0UL;
+		}
+
+		timer->fire_tsc = now_tsc + hyperv_ref_to_cycles(delta);
+		(void)add_timer(timer);
+	}
+}
+
+static void
+hyperv_stimer_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
+{
+	uint32_t offset = msr - HV_X64_MSR_STIMER0_CONFIG;
+	struct hyperv_stimer *stimer = &vcpu->arch.hyperv.stimer[offset >> 1U];
+
+	if ((offset & 1U) == 0U) {
+		stimer->config.val64 = wval;
+	} else {
+		stimer->count = wval;
+		if ((stimer->config.auto_enable != 0UL) && (wval != 0UL)) {
+			stimer->config.enabled = 1UL;
+		}
+	}
+
+	hyperv_stimer_update(stimer);
+}
+
+static uint64_t
+hyperv_stimer_rdmsr(const struct acrn_vcpu *vcpu, uint32_t msr)
+{
+	uint32_t offset = msr - HV_X64_MSR_STIMER0_CONFIG;
+	const struct hyperv_stimer *stimer = &vcpu->arch.hyperv.stimer[offset >> 1U];
+
+	return ((offset & 1U) == 0U) ? stimer->config.val64 : stimer->count;
+}
+
+/* the guest has consumed a message, post the pending ones again */
+static void
+hyperv_synic_eom(struct acrn_vcpu *vcpu)
+{
+	uint32_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		if (vcpu->arch.hyperv.stimer[i].msg_pending) {
+			hyperv_stimer_post_msg(&vcpu->arch.hyperv.stimer[i]);
+		}
+	}
+}
+
+void
+hyperv_free_vcpu(struct acrn_vcpu *vcpu)
+{
+	uint32_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		del_timer(&vcpu->arch.hyperv.stimer[i].timer);
+	}
+}
+
+void
+hyperv_reset_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	struct hyperv_stimer *stimer;
+	uint32_t i;
+
+	hyperv_free_vcpu(vcpu);
+	(void)memset(hv, 0U, sizeof(struct acrn_hyperv_vcpu));
+
+	for (i = 0U; i < HV_SYNIC_SINT_COUNT; i++) {
+		hv->sint[i].masked = 1UL;
+	}
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &hv->stimer[i];
+		stimer->vcpu = vcpu;
+		stimer->index = i;
+		initialize_timer(&stimer->timer, hyperv_stimer_expired, stimer, 0UL, TICK_MODE_ONESHOT, 0UL);
+	}
 }
 
 static void
@@ -136,8 +412,8 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 	uint64_t page_gpa;
 	void *page_hva;
 
-	/* asm volatile ("mov $2,%%eax; mov $0,%%edx; ret":::"eax","edx"); */
-	const uint8_t inst[11] = {0xb8U, 0x02U, 0x0U, 0x0U, 0x0U, 0xbaU, 0x0U, 0x0U, 0x0U, 0x0U, 0xc3U};
+	/* asm volatile ("vmcall; ret"), the hypercall is handled by hyperv_hypercall() */
+	const uint8_t inst[4] = {0x0fU, 0x01U, 0xc1U, 0xc3U};
 
 	hypercall.val64 = val;
 
@@ -147,12 +423,169 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 		if (page_hva != NULL) {
 			stac();
 			(void)memset(page_hva, 0U, PAGE_SIZE);
-			(void)memcpy_s(page_hva, 11U, inst, 11U);
+			(void)memcpy_s(page_hva, sizeof(inst), inst, sizeof(inst));
 			clac();
 		}
 	}
 }
 
+/*
+ * Read the input of a slow hypercall from the guest, it must be 8 bytes aligned.
+ */
+static uint16_t
+hyperv_read_input(struct acrn_vcpu *vcpu, void *buf, uint64_t gpa, uint32_t size)
+{
+	uint16_t status = HV_STATUS_SUCCESS;
+
+	if ((gpa & 0x7UL) != 0UL) {
+		status = HV_STATUS_INVALID_ALIGNMENT;
+	} else if (copy_from_gpa(vcpu->vm, buf, gpa, size) != 0) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else {
+		/* the input is in buf */
+	}
+
+	return status;
+}
+
+/* HvCallSendSyntheticClusterIpi */
+static uint16_t
+hyperv_send_ipi(struct acrn_vcpu *vcpu, union hyperv_hypercall_input input, uint64_t param0, uint64_t param1)
+{
+	struct hyperv_send_ipi ipi;
+	struct acrn_vcpu *target;
+	uint16_t i, status = HV_STATUS_SUCCESS;
+
+	if (input.fast != 0UL) {
+		ipi.vector = (uint32_t)param0;
+		ipi.reserved = (uint32_t)(param0 >> 32U);
+		ipi.cpu_mask = param1;
+	} else {
+		status = hyperv_read_input(vcpu, &ipi, param0, sizeof(ipi));
+	}
+
+	if (status == HV_STATUS_SUCCESS) {
+		if ((ipi.reserved != 0U) || (ipi.vector < 0x10U) || (ipi.vector > 0xffU)) {
+			status = HV_STATUS_INVALID_PARAMETER;
+		} else {
+			foreach_vcpu(i, vcpu->vm, target) {
+				if ((ipi.cpu_mask & (1UL << target->vcpu_id)) != 0UL) {
+					vlapic_set_intr(target, ipi.vector, LAPIC_TRIG_EDGE);
+				}
+			}
+		}
+	}
+
+	return status;
+}
+
+/*
+ * Flush the TLB of the vCPUs in vcpu_mask, by invalidating their VPID on
+ * their pCPUs before they enter the guest again. It returns when none of
+ * the target vCPUs may still use a stale translation, i.e. when each of them
+ * has either left the guest and taken the request, or is not running.
+ */
+static void
+hyperv_flush_vpid_mask(struct acrn_vcpu *vcpu, uint64_t vcpu_mask)
+{
+	struct acrn_vcpu *target;
+	uint16_t i;
+
+	foreach_vcpu(i, vcpu->vm, target) {
+		if ((vcpu_mask & (1UL << target->vcpu_id)) != 0UL) {
+			vcpu_make_request(target, ACRN_REQUEST_VPID_FLUSH);
+		}
+	}
+
+	foreach_vcpu(i, vcpu->vm, target) {
+		if ((target != vcpu) && ((vcpu_mask & (1UL << target->vcpu_id)) != 0UL)) {
+			while (bitmap_test(ACRN_REQUEST_VPID_FLUSH, &target->arch.pending_req) && target->running) {
+				/*
+				 * The target may be waiting for our own flush in this
+				 * hypercall as well, take it here to avoid a deadlock.
+				 */
+				if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH, &vcpu->arch.pending_req)) {
+					flush_vpid_single(vcpu->arch.vpid);
+				}
+				asm_pause();
+			}
+		}
+	}
+}
+
+/*
+ * HvCallFlushVirtualAddressSpace and HvCallFlushVirtualAddressList, the
+ * whole VPID of the target vCPUs is flushed in both cases.
+ */
+static uint16_t
+hyperv_flush_tlb(struct acrn_vcpu *vcpu, union hyperv_hypercall_input input, uint64_t param0)
+{
+	struct hyperv_tlb_flush flush;
+	uint16_t status = HV_STATUS_SUCCESS;
+
+	/* the input doesn't fit into the registers of a fast hypercall without XMM input */
+	if (input.fast != 0UL) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else {
+		status = hyperv_read_input(vcpu, &flush, param0, sizeof(flush));
+	}
+
+	if (status == HV_STATUS_SUCCESS) {
+		if ((flush.flags & HV_FLUSH_ALL_PROCESSORS) != 0UL) {
+			flush.processor_mask = vm_active_cpus(vcpu->vm);
+		}
+		hyperv_flush_vpid_mask(vcpu, flush.processor_mask);
+	}
+
+	return status;
+}
+
+/*
+ * Handle the hypercall issued through the hypercall page, see the
+ * "Hypercall Interface" chapter of the TLFS.
+ *
+ * RCX is the hypercall input value, RDX and R8 are the input and output
+ * parameter GPAs of a slow hypercall, or the input parameters of a fast
+ * hypercall.
+ *
+ * @return the hypercall result value, to be returned to the guest in RAX
+ */
+uint64_t
+hyperv_hypercall(struct acrn_vcpu *vcpu)
+{
+	union hyperv_hypercall_input input;
+	uint64_t param0 = vcpu_get_gpreg(vcpu, CPU_REG_RDX);
+	uint64_t param1 = vcpu_get_gpreg(vcpu, CPU_REG_R8);
+	uint64_t rep_done = 0UL;
+	uint16_t status;
+
+	input.val64 = vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+
+	switch (input.call_code) {
+	case HVCALL_SEND_IPI:
+		status = hyperv_send_ipi(vcpu, input, param0, param1);
+		break;
+	case HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE:
+		status = hyperv_flush_tlb(vcpu, input, param0);
+		break;
+	case HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST:
+		status = hyperv_flush_tlb(vcpu, input, param0);
+		/* the whole address space is flushed, so are all the reps */
+		if (status == HV_STATUS_SUCCESS) {
+			rep_done = input.rep_count;
+		}
+		break;
+	default:
+		status = HV_STATUS_INVALID_HYPERCALL_CODE;
+		break;
+	}
+
+	dev_dbg(DBG_LEVEL_HYPERV, "hv: %s: input=0x%lx status=%hu vcpuid=%d vmid=%d",
+		__func__, input.val64, status, vcpu->vcpu_id, vcpu->vm->vm_id);
+
+	return ((uint64_t)status | (rep_done << 32U));
+}
+
 int32_t
 hyperv_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
 {
@@ -182,9 +615,30 @@ hyperv_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
 	case HV_X64_MSR_REFERENCE_TSC:
 		hyperv_setup_tsc_page(vcpu, wval);
 		break;
+	case HV_X64_MSR_SCONTROL:
+		vcpu->arch.hyperv.scontrol = wval;
+		break;
+	case HV_X64_MSR_SVERSION:
+		/* read only */
+		break;
+	case HV_X64_MSR_SIEFP:
+		vcpu->arch.hyperv.siefp.val64 = wval;
+		break;
+	case HV_X64_MSR_SIMP:
+		vcpu->arch.hyperv.simp.val64 = wval;
+		break;
+	case HV_X64_MSR_EOM:
+		hyperv_synic_eom(vcpu);
+		break;
 	default:
-		pr_err("hv: %s: unexpected MSR[0x%x] write", __func__, msr);
-		ret = -1;
+		if ((msr >= HV_X64_MSR_SINT0) && (msr <= HV_X64_MSR_SINT15)) {
+			vcpu->arch.hyperv.sint[msr - HV_X64_MSR_SINT0].val64 = wval;
+		} else if ((msr >= HV_X64_MSR_STIMER0_CONFIG) && (msr <= HV_X64_MSR_STIMER3_COUNT)) {
+			hyperv_stimer_wrmsr(vcpu, msr, wval);
+		} else {
+			pr_err("hv: %s: unexpected MSR[0x%x] write", __func__, msr);
+			ret = -1;
+		}
 		break;
 	}
 
@@ -215,9 +669,31 @@ hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 	case HV_X64_MSR_REFERENCE_TSC:
 		*rval = vcpu->vm->arch_vm.hyperv.ref_tsc_page.val64;
 		break;
+	case HV_X64_MSR_SCONTROL:
+		*rval = vcpu->arch.hyperv.scontrol;
+		break;
+	case HV_X64_MSR_SVERSION:
+		*rval = HV_SYNIC_VERSION;
+		break;
+	case HV_X64_MSR_SIEFP:
+		*rval = vcpu->arch.hyperv.siefp.val64;
+		break;
+	case HV_X64_MSR_SIMP:
+		*rval = vcpu->arch.hyperv.simp.val64;
+		break;
+	case HV_X64_MSR_EOM:
+		/* write only */
+		*rval = 0UL;
+		break;
 	default:
-		pr_err("hv: %s: unexpected MSR[0x%x] read", __func__, msr);
-		ret = -1;
+		if ((msr >= HV_X64_MSR_SINT0) && (msr <= HV_X64_MSR_SINT15)) {
+			*rval = vcpu->arch.hyperv.sint[msr - HV_X64_MSR_SINT0].val64;
+		} else if ((msr >= HV_X64_MSR_STIMER0_CONFIG) && (msr <= HV_X64_MSR_STIMER3_COUNT)) {
+			*rval = hyperv_stimer_rdmsr(vcpu, msr);
+		} else {
+			pr_err("hv: %s: unexpected MSR[0x%x] read", __func__, msr);
+			ret = -1;
+		}
 		break;
 	}
 
@@ -228,7 +704,7 @@ hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 }
 
 void
-hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
+hyperv_init_vcpuid_entry(const struct acrn_vm *vm, uint32_t leaf, uint32_t subleaf, uint32_t flags,
 			 struct vcpuid_entry *entry)
 {
 	entry->leaf = leaf;
@@ -236,6 +712,18 @@ hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 	entry->flags = flags;
 
 	switch (leaf) {
+	case 0x40000000U: /* HV vendor ID, only with GUEST_FLAG_HYPERV_VENDOR_ID */
+	{
+		static const char sig[12] = "Microsoft Hv";
+		const uint32_t *sigptr = (const uint32_t *)sig;
+
+		/* keep ACRN's timing leaf 0x40000010 in range */
+		entry->eax = 0x40000010U;
+		entry->ebx = sigptr[0];
+		entry->ecx = sigptr[1];
+		entry->edx = sigptr[2];
+		break;
+	}
 	case 0x40000001U: /* HV interface version */
 		entry->eax = 0x31237648U; /* "Hv#1" */
 		entry->ebx = 0U;
@@ -250,13 +738,18 @@ hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 		break;
 	case 0x40000003U: /* HV supported feature */
 		entry->eax = CPUID3A_HYPERCALL_MSR | CPUID3A_VP_INDEX_MSR |
-			CPUID3A_TIME_REF_COUNT_MSR | CPUID3A_REFERENCE_TSC_MSR;
+			CPUID3A_TIME_REF_COUNT_MSR | CPUID3A_REFERENCE_TSC_MSR |
+			CPUID3A_SYNIC_MSRS | CPUID3A_SYNTIMER_MSRS;
 		entry->ebx = 0U;
 		entry->ecx = 0U;
-		entry->edx = 0U;
+		/*
+		 * Windows uses message mode timers. Direct mode is for Linux,
+		 * which only reads these leaves with the Hyper-V vendor ID.
+		 */
+		entry->edx = vm_hyperv_vendor_id(vm) ? CPUID3D_STIMER_DIRECT_MODE : 0U;
 		break;
 	case 0x40000004U: /* HV Recommended hypercall usage */
-		entry->eax = 0U;
+		entry->eax = CPUID4A_REMOTE_TLB_FLUSH | CPUID4A_CLUSTER_IPI;
 		entry->ebx = 0U;
 		entry->ecx = 0U;
 		entry->edx = 0U;
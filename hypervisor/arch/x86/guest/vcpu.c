@@ -206,6 +206,9 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	vcpu->arch.exception_info.exception = VECTOR_INVALID;
 	vcpu->arch.cur_context = NORMAL_WORLD;
 	vcpu->arch.irq_window_enabled = false;
+#ifdef HV_DEBUG
+	vcpu->arch.vmexit_tsc = 0UL;
+#endif
 	(void)memset((void *)vcpu->arch.vmcs, 0U, PAGE_SIZE);
 
 	for (i = 0; i < NR_WORLD; i++) {
@@ -219,6 +222,10 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	vlapic = vcpu_vlapic(vcpu);
 	vlapic_reset(vlapic, apicv_ops, mode);
 
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_reset_vcpu(vcpu);
+#endif
+
 	reset_vcpu_regs(vcpu);
 }
 
@@ -635,6 +642,9 @@ void offline_vcpu(struct acrn_vcpu *vcpu)
 {
 	if (vcpu->state == VCPU_ZOMBIE) {
 		vlapic_free(vcpu);
+#ifdef CONFIG_HYPERV_ENABLED
+		hyperv_free_vcpu(vcpu);
+#endif
 		per_cpu(ever_run_vcpu, pcpuid_from_vcpu(vcpu)) = NULL;
 		vcpu->state = VCPU_OFFLINE;
 	}
@@ -767,7 +777,11 @@ static void context_switch_out(struct thread_object *prev)
 
 	save_xsave_area(ectx);
 
+#ifdef HV_DEBUG
+	vcpu->arch.switch_out_tsc = rdtsc();
+#endif
 	vcpu->running = false;
+	apicv_set_pi_notification(vcpu, false);
 }
 
 static void context_switch_in(struct thread_object *next)
@@ -784,7 +798,14 @@ static void context_switch_in(struct thread_object *next)
 
 	rstore_xsave_area(ectx);
 
+#ifdef HV_DEBUG
+	/* the vmexit being handled doesn't account the time switched out */
+	if (vcpu->arch.vmexit_tsc != 0UL) {
+		vcpu->arch.vmexit_tsc += rdtsc() - vcpu->arch.switch_out_tsc;
+	}
+#endif
 	vcpu->running = true;
+	apicv_set_pi_notification(vcpu, true);
 }
 
 void launch_vcpu(struct acrn_vcpu *vcpu)
@@ -817,6 +838,8 @@ int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
 		vcpu->thread_obj.host_sp = build_stack_frame(vcpu);
 		vcpu->thread_obj.switch_out = context_switch_out;
 		vcpu->thread_obj.switch_in = context_switch_in;
+		vcpu->thread_obj.sched_weight = get_vm_config(vm->vm_id)->sched_weight;
+		vcpu->thread_obj.sched_cap = get_vm_config(vm->vm_id)->sched_cap;
 		init_thread_data(&vcpu->thread_obj);
 		for (i = 0; i < VCPU_EVENT_NUM; i++) {
 			init_event(&vcpu->events[i]);
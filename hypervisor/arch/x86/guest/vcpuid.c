@@ -256,6 +256,11 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 	int32_t result;
 
 	init_vcpuid_entry(0x40000000U, 0U, 0U, &entry);
+#ifdef CONFIG_HYPERV_ENABLED
+	if (!is_sos_vm(vm) && vm_hyperv_vendor_id(vm)) {
+		hyperv_init_vcpuid_entry(vm, 0x40000000U, 0U, 0U, &entry);
+	}
+#endif
 	result = set_vcpuid_entry(vm, &entry);
 	if (result == 0) {
 		init_vcpuid_entry(0x40000001U, 0U, 0U, &entry);
@@ -265,7 +270,7 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 		}
 #ifdef CONFIG_HYPERV_ENABLED
 		else {
-			hyperv_init_vcpuid_entry(0x40000001U, 0U, 0U, &entry);
+			hyperv_init_vcpuid_entry(vm, 0x40000001U, 0U, 0U, &entry);
 		}
 #endif
 		result = set_vcpuid_entry(vm, &entry);
@@ -274,7 +279,7 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 #ifdef CONFIG_HYPERV_ENABLED
 	if (result == 0) {
 		for (i = 0x40000002U; i <= 0x40000006U; i++) {
-			hyperv_init_vcpuid_entry(i, 0U, 0U, &entry);
+			hyperv_init_vcpuid_entry(vm, i, 0U, 0U, &entry);
 			result = set_vcpuid_entry(vm, &entry);
 			if (result != 0) {
 				break;
@@ -632,6 +632,72 @@ uint64_t apicv_get_pir_desc_paddr(struct acrn_vcpu *vcpu)
 	return hva2hpa(&(vlapic->pir_desc));
 }
 
+/**
+ * @brief Switch the notification of the interrupts posted by VT-d.
+ *
+ * The interrupts posted to the running vCPU notify its pCPU with
+ * POSTED_INTR_VECTOR, which is processed by the processor in non-root mode
+ * without VM exit. The ones posted to a vCPU which is scheduled out notify
+ * the pCPU with POSTED_INTR_WAKEUP_VECTOR instead, so they are not picked up
+ * by another vCPU running on the pCPU, and the vCPU is woken up if it halts.
+ *
+ * @param[in] vcpu Target vCPU
+ * @param[in] running Whether the vCPU is switched in or out
+ *
+ * @return None
+ *
+ * @pre vcpu != NULL
+ */
+void apicv_set_pi_notification(struct acrn_vcpu *vcpu, bool running)
+{
+	struct vlapic_pir_desc *pir_desc = &(vcpu_vlapic(vcpu)->pir_desc);
+	union vlapic_pir_ctrl old_ctrl, new_ctrl;
+
+	/* the IOMMU updates the ON bit atomically at the same time */
+	do {
+		old_ctrl.value = pir_desc->control.value;
+		new_ctrl.value = old_ctrl.value;
+		new_ctrl.bits.nv = running ? POSTED_INTR_VECTOR : POSTED_INTR_WAKEUP_VECTOR;
+		new_ctrl.bits.ndst = per_cpu(lapic_id, pcpuid_from_vcpu(vcpu));
+	} while (atomic_cmpxchg64(&pir_desc->control.value, old_ctrl.value, new_ctrl.value) != old_ctrl.value);
+
+	/* the interrupts posted before are injected in next vmentry */
+	if (running && (new_ctrl.bits.on != 0U)) {
+		bitmap_set_lock(ACRN_REQUEST_EVENT, &vcpu->arch.pending_req);
+	}
+}
+
+/**
+ * @brief Pick up the interrupts posted by VT-d to the vCPUs of the pCPU.
+ *
+ * It's called when the notification of a posted interrupt is received in
+ * root mode, i.e. the target vCPU is not running in non-root mode.
+ *
+ * @param[in] pcpu_id ID of the pCPU which received the notification
+ *
+ * @return None
+ */
+void apicv_handle_pi_notification(uint16_t pcpu_id)
+{
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t vm_id, i;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (is_poweroff_vm(vm)) {
+			continue;
+		}
+		foreach_vcpu(i, vm, vcpu) {
+			if ((pcpuid_from_vcpu(vcpu) == pcpu_id) &&
+					bitmap_test(POSTED_INTR_ON, &(vcpu_vlapic(vcpu)->pir_desc.control.value))) {
+				vcpu_make_request(vcpu, ACRN_REQUEST_EVENT);
+				signal_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
+			}
+		}
+	}
+}
+
 /**
  * @pre offset value shall be one of the folllowing values:
  *	APIC_OFFSET_CMCI_LVT
@@ -1649,6 +1715,7 @@ vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum
 	struct lapic_regs *lapic;
 	uint64_t preserved_lapic_mode = vlapic->msr_apicbase & APICBASE_LAPIC_MODE;
 	uint32_t preserved_apic_id = vlapic->apic_page.id.v;
+	uint32_t preserved_pi_ndst = vlapic->pir_desc.control.bits.ndst;
 
 	vlapic->msr_apicbase = DEFAULT_APIC_BASE;
 
@@ -1668,6 +1735,9 @@ vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum
 	lapic = &(vlapic->apic_page);
 	(void)memset((void *)lapic, 0U, sizeof(struct lapic_regs));
 	(void)memset((void *)&(vlapic->pir_desc), 0U, sizeof(vlapic->pir_desc));
+	/* the notification is switched to POSTED_INTR_VECTOR when the vCPU is switched in */
+	vlapic->pir_desc.control.bits.nv = POSTED_INTR_WAKEUP_VECTOR;
+	vlapic->pir_desc.control.bits.ndst = preserved_pi_ndst;
 
 	if (mode == INIT_RESET) {
 		if ((preserved_lapic_mode & APICBASE_ENABLED) != 0U ) {
@@ -2233,7 +2303,7 @@ apicv_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector)
 	idx = vector >> 6U;
 
 	if (!bitmap_test_and_set_lock((uint16_t)(vector & 0x3fU), &pir_desc->pir[idx])) {
-		notify = (atomic_cmpxchg64(&pir_desc->pending, 0UL, 1UL) == 0UL);
+		notify = !bitmap_test_and_set_lock(POSTED_INTR_ON, &pir_desc->control.value);
 	}
 	return notify;
 }
@@ -2292,7 +2362,7 @@ static void vlapic_apicv_inject_pir(struct acrn_vlapic *vlapic)
 	struct lapic_reg *irr = NULL;
 
 	pir_desc = &(vlapic->pir_desc);
-	if (atomic_cmpxchg64(&pir_desc->pending, 1UL, 0UL) == 1UL) {
+	if (bitmap_test_and_clear_lock(POSTED_INTR_ON, &pir_desc->control.value)) {
 		pirval = 0UL;
 		lapic = &(vlapic->apic_page);
 		irr = &lapic->irr[0];
@@ -2409,7 +2479,9 @@ static bool apicv_basic_has_pending_intr(struct acrn_vcpu *vcpu)
 
 static bool apicv_advanced_has_pending_intr(struct acrn_vcpu *vcpu)
 {
-	return apicv_basic_has_pending_intr(vcpu);
+	/* the interrupts posted by VT-d may not be requested as ACRN_REQUEST_EVENT yet */
+	return (apicv_basic_has_pending_intr(vcpu) ||
+		bitmap_test(POSTED_INTR_ON, &(vcpu_vlapic(vcpu)->pir_desc.control.value)));
 }
 
 bool vlapic_has_pending_intr(struct acrn_vcpu *vcpu)
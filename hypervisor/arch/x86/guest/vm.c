@@ -158,6 +158,16 @@ bool vm_hide_mtrr(const struct acrn_vm *vm)
 	return ((vm_config->guest_flags & GUEST_FLAG_HIDE_MTRR) != 0U);
 }
 
+/**
+ * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
+ */
+bool vm_hyperv_vendor_id(const struct acrn_vm *vm)
+{
+	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+
+	return ((vm_config->guest_flags & GUEST_FLAG_HYPERV_VENDOR_ID) != 0U);
+}
+
 /**
  * @brief Initialize the I/O bitmap for \p vm
  *
@@ -123,6 +123,10 @@ static int32_t dispatch_sos_hypercall(const struct acrn_vcpu *vcpu)
 		}
 		break;
 
+	case HC_INJECT_MSI_BATCH:
+		ret = hcall_inject_msi_batch(sos_vm, param1);
+		break;
+
 	case HC_SET_IOREQ_BUFFER:
 		/* param1: relative vmid to sos, vm_id: absolute vmid */
 		if (vmid_is_valid) {
@@ -225,11 +229,23 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 	struct acrn_vm *vm = vcpu->vm;
 	/* hypercall ID from guest*/
 	uint64_t hypcall_id = vcpu_get_gpreg(vcpu, CPU_REG_R8);
+	bool set_result = true;
 
 	if (!is_hypercall_from_ring0()) {
 		pr_err("hypercall 0x%lx is only allowed from RING-0!\n", hypcall_id);
 		vcpu_inject_gp(vcpu, 0U);
 		ret = -EACCES;
+#ifdef CONFIG_HYPERV_ENABLED
+	} else if (vm->arch_vm.hyperv.hypercall_page.enabled != 0UL) {
+		/*
+		 * Hyper-V hypercall from the hypercall page, its call code is in RCX and
+		 * R8 may hold anything, so it is not matched against the ACRN hypercalls.
+		 * RAX is its result value instead of ret.
+		 */
+		vcpu_set_gpreg(vcpu, CPU_REG_RAX, hyperv_hypercall(vcpu));
+		ret = 0;
+		set_result = false;
+#endif
 	} else if (hypcall_id == HC_WORLD_SWITCH) {
 		ret = hcall_world_switch(vcpu);
 	} else if (hypcall_id == HC_INITIALIZE_TRUSTY) {
@@ -248,7 +264,7 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		ret = -ENODEV;
 	}
 
-	if ((ret != -EACCES) && (ret != -ENODEV)) {
+	if (set_result && (ret != -EACCES) && (ret != -ENODEV)) {
 		vcpu_set_gpreg(vcpu, CPU_REG_RAX, (uint64_t)ret);
 	}
 	TRACE_2L(TRACE_VMEXIT_VMCALL, vm->vm_id, hypcall_id);
@@ -23,7 +23,7 @@
  * According to "SDM APPENDIX C VMX BASIC EXIT REASONS",
  * there are 65 Basic Exit Reasons.
  */
-#define NR_VMX_EXIT_REASONS	65U
+#define NR_VMX_EXIT_REASONS	ACRN_VMEXIT_REASON_NUM
 
 static int32_t triple_fault_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t unhandled_vmexit_handler(struct acrn_vcpu *vcpu);
@@ -169,6 +169,53 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 		.handler = unhandled_vmexit_handler}
 };
 
+#ifdef HV_DEBUG
+/*
+ * Start accounting the vmexit the vcpu has just taken.
+ *
+ * @pre vcpu != NULL
+ */
+void vmexit_stats_start(struct acrn_vcpu *vcpu)
+{
+	vcpu->arch.vmexit_tsc = rdtsc();
+}
+
+/*
+ * Account the vmexit being handled by the vcpu, the cost is the TSC cycles
+ * from the vmexit to the next vmentry, minus the time the vcpu was switched
+ * out (halted, or waiting for an I/O request to be completed by the DM).
+ *
+ * @pre vcpu != NULL
+ */
+void vmexit_stats_account(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vmexit_reason_stats *stats;
+	uint32_t reason = vcpu->arch.exit_reason & 0xFFFFU;
+	uint64_t cycles;
+	uint16_t bucket = 0U;
+
+	if ((vcpu->arch.vmexit_tsc != 0UL) && (reason < NR_VMX_EXIT_REASONS)) {
+		cycles = rdtsc() - vcpu->arch.vmexit_tsc;
+		stats = &vcpu->arch.vmexit_stats[reason];
+
+		stats->count++;
+		stats->cycles += cycles;
+		if (cycles > stats->max_cycles) {
+			stats->max_cycles = cycles;
+		}
+
+		if (cycles >= (1UL << ACRN_VMEXIT_HIST_SHIFT)) {
+			bucket = (fls64(cycles) + 1U) - ACRN_VMEXIT_HIST_SHIFT;
+			if (bucket >= ACRN_VMEXIT_HIST_BUCKETS) {
+				bucket = ACRN_VMEXIT_HIST_BUCKETS - 1U;
+			}
+		}
+		stats->hist[bucket]++;
+	}
+	vcpu->arch.vmexit_tsc = 0UL;
+}
+#endif
+
 int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	struct vm_exit_dispatch *dispatch = NULL;
@@ -501,6 +501,10 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	{
 		if (is_x2apic_msr(msr)) {
 			err = vlapic_x2apic_read(vcpu, msr, &v);
+#ifdef CONFIG_HYPERV_ENABLED
+		} else if (is_hyperv_synic_msr(msr)) {
+			err = hyperv_rdmsr(vcpu, msr, &v);
+#endif
 		} else {
 			pr_warn("%s(): vm%d vcpu%d reading MSR %lx not supported",
 				__func__, vcpu->vm->vm_id, vcpu->vcpu_id, msr);
@@ -805,6 +809,10 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	{
 		if (is_x2apic_msr(msr)) {
 			err = vlapic_x2apic_write(vcpu, msr, v);
+#ifdef CONFIG_HYPERV_ENABLED
+		} else if (is_hyperv_synic_msr(msr)) {
+			err = hyperv_wrmsr(vcpu, msr, v);
+#endif
 		} else {
 			pr_warn("%s(): vm%d vcpu%d writing MSR %lx not supported",
 				__func__, vcpu->vm->vm_id, vcpu->vcpu_id, msr);
@@ -39,6 +39,7 @@ static struct static_mapping_table irq_static_mappings[NR_STATIC_MAPPINGS] = {
 	{NOTIFY_VCPU_IRQ, NOTIFY_VCPU_VECTOR},
 	{POSTED_INTR_IRQ, POSTED_INTR_VECTOR},
 	{PMI_IRQ, PMI_VECTOR},
+	{POSTED_INTR_WAKEUP_IRQ, POSTED_INTR_WAKEUP_VECTOR},
 };
 
 /*
@@ -100,10 +100,12 @@ void setup_notification(void)
 
 static void posted_intr_notification(__unused uint32_t irq, __unused void *data)
 {
-	/* Dummy IRQ handler for case that Posted-Interrupt Notification
-	 * is sent to vCPU in root mode(isn't running),interrupt will be
-	 * picked up in next vmentry,do nothine here.
+	/* Posted-Interrupt Notification is sent to a vCPU in root mode (isn't
+	 * running), or the wakeup notification is sent to a vCPU which is
+	 * scheduled out. The interrupts posted by vLAPICs are already requested
+	 * as ACRN_REQUEST_EVENT, but the ones posted by VT-d are not.
 	 */
+	apicv_handle_pi_notification(get_pcpu_id());
 }
 
 /*pre-conditon: be called only by BSP initialization proccess*/
@@ -114,6 +116,12 @@ void setup_posted_intr_notification(void)
 			NULL, IRQF_NONE) < 0) {
 		pr_err("Failed to setup posted-intr notification");
 	}
+
+	if (request_irq(POSTED_INTR_WAKEUP_IRQ,
+			posted_intr_notification,
+			NULL, IRQF_NONE) < 0) {
+		pr_err("Failed to setup posted-intr wakeup notification");
+	}
 }
 
 /**
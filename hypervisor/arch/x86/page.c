@@ -68,6 +68,7 @@ static inline void nop_recover_exe_right(uint64_t *entry __attribute__((unused))
 const struct memory_ops ppt_mem_ops = {
 	.info = &ppt_pages_info,
 	.large_page_enabled = true,
+	.large_page_merge = false,
 	.get_default_access_right = ppt_get_default_access_right,
 	.pgentry_present = ppt_pgentry_present,
 	.get_pml4_page = ppt_get_pml4_page,
@@ -221,4 +222,12 @@ void init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id)
 		mem_ops->tweak_exe_right = nop_tweak_exe_right;
 		mem_ops->recover_exe_right = nop_recover_exe_right;
 	}
+
+	/*
+	 * The EPT users request ACRN_REQUEST_EPT_FLUSH after changing the mappings.
+	 * The secure world EPT shares the page tables of the normal world EPT under
+	 * its PDPTEs, don't merge them if there is a secure world.
+	 */
+	mem_ops->large_page_merge = mem_ops->large_page_enabled &&
+		((get_vm_config(vm_id)->guest_flags & GUEST_FLAG_SECURE_WORLD_ENABLED) == 0UL);
 }
@@ -56,6 +56,59 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 	/* TODO: flush the TLB */
 }
 
+/*
+ * Merge the next level page table of a PDPTE/PDE back into a large page if
+ * its 512 entries map one aligned, contiguous region with the same attributes,
+ * e.g. when the attributes of a split large page become uniform again.
+ * Nothing is merged if the large page would lose any access right, see
+ * tweak_exe_right. The page table page is reserved for the address range by
+ * get_pd_page/get_pt_page, so it is just left unused.
+ *
+ * The caller is responsible for flushing the TLB.
+ *
+ * @pre: level could only IA32E_PDPT or IA32E_PD
+ */
+static void try_to_merge_large_page(uint64_t *pte, enum _page_table_level level,
+		const struct memory_ops *mem_ops)
+{
+	const uint64_t *pbase;
+	uint64_t ref_paddr, ref_prot, paddrinc, new_pte, large_pte;
+	uint64_t i;
+	bool mergeable;
+
+	if (mem_ops->large_page_merge && (mem_ops->pgentry_present(*pte) != 0UL)) {
+		if (level == IA32E_PDPT) {
+			pbase = pdpte_page_vaddr(*pte);
+			ref_paddr = pbase[0] & PDE_PFN_MASK;
+			ref_prot = pbase[0] & ~PDE_PFN_MASK;
+			paddrinc = PDE_SIZE;
+			/* the PDEs must be large pages already */
+			mergeable = (pde_large(pbase[0]) != 0UL) && mem_aligned_check(ref_paddr, PDPTE_SIZE);
+		} else {
+			pbase = pde_page_vaddr(*pte);
+			ref_paddr = pbase[0] & PTE_PFN_MASK;
+			ref_prot = pbase[0] & ~PTE_PFN_MASK;
+			paddrinc = PTE_SIZE;
+			mergeable = mem_aligned_check(ref_paddr, PDE_SIZE);
+		}
+		mergeable = mergeable && (mem_ops->pgentry_present(pbase[0]) != 0UL);
+
+		for (i = 1UL; mergeable && (i < PTRS_PER_PTE); i++) {
+			mergeable = (pbase[i] == ((ref_paddr + (i * paddrinc)) | ref_prot));
+		}
+
+		if (mergeable) {
+			new_pte = ref_paddr | ref_prot | PAGE_PSE;
+			large_pte = new_pte;
+			mem_ops->tweak_exe_right(&large_pte);
+			if (large_pte == new_pte) {
+				dev_dbg(DBG_LEVEL_MMU, "%s, paddr: 0x%lx, level: %d\n", __func__, ref_paddr, level);
+				set_pgentry(pte, new_pte, mem_ops);
+			}
+		}
+	}
+}
+
 static inline void local_modify_or_del_pte(uint64_t *pte,
 		uint64_t prot_set, uint64_t prot_clr, uint32_t type, const struct memory_ops *mem_ops)
 {
@@ -153,6 +206,9 @@ static void modify_or_del_pde(const uint64_t *pdpte, uint64_t vaddr_start, uint6
 				}
 			}
 			modify_or_del_pte(pde, vaddr, vaddr_end, prot_set, prot_clr, mem_ops, type);
+			if (type == MR_MODIFY) {
+				try_to_merge_large_page(pde, IA32E_PD, mem_ops);
+			}
 		}
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
@@ -199,6 +255,9 @@ static void modify_or_del_pdpte(const uint64_t *pml4e, uint64_t vaddr_start, uin
 				}
 			}
 			modify_or_del_pde(pdpte, vaddr, vaddr_end, prot_set, prot_clr, mem_ops, type);
+			if (type == MR_MODIFY) {
+				try_to_merge_large_page(pdpte, IA32E_PDPT, mem_ops);
+			}
 		}
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
@@ -314,6 +373,7 @@ static void add_pde(const uint64_t *pdpte, uint64_t paddr_start, uint64_t vaddr_
 				}
 			}
 			add_pte(pde, paddr, vaddr, vaddr_end, prot, mem_ops);
+			try_to_merge_large_page(pde, IA32E_PD, mem_ops);
 		}
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
@@ -362,6 +422,7 @@ static void add_pdpte(const uint64_t *pml4e, uint64_t paddr_start, uint64_t vadd
 				}
 			}
 			add_pde(pdpte, paddr, vaddr, vaddr_end, prot, mem_ops);
+			try_to_merge_large_page(pdpte, IA32E_PDPT, mem_ops);
 		}
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
@@ -13,6 +13,7 @@
 #include <cpu_caps.h>
 #include <softirq.h>
 #include <trace.h>
+#include <spinlock.h>
 
 #define MAX_TIMER_ACTIONS	32U
 #define CAL_MS			10U
@@ -46,42 +47,100 @@ static void tsc_deadline_handler(__unused uint32_t irq, __unused void *data)
 
 static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
 {
-	struct hv_timer *timer = NULL;
-
 	/* find the next event timer */
-	if (!list_empty(&cpu_timer->timer_list)) {
-		timer = list_entry((&cpu_timer->timer_list)->next,
-			struct hv_timer, node);
-
+	if (cpu_timer->nr_timers != 0U) {
 		/* it is okay to program a expired time */
-		msr_write(MSR_IA32_TSC_DEADLINE, timer->fire_tsc);
+		msr_write(MSR_IA32_TSC_DEADLINE, cpu_timer->queue[1U]->fire_tsc);
 	}
 }
 
+static inline void timer_queue_set(struct per_cpu_timers *cpu_timer, uint32_t idx, struct hv_timer *timer)
+{
+	cpu_timer->queue[idx] = timer;
+	timer->queue_idx = idx;
+}
+
 /*
- * return true if we add the timer on the timer_list head
+ * move the timer at idx towards the root until its parent fires no later
+ * than it; return the final position
  */
-static bool local_add_timer(struct per_cpu_timers *cpu_timer,
-			struct hv_timer *timer)
+static uint32_t timer_queue_sift_up(struct per_cpu_timers *cpu_timer, uint32_t idx)
+{
+	struct hv_timer *timer = cpu_timer->queue[idx];
+	uint32_t pos = idx, parent;
+
+	while (pos > 1U) {
+		parent = pos >> 1U;
+		if (cpu_timer->queue[parent]->fire_tsc <= timer->fire_tsc) {
+			break;
+		}
+		timer_queue_set(cpu_timer, pos, cpu_timer->queue[parent]);
+		pos = parent;
+	}
+	timer_queue_set(cpu_timer, pos, timer);
+
+	return pos;
+}
+
+/*
+ * move the timer at idx towards the leaves until both children fire no
+ * earlier than it
+ */
+static void timer_queue_sift_down(struct per_cpu_timers *cpu_timer, uint32_t idx)
 {
-	struct list_head *pos, *prev;
-	struct hv_timer *tmp;
-	uint64_t tsc = timer->fire_tsc;
-
-	prev = &cpu_timer->timer_list;
-	list_for_each(pos, &cpu_timer->timer_list) {
-		tmp = list_entry(pos, struct hv_timer, node);
-		if (tmp->fire_tsc < tsc) {
-			prev = &tmp->node;
+	struct hv_timer *timer = cpu_timer->queue[idx];
+	uint32_t pos = idx, child;
+
+	while ((pos << 1U) <= cpu_timer->nr_timers) {
+		child = pos << 1U;
+		if ((child < cpu_timer->nr_timers) &&
+				(cpu_timer->queue[child + 1U]->fire_tsc < cpu_timer->queue[child]->fire_tsc)) {
+			child++;
 		}
-		else {
+		if (timer->fire_tsc <= cpu_timer->queue[child]->fire_tsc) {
 			break;
 		}
+		timer_queue_set(cpu_timer, pos, cpu_timer->queue[child]);
+		pos = child;
 	}
+	timer_queue_set(cpu_timer, pos, timer);
+}
 
-	list_add(&timer->node, prev);
+/*
+ * return true if the timer becomes the nearest one of the queue
+ *
+ * @pre cpu_timer->lock is held
+ * @pre cpu_timer->nr_timers < MAX_TIMERS_PER_PCPU
+ */
+static bool local_add_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer)
+{
+	cpu_timer->nr_timers++;
+	timer_queue_set(cpu_timer, cpu_timer->nr_timers, timer);
 
-	return (prev == &cpu_timer->timer_list);
+	return (timer_queue_sift_up(cpu_timer, cpu_timer->nr_timers) == 1U);
+}
+
+/*
+ * @pre cpu_timer->lock is held
+ */
+static void local_del_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer)
+{
+	uint32_t idx = timer->queue_idx;
+	struct hv_timer *last = cpu_timer->queue[cpu_timer->nr_timers];
+
+	cpu_timer->queue[cpu_timer->nr_timers] = NULL;
+	cpu_timer->nr_timers--;
+	timer->queue_idx = TIMER_NOT_QUEUED;
+
+	/* fill the hole with the last timer and restore the heap order */
+	if (last != timer) {
+		timer_queue_set(cpu_timer, idx, last);
+		if (timer_queue_sift_up(cpu_timer, idx) == idx) {
+			timer_queue_sift_down(cpu_timer, idx);
+		}
+	}
 }
 
 int32_t add_timer(struct hv_timer *timer)
@@ -94,7 +153,7 @@ int32_t add_timer(struct hv_timer *timer)
 	if ((timer == NULL) || (timer->func == NULL) || (timer->fire_tsc == 0UL)) {
 		ret = -EINVAL;
 	} else {
-		ASSERT(list_empty(&timer->node), "add timer again!\n");
+		ASSERT(!timer_is_started(timer), "add timer again!\n");
 
 		/* limit minimal periodic timer cycle period */
 		if (timer->mode == TICK_MODE_PERIODIC) {
@@ -104,12 +163,21 @@ int32_t add_timer(struct hv_timer *timer)
 		pcpu_id  = get_pcpu_id();
 		cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
-		CPU_INT_ALL_DISABLE(&rflags);
-		/* update the physical timer if we're on the timer_list head */
-		if (local_add_timer(cpu_timer, timer)) {
-			update_physical_timer(cpu_timer);
+		spinlock_irqsave_obtain(&cpu_timer->lock, &rflags);
+		if (cpu_timer->nr_timers >= MAX_TIMERS_PER_PCPU) {
+			pr_err("%s: too many timers on pcpu%hu", __func__, pcpu_id);
+			ret = -ENOMEM;
+		} else {
+			timer->pcpu_id = pcpu_id;
+			/* update the physical timer if we're the nearest timer */
+			if (local_add_timer(cpu_timer, timer)) {
+				update_physical_timer(cpu_timer);
+			}
 		}
-		CPU_INT_ALL_RESTORE(rflags);
+		spinlock_irqrestore_release(&cpu_timer->lock, rflags);
+
+		/* the callers don't expect a failure, the queue is sized for all the timers of a pCPU */
+		ASSERT(ret == 0, "timer queue overflow!\n");
 
 		TRACE_2L(TRACE_TIMER_ACTION_ADDED, timer->fire_tsc, 0UL);
 	}
@@ -120,13 +188,22 @@ int32_t add_timer(struct hv_timer *timer)
 
 void del_timer(struct hv_timer *timer)
 {
+	struct per_cpu_timers *cpu_timer;
 	uint64_t rflags;
 
-	CPU_INT_ALL_DISABLE(&rflags);
-	if ((timer != NULL) && !list_empty(&timer->node)) {
-		list_del_init(&timer->node);
+	if (timer != NULL) {
+		cpu_timer = &per_cpu(cpu_timers, timer->pcpu_id);
+
+		spinlock_irqsave_obtain(&cpu_timer->lock, &rflags);
+		if (timer_is_started(timer)) {
+			local_del_timer(cpu_timer, timer);
+		}
+		/* the callback is running on the timer pCPU, don't restart the timer after it */
+		if (cpu_timer->running == timer) {
+			cpu_timer->running = NULL;
+		}
+		spinlock_irqrestore_release(&cpu_timer->lock, rflags);
 	}
-	CPU_INT_ALL_RESTORE(rflags);
 }
 
 static void init_percpu_timer(uint16_t pcpu_id)
@@ -134,7 +211,8 @@ static void init_percpu_timer(uint16_t pcpu_id)
 	struct per_cpu_timers *cpu_timer;
 
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	INIT_LIST_HEAD(&cpu_timer->timer_list);
+	(void)memset(cpu_timer, 0U, sizeof(struct per_cpu_timers));
+	spinlock_init(&cpu_timer->lock);
 }
 
 static void init_tsc_deadline_timer(void)
@@ -154,33 +232,50 @@ static void timer_softirq(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 	struct hv_timer *timer;
-	struct list_head *pos, *n;
 	uint32_t tries = MAX_TIMER_ACTIONS;
 	uint64_t current_tsc = rdtsc();
+	uint64_t rflags;
 
 	/* handle passed timer */
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
+	spinlock_irqsave_obtain(&cpu_timer->lock, &rflags);
+
 	/* This is to make sure we are not blocked due to delay inside func()
 	 * force to exit irq handler after we serviced >31 timers
 	 * caller used to local_add_timer() for periodic timer, if there is a delay
 	 * inside func(), it will infinitely loop here, because new added timer
 	 * already passed due to previously func()'s delay.
 	 */
-	list_for_each_safe(pos, n, &cpu_timer->timer_list) {
-		timer = list_entry(pos, struct hv_timer, node);
+	while (cpu_timer->nr_timers != 0U) {
+		timer = cpu_timer->queue[1U];
 		/* timer expried */
 		tries--;
 		if ((timer->fire_tsc <= current_tsc) && (tries != 0U)) {
-			del_timer(timer);
+			local_del_timer(cpu_timer, timer);
 
+			/* the callback may add or delete timers */
+			cpu_timer->running = timer;
+			spinlock_irqrestore_release(&cpu_timer->lock, rflags);
 			run_timer(timer);
-
-			if (timer->mode == TICK_MODE_PERIODIC) {
+			spinlock_irqsave_obtain(&cpu_timer->lock, &rflags);
+
+			/*
+			 * restart a periodic timer, unless it was deleted or
+			 * restarted meanwhile
+			 */
+			if ((cpu_timer->running == timer) && (timer->mode == TICK_MODE_PERIODIC) &&
+					!timer_is_started(timer)) {
 				/* update periodic timer fire tsc */
 				timer->fire_tsc += timer->period_in_cycle;
-				(void)local_add_timer(cpu_timer, timer);
+				if (cpu_timer->nr_timers < MAX_TIMERS_PER_PCPU) {
+					(void)local_add_timer(cpu_timer, timer);
+				} else {
+					pr_err("%s: too many timers on pcpu%hu", __func__, pcpu_id);
+					ASSERT(false, "timer queue overflow!\n");
+				}
 			}
+			cpu_timer->running = NULL;
 		} else {
 			break;
 		}
@@ -188,6 +283,8 @@ static void timer_softirq(uint16_t pcpu_id)
 
 	/* update nearest timer */
 	update_physical_timer(cpu_timer);
+
+	spinlock_irqrestore_release(&cpu_timer->lock, rflags);
 }
 
 void timer_init(void)
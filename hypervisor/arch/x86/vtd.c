@@ -8,6 +8,7 @@
 
 #include <types.h>
 #include <bits.h>
+#include <atomic.h>
 #include <errno.h>
 #include <spinlock.h>
 #include <page.h>
@@ -87,6 +88,10 @@ static inline uint64_t dmar_set_bitslice(uint64_t var, uint64_t mask, uint32_t p
 
 #define DMAR_INVALIDATION_QUEUE_SIZE	4096U
 #define DMAR_QI_INV_ENTRY_SIZE		16U
+/* the queue is full with one free entry, one more is taken by the wait descriptor */
+#define DMAR_QI_MAX_BATCH		((DMAR_INVALIDATION_QUEUE_SIZE / DMAR_QI_INV_ENTRY_SIZE) - 2U)
+/* more page-selective IOTLB invalidations than this are replaced by a domain-selective one */
+#define DMAR_IOTLB_MAX_PSI		16U
 #define DMAR_NUM_IR_ENTRIES_PER_PAGE	256U
 
 #define DMAR_INV_STATUS_WRITE_SHIFT	5U
@@ -129,6 +134,8 @@ struct dmar_drhd_rt {
 	uint64_t ir_table_addr;
 	uint64_t qi_queue;
 	uint16_t qi_tail;
+	uint16_t qi_batch;	/* descriptors queued since the last submission */
+	volatile uint32_t qi_status;	/* status word written by the invalidation wait descriptor */
 
 	uint64_t cap;
 	uint64_t ecap;
@@ -194,7 +201,7 @@ bool iommu_snoop_supported(const struct iommu_domain *iommu)
 
 static struct dmar_drhd_rt dmar_drhd_units[MAX_DRHDS];
 static bool iommu_page_walk_coherent = true;
-static uint32_t qi_status = 0U;
+static bool iommu_posted_intr = true;
 static struct dmar_info *platform_dmar_info = NULL;
 
 /* Domain id 0 is reserved in some cases per VT-d */
@@ -292,9 +299,13 @@ static inline void dmar_wait_completion(const struct dmar_drhd_rt *dmar_unit, ui
 	}
 }
 
+bool iommu_posted_intr_supported(void)
+{
+	return iommu_posted_intr;
+}
+
 /* Flush CPU cache when root table, context table or second-level translation teable updated
- * In the context of ACRN, GPA to HPA mapping relationship is not changed after VM created,
- * skip flushing iotlb to avoid performance penalty.
+ * The IOTLB entries of a changed GPA range are invalidated by iommu_flush_iotlb_range().
  */
 void iommu_flush_cache(const void *p, uint32_t size)
 {
@@ -517,6 +528,11 @@ static int32_t dmar_register_hrhd(struct dmar_drhd_rt *dmar_unit)
 			iommu_page_walk_coherent = false;
 		}
 
+		if ((iommu_cap_pi(dmar_unit->cap) == 0U) && (!dmar_unit->drhd->ignore)) {
+			dev_dbg(DBG_LEVEL_IOMMU, "dmar uint doesn't support posted interrupts!");
+			iommu_posted_intr = false;
+		}
+
 		/* when the hardware support snoop control,
 		 * to make sure snoop control is always enabled,
 		 * the SNP filed in the leaf PTE should be set.
@@ -583,31 +599,41 @@ static struct dmar_drhd_rt *device_to_dmaru(uint8_t bus, uint8_t devfun)
 	return dmaru;
 }
 
-static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+/*
+ * Submit the descriptors queued since the last submission, followed by an
+ * invalidation wait descriptor which writes the status word of the unit.
+ * It doesn't wait for the completion, so the invalidations of several units
+ * can be processed concurrently, see dmar_qi_wait().
+ *
+ * @pre dmar_unit->lock is held
+ */
+static void dmar_qi_submit(struct dmar_drhd_rt *dmar_unit)
 {
 	struct dmar_entry *invalidate_desc_ptr;
-	__unused uint64_t start;
-
-	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
-
-	invalidate_desc_ptr->hi_64 = invalidate_desc.hi_64;
-	invalidate_desc_ptr->lo_64 = invalidate_desc.lo_64;
-	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
 
-	invalidate_desc_ptr++;
+	if (dmar_unit->qi_batch != 0U) {
+		invalidate_desc_ptr = (struct dmar_entry *)hpa2hva(dmar_unit->qi_queue + dmar_unit->qi_tail);
+		invalidate_desc_ptr->hi_64 = hva2hpa((const void *)&dmar_unit->qi_status);
+		invalidate_desc_ptr->lo_64 = DMAR_INV_WAIT_DESC_LOWER;
+		dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
 
-	invalidate_desc_ptr->hi_64 = hva2hpa(&qi_status);
-	invalidate_desc_ptr->lo_64 = DMAR_INV_WAIT_DESC_LOWER;
-	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+		dmar_unit->qi_status = DMAR_INV_STATUS_INCOMPLETE;
+		dmar_unit->qi_batch = 0U;
+		iommu_write32(dmar_unit, DMAR_IQT_REG, dmar_unit->qi_tail);
+	}
+}
 
-	qi_status = DMAR_INV_STATUS_INCOMPLETE;
-	iommu_write32(dmar_unit, DMAR_IQT_REG, dmar_unit->qi_tail);
+/*
+ * Wait for the last submission of the unit to complete.
+ *
+ * @pre dmar_unit->lock is held
+ */
+static void dmar_qi_wait(const struct dmar_drhd_rt *dmar_unit)
+{
+	__unused uint64_t start;
 
 	start = rdtsc();
-	while (qi_status == DMAR_INV_STATUS_INCOMPLETE) {
-		if (qi_status == DMAR_INV_STATUS_COMPLETED) {
-			break;
-		}
+	while (dmar_unit->qi_status == DMAR_INV_STATUS_INCOMPLETE) {
 		if ((rdtsc() - start) > CYCLES_PER_MS) {
 			pr_err("DMAR OP Timeout! @ %s", __func__);
 		}
@@ -615,11 +641,47 @@ static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_en
 	}
 }
 
+/*
+ * Submit the queued descriptors and wait for their completion.
+ *
+ * @pre dmar_unit->lock is held
+ */
+static void dmar_qi_flush(struct dmar_drhd_rt *dmar_unit)
+{
+	dmar_qi_submit(dmar_unit);
+	dmar_qi_wait(dmar_unit);
+}
+
+/*
+ * Queue an invalidation descriptor, it is processed by the hardware with the
+ * next dmar_qi_submit(). As every submission is waited for before the lock
+ * is released, the queue is empty when a batch starts, it's flushed before
+ * the batch and its wait descriptor could overrun the queue.
+ *
+ * @pre dmar_unit->lock is held
+ */
+static void dmar_qi_queue(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+{
+	struct dmar_entry *invalidate_desc_ptr;
+
+	if (dmar_unit->qi_batch == DMAR_QI_MAX_BATCH) {
+		dmar_qi_flush(dmar_unit);
+	}
+
+	invalidate_desc_ptr = (struct dmar_entry *)hpa2hva(dmar_unit->qi_queue + dmar_unit->qi_tail);
+	invalidate_desc_ptr->hi_64 = invalidate_desc.hi_64;
+	invalidate_desc_ptr->lo_64 = invalidate_desc.lo_64;
+	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+	dmar_unit->qi_batch++;
+}
+
 /*
  * did: domain id
  * sid: source id
  * fm: function mask
  * cirg: cache-invalidation request granularity
+ *
+ * @pre dmar_unit->lock is held
  */
 static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 	uint16_t did, uint16_t sid, uint8_t fm, enum dmar_cirg_type cirg)
@@ -645,19 +707,13 @@ static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 	}
 
 	if (invalidate_desc.lo_64 != 0UL) {
-		spinlock_obtain(&(dmar_unit->lock));
-
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
-
-		spinlock_release(&(dmar_unit->lock));
+		dmar_qi_queue(dmar_unit, invalidate_desc);
 	}
 }
 
-static void dmar_invalid_context_cache_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_context_cache(dmar_unit, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
-}
-
+/*
+ * @pre dmar_unit->lock is held
+ */
 static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t address, uint8_t am,
 			       bool hint, enum dmar_iirg_type iirg)
 {
@@ -692,22 +748,64 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
 	}
 
 	if (invalidate_desc.lo_64 != 0UL) {
-		spinlock_obtain(&(dmar_unit->lock));
+		dmar_qi_queue(dmar_unit, invalidate_desc);
+	}
+}
 
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
+/*
+ * Return the address mask of the largest naturally aligned power-of-2 pages
+ * chunk which starts at addr, ends no later than end and is covered by a
+ * single page-selective invalidation of the unit.
+ */
+static uint8_t dmar_iotlb_chunk_am(const struct dmar_drhd_rt *dmar_unit, uint64_t addr, uint64_t end)
+{
+	uint8_t am = 0U;
+	uint8_t max_am = iommu_cap_max_amask_val(dmar_unit->cap);
+	uint64_t chunk_size = (uint64_t)PAGE_SIZE << 1U;
 
-		spinlock_release(&(dmar_unit->lock));
+	while ((am < max_am) && ((addr & (chunk_size - 1UL)) == 0UL) && ((end - addr) >= chunk_size)) {
+		am++;
+		chunk_size <<= 1U;
 	}
+
+	return am;
 }
 
-/* Invalidate IOTLB globally,
- * all iotlb entries are invalidated,
- * all PASID-cache entries are invalidated,
- * all paging-structure-cache entries are invalidated.
+/*
+ * Queue the IOTLB invalidations of [gpa, gpa + size) of the domain did, as
+ * page-selective invalidations of aligned chunks. It falls back to a
+ * domain-selective invalidation if the unit doesn't support page-selective
+ * invalidation or the range takes more than DMAR_IOTLB_MAX_PSI of them.
+ *
+ * @pre dmar_unit->lock is held
+ * @pre size > 0
  */
-static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
+static void dmar_invalid_iotlb_range(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t gpa, uint64_t size)
+{
+	uint64_t start = gpa & PAGE_MASK;
+	uint64_t end = round_page_up(gpa + size);
+	uint64_t addr;
+	uint32_t count = 0U;
+	uint8_t am;
+
+	if (iommu_cap_pgsel_inv(dmar_unit->cap) != 0U) {
+		addr = start;
+		while ((addr < end) && (count <= DMAR_IOTLB_MAX_PSI)) {
+			addr += (uint64_t)PAGE_SIZE << dmar_iotlb_chunk_am(dmar_unit, addr, end);
+			count++;
+		}
+	}
+
+	if ((count == 0U) || (count > DMAR_IOTLB_MAX_PSI)) {
+		dmar_invalid_iotlb(dmar_unit, did, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+	} else {
+		addr = start;
+		while (addr < end) {
+			am = dmar_iotlb_chunk_am(dmar_unit, addr, end);
+			dmar_invalid_iotlb(dmar_unit, did, addr, am, false, DMAR_IIRG_PAGE);
+			addr += (uint64_t)PAGE_SIZE << am;
+		}
+	}
 }
 
 static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
@@ -737,6 +835,9 @@ static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
 	spinlock_release(&(dmar_unit->lock));
 }
 
+/*
+ * @pre dmar_unit->lock is held
+ */
 static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index,
 				uint8_t index_mask, bool is_global)
 {
@@ -752,17 +853,25 @@ static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index
 	}
 
 	if (invalidate_desc.lo_64 != 0UL) {
-		spinlock_obtain(&(dmar_unit->lock));
-
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
-
-		spinlock_release(&(dmar_unit->lock));
+		dmar_qi_queue(dmar_unit, invalidate_desc);
 	}
 }
 
-static void dmar_invalid_iec_global(struct dmar_drhd_rt *dmar_unit)
+/* Invalidate the context-cache, IOTLB and interrupt entry cache globally,
+ * all iotlb entries are invalidated,
+ * all PASID-cache entries are invalidated,
+ * all paging-structure-cache entries are invalidated.
+ */
+static void dmar_invalid_caches_global(struct dmar_drhd_rt *dmar_unit)
 {
+	spinlock_obtain(&(dmar_unit->lock));
+
+	dmar_invalid_context_cache(dmar_unit, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
+	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
 	dmar_invalid_iec(dmar_unit, 0U, 0U, true);
+	dmar_qi_flush(dmar_unit);
+
+	spinlock_release(&(dmar_unit->lock));
 }
 
 static void dmar_set_root_table(struct dmar_drhd_rt *dmar_unit)
@@ -965,6 +1074,9 @@ static void dmar_enable_qi(struct dmar_drhd_rt *dmar_unit)
 	dmar_unit->qi_queue = hva2hpa(get_qi_queue(dmar_unit->index));
 	iommu_write64(dmar_unit, DMAR_IQA_REG, dmar_unit->qi_queue);
 
+	/* the queue head is reset to 0 by the write of IQA */
+	dmar_unit->qi_tail = 0U;
+	dmar_unit->qi_batch = 0U;
 	iommu_write32(dmar_unit, DMAR_IQT_REG, 0U);
 
 	if ((dmar_unit->gcmd & DMA_GCMD_QIE) == 0U) {
@@ -1003,9 +1115,7 @@ static void dmar_prepare(struct dmar_drhd_rt *dmar_unit)
 static void dmar_enable(struct dmar_drhd_rt *dmar_unit)
 {
 	dev_dbg(DBG_LEVEL_IOMMU, "enable dmar uint [0x%x]", dmar_unit->drhd->reg_base_addr);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_invalid_caches_global(dmar_unit);
 	dmar_enable_translation(dmar_unit);
 }
 
@@ -1021,9 +1131,7 @@ static void dmar_suspend(struct dmar_drhd_rt *dmar_unit)
 {
 	uint32_t i;
 
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_invalid_caches_global(dmar_unit);
 
 	dmar_disable(dmar_unit);
 
@@ -1151,6 +1259,12 @@ static int32_t add_iommu_device(struct iommu_domain *domain, uint8_t bus, uint8_
 						CTX_ENTRY_LOWER_SLPTPTR_MASK, CTX_ENTRY_LOWER_SLPTPTR_POS, domain->trans_table_ptr >> PAGE_SHIFT);
 				lo_64 = dmar_set_bitslice(lo_64, CTX_ENTRY_LOWER_P_MASK, CTX_ENTRY_LOWER_P_POS, 1UL);
 
+				/*
+				 * Counted before the entry is present, so that no flush of the
+				 * domain is skipped once the device can cache its translations.
+				 * Devices are assigned and deassigned without a common lock.
+				 */
+				atomic_inc32(&domain->nr_devices);
 				context_entry->hi_64 = hi_64;
 				context_entry->lo_64 = lo_64;
 				iommu_flush_cache(context_entry, sizeof(struct dmar_entry));
@@ -1161,7 +1275,7 @@ static int32_t add_iommu_device(struct iommu_domain *domain, uint8_t bus, uint8_
 	return ret;
 }
 
-static int32_t remove_iommu_device(const struct iommu_domain *domain, uint8_t bus, uint8_t devfun)
+static int32_t remove_iommu_device(struct iommu_domain *domain, uint8_t bus, uint8_t devfun)
 {
 	struct dmar_drhd_rt *dmar_unit;
 	struct dmar_entry *root_table;
@@ -1211,10 +1325,14 @@ static int32_t remove_iommu_device(const struct iommu_domain *domain, uint8_t bu
 				context_entry->hi_64 = 0UL;
 				iommu_flush_cache(context_entry, sizeof(struct dmar_entry));
 
+				spinlock_obtain(&(dmar_unit->lock));
 				dmar_invalid_context_cache(dmar_unit, vmid_to_domainid(domain->vm_id), sid.value, 0U,
 								DMAR_CIRG_DEVICE);
 				dmar_invalid_iotlb(dmar_unit, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
 								DMAR_IIRG_DOMAIN);
+				dmar_qi_flush(dmar_unit);
+				spinlock_release(&(dmar_unit->lock));
+				atomic_dec32(&domain->nr_devices);
 			}
 		}
 	}
@@ -1264,6 +1382,7 @@ struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_ta
 		domain->addr_width = addr_width;
 		domain->is_tt_ept = true;
 		domain->iommu_snoop = true;
+		domain->nr_devices = 0U;
 
 		dev_dbg(DBG_LEVEL_IOMMU, "create domain [%d]: vm_id = %hu, ept@0x%x",
 			vmid_to_domainid(domain->vm_id), domain->vm_id, domain->trans_table_ptr);
@@ -1290,7 +1409,7 @@ void destroy_iommu_domain(struct iommu_domain *domain)
  * @pre (from_domain != NULL) || (to_domain != NULL)
  */
 
-int32_t move_pt_device(const struct iommu_domain *from_domain, struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun)
+int32_t move_pt_device(struct iommu_domain *from_domain, struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun)
 {
 	int32_t status = 0;
 	uint16_t bus_local = bus;
@@ -1312,6 +1431,42 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, struct iommu_doma
 	return status;
 }
 
+void iommu_flush_iotlb_range(const struct iommu_domain *domain, uint64_t gpa, uint64_t size)
+{
+	struct dmar_drhd_rt *dmar_unit;
+	uint32_t i;
+
+	/* nothing is cached for a domain without any device */
+	if ((domain != NULL) && (atomic_load32(&domain->nr_devices) != 0U) && (platform_dmar_info != NULL) && (size != 0UL)) {
+		/*
+		 * Submit the invalidations to all the units before waiting for any of
+		 * them, the locks are always taken in the order of the unit index.
+		 * QIE can't change while the lock of a unit is held, so only the
+		 * units with queued invalidation enabled are waited for.
+		 */
+		for (i = 0U; i < platform_dmar_info->drhd_count; i++) {
+			dmar_unit = &dmar_drhd_units[i];
+			if (!dmar_unit->drhd->ignore) {
+				spinlock_obtain(&(dmar_unit->lock));
+				if ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U) {
+					dmar_invalid_iotlb_range(dmar_unit, vmid_to_domainid(domain->vm_id), gpa, size);
+					dmar_qi_submit(dmar_unit);
+				}
+			}
+		}
+
+		for (i = 0U; i < platform_dmar_info->drhd_count; i++) {
+			dmar_unit = &dmar_drhd_units[i];
+			if (!dmar_unit->drhd->ignore) {
+				if ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U) {
+					dmar_qi_wait(dmar_unit);
+				}
+				spinlock_release(&(dmar_unit->lock));
+			}
+		}
+	}
+}
+
 void enable_iommu(void)
 {
 	do_action_for_iommus(dmar_enable);
@@ -1393,8 +1548,9 @@ int32_t dmar_assign_irte(struct intr_source intr_src, union dmar_ir_entry irte,
 		irte.bits.sq = 0x0UL;
 		irte.bits.sid = sid.value;
 		irte.bits.present = 0x1UL;
-		irte.bits.mode = 0x0UL;
-		irte.bits.trigger_mode = trigger_mode;
+		if (irte.bits.mode == 0x0UL) {
+			irte.bits.trigger_mode = trigger_mode;
+		}
 		irte.bits.fpd = 0x0UL;
 		ir_table = (union dmar_ir_entry *)hpa2hva(dmar_unit->ir_table_addr);
 		ir_entry = ir_table + index;
@@ -1402,7 +1558,10 @@ int32_t dmar_assign_irte(struct intr_source intr_src, union dmar_ir_entry irte,
 		ir_entry->entry.lo_64 = irte.entry.lo_64;
 
 		iommu_flush_cache(ir_entry, sizeof(union dmar_ir_entry));
+		spinlock_obtain(&(dmar_unit->lock));
 		dmar_invalid_iec(dmar_unit, index, 0U, false);
+		dmar_qi_flush(dmar_unit);
+		spinlock_release(&(dmar_unit->lock));
 	}
 	return ret;
 }
@@ -1433,6 +1592,9 @@ void dmar_free_irte(struct intr_source intr_src, uint16_t index)
 		ir_entry->bits.present = 0x0UL;
 
 		iommu_flush_cache(ir_entry, sizeof(union dmar_ir_entry));
+		spinlock_obtain(&(dmar_unit->lock));
 		dmar_invalid_iec(dmar_unit, index, 0U, false);
+		dmar_qi_flush(dmar_unit);
+		spinlock_release(&(dmar_unit->lock));
 	}
 }
@@ -44,6 +44,7 @@ void vcpu_thread(struct thread_object *obj)
 		profiling_vmenter_handler(vcpu);
 
 		TRACE_2L(TRACE_VM_ENTER, 0UL, 0UL);
+		vmexit_stats_account(vcpu);
 		ret = run_vcpu(vcpu);
 		if (ret != 0) {
 			pr_fatal("vcpu resume failed");
@@ -51,6 +52,7 @@ void vcpu_thread(struct thread_object *obj)
 			/* Fatal error happened (resume vcpu failed). Stop the vcpu running. */
 			continue;
 		}
+		vmexit_stats_start(vcpu);
 		basic_exit_reason = vcpu->arch.exit_reason & 0xFFFFU;
 		TRACE_2L(TRACE_VM_EXIT, basic_exit_reason, vcpu_get_rip(vcpu));
 
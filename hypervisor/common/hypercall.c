@@ -422,6 +422,43 @@ static void inject_msi_lapic_pt(struct acrn_vm *vm, const struct acrn_msi_entry
 	}
 }
 
+/*
+ * @pre target_vm != NULL
+ * @pre msi != NULL
+ */
+static int32_t inject_msi_to_vm(struct acrn_vm *target_vm, struct acrn_msi_entry *msi)
+{
+	int32_t ret = -1;
+
+	/* For target cpu with lapic pt, send ipi instead of injection via vlapic */
+	if (is_lapic_pt_configured(target_vm)) {
+		enum vm_vlapic_state vlapic_state = check_vm_vlapic_state(target_vm);
+		if (vlapic_state == VM_VLAPIC_X2APIC) {
+			/*
+			 * All the vCPUs of VM are in x2APIC mode and LAPIC is PT
+			 * Inject the vMSI as an IPI directly to VM
+			 */
+			inject_msi_lapic_pt(target_vm, msi);
+			ret = 0;
+		} else if (vlapic_state == VM_VLAPIC_XAPIC) {
+			/*
+			 * All the vCPUs of VM are in xAPIC and use vLAPIC
+			 * Inject using vLAPIC
+			 */
+			ret = vlapic_intr_msi(target_vm, msi->msi_addr, msi->msi_data);
+		} else {
+			/*
+			 * For cases VM_VLAPIC_DISABLED and VM_VLAPIC_TRANSITION
+			 * Silently drop interrupt
+			 */
+		}
+	} else {
+		ret = vlapic_intr_msi(target_vm, msi->msi_addr, msi->msi_data);
+	}
+
+	return ret;
+}
+
 /**
  * @brief inject MSI interrupt
  *
@@ -446,30 +483,69 @@ int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 		if (copy_from_gpa(vm, &msi, param, sizeof(msi)) != 0) {
 			pr_err("%s: Unable copy param to vm\n", __func__);
 		} else {
-			/* For target cpu with lapic pt, send ipi instead of injection via vlapic */
-			if (is_lapic_pt_configured(target_vm)) {
-				enum vm_vlapic_state vlapic_state = check_vm_vlapic_state(target_vm);
-				if (vlapic_state == VM_VLAPIC_X2APIC) {
-					/*
-					 * All the vCPUs of VM are in x2APIC mode and LAPIC is PT
-					 * Inject the vMSI as an IPI directly to VM
-					 */
-					inject_msi_lapic_pt(target_vm, &msi);
-					ret = 0;
-				} else if (vlapic_state == VM_VLAPIC_XAPIC) {
-					/*
-					 * All the vCPUs of VM are in xAPIC and use vLAPIC
-					 * Inject using vLAPIC
-					 */
-					ret = vlapic_intr_msi(target_vm, msi.msi_addr, msi.msi_data);
-				} else {
-					/*
-					 * For cases VM_VLAPIC_DISABLED and VM_VLAPIC_TRANSITION
-					 * Silently drop interrupt
-					 */
+			ret = inject_msi_to_vm(target_vm, &msi);
+		}
+	}
+
+	return ret;
+}
+
+/* entries of a MSI batch copied at a time, to keep them off the stack */
+#define MSI_BATCH_CHUNK		8U
+
+/**
+ * @brief inject a batch of MSI interrupts
+ *
+ * Inject the MSI interrupts of a batch in the order of the entries, each
+ * one is handled as a HC_INJECT_MSI hypercall to its target VM. An entry
+ * which fails to inject doesn't stop the following ones. The entries are
+ * copied from the SOS MSI_BATCH_CHUNK at a time.
+ *
+ * @param vm Pointer to VM data structure
+ * @param param guest physical address. This gpa points to struct acrn_msi_batch
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 if all the entries are injected, the error of the first entry
+ *	   which fails otherwise.
+ */
+int32_t hcall_inject_msi_batch(struct acrn_vm *vm, uint64_t param)
+{
+	int32_t ret = -1, err;
+	uint32_t count, i, j, n;
+	uint16_t vmid;
+	struct acrn_vm *target_vm;
+	struct acrn_msi_batch_entry entries[MSI_BATCH_CHUNK];
+
+	if (copy_from_gpa(vm, &count, param + offsetof(struct acrn_msi_batch, count), sizeof(count)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+	} else if (count > ACRN_MSI_BATCH_MAX) {
+		pr_err("%s: invalid MSI batch count %u\n", __func__, count);
+	} else {
+		ret = 0;
+		for (i = 0U; i < count; i += n) {
+			n = min(count - i, MSI_BATCH_CHUNK);
+			if (copy_from_gpa(vm, entries, param + offsetof(struct acrn_msi_batch, entries) +
+					(i * sizeof(struct acrn_msi_batch_entry)),
+					n * sizeof(struct acrn_msi_batch_entry)) != 0) {
+				pr_err("%s: Unable copy param to vm\n", __func__);
+				if (ret == 0) {
+					ret = -EINVAL;
+				}
+				break;
+			}
+
+			for (j = 0U; j < n; j++) {
+				err = -EINVAL;
+				vmid = rel_vmid_2_vmid(vm->vm_id, entries[j].vmid);
+				if (vmid < CONFIG_MAX_VM_NUM) {
+					target_vm = get_vm_from_vmid(vmid);
+					if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+						err = inject_msi_to_vm(target_vm, &entries[j].msi);
+					}
+				}
+				if ((err != 0) && (ret == 0)) {
+					ret = err;
 				}
-			} else {
-				ret = vlapic_intr_msi(target_vm, msi.msi_addr, msi.msi_data);
 			}
 		}
 	}
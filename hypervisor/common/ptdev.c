@@ -12,10 +12,89 @@
 #include <logmsg.h>
 
 #define PTIRQ_BITMAP_ARRAY_SIZE	INT_DIV_ROUNDUP(CONFIG_MAX_PT_IRQ_ENTRIES, 64U)
+#define PTIRQ_ENTRY_HASHBITS	8U
+#define PTIRQ_ENTRY_HASHSIZE	(1U << PTIRQ_ENTRY_HASHBITS)
 struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
 static uint64_t ptirq_entry_bitmaps[PTIRQ_BITMAP_ARRAY_SIZE];
 spinlock_t ptdev_lock;
 
+/*
+ * The active entries are hashed by their physical sid, and by their VM and
+ * virtual sid, the entries of an intr_type share the buckets with the others.
+ * Both tables are protected by ptdev_lock.
+ */
+static struct hlist_head phys_sid_htable[PTIRQ_ENTRY_HASHSIZE];
+static struct hlist_head virt_sid_htable[PTIRQ_ENTRY_HASHSIZE];
+
+static inline struct hlist_head *ptirq_phys_bucket(const union source_id *sid)
+{
+	return &phys_sid_htable[hash64(sid->value, PTIRQ_ENTRY_HASHBITS)];
+}
+
+/*
+ * @pre vm != NULL
+ */
+static inline struct hlist_head *ptirq_virt_bucket(const union source_id *sid, const struct acrn_vm *vm)
+{
+	return &virt_sid_htable[hash64(sid->value ^ ((uint64_t)vm->vm_id << 48U), PTIRQ_ENTRY_HASHBITS)];
+}
+
+/*
+ * lookup a ptdev entry by sid
+ * Before adding a ptdev remapping, should lookup by physical sid to check
+ * whether the resource has been token by others.
+ * When updating a ptdev remapping, should lookup by virtual sid to check
+ * whether this resource is valid.
+ * @pre: vm must be NULL when lookup by physical sid, otherwise,
+ * vm must not be NULL when lookup by virtual sid.
+ * @pre ptdev_lock is held
+ */
+struct ptirq_remapping_info *ptirq_lookup_entry_by_sid(uint32_t intr_type,
+		const union source_id *sid, const struct acrn_vm *vm)
+{
+	struct hlist_node *pos;
+	struct ptirq_remapping_info *entry;
+	struct ptirq_remapping_info *entry_found = NULL;
+
+	if (vm == NULL) {
+		hlist_for_each(pos, ptirq_phys_bucket(sid)) {
+			entry = hlist_entry(pos, struct ptirq_remapping_info, phys_link);
+			if ((intr_type == entry->intr_type) && (sid->value == entry->phys_sid.value)) {
+				entry_found = entry;
+				break;
+			}
+		}
+	} else {
+		hlist_for_each(pos, ptirq_virt_bucket(sid, vm)) {
+			entry = hlist_entry(pos, struct ptirq_remapping_info, virt_link);
+			if ((intr_type == entry->intr_type) && (vm == entry->vm) &&
+					(sid->value == entry->virt_sid.value)) {
+				entry_found = entry;
+				break;
+			}
+		}
+	}
+	return entry_found;
+}
+
+/*
+ * Move the entry to another VM and/or virtual sid, it's rehashed if active.
+ * @pre vm != NULL
+ * @pre ptdev_lock is held
+ */
+void ptirq_update_virt_sid(struct ptirq_remapping_info *entry, struct acrn_vm *vm,
+		const union source_id *virt_sid)
+{
+	if (is_entry_active(entry)) {
+		hlist_del(&entry->virt_link);
+	}
+	entry->vm = vm;
+	entry->virt_sid.value = virt_sid->value;
+	if (is_entry_active(entry)) {
+		hlist_add_head(&entry->virt_link, ptirq_virt_bucket(&entry->virt_sid, entry->vm));
+	}
+}
+
 static inline uint16_t ptirq_alloc_entry_id(void)
 {
 	uint16_t id = (uint16_t)ffz64_ex(ptirq_entry_bitmaps, CONFIG_MAX_PT_IRQ_ENTRIES);
@@ -112,8 +191,8 @@ void ptirq_release_entry(struct ptirq_remapping_info *entry)
 	del_timer(&entry->intr_delay_timer);
 	CPU_INT_ALL_RESTORE(rflags);
 
-	bitmap_clear_nolock((entry->ptdev_entry_id) & 0x3FU,
-		&ptirq_entry_bitmaps[((entry->ptdev_entry_id) & 0x3FU) >> 6U]);
+	bitmap_clear_lock((entry->ptdev_entry_id) & 0x3FU,
+		&ptirq_entry_bitmaps[(entry->ptdev_entry_id) >> 6U]);
 
 	(void)memset((void *)entry, 0U, sizeof(struct ptirq_remapping_info));
 }
@@ -163,6 +242,8 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 	} else {
 		entry->allocated_pirq = (uint32_t)retval;
 		entry->active = true;
+		hlist_add_head(&entry->phys_link, ptirq_phys_bucket(&entry->phys_sid));
+		hlist_add_head(&entry->virt_link, ptirq_virt_bucket(&entry->virt_sid, entry->vm));
 	}
 
 	return retval;
@@ -170,6 +251,8 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 
 void ptirq_deactivate_entry(struct ptirq_remapping_info *entry)
 {
+	hlist_del(&entry->phys_link);
+	hlist_del(&entry->virt_link);
 	entry->active = false;
 	free_irq(entry->allocated_pirq);
 }
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <list.h>
+#include <per_cpu.h>
+#include <schedule.h>
+
+/* minimum time a thread_object runs before the tick may preempt it */
+#define SCHED_FS_SLICE_MS		10UL
+/* accounting period of the CPU cap */
+#define SCHED_FS_CAP_PERIOD_MS		100UL
+/* how far behind min_vruntime a woken thread_object may be placed */
+#define SCHED_FS_WAKEUP_CREDIT_MS	5UL
+
+struct sched_fs_data {
+	/* keep list as the first item */
+	struct list_head list;
+
+	uint16_t weight;
+	uint16_t cap;
+	/* virtual runtime, the consumed cycles scaled by SCHED_FS_DEFAULT_WEIGHT / weight */
+	uint64_t vruntime;
+	uint64_t last_cycles;
+	uint64_t slice_start;
+	/* cycles consumed in the cap period period_seq */
+	uint64_t period_used;
+	uint64_t period_seq;
+};
+
+/*
+ * @pre obj != NULL
+ * @pre obj->data != NULL
+ */
+static bool fs_is_inqueue(struct thread_object *obj)
+{
+	struct sched_fs_data *data = (struct sched_fs_data *)obj->data;
+	return !list_empty(&data->list);
+}
+
+/*
+ * Insert the thread_object into the runqueue which is ordered by vruntime,
+ * behind all the objects with the same vruntime.
+ *
+ * @pre obj != NULL
+ * @pre obj->data != NULL
+ */
+static void fs_runqueue_add(struct sched_fs_control *fs_ctl, struct thread_object *obj)
+{
+	struct sched_fs_data *data = (struct sched_fs_data *)obj->data;
+	struct sched_fs_data *iter_data;
+	struct list_head *pos, *prev;
+
+	if (!fs_is_inqueue(obj)) {
+		prev = &fs_ctl->runqueue;
+		list_for_each(pos, &fs_ctl->runqueue) {
+			iter_data = list_entry(pos, struct sched_fs_data, list);
+			if (iter_data->vruntime > data->vruntime) {
+				break;
+			}
+			prev = pos;
+		}
+		list_add(&data->list, prev);
+	}
+}
+
+/*
+ * @pre obj != NULL
+ * @pre obj->data != NULL
+ */
+static void fs_runqueue_remove(struct thread_object *obj)
+{
+	struct sched_fs_data *data = (struct sched_fs_data *)obj->data;
+	list_del_init(&data->list);
+}
+
+/*
+ * The consumed cycles are reset lazily when the thread_object is first
+ * accounted in a new cap period.
+ */
+static void fs_sync_period(const struct sched_fs_control *fs_ctl, struct sched_fs_data *data)
+{
+	if (data->period_seq != fs_ctl->period_seq) {
+		data->period_seq = fs_ctl->period_seq;
+		data->period_used = 0UL;
+	}
+}
+
+static bool fs_is_throttled(const struct sched_fs_control *fs_ctl, struct sched_fs_data *data)
+{
+	fs_sync_period(fs_ctl, data);
+
+	return ((data->cap != 0U) &&
+		(data->period_used >= ((SCHED_FS_CAP_PERIOD_MS * CYCLES_PER_MS * data->cap) / 100UL)));
+}
+
+/*
+ * Charge the cycles consumed since last_cycles to the thread_object.
+ */
+static void fs_charge(const struct sched_fs_control *fs_ctl, struct sched_fs_data *data, uint64_t now)
+{
+	uint64_t delta = now - data->last_cycles;
+
+	fs_sync_period(fs_ctl, data);
+	data->vruntime += (delta * SCHED_FS_DEFAULT_WEIGHT) / data->weight;
+	data->period_used += delta;
+	data->last_cycles = now;
+}
+
+static void fs_update_period(struct sched_fs_control *fs_ctl, uint64_t now)
+{
+	if ((now - fs_ctl->period_start) >= (SCHED_FS_CAP_PERIOD_MS * CYCLES_PER_MS)) {
+		fs_ctl->period_start = now;
+		fs_ctl->period_seq++;
+	}
+}
+
+/*
+ * Return the first thread_object in the runqueue which is not throttled,
+ * except the skipped one.
+ */
+static struct thread_object *fs_first_eligible(struct sched_fs_control *fs_ctl, const struct thread_object *skip)
+{
+	struct thread_object *obj = NULL;
+	struct sched_fs_data *data;
+	struct list_head *pos;
+
+	list_for_each(pos, &fs_ctl->runqueue) {
+		data = list_entry(pos, struct sched_fs_data, list);
+		if ((data != (struct sched_fs_data *)skip->data) && !fs_is_throttled(fs_ctl, data)) {
+			obj = list_entry(pos, struct thread_object, data);
+			break;
+		}
+	}
+
+	return obj;
+}
+
+static void sched_tick_handler(void *param)
+{
+	struct sched_control  *ctl = (struct sched_control *)param;
+	struct sched_fs_control *fs_ctl = (struct sched_fs_control *)ctl->priv;
+	struct sched_fs_data *data;
+	struct thread_object *current, *next;
+	uint16_t pcpu_id = get_pcpu_id();
+	uint64_t now = rdtsc();
+	uint64_t rflags;
+
+	obtain_schedule_lock(pcpu_id, &rflags);
+	current = ctl->curr_obj;
+	/* If no vCPU start scheduling, ignore this tick */
+	if ((current != NULL) && !list_empty(&fs_ctl->runqueue)) {
+		fs_update_period(fs_ctl, now);
+		next = fs_first_eligible(fs_ctl, current);
+		if (is_idle_thread(current)) {
+			/* a throttled thread_object may become eligible in a new period */
+			if (next != NULL) {
+				make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+			}
+		} else {
+			data = (struct sched_fs_data *)current->data;
+			fs_charge(fs_ctl, data, now);
+			if (fs_is_throttled(fs_ctl, data)) {
+				make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+			} else if ((next != NULL) && ((now - data->slice_start) >= (SCHED_FS_SLICE_MS * CYCLES_PER_MS)) &&
+					(((struct sched_fs_data *)next->data)->vruntime < data->vruntime)) {
+				make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+			} else {
+				/* keep running current */
+			}
+		}
+	}
+	release_schedule_lock(pcpu_id, rflags);
+}
+
+/*
+ * @pre ctl->pcpu_id == get_pcpu_id()
+ */
+static int32_t sched_fs_init(struct sched_control *ctl)
+{
+	struct sched_fs_control *fs_ctl = &per_cpu(sched_fs_ctl, ctl->pcpu_id);
+	uint64_t tick_period = CYCLES_PER_MS;
+	int32_t ret = 0;
+
+	ASSERT(get_pcpu_id() == ctl->pcpu_id, "Init scheduler on wrong CPU!");
+
+	ctl->priv = fs_ctl;
+	INIT_LIST_HEAD(&fs_ctl->runqueue);
+	fs_ctl->min_vruntime = 0UL;
+	fs_ctl->period_start = rdtsc();
+	fs_ctl->period_seq = 0UL;
+
+	/* The tick_timer is periodically */
+	initialize_timer(&fs_ctl->tick_timer, sched_tick_handler, ctl,
+			rdtsc() + tick_period, TICK_MODE_PERIODIC, tick_period);
+
+	if (add_timer(&fs_ctl->tick_timer) < 0) {
+		pr_err("Failed to add schedule tick timer!");
+		ret = -1;
+	}
+	return ret;
+}
+
+static void sched_fs_deinit(struct sched_control *ctl)
+{
+	struct sched_fs_control *fs_ctl = (struct sched_fs_control *)ctl->priv;
+	del_timer(&fs_ctl->tick_timer);
+}
+
+/*
+ * @pre obj != NULL
+ * @pre obj->sched_weight <= SCHED_FS_MAX_WEIGHT
+ * @pre obj->sched_cap <= 100U
+ */
+static void sched_fs_init_data(struct thread_object *obj)
+{
+	struct sched_fs_control *fs_ctl = &per_cpu(sched_fs_ctl, obj->pcpu_id);
+	struct sched_fs_data *data;
+
+	data = (struct sched_fs_data *)obj->data;
+	INIT_LIST_HEAD(&data->list);
+	data->weight = (obj->sched_weight == 0U) ? SCHED_FS_DEFAULT_WEIGHT : obj->sched_weight;
+	data->cap = obj->sched_cap;
+	data->vruntime = fs_ctl->min_vruntime;
+	data->period_used = 0UL;
+	data->period_seq = fs_ctl->period_seq;
+}
+
+static struct thread_object *sched_fs_pick_next(struct sched_control *ctl)
+{
+	struct sched_fs_control *fs_ctl = (struct sched_fs_control *)ctl->priv;
+	struct thread_object *next = NULL;
+	struct thread_object *current = NULL;
+	struct sched_fs_data *data;
+	uint64_t now = rdtsc();
+
+	current = ctl->curr_obj;
+	fs_update_period(fs_ctl, now);
+	/* Ignore the idle object, account the cycles current ran and requeue it by vruntime */
+	if (!is_idle_thread(current)) {
+		data = (struct sched_fs_data *)current->data;
+		fs_charge(fs_ctl, data, now);
+		if (fs_is_inqueue(current)) {
+			fs_runqueue_remove(current);
+			fs_runqueue_add(fs_ctl, current);
+		}
+	}
+
+	/*
+	 * Pick the runnable object with the smallest vruntime which has not used up its
+	 * cap in the current period, or the idle object if there is no such one.
+	 */
+	next = fs_first_eligible(fs_ctl, &get_cpu_var(idle));
+	if (next != NULL) {
+		data = (struct sched_fs_data *)next->data;
+		data->last_cycles = now;
+		data->slice_start = now;
+		if (data->vruntime > fs_ctl->min_vruntime) {
+			fs_ctl->min_vruntime = data->vruntime;
+		}
+	} else {
+		next = &get_cpu_var(idle);
+	}
+
+	return next;
+}
+
+static void sched_fs_sleep(struct thread_object *obj)
+{
+	fs_runqueue_remove(obj);
+}
+
+/*
+ * A woken thread_object is placed at most SCHED_FS_WAKEUP_CREDIT_MS behind
+ * min_vruntime, so an IO bound thread_object runs soon after its wakeup but
+ * can't bank the time it slept.
+ */
+static void sched_fs_wake(struct thread_object *obj)
+{
+	struct sched_fs_control *fs_ctl = (struct sched_fs_control *)obj->sched_ctl->priv;
+	struct sched_fs_data *data = (struct sched_fs_data *)obj->data;
+	uint64_t credit = SCHED_FS_WAKEUP_CREDIT_MS * CYCLES_PER_MS;
+
+	if ((fs_ctl->min_vruntime > credit) && (data->vruntime < (fs_ctl->min_vruntime - credit))) {
+		data->vruntime = fs_ctl->min_vruntime - credit;
+	}
+	fs_runqueue_add(fs_ctl, obj);
+}
+
+struct acrn_scheduler sched_fs = {
+	.name		= "sched_fs",
+	.init		= sched_fs_init,
+	.init_data	= sched_fs_init_data,
+	.pick_next	= sched_fs_pick_next,
+	.sleep		= sched_fs_sleep,
+	.wake		= sched_fs_wake,
+	.deinit		= sched_fs_deinit,
+};
@@ -78,6 +78,9 @@ void init_sched(uint16_t pcpu_id)
 #endif
 #ifdef CONFIG_SCHED_IORR
 	ctl->scheduler = &sched_iorr;
+#endif
+#ifdef CONFIG_SCHED_FS
+	ctl->scheduler = &sched_fs;
 #endif
 	if (ctl->scheduler->init != NULL) {
 		ctl->scheduler->init(ctl);
@@ -11,6 +11,7 @@
 #include <hypercall.h>
 #include <npk_log.h>
 #include <vm.h>
+#include <ept.h>
 #include <logmsg.h>
 
 #ifdef PROFILING_ON
@@ -152,6 +153,93 @@ static int32_t hcall_get_hw_info(struct acrn_vm *vm, uint64_t param)
 	return ret;
 }
 
+/**
+ * @brief Get the vmexit statistics of a vCPU
+ *
+ * @param vm Pointer to vm data structure
+ * @param param Guest physical address pointing to struct acrn_vmexit_stats
+ *
+ * @pre vm shall point to SOS_VM
+ *
+ * @retval 0 on success
+ * @retval -1 in case of error
+ */
+static int32_t hcall_get_vmexit_stats(struct acrn_vm *vm, uint64_t param)
+{
+	struct acrn_vmexit_stats_hdr hdr;
+	struct acrn_vm *target_vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t vm_id;
+	int32_t ret = -1;
+
+	if (copy_from_gpa(vm, &hdr, param, sizeof(hdr)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+	} else {
+		vm_id = rel_vmid_2_vmid(vm->vm_id, hdr.vmid);
+		if (vm_id < CONFIG_MAX_VM_NUM) {
+			target_vm = get_vm_from_vmid(vm_id);
+			if (!is_poweroff_vm(target_vm) && (hdr.vcpu_id < target_vm->hw.created_vcpus)) {
+				vcpu = vcpu_from_vid(target_vm, hdr.vcpu_id);
+				hdr.pcpu_id = pcpuid_from_vcpu(vcpu);
+				hdr.tsc_khz = get_tsc_khz();
+				/* the statistics are copied from the vcpu directly */
+				if ((copy_to_gpa(vm, &hdr, param, sizeof(hdr)) == 0) &&
+						(copy_to_gpa(vm, vcpu->arch.vmexit_stats,
+						param + offsetof(struct acrn_vmexit_stats, reasons),
+						sizeof(vcpu->arch.vmexit_stats)) == 0)) {
+					if ((hdr.flags & ACRN_VMEXIT_STATS_CLEAR) != 0U) {
+						(void)memset((void *)vcpu->arch.vmexit_stats, 0U,
+								sizeof(vcpu->arch.vmexit_stats));
+					}
+					ret = 0;
+				} else {
+					pr_err("%s: Unable to copy param to vm", __func__);
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Get the page size distribution of the EPT of a VM
+ *
+ * @param vm Pointer to vm data structure
+ * @param param Guest physical address pointing to struct acrn_ept_stats
+ *
+ * @pre vm shall point to SOS_VM
+ *
+ * @retval 0 on success
+ * @retval -1 in case of error
+ */
+static int32_t hcall_get_ept_stats(struct acrn_vm *vm, uint64_t param)
+{
+	struct acrn_ept_stats stats;
+	struct acrn_vm *target_vm;
+	uint16_t vm_id;
+	int32_t ret = -1;
+
+	if (copy_from_gpa(vm, &stats, param, sizeof(stats)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+	} else {
+		vm_id = rel_vmid_2_vmid(vm->vm_id, stats.vmid);
+		if (vm_id < CONFIG_MAX_VM_NUM) {
+			target_vm = get_vm_from_vmid(vm_id);
+			if (!is_poweroff_vm(target_vm)) {
+				get_ept_page_stats(target_vm, &stats);
+				if (copy_to_gpa(vm, &stats, param, sizeof(stats)) == 0) {
+					ret = 0;
+				} else {
+					pr_err("%s: Unable to copy param to vm", __func__);
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
 /**
   * @brief Setup hypervisor debug infrastructure, such as share buffer, NPK log and profiling.
   *
@@ -185,6 +273,14 @@ int32_t hcall_debug(struct acrn_vm *vm, uint64_t param1, uint64_t param2, uint64
 		ret = hcall_get_hw_info(vm, param1);
 		break;
 
+	case HC_GET_VMEXIT_STATS:
+		ret = hcall_get_vmexit_stats(vm, param1);
+		break;
+
+	case HC_GET_EPT_STATS:
+		ret = hcall_get_ept_stats(vm, param1);
+		break;
+
 	default:
 		pr_err("op %d: Invalid hypercall\n", hypcall_id);
 		ret = -EPERM;
@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <cpu.h>
 #include <per_cpu.h>
+#include <atomic.h>
 
 uint32_t sbuf_next_ptr(uint32_t pos_arg,
 		uint32_t span, uint32_t scope)
@@ -42,7 +43,7 @@ uint32_t sbuf_next_ptr(uint32_t pos_arg,
  * negative:	failed.
  */
 
-uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
+static uint32_t sbuf_put_fixed(struct shared_buf *sbuf, uint8_t *data)
 {
 	void *to;
 	uint32_t next_tail;
@@ -50,6 +51,14 @@ uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
 	bool trigger_overwrite = false;
 
 	stac();
+	(void)atomic_inc_return(&sbuf->writers);
+	/* the mode may have been switched since sbuf_put() checked it */
+	if ((sbuf->flags & (SBUF_VARLEN_EN | SBUF_PAUSED)) != 0U) {
+		(void)atomic_dec_return(&sbuf->writers);
+		clac();
+		return 0;
+	}
+
 	next_tail = sbuf_next_ptr(sbuf->tail, sbuf->ele_size, sbuf->size);
 	/* if this write would trigger overrun */
 	if (next_tail == sbuf->head) {
@@ -57,6 +66,7 @@ uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
 		sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
 		if ((sbuf->flags & OVERWRITE_EN) == 0U) {
 			/* if not enable over write, return here. */
+			(void)atomic_dec_return(&sbuf->writers);
 			clac();
 			return 0;
 		}
@@ -74,11 +84,212 @@ uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
 	sbuf->tail = next_tail;
 
 	ele_size = sbuf->ele_size;
+	(void)atomic_dec_return(&sbuf->writers);
 	clac();
 
 	return ele_size;
 }
 
+static inline uint64_t sbuf_rec_hdr_val(uint32_t size, uint16_t type, uint16_t len)
+{
+	/* the layout of struct sbuf_rec_hdr, so a header is published with one store */
+	return ((uint64_t)size | ((uint64_t)type << 32U) | ((uint64_t)len << 48U));
+}
+
+static inline void sbuf_set_rec_hdr(const struct shared_buf *sbuf, uint32_t pos, uint64_t hdr)
+{
+	volatile uint64_t *ptr = (volatile uint64_t *)((void *)sbuf + SBUF_HEAD_SIZE + pos);
+
+	*ptr = hdr;
+}
+
+/**
+ * Reserve a contiguous range of size bytes for one or more records, the
+ * records are filled by sbuf_rsv_put() and published by sbuf_commit().
+ * Lock free, the buf may be shared by several producers. The producer is
+ * counted in writers until sbuf_commit(), so the consumer doesn't reset the
+ * buf under it.
+ *
+ * return:
+ * 0:		reserved
+ * -ENOSPC:	buf is full
+ * -EINVAL:	buf is not in SBUF_VARLEN_EN mode or size is invalid
+ * -EBUSY:	buf is paused by the consumer
+ */
+int32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t size, struct sbuf_rsv *rsv)
+{
+	uint32_t head, tail, start = 0U, next_tail = 0U, used, need;
+	int32_t ret = -EINVAL;
+
+	stac();
+	(void)atomic_inc_return(&sbuf->writers);
+	if ((sbuf->flags & SBUF_PAUSED) != 0U) {
+		ret = -EBUSY;
+	} else if (((sbuf->flags & SBUF_VARLEN_EN) != 0U) && ((sbuf->size & (SBUF_REC_ALIGN - 1U)) == 0U) &&
+			(size >= SBUF_REC_SIZE(0U)) && ((size & (SBUF_REC_ALIGN - 1U)) == 0U) && (size < sbuf->size)) {
+		do {
+			tail = sbuf->tail;
+			head = sbuf->head;
+			if ((tail >= sbuf->size) || ((tail & (SBUF_REC_ALIGN - 1U)) != 0U)) {
+				ret = -EINVAL;
+			} else {
+				/* a record never wraps, skip the rest of the buf if it doesn't fit */
+				if ((tail + size) > sbuf->size) {
+					start = 0U;
+					need = (sbuf->size - tail) + size;
+				} else {
+					start = tail;
+					need = size;
+				}
+				used = (tail >= head) ? (tail - head) : (sbuf->size - (head - tail));
+				if ((used + need) >= sbuf->size) {
+					if ((sbuf->flags & OVERRUN_CNT_EN) != 0U) {
+						atomic_inc32(&sbuf->overrun_cnt);
+					}
+					ret = -ENOSPC;
+				} else {
+					next_tail = sbuf_next_ptr(start, size, sbuf->size);
+					ret = 0;
+				}
+			}
+		} while ((ret == 0) && (atomic_cmpxchg32(&sbuf->tail, tail, next_tail) != tail));
+
+		if (ret == 0) {
+			if (start != tail) {
+				sbuf_set_rec_hdr(sbuf, tail, sbuf_rec_hdr_val(sbuf->size - tail, SBUF_REC_PAD, 0U));
+			}
+			rsv->sbuf = sbuf;
+			rsv->start = start;
+			rsv->pos = start;
+			rsv->end = start + size;
+			rsv->first_hdr = 0UL;
+		}
+	} else {
+		/* -EINVAL */
+	}
+
+	if (ret != 0) {
+		(void)atomic_dec_return(&sbuf->writers);
+	}
+	clac();
+
+	return ret;
+}
+
+/**
+ * Append a record to the reserved range. The header of the first record is
+ * kept in rsv until sbuf_commit(), the consumer can't go past it before.
+ *
+ * return:
+ * 0:		record put
+ * -ENOSPC:	not enough reserved space left
+ */
+int32_t sbuf_rsv_put(struct sbuf_rsv *rsv, uint16_t type, const void *data, uint16_t len)
+{
+	uint32_t rec_size = SBUF_REC_SIZE(len);
+	uint64_t hdr = sbuf_rec_hdr_val(rec_size, type, len);
+	int32_t ret = -ENOSPC;
+
+	if (rec_size <= (rsv->end - rsv->pos)) {
+		stac();
+		if (len != 0U) {
+			(void)memcpy_s((void *)rsv->sbuf + SBUF_HEAD_SIZE + rsv->pos + sizeof(struct sbuf_rec_hdr),
+					len, data, len);
+		}
+		if (rsv->pos == rsv->start) {
+			rsv->first_hdr = hdr;
+		} else {
+			sbuf_set_rec_hdr(rsv->sbuf, rsv->pos, hdr);
+		}
+		clac();
+		rsv->pos += rec_size;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * Publish all the records put into the reserved range, the space which is
+ * not used is padded.
+ */
+void sbuf_commit(struct sbuf_rsv *rsv)
+{
+	uint64_t pad = sbuf_rec_hdr_val(rsv->end - rsv->pos, SBUF_REC_PAD, 0U);
+
+	stac();
+	if (rsv->pos == rsv->start) {
+		rsv->first_hdr = pad;
+	} else if (rsv->pos != rsv->end) {
+		sbuf_set_rec_hdr(rsv->sbuf, rsv->pos, pad);
+	} else {
+		/* the whole range is used */
+	}
+	/* the records must be visible before the first header */
+	cpu_write_memory_barrier();
+	sbuf_set_rec_hdr(rsv->sbuf, rsv->start, rsv->first_hdr);
+	(void)atomic_dec_return(&rsv->sbuf->writers);
+	clac();
+}
+
+/**
+ * Put one record into a SBUF_VARLEN_EN buf.
+ *
+ * return:
+ * size of the record:	write succeeded.
+ * 0:			no write, buf is full or not in SBUF_VARLEN_EN mode
+ */
+uint32_t sbuf_put_rec(struct shared_buf *sbuf, uint16_t type, const void *data, uint16_t len)
+{
+	struct sbuf_rsv rsv;
+	uint32_t ret = 0U;
+
+	if (sbuf_reserve(sbuf, SBUF_REC_SIZE(len), &rsv) == 0) {
+		(void)sbuf_rsv_put(&rsv, type, data, len);
+		sbuf_commit(&rsv);
+		ret = SBUF_REC_SIZE(len);
+	}
+
+	return ret;
+}
+
+/**
+ * The high caller should guarantee each time there must have
+ * sbuf->ele_size data can be write form data and this function
+ * should guarantee execution atomically.
+ *
+ * flag:
+ * If OVERWRITE_EN set, buf can store (ele_num - 1) elements at most.
+ * Should use lock to guarantee that only one read or write at
+ * the same time.
+ * if OVERWRITE_EN not set, buf can store (ele_num - 1) elements
+ * at most. Shouldn't modify the sbuf->head.
+ * If SBUF_VARLEN_EN set, the element is put as a SBUF_REC_DATA record.
+ *
+ * return:
+ * ele_size:	write succeeded.
+ * 0:		no write, buf is full
+ * negative:	failed.
+ */
+
+uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
+{
+	uint32_t flags, ele_size, ret;
+
+	stac();
+	flags = sbuf->flags;
+	ele_size = sbuf->ele_size;
+	clac();
+
+	if ((flags & SBUF_VARLEN_EN) != 0U) {
+		ret = (sbuf_put_rec(sbuf, SBUF_REC_DATA, data, (uint16_t)ele_size) != 0U) ? ele_size : 0U;
+	} else {
+		ret = sbuf_put_fixed(sbuf, data);
+	}
+
+	return ret;
+}
+
 int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva)
 {
 	if ((pcpu_id >= get_pcpu_nums()) || (sbuf_id >= ACRN_SBUF_ID_MAX)) {
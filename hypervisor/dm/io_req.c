@@ -445,10 +445,71 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	return status;
 }
 
+/**
+ * @brief Locate the emulated MMIO regions around an address
+ *
+ * @pre vm->emul_mmio_lock is held
+ *
+ * @return The number of registered regions whose range_start is not above
+ *	   \p address, i.e. the position in vm->emul_mmio_sorted[] of the first
+ *	   region starting above \p address.
+ */
+static uint16_t mmio_sorted_upper_bound(const struct acrn_vm *vm, uint64_t address)
+{
+	uint16_t low = 0U, high = vm->nr_emul_mmio_regions, mid;
+
+	while (low < high) {
+		mid = low + ((high - low) >> 1U);
+		if (vm->emul_mmio[vm->emul_mmio_sorted[mid]].range_start <= address) {
+			low = mid + 1U;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+/**
+ * @brief Find the emulated MMIO region overlapping with an access
+ *
+ * The registered regions do not overlap with each other, so only the last
+ * region starting at or below \p address and the first one starting above
+ * it can overlap with [address, address + size).
+ *
+ * @pre vm->emul_mmio_lock is held
+ *
+ * @return The overlapping region, or NULL if there is none.
+ */
+static struct mem_io_node *find_overlap_mmio_node(struct acrn_vm *vm, uint64_t address, uint64_t size)
+{
+	uint16_t pos = mmio_sorted_upper_bound(vm, address);
+	struct mem_io_node *mmio_node, *overlap = NULL;
+
+	if (pos > 0U) {
+		mmio_node = &(vm->emul_mmio[vm->emul_mmio_sorted[pos - 1U]]);
+		if (address < mmio_node->range_end) {
+			overlap = mmio_node;
+		}
+	}
+
+	if ((overlap == NULL) && (pos < vm->nr_emul_mmio_regions)) {
+		mmio_node = &(vm->emul_mmio[vm->emul_mmio_sorted[pos]]);
+		if ((address + size) > mmio_node->range_start) {
+			overlap = mmio_node;
+		}
+	}
+
+	return overlap;
+}
+
 /**
  * Use registered MMIO handlers on the given request if it falls in the range of
  * any of them.
  *
+ * The region hit last time by the vCPU is checked first, as most accesses from
+ * a vCPU go to the same device in a row.
+ *
  * @pre io_req->io_type == REQ_MMIO
  *
  * @retval 0 Successfully emulated by registered handlers.
@@ -459,46 +520,46 @@ static int32_t
 hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status = -ENODEV;
-	uint16_t idx;
-	uint64_t address, size, base, end;
+	uint64_t address, size;
+	struct acrn_vm *vm = vcpu->vm;
 	struct mmio_request *mmio_req = &io_req->reqs.mmio;
-	struct mem_io_node *mmio_handler = NULL;
+	struct mem_io_node *mmio_handler;
 	hv_mem_io_handler_t read_write = NULL;
 	void *handler_private_data = NULL;
 
-	if (is_sos_vm(vcpu->vm) || is_prelaunched_vm(vcpu->vm)) {
+	if (is_sos_vm(vm) || is_prelaunched_vm(vm)) {
 		read_write = mmio_default_access_handler;
 	}
 
 	address = mmio_req->address;
 	size = mmio_req->size;
 
-	spinlock_obtain(&vcpu->vm->emul_mmio_lock);
-	for (idx = 0U; idx <= vcpu->vm->max_emul_mmio_regions; idx++) {
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		if (mmio_handler->read_write != NULL) {
-			base = mmio_handler->range_start;
-			end = mmio_handler->range_end;
-
-			if (((address + size) <= base) || (address >= end)) {
-				continue;
+	spinlock_obtain(&vm->emul_mmio_lock);
+	mmio_handler = &(vm->emul_mmio[vcpu->mmio_hint]);
+	if ((mmio_handler->read_write == NULL) || (address < mmio_handler->range_start) ||
+			((address + size) > mmio_handler->range_end)) {
+		mmio_handler = find_overlap_mmio_node(vm, address, size);
+		if (mmio_handler != NULL) {
+			if ((address >= mmio_handler->range_start) && ((address + size) <= mmio_handler->range_end)) {
+				vcpu->mmio_hint = (uint16_t)(uint64_t)(mmio_handler - &(vm->emul_mmio[0U]));
 			} else {
-				 if ((address >= base) && ((address + size) <= end)) {
-					read_write = mmio_handler->read_write;
-					handler_private_data = mmio_handler->handler_private_data;
-				} else {
-					pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
-					status = -EIO;
-				}
-				break;
+				pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
+				status = -EIO;
 			}
 		}
 	}
 
-	if ((status == -ENODEV) && (read_write != NULL)) {
-		status = read_write(io_req, handler_private_data);
+	if (status == -ENODEV) {
+		if (mmio_handler != NULL) {
+			read_write = mmio_handler->read_write;
+			handler_private_data = mmio_handler->handler_private_data;
+		}
+
+		if (read_write != NULL) {
+			status = read_write(io_req, handler_private_data);
+		}
 	}
-	spinlock_release(&vcpu->vm->emul_mmio_lock);
+	spinlock_release(&vm->emul_mmio_lock);
 
 	return status;
 }
@@ -603,28 +664,31 @@ void register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
  * This API find match MMIO node from \p vm.
  *
  * @param vm The VM to which the MMIO node is belong to.
+ * @param pos Returns the position of the MMIO node in vm->emul_mmio_sorted[].
+ *
+ * @pre vm->emul_mmio_lock is held
  *
  * @return If there's a match mmio_node return it, otherwise return NULL;
  */
 static inline struct mem_io_node *find_match_mmio_node(struct acrn_vm *vm,
-				uint64_t start, uint64_t end)
+				uint64_t start, uint64_t end, uint16_t *pos)
 {
-	bool found = false;
-	uint16_t idx;
-	struct mem_io_node *mmio_node;
+	uint16_t idx = mmio_sorted_upper_bound(vm, start);
+	struct mem_io_node *mmio_node = NULL;
 
-	for (idx = 0U; idx < CONFIG_MAX_EMULATED_MMIO_REGIONS; idx++) {
-		mmio_node = &(vm->emul_mmio[idx]);
+	if (idx > 0U) {
+		idx--;
+		mmio_node = &(vm->emul_mmio[vm->emul_mmio_sorted[idx]]);
 		if ((mmio_node->range_start == start) && (mmio_node->range_end == end)) {
-			found = true;
-			break;
+			*pos = idx;
+		} else {
+			mmio_node = NULL;
 		}
 	}
 
-	if (!found) {
+	if (mmio_node == NULL) {
 		pr_fatal("%s, vm[%d] no match mmio region [0x%lx, 0x%lx] is found",
 				__func__, vm->vm_id, start, end);
-		mmio_node = NULL;
 	}
 
 	return mmio_node;
@@ -637,20 +701,26 @@ static inline struct mem_io_node *find_match_mmio_node(struct acrn_vm *vm,
  *
  * @param vm The VM to which the MMIO node is belong to.
  *
+ * @pre vm->emul_mmio_lock is held
+ *
  * @return If there's a free mmio_node return it, otherwise return NULL;
  */
 static inline struct mem_io_node *find_free_mmio_node(struct acrn_vm *vm)
 {
 	uint16_t idx;
-	struct mem_io_node *mmio_node = find_match_mmio_node(vm, 0UL, 0UL);
+	struct mem_io_node *mmio_node = NULL;
 
-	if (mmio_node != NULL) {
-		idx = (uint16_t)(uint64_t)(mmio_node - &(vm->emul_mmio[0U]));
-		if (vm->max_emul_mmio_regions < idx) {
-			vm->max_emul_mmio_regions = idx;
+	for (idx = 0U; idx < CONFIG_MAX_EMULATED_MMIO_REGIONS; idx++) {
+		if (vm->emul_mmio[idx].read_write == NULL) {
+			mmio_node = &(vm->emul_mmio[idx]);
+			break;
 		}
 	}
 
+	if (mmio_node == NULL) {
+		pr_fatal("%s, vm[%d] no free mmio region is found", __func__, vm->vm_id);
+	}
+
 	return mmio_node;
 }
 
@@ -665,28 +735,49 @@ static inline struct mem_io_node *find_free_mmio_node(struct acrn_vm *vm)
  * @param end The end of the range (exclusive) \p read_write can emulate
  * @param handler_private_data Handler-specific data which will be passed to \p read_write when called
  *
- * @return None
+ * @retval 0 on success
+ * @retval -EINVAL if \p read_write is NULL, the range is empty or overlaps with a registered one
+ * @retval -ENOMEM if there is no free MMIO node
  */
-void register_mmio_emulation_handler(struct acrn_vm *vm,
+int32_t register_mmio_emulation_handler(struct acrn_vm *vm,
 	hv_mem_io_handler_t read_write, uint64_t start,
 	uint64_t end, void *handler_private_data)
 {
 	struct mem_io_node *mmio_node;
+	uint16_t pos, idx;
+	int32_t ret = -EINVAL;
 
 	/* Ensure both a read/write handler and range check function exist */
 	if ((read_write != NULL) && (end > start)) {
 		spinlock_obtain(&vm->emul_mmio_lock);
-		mmio_node = find_free_mmio_node(vm);
-		if (mmio_node != NULL) {
-			/* Fill in information for this node */
-			mmio_node->read_write = read_write;
-			mmio_node->handler_private_data = handler_private_data;
-			mmio_node->range_start = start;
-			mmio_node->range_end = end;
+		if (find_overlap_mmio_node(vm, start, end - start) != NULL) {
+			pr_fatal("%s, vm[%d] mmio region [0x%lx, 0x%lx] overlaps with a registered one",
+					__func__, vm->vm_id, start, end);
+		} else {
+			mmio_node = find_free_mmio_node(vm);
+			if (mmio_node == NULL) {
+				ret = -ENOMEM;
+			} else {
+				/* Fill in information for this node */
+				mmio_node->read_write = read_write;
+				mmio_node->handler_private_data = handler_private_data;
+				mmio_node->range_start = start;
+				mmio_node->range_end = end;
+
+				/* Keep the index sorted by range_start */
+				pos = mmio_sorted_upper_bound(vm, start);
+				for (idx = vm->nr_emul_mmio_regions; idx > pos; idx--) {
+					vm->emul_mmio_sorted[idx] = vm->emul_mmio_sorted[idx - 1U];
+				}
+				vm->emul_mmio_sorted[pos] = (uint16_t)(uint64_t)(mmio_node - &(vm->emul_mmio[0U]));
+				vm->nr_emul_mmio_regions++;
+				ret = 0;
+			}
 		}
 		spinlock_release(&vm->emul_mmio_lock);
 	}
 
+	return ret;
 }
 
 /**
@@ -704,11 +795,17 @@ void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 					uint64_t start, uint64_t end)
 {
 	struct mem_io_node *mmio_node;
+	uint16_t pos, idx;
 
 	spinlock_obtain(&vm->emul_mmio_lock);
-	mmio_node = find_match_mmio_node(vm, start, end);
+	mmio_node = find_match_mmio_node(vm, start, end, &pos);
 	if (mmio_node != NULL) {
 		(void)memset(mmio_node, 0U, sizeof(struct mem_io_node));
+
+		vm->nr_emul_mmio_regions--;
+		for (idx = pos; idx < vm->nr_emul_mmio_regions; idx++) {
+			vm->emul_mmio_sorted[idx] = vm->emul_mmio_sorted[idx + 1U];
+		}
 	}
 	spinlock_release(&vm->emul_mmio_lock);
 }
@@ -468,7 +468,8 @@ vioapic_init(struct acrn_vm *vm)
 
 	vioapic_reset(vm);
 
-	register_mmio_emulation_handler(vm,
+	/* the first region of the VM, it can't overlap */
+	(void)register_mmio_emulation_handler(vm,
 			vioapic_mmio_access_handler,
 			(uint64_t)VIOAPIC_BASE,
 			(uint64_t)VIOAPIC_BASE + VIOAPIC_SIZE,
@@ -111,10 +111,20 @@ static void vdev_pt_map_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
 
 			addr_lo = round_page_down(addr_lo);
 			addr_hi = round_page_up(addr_hi);
-			register_mmio_emulation_handler(vm, vmsix_handle_table_mmio_access,
-					addr_lo, addr_hi, vdev);
+			/*
+			 * The physical MSI-X table is never mapped to the guest. If the
+			 * guest put the table over another emulated region, its pages
+			 * are left to that handler, or to the DM, and the table is not
+			 * emulated until the BAR is moved.
+			 */
+			if (register_mmio_emulation_handler(vm, vmsix_handle_table_mmio_access,
+					addr_lo, addr_hi, vdev) == 0) {
+				msix->mmio_gpa = vbar->base;
+			} else {
+				pr_err("%s: MSI-X table of %x:%x.%x at 0x%lx is not emulated", __func__,
+					vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f, addr_lo);
+			}
 			ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, addr_lo, addr_hi - addr_lo);
-			msix->mmio_gpa = vbar->base;
 		}
 	}
 }
@@ -244,7 +244,8 @@ void vpci_init(struct acrn_vm *vm)
 	case SOS_VM:
 		pci_mmcfg_base = get_mmcfg_base();
 		vm->vpci.pci_mmcfg_base = pci_mmcfg_base;
-		register_mmio_emulation_handler(vm, vpci_handle_mmconfig_access,
+		/* the MMCONFIG window is apart from the vIOAPIC, and no BAR is mapped yet */
+		(void)register_mmio_emulation_handler(vm, vpci_handle_mmconfig_access,
 			pci_mmcfg_base, pci_mmcfg_base + PCI_MMCONFIG_SIZE, &vm->vpci);
 		/* falls through */
 	case PRE_LAUNCHED_VM:
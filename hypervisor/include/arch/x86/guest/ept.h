@@ -8,6 +8,8 @@
 #define EPT_H
 #include <types.h>
 
+struct acrn_ept_stats;
+
 typedef void (*pge_handler)(uint64_t *pgentry, uint64_t size);
 
 /**
@@ -150,6 +152,16 @@ void *get_ept_entry(struct acrn_vm *vm);
  */
 void walk_ept_table(struct acrn_vm *vm, pge_handler cb);
 
+/**
+ * @brief Count the 4KB, 2MB and 1GB pages mapped in the normal world EPT
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[out] stats the page counts, the other fields are not changed
+ *
+ * @return None
+ */
+void get_ept_page_stats(struct acrn_vm *vm, struct acrn_ept_stats *stats);
+
 /**
  * @brief EPT misconfiguration handling
  *
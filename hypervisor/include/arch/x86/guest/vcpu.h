@@ -27,6 +27,9 @@
 #include <msr.h>
 #include <cpu.h>
 #include <instr_emul.h>
+#ifdef CONFIG_HYPERV_ENABLED
+#include <hyperv.h>
+#endif
 
 /**
  * @brief vcpu
@@ -200,6 +203,11 @@ struct acrn_vcpu_arch {
 	/* per vcpu lapic */
 	struct acrn_vlapic vlapic;
 
+#ifdef CONFIG_HYPERV_ENABLED
+	/* per vcpu Hyper-V SynIC and synthetic timers */
+	struct acrn_hyperv_vcpu hyperv;
+#endif
+
 	struct acrn_vmtrr vmtrr;
 
 	int32_t cur_context;
@@ -223,6 +231,17 @@ struct acrn_vcpu_arch {
 	bool irq_window_enabled;
 	uint32_t nrexits;
 
+#ifdef HV_DEBUG
+	/*
+	 * TSC of the vmexit being handled, 0 if there is none, moved forward by
+	 * the time the vcpu is switched out
+	 */
+	uint64_t vmexit_tsc;
+	/* TSC when the vcpu is switched out */
+	uint64_t switch_out_tsc;
+	struct acrn_vmexit_reason_stats vmexit_stats[ACRN_VMEXIT_REASON_NUM];
+#endif
+
 	/* VCPU context state information */
 	uint32_t exit_reason;
 	uint32_t idt_vectoring_info;
@@ -262,6 +281,7 @@ struct acrn_vcpu {
 
 	struct instr_emul_ctxt inst_ctxt;
 	struct io_request req; /* used by io/ept emulation */
+	uint16_t mmio_hint; /* index in vm->emul_mmio[] of the last hit MMIO region */
 
 	uint64_t reg_cached;
 	uint64_t reg_updated;
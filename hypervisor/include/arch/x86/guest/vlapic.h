@@ -43,9 +43,30 @@
 
 #define VLAPIC_MAXLVT_INDEX	APIC_LVT_CMCI
 
+/* bits of the control word of the posted-interrupt descriptor */
+#define POSTED_INTR_ON		0U
+#define POSTED_INTR_SN		1U
+
+/*
+ * The control word of the posted-interrupt descriptor, as defined by the
+ * VT-d spec for the interrupts posted by the IOMMU. The processor only
+ * uses the ON bit, which is also set when a vLAPIC posts an interrupt.
+ */
+union vlapic_pir_ctrl {
+	uint64_t value;
+	struct {
+		uint32_t on:1;
+		uint32_t sn:1;
+		uint32_t rsvd_1:14;
+		uint32_t nv:8;
+		uint32_t rsvd_2:8;
+		uint32_t ndst;
+	} bits __packed;
+};
+
 struct vlapic_pir_desc {
 	uint64_t pir[4];
-	uint64_t pending;
+	union vlapic_pir_ctrl control;
 	uint64_t unused[3];
 } __aligned(64);
 
@@ -135,6 +156,8 @@ bool vlapic_has_pending_intr(struct acrn_vcpu *vcpu);
  * @pre vcpu != NULL
  */
 uint64_t apicv_get_pir_desc_paddr(struct acrn_vcpu *vcpu);
+void apicv_set_pi_notification(struct acrn_vcpu *vcpu, bool running);
+void apicv_handle_pi_notification(uint16_t pcpu_id);
 
 uint64_t vlapic_get_tsc_deadline_msr(const struct acrn_vlapic *vlapic);
 void vlapic_set_tsc_deadline_msr(struct acrn_vlapic *vlapic, uint64_t val_arg);
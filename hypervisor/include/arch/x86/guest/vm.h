@@ -132,8 +132,10 @@ struct acrn_vm {
 	spinlock_t vm_lock;	/* Spin-lock used to protect vlapic_state modifications for a VM */
 
 	spinlock_t emul_mmio_lock;	/* Used to protect emulation mmio_node concurrent access for a VM */
-	uint16_t max_emul_mmio_regions;	/* max index of the emulated mmio_region */
+	uint16_t nr_emul_mmio_regions;	/* number of the registered emulated mmio_regions */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	/* Indexes into emul_mmio[] of the registered regions, sorted by range_start */
+	uint16_t emul_mmio_sorted[CONFIG_MAX_EMULATED_MMIO_REGIONS];
 
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
 
@@ -237,6 +239,7 @@ bool is_rt_vm(const struct acrn_vm *vm);
 bool has_rt_vm(void);
 bool is_highest_severity_vm(const struct acrn_vm *vm);
 bool vm_hide_mtrr(const struct acrn_vm *vm);
+bool vm_hyperv_vendor_id(const struct acrn_vm *vm);
 void update_vm_vlapic_state(struct acrn_vm *vm);
 enum vm_vlapic_state check_vm_vlapic_state(const struct acrn_vm *vm);
 #endif /* !ASSEMBLER */
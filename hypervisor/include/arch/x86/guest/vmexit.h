@@ -13,6 +13,13 @@ struct vm_exit_dispatch {
 };
 
 int32_t vmexit_handler(struct acrn_vcpu *vcpu);
+#ifdef HV_DEBUG
+void vmexit_stats_start(struct acrn_vcpu *vcpu);
+void vmexit_stats_account(struct acrn_vcpu *vcpu);
+#else
+static inline void vmexit_stats_start(__unused struct acrn_vcpu *vcpu) {}
+static inline void vmexit_stats_account(__unused struct acrn_vcpu *vcpu) {}
+#endif
 int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t cpuid_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu);
@@ -25,7 +25,7 @@
 #define NR_IRQS			256U
 #define IRQ_INVALID		0xffffffffU
 
-#define NR_STATIC_MAPPINGS     (4U)
+#define NR_STATIC_MAPPINGS     (5U)
 
 #define HYPERVISOR_CALLBACK_VHM_VECTOR	0xF3U
 
@@ -41,11 +41,13 @@
 #define NOTIFY_VCPU_VECTOR	(VECTOR_FIXED_START + 1U)
 #define POSTED_INTR_VECTOR	(VECTOR_FIXED_START + 2U)
 #define PMI_VECTOR		(VECTOR_FIXED_START + 3U)
+#define POSTED_INTR_WAKEUP_VECTOR	(VECTOR_FIXED_START + 4U)
 
 #define TIMER_IRQ		(NR_IRQS - 1U)
 #define NOTIFY_VCPU_IRQ		(NR_IRQS - 2U)
 #define POSTED_INTR_IRQ		(NR_IRQS - 3U)
 #define PMI_IRQ			(NR_IRQS - 4U)
+#define POSTED_INTR_WAKEUP_IRQ	(NR_IRQS - 5U)
 
 /* the maximum number of msi entry is 2048 according to PCI
  * local bus specification
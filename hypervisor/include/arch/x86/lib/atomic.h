@@ -33,6 +33,20 @@
 
 #define	BUS_LOCK	"lock ; "
 
+#define build_atomic_load(name, size, type)		\
+static inline type name(const volatile type *ptr)	\
+{							\
+	type ret;					\
+	asm volatile("mov" size " %1,%0"		\
+			: "=r" (ret)			\
+			: "m" (*ptr)			\
+			: "cc", "memory");		\
+	return ret;					\
+}
+build_atomic_load(atomic_load16, "w", uint16_t)
+build_atomic_load(atomic_load32, "l", uint32_t)
+build_atomic_load(atomic_load64, "q", uint64_t)
+
 #define build_atomic_inc(name, size, type)		\
 static inline void name(type *ptr)			\
 {							\
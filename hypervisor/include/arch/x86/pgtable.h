@@ -138,6 +138,7 @@
 #define PML4E_PFN_MASK		0x0000FFFFFFFFF000UL
 #define PDPTE_PFN_MASK		0x0000FFFFFFFFF000UL
 #define PDE_PFN_MASK		0x0000FFFFFFFFF000UL
+#define PTE_PFN_MASK		0x0000FFFFFFFFF000UL
 /**
  * @brief Address space translation
  *
@@ -7,7 +7,8 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-#include <list.h>
+#include <types.h>
+#include <spinlock.h>
 
 /**
  * @brief Timer
@@ -26,18 +27,39 @@ enum tick_mode {
 	TICK_MODE_PERIODIC,	/**< periodic mode */
 };
 
+/**
+ * @brief Maximum number of active timers on one pCPU
+ */
+#define MAX_TIMERS_PER_PCPU	256U
+
+/**
+ * @brief Position in the timer queue of a timer which is not started
+ */
+#define TIMER_NOT_QUEUED	0U
+
+struct hv_timer;
+
 /**
  * @brief Definition of timers for per-cpu
+ *
+ * The active timers are kept in a binary min-heap keyed by fire_tsc, so the
+ * nearest timer is always queue[1] and adding or deleting a timer is O(log n).
+ * A timer may be deleted from another pCPU, so the queue is protected by a
+ * lock.
  */
 struct per_cpu_timers {
-	struct list_head timer_list;	/**< it's for runtime active timer list */
+	spinlock_t lock;					/**< protects the fields below */
+	struct hv_timer *queue[MAX_TIMERS_PER_PCPU + 1U];	/**< 1-based min-heap of active timers */
+	uint32_t nr_timers;					/**< number of active timers */
+	struct hv_timer *running;				/**< timer whose callback is running */
 };
 
 /**
  * @brief Definition of timer
  */
 struct hv_timer {
-	struct list_head node;		/**< link all timers */
+	uint32_t queue_idx;		/**< position in the timer queue, TIMER_NOT_QUEUED if not started */
+	uint16_t pcpu_id;		/**< pCPU whose timer queue holds this timer */
 	enum tick_mode mode;		/**< timer mode: one-shot or periodic */
 	uint64_t fire_tsc;		/**< tsc deadline to interrupt */
 	uint64_t period_in_cycle;	/**< period of the periodic timer in unit of TSC cycles */
@@ -104,7 +126,8 @@ static inline void initialize_timer(struct hv_timer *timer,
 		timer->fire_tsc = fire_tsc;
 		timer->mode = mode;
 		timer->period_in_cycle = period_in_cycle;
-		INIT_LIST_HEAD(&timer->node);
+		timer->queue_idx = TIMER_NOT_QUEUED;
+		timer->pcpu_id = 0U;
 	}
 }
 
@@ -129,7 +152,7 @@ static inline bool timer_expired(const struct hv_timer *timer)
  */
 static inline bool timer_is_started(const struct hv_timer *timer)
 {
-	return (!list_empty(&timer->node));
+	return (timer->queue_idx != TIMER_NOT_QUEUED);
 }
 
 /**
@@ -137,21 +160,25 @@ static inline bool timer_is_started(const struct hv_timer *timer)
  *
  * @param[in] timer Pointer to timer.
  *
+ * The timer is added to the queue of the current pCPU.
+ *
  * @retval 0 on success
  * @retval -EINVAL timer has an invalid value
- *
- * @remark Don't call it in the timer callback function or interrupt content.
+ * @retval -ENOMEM too many timers are active on this pCPU, which is a
+ *	   fatal error in a debug build
  */
 int32_t add_timer(struct hv_timer *timer);
 
 /**
  * @brief Delete a timer.
  *
+ * It may be called on any pCPU. If the callback of the timer is running on
+ * the pCPU of the timer, it runs to completion, but a periodic timer is not
+ * restarted after it.
+ *
  * @param[in] timer Pointer to timer.
  *
  * @return None
- *
- * @remark Don't call it in the timer callback function or interrupt content.
  */
 void del_timer(struct hv_timer *timer);
 
@@ -128,6 +128,9 @@ struct acrn_vm_config {
 	struct acrn_vm_pci_dev_config *pci_devs;	/* point to PCI devices BDF list */
 	struct acrn_vm_os_config os_config;		/* OS information the VM */
 	uint16_t clos;					/* if guest_flags has GUEST_FLAG_CLOS_REQUIRED, then VM use this CLOS */
+	uint16_t sched_weight;				/* pCPU time share of each vCPU for the fair-share scheduler,
+							 * 0 means SCHED_FS_DEFAULT_WEIGHT */
+	uint16_t sched_cap;				/* max percentage of pCPU time of each vCPU, 0 means no cap */
 
 	struct vuart_config vuart[MAX_VUART_NUM_PER_VM];/* vuart configuration for VM */
 } __aligned(8);
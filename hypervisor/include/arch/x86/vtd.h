@@ -59,6 +59,7 @@ struct iommu_domain {
 	uint32_t addr_width;   /* address width of the domain */
 	uint64_t trans_table_ptr;
 	bool iommu_snoop;
+	uint32_t nr_devices;	/* devices translated with this domain, atomic */
 };
 
 union source {
@@ -530,6 +531,24 @@ union dmar_ir_entry {
 		uint64_t svt:2;
 		uint64_t rsvd_3:44;
 	} bits __packed;
+	/* posted-interrupt format, mode is 1 */
+	struct {
+		uint64_t present:1;
+		uint64_t fpd:1;
+		uint64_t rsvd_1:6;
+		uint64_t avail:4;
+		uint64_t rsvd_2:2;
+		uint64_t urgent:1;
+		uint64_t mode:1;
+		uint64_t vector:8;
+		uint64_t rsvd_3:14;
+		uint64_t pda_lo:26;
+		uint64_t sid:16;
+		uint64_t sq:2;
+		uint64_t svt:2;
+		uint64_t rsvd_4:12;
+		uint64_t pda_hi:32;
+	} pi_bits __packed;
 };
 
 #ifdef CONFIG_ACPI_PARSE_ENABLED
@@ -575,7 +594,7 @@ struct iommu_domain;
  * @pre domain != NULL
  *
  */
-int32_t move_pt_device(const struct iommu_domain *from_domain, struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun);
+int32_t move_pt_device(struct iommu_domain *from_domain, struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun);
 
 /**
  * @brief Create a iommu domain for a VM specified by vm_id.
@@ -609,6 +628,21 @@ struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_ta
  */
 void destroy_iommu_domain(struct iommu_domain *domain);
 
+/**
+ * @brief Invalidate the IOTLB entries of a guest physical address range of a domain.
+ *
+ * The range is invalidated with page-selective invalidations if the IOMMUs
+ * support it, or a domain-selective invalidation otherwise. The IOMMUs
+ * process their invalidations concurrently, it returns when all of them have
+ * completed. Nothing is done for a domain without any device assigned.
+ *
+ * @param[in] domain iommu domain, nothing is done if it's NULL
+ * @param[in] gpa start guest physical address of the range
+ * @param[in] size size of the range
+ *
+ */
+void iommu_flush_iotlb_range(const struct iommu_domain *domain, uint64_t gpa, uint64_t size);
+
 /**
  * @brief Enable translation of IOMMUs.
  *
@@ -657,11 +691,24 @@ int32_t init_iommu(void);
  */
 bool iommu_snoop_supported(const struct iommu_domain *iommu);
 
+/**
+ * @brief check if all the IOMMUs support posted interrupts.
+ *
+ * @retval true support
+ * @retval false not support
+ *
+ */
+bool iommu_posted_intr_supported(void);
+
 /**
  * @brief Assign RTE for Interrupt Remapping Table.
  *
+ * The IRTE is in posted-interrupt format if irte.bits.mode is 1, the caller
+ * shall only call it so if iommu_posted_intr_supported() is true.
+ *
  * @param[in] intr_src filled with type of interrupt source and the source
- * @param[in] irte filled with info about interrupt deliverymode, destination and destination mode
+ * @param[in] irte filled with info about interrupt deliverymode, destination and destination mode,
+ *                 or about the posted interrupt
  * @param[in] index into Interrupt Remapping Table
  *
  * @retval -EINVAL if corresponding DMAR is not present
@@ -179,6 +179,21 @@ int32_t hcall_set_irqline(const struct acrn_vm *vm, uint16_t vmid,
  */
 int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 
+/**
+ * @brief inject a batch of MSI interrupts
+ *
+ * Inject the MSI interrupts of a batch in the order of the entries, each
+ * one is handled as a HC_INJECT_MSI hypercall to its target VM.
+ *
+ * @param vm Pointer to VM data structure
+ * @param param guest physical address. This gpa points to struct acrn_msi_batch
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 if all the entries are injected, the error of the first entry
+ *	   which fails otherwise.
+ */
+int32_t hcall_inject_msi_batch(struct acrn_vm *vm, uint64_t param);
+
 /**
  * @brief set ioreq shared buffer
  *
@@ -115,6 +115,8 @@ typedef void (*ptirq_arch_release_fn_t)(const struct ptirq_remapping_info *entry
  * with interrupt handler and softirq.
  */
 struct ptirq_remapping_info {
+	struct hlist_node phys_link;	/* in the phys_sid hash table while active */
+	struct hlist_node virt_link;	/* in the virt_sid hash table while active */
 	uint16_t ptdev_entry_id;
 	uint32_t intr_type;
 	union source_id phys_sid;
@@ -148,6 +150,10 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 void ptirq_release_entry(struct ptirq_remapping_info *entry);
 int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_irq);
 void ptirq_deactivate_entry(struct ptirq_remapping_info *entry);
+struct ptirq_remapping_info *ptirq_lookup_entry_by_sid(uint32_t intr_type,
+		const union source_id *sid, const struct acrn_vm *vm);
+void ptirq_update_virt_sid(struct ptirq_remapping_info *entry, struct acrn_vm *vm,
+		const union source_id *virt_sid);
 
 uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt);
 
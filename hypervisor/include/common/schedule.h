@@ -43,6 +43,9 @@ struct thread_object {
 	switch_t switch_out;
 	switch_t switch_in;
 
+	uint16_t sched_weight;		/* relative share of pCPU time, 0 means the default weight */
+	uint16_t sched_cap;		/* upper limit of pCPU time in percent, 0 means no limit */
+
 	uint8_t data[THREAD_DATA_SIZE];
 };
 
@@ -80,6 +83,7 @@ struct acrn_scheduler {
 };
 extern struct acrn_scheduler sched_noop;
 extern struct acrn_scheduler sched_iorr;
+extern struct acrn_scheduler sched_fs;
 
 struct sched_noop_control {
 	struct thread_object *noop_thread_obj;
@@ -90,6 +94,17 @@ struct sched_iorr_control {
 	struct hv_timer tick_timer;
 };
 
+#define SCHED_FS_DEFAULT_WEIGHT		256U
+#define SCHED_FS_MAX_WEIGHT		4096U
+
+struct sched_fs_control {
+	struct list_head runqueue;	/* runnable thread objects ordered by vruntime */
+	uint64_t min_vruntime;
+	uint64_t period_start;		/* start TSC of the current cap period */
+	uint64_t period_seq;
+	struct hv_timer tick_timer;
+};
+
 bool is_idle_thread(const struct thread_object *obj);
 uint16_t sched_get_pcpuid(const struct thread_object *obj);
 struct thread_object *sched_get_current(uint16_t pcpu_id);
@@ -19,6 +19,8 @@
 /* sbuf flags */
 #define OVERRUN_CNT_EN	(1U << 0U) /* whether overrun counting is enabled */
 #define OVERWRITE_EN	(1U << 1U) /* whether overwrite is enabled */
+#define SBUF_VARLEN_EN	(1U << 2U) /* whether the buf holds variable-length records */
+#define SBUF_PAUSED	(1U << 3U) /* whether the consumer is resetting the buf */
 
 /**
  * (sbuf) head + buf (store (ele_num - 1) elements at most)
@@ -34,6 +36,27 @@
  * |
  * |
  * struct shared_buf *buf
+ *
+ * If SBUF_VARLEN_EN is set, the buf holds variable-length records instead of
+ * elements, and any number of producers may put records concurrently:
+ *
+ * ---------------------------------------------------------------------------
+ * | struct shared_buf | hdr | data | hdr | data | ... | hdr (pad) | unused |
+ * ---------------------------------------------------------------------------
+ *
+ * Each record starts with a struct sbuf_rec_hdr and is SBUF_REC_ALIGN aligned.
+ * A producer reserves space by moving tail forward with cmpxchg, fills its
+ * records and publishes the first header last. A zero header means the record
+ * is reserved but not committed yet, so the consumer must zero the consumed
+ * space before moving head forward. A record never wraps, the space left at
+ * the end of the buf is filled with a SBUF_REC_PAD record instead.
+ * sbuf_put() puts an element as a SBUF_REC_DATA record of ele_size bytes.
+ * OVERWRITE_EN is not supported in this mode, records are dropped if the buf
+ * is full.
+ *
+ * A producer counts itself in writers while it puts data, and drops the data
+ * if SBUF_PAUSED is set. To reset the buf or switch its mode, the consumer
+ * sets SBUF_PAUSED and waits for writers to drop to 0 first.
  */
 
 enum {
@@ -52,12 +75,31 @@ struct shared_buf {
 	uint32_t head;		/* offset from base, to read */
 	uint32_t tail;		/* offset from base, to write */
 	uint32_t flags;
-	uint32_t reserved;
+	int32_t writers;	/* number of producers putting data */
 	uint32_t overrun_cnt;	/* count of overrun */
 	uint32_t size;		/* ele_num * ele_size */
 	uint32_t padding[6];
 };
 
+#define SBUF_REC_ALIGN		8U
+#define SBUF_REC_DATA		0U
+#define SBUF_REC_PAD		0xffffU
+#define SBUF_REC_SIZE(len)	((((uint32_t)(len)) + 8U + (SBUF_REC_ALIGN - 1U)) & ~(SBUF_REC_ALIGN - 1U))
+
+struct sbuf_rec_hdr {
+	uint32_t size;		/* size of the record including the header, 0: not committed */
+	uint16_t type;		/* record type, SBUF_REC_PAD: no data, skipped by the consumer */
+	uint16_t len;		/* length of data */
+};
+
+/* a range of the buf reserved by sbuf_reserve() */
+struct sbuf_rsv {
+	struct shared_buf *sbuf;
+	uint32_t start;		/* offset of the first record */
+	uint32_t pos;		/* offset of the next record */
+	uint32_t end;
+	uint64_t first_hdr;	/* header of the first record, published by sbuf_commit() */
+};
 
 /**
  *@pre sbuf != NULL
@@ -68,4 +110,24 @@ int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva);
 void sbuf_reset(void);
 uint32_t sbuf_next_ptr(uint32_t pos, uint32_t span, uint32_t scope);
 
+/**
+ *@pre sbuf != NULL
+ *@pre rsv != NULL
+ */
+int32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t size, struct sbuf_rsv *rsv);
+/**
+ *@pre rsv != NULL
+ *@pre data != NULL
+ */
+int32_t sbuf_rsv_put(struct sbuf_rsv *rsv, uint16_t type, const void *data, uint16_t len);
+/**
+ *@pre rsv != NULL
+ */
+void sbuf_commit(struct sbuf_rsv *rsv);
+/**
+ *@pre sbuf != NULL
+ *@pre data != NULL
+ */
+uint32_t sbuf_put_rec(struct shared_buf *sbuf, uint16_t type, const void *data, uint16_t len);
+
 #endif /* SHARED_BUFFER_H */
@@ -259,9 +259,11 @@ void   register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
  * @param end The end of the range (exclusive) \p read_write can emulate
  * @param handler_private_data Handler-specific data which will be passed to \p read_write when called
  *
- * @return None
+ * @retval 0 on success
+ * @retval -EINVAL if \p read_write is NULL, the range is empty or overlaps with a registered one
+ * @retval -ENOMEM if there is no free MMIO node
  */
-void register_mmio_emulation_handler(struct acrn_vm *vm,
+int32_t register_mmio_emulation_handler(struct acrn_vm *vm,
 	hv_mem_io_handler_t read_write, uint64_t start,
 	uint64_t end, void *handler_private_data);
 
@@ -23,6 +23,7 @@
 #define ENODEV		19
 /** Indicates that argument is not valid. */
 #define EINVAL		22
+#define ENOSPC		28
 /** Indicates that timeout occurs. */
 #define ETIMEDOUT	110
 
@@ -29,6 +29,8 @@
 #ifndef LIST_H_
 #define LIST_H_
 
+#include <types.h>
+
 struct list_head {
 	struct list_head *next, *prev;
 };
@@ -121,4 +123,49 @@ static inline void list_splice_init(struct list_head *list,
 #define get_first_item(attached, type, member) \
 	((type *)((char *)((attached)->next)-(uint64_t)(&((type *)0)->member)))
 
+/*
+ * Singly headed doubly linked list, for hash table buckets where the
+ * head is half the size of a list_head.
+ */
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+#define INIT_HLIST_HEAD(ptr) ((ptr)->first = NULL)
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+
+	n->next = first;
+	if (first != NULL) {
+		first->pprev = &n->next;
+	}
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void hlist_del(struct hlist_node *n)
+{
+	struct hlist_node *next = n->next;
+	struct hlist_node **pprev = n->pprev;
+
+	*pprev = next;
+	if (next != NULL) {
+		next->pprev = pprev;
+	}
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+#define hlist_entry(ptr, type, member) \
+	((type *)((char *)(ptr)-(uint64_t)(&((type *)0)->member)))
+
+#define hlist_for_each(pos, head) \
+	for ((pos) = (head)->first; (pos) != NULL; (pos) = (pos)->next)
+
 #endif /* LIST_H_ */
@@ -54,4 +54,14 @@ static inline uint8_t calculate_checksum8(const void *buf, uint32_t len)
 	return (uint8_t)(0x100U - calculate_sum8(buf, len));
 }
 
+/**
+ * Multiplicative hash of key into hbits bits.
+ *
+ * @pre 0 < hbits <= 32
+ */
+static inline uint64_t hash64(uint64_t key, uint32_t hbits)
+{
+	return ((key * 0x61c8864680b583ebUL) >> (64U - hbits));
+}
+
 #endif /* UTIL_H */
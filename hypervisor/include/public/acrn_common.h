@@ -53,6 +53,7 @@
 #define GUEST_FLAG_CLOS_REQUIRED		(1UL << 3U)     /* Whether CLOS is required */
 #define GUEST_FLAG_HIDE_MTRR			(1UL << 4U)  	/* Whether hide MTRR from VM */
 #define GUEST_FLAG_RT				(1UL << 5U)     /* Whether the vm is RT-VM */
+#define GUEST_FLAG_HYPERV_VENDOR_ID		(1UL << 6U)     /* Whether to report the Hyper-V vendor ID to the VM */
 
 /* TODO: We may need to get this addr from guest ACPI instead of hardcode here */
 #define VIRTUAL_PM1A_CNT_ADDR		0x404U
@@ -499,6 +500,136 @@ struct acrn_msi_entry {
 	uint64_t msi_data;
 } __aligned(8);
 
+/** Maximum number of MSI entries of one HC_INJECT_MSI_BATCH hypercall */
+#define ACRN_MSI_BATCH_MAX	32U
+
+/**
+ * @brief Info to inject a MSI interrupt to the specified VM
+ *
+ * one entry of the HC_INJECT_MSI_BATCH hypercall parameter
+ */
+struct acrn_msi_batch_entry {
+	/** ID of the target VM, relative to SOS */
+	uint16_t vmid;
+
+	/** Reserved */
+	uint16_t reserved[3];
+
+	/** the MSI to inject */
+	struct acrn_msi_entry msi;
+} __aligned(8);
+
+/**
+ * @brief Info to inject a batch of MSI interrupts
+ *
+ * the parameter for HC_INJECT_MSI_BATCH hypercall, the entries are
+ * injected in the order of the array
+ */
+struct acrn_msi_batch {
+	/** number of valid entries, no more than ACRN_MSI_BATCH_MAX */
+	uint32_t count;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** MSI entries to inject */
+	struct acrn_msi_batch_entry entries[ACRN_MSI_BATCH_MAX];
+} __aligned(8);
+
+/** number of the VMX basic exit reasons */
+#define ACRN_VMEXIT_REASON_NUM		65U
+/** number of the buckets of the vmexit latency histogram */
+#define ACRN_VMEXIT_HIST_BUCKETS	16U
+/** log2 of the upper bound of the first bucket, in TSC cycles */
+#define ACRN_VMEXIT_HIST_SHIFT		8U
+
+/** clear the statistics after they are read */
+#define ACRN_VMEXIT_STATS_CLEAR		(1U << 0U)
+
+/**
+ * vmexit statistics of one exit reason
+ */
+struct acrn_vmexit_reason_stats {
+	/** number of the vmexits */
+	uint64_t count;
+
+	/**
+	 * TSC cycles from the vmexits to the next vmentries, excluding the time
+	 * the vCPU is switched out
+	 */
+	uint64_t cycles;
+
+	/** max TSC cycles of one vmexit */
+	uint64_t max_cycles;
+
+	/**
+	 * log2 latency histogram, bucket i (0 < i < ACRN_VMEXIT_HIST_BUCKETS - 1)
+	 * counts the vmexits taking [2^(i + ACRN_VMEXIT_HIST_SHIFT - 1),
+	 * 2^(i + ACRN_VMEXIT_HIST_SHIFT)) cycles, the first and the last buckets
+	 * count all the shorter and longer ones.
+	 */
+	uint32_t hist[ACRN_VMEXIT_HIST_BUCKETS];
+} __aligned(8);
+
+/**
+ * the header of struct acrn_vmexit_stats
+ */
+struct acrn_vmexit_stats_hdr {
+	/** IN: ID of the VM, relative to SOS */
+	uint16_t vmid;
+
+	/** IN: ID of the vCPU */
+	uint16_t vcpu_id;
+
+	/** IN: ACRN_VMEXIT_STATS_CLEAR */
+	uint32_t flags;
+
+	/** OUT: physical CPU the vCPU runs on */
+	uint16_t pcpu_id;
+
+	/** Reserved */
+	uint16_t reserved;
+
+	/** OUT: TSC frequency in KHz */
+	uint32_t tsc_khz;
+} __aligned(8);
+
+/**
+ * the parameter for HC_GET_VMEXIT_STATS hypercall, IC_GET_VMEXIT_STATS ioctl
+ */
+struct acrn_vmexit_stats {
+	struct acrn_vmexit_stats_hdr hdr;
+
+	/** OUT: statistics indexed by the basic exit reason */
+	struct acrn_vmexit_reason_stats reasons[ACRN_VMEXIT_REASON_NUM];
+} __aligned(8);
+
+/**
+ * the parameter for HC_GET_EPT_STATS hypercall, IC_GET_EPT_STATS ioctl
+ */
+struct acrn_ept_stats {
+	/** IN: ID of the VM, relative to SOS */
+	uint16_t vmid;
+
+	/** Reserved */
+	uint16_t reserved0;
+
+	/** Reserved */
+	uint32_t reserved1;
+
+	/** OUT: number of the 4KB pages mapped in the normal world EPT */
+	uint64_t pages_4k;
+
+	/** OUT: number of the 2MB pages mapped in the normal world EPT */
+	uint64_t pages_2m;
+
+	/** OUT: number of the 1GB pages mapped in the normal world EPT */
+	uint64_t pages_1g;
+
+	/** OUT: number of the page tables of 4KB pages in the normal world EPT */
+	uint64_t page_tables;
+} __aligned(8);
+
 /**
  * @brief Info to inject a NMI interrupt for a VM
  */
@@ -45,6 +45,7 @@
 #define HC_INJECT_MSI               BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x03UL)
 #define HC_VM_INTR_MONITOR          BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x04UL)
 #define HC_SET_IRQLINE              BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x05UL)
+#define HC_INJECT_MSI_BATCH         BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x06UL)
 
 /* DM ioreq management */
 #define HC_ID_IOREQ_BASE            0x30UL
@@ -71,6 +72,8 @@
 #define HC_SETUP_HV_NPK_LOG         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x01UL)
 #define HC_PROFILING_OPS            BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x02UL)
 #define HC_GET_HW_INFO              BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x03UL)
+#define HC_GET_VMEXIT_STATS         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x04UL)
+#define HC_GET_EPT_STATS            BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x05UL)
 
 /* Trusty */
 #define HC_ID_TRUSTY_BASE           0x70UL
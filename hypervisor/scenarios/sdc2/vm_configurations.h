@@ -13,7 +13,8 @@
 
 /* Bits mask of guest flags that can be programmed by device model. Other bits are set by hypervisor only */
 #define DM_OWNED_GUEST_FLAG_MASK	(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \
-						GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)
+						GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | \
+						GUEST_FLAG_HYPERV_VENDOR_ID)
 
 #define SOS_VM_BOOTARGS			SOS_ROOTFS	\
 					"rw rootwait "	\
@@ -51,7 +51,8 @@ def gen_sdc_header(vm_info, config):
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
-          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | \\\n" +
+          "\t\t\t\t\t\tGUEST_FLAG_HYPERV_VENDOR_ID)", file=config)
 
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
@@ -102,7 +103,8 @@ def gen_sdc2_header(vm_info, config):
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
-          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | \\\n" +
+          "\t\t\t\t\t\tGUEST_FLAG_HYPERV_VENDOR_ID)", file=config)
 
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
@@ -231,7 +233,8 @@ def gen_industry_header(vm_info, config):
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t(GUEST_FLAG_SECURE_WORLD_ENABLED | " +
           "GUEST_FLAG_LAPIC_PASSTHROUGH | \\", file=config)
-    print("\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+    print("\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | \\\n" +
+          "\t\t\t\t\t\tGUEST_FLAG_HYPERV_VENDOR_ID)", file=config)
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
     print('\t\t\t\t\t"rw rootwait "\t\\', file=config)
@@ -265,7 +268,8 @@ def gen_hybrid_header(vm_info, config):
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
-          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | \\\n" +
+          "\t\t\t\t\t\tGUEST_FLAG_HYPERV_VENDOR_ID)", file=config)
 
     print("", file=config)
     print("#define CONFIG_MAX_VM_NUM\t\t({0}U + CONFIG_MAX_KATA_VM_NUM)".format(
@@ -49,6 +49,37 @@ struct mngr_msg {
 		/* ack of DM_QUERY */
 		int state;
 
+		/* req and ack of DM_EVSTATS, times are in ns */
+		struct dm_evstats {
+			int loop;	/* index of the event dispatch loop */
+			int err;	/* -1 if there is no such loop */
+			char name[16];
+			unsigned long long wakeups;
+			unsigned long long events;
+			unsigned long long lat_total_ns;
+			unsigned long long lat_max_ns;
+			unsigned long long run_total_ns;
+			unsigned long long run_max_ns;
+			/* dispatch latency <1us, <4us, <16us, ... */
+			unsigned long long lat_hist[8];
+		} evstats;
+
+		/* req and ack of DM_VQSTATS */
+		struct dm_vqstats {
+			int idx;	/* index of the polled virtqueue */
+			int err;	/* -1 if there is no such virtqueue */
+			char name[16];
+			int slot;
+			int queue;
+			int polling;
+			unsigned long long kicks;
+			unsigned long long kicks_avoided;
+			unsigned long long poll_hits;
+			unsigned long long poll_misses;
+			unsigned long long poll_enter;
+			unsigned long long poll_exit;
+		} vqstats;
+
 		/* req of ACRND_TIMER */
 		struct req_acrnd_timer {
 			char name[MAX_VMNAME_LEN];
@@ -98,6 +129,8 @@ enum dm_msgid {
 	DM_CONTINUE,		/* Unfreeze this virtual machine */
 	DM_QUERY,		/* Ask power state of this UOS */
 	DM_BLKRESCAN,		/* Rescan virtio-blk device for any changes in UOS */
+	DM_EVSTATS,		/* Ask counters of an event dispatch loop */
+	DM_VQSTATS,		/* Ask poll mode counters of a virtqueue */
 	DM_MAX,
 };
 
@@ -461,6 +461,81 @@ int resume_vm(const char *vmname, unsigned reason)
 	return ack.data.err;
 }
 
+int evstats_vm(const char *vmname)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct dm_evstats *ev = &ack.data.evstats;
+	int i, loop;
+
+	printf("%-12s %12s %12s %10s %10s %10s %10s\n", "LOOP", "WAKEUPS",
+		"EVENTS", "LAT_AVG", "LAT_MAX", "RUN_AVG", "RUN_MAX");
+
+	for (loop = 0; ; loop++) {
+		req.magic = MNGR_MSG_MAGIC;
+		req.msgid = DM_EVSTATS;
+		req.timestamp = time(NULL);
+		req.data.evstats.loop = loop;
+
+		ack.data.evstats.err = -1;
+		if (send_msg(vmname, &req, &ack) != 0 || ev->err)
+			break;
+
+		printf("%-12s %12llu %12llu %8lluus %8lluus %8lluus %8lluus\n",
+			ev->name, ev->wakeups, ev->events,
+			ev->events ? ev->lat_total_ns / ev->events / 1000 : 0,
+			ev->lat_max_ns / 1000,
+			ev->events ? ev->run_total_ns / ev->events / 1000 : 0,
+			ev->run_max_ns / 1000);
+		printf("%-12s", "  latency");
+		for (i = 0; i < 8; i++)
+			printf(" %llu", ev->lat_hist[i]);
+		printf("\n");
+	}
+
+	if (loop == 0) {
+		printf("Unable to get event stats of vm\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int vqstats_vm(const char *vmname)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct dm_vqstats *vs = &ack.data.vqstats;
+	int idx;
+
+	printf("%-12s %4s %5s %6s %12s %14s %12s %12s %8s %8s\n", "DEVICE", "SLOT",
+		"QUEUE", "MODE", "KICKS", "KICKS_AVOIDED", "POLL_HITS",
+		"POLL_MISSES", "ENTER", "EXIT");
+
+	for (idx = 0; ; idx++) {
+		req.magic = MNGR_MSG_MAGIC;
+		req.msgid = DM_VQSTATS;
+		req.timestamp = time(NULL);
+		req.data.vqstats.idx = idx;
+
+		ack.data.vqstats.err = -1;
+		if (send_msg(vmname, &req, &ack) != 0 || vs->err)
+			break;
+
+		printf("%-12s %4d %5d %6s %12llu %14llu %12llu %12llu %8llu %8llu\n",
+			vs->name, vs->slot, vs->queue, vs->polling ? "poll" : "notify",
+			vs->kicks, vs->kicks_avoided, vs->poll_hits, vs->poll_misses,
+			vs->poll_enter, vs->poll_exit);
+	}
+
+	if (idx == 0) {
+		printf("No virtqueue in poll mode, see --virtio_poll of acrn-dm\n");
+		return -1;
+	}
+
+	return 0;
+}
+
 int blkrescan_vm(const char *vmname, char *devargs)
 {
 	struct mngr_msg req;
@@ -38,6 +38,8 @@
 #define RESUME_DESC    "Resume virtual machine from suspend state"
 #define RESET_DESC     "Stop and then start virtual machine VM_NAME"
 #define BLKRESCAN_DESC  "Rescan virtio-blk device attached to a virtual machine"
+#define EVSTATS_DESC   "Show the event dispatch counters of virtual machine VM_NAME"
+#define VQSTATS_DESC   "Show the virtqueue poll mode counters of virtual machine VM_NAME"
 
 #define VM_NAME (1)
 #define CMD_ARGS (2)
@@ -439,6 +441,42 @@ static int acrnctl_do_blkrescan(int argc, char *argv[])
 	return 0;
 }
 
+static int acrnctl_do_evstats(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for evstats\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return evstats_vm(argv[VM_NAME]);
+}
+
+static int acrnctl_do_vqstats(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for vqstats\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return vqstats_vm(argv[VM_NAME]);
+}
+
 static int acrnctl_do_stop(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
@@ -801,6 +839,8 @@ struct acrnctl_cmd acmds[] = {
 	ACMD("resume", acrnctl_do_resume, RESUME_DESC, df_valid_args),
 	ACMD("reset", acrnctl_do_reset, RESET_DESC, df_valid_args),
 	ACMD("blkrescan", acrnctl_do_blkrescan, BLKRESCAN_DESC, valid_blkrescan_args),
+	ACMD("evstats", acrnctl_do_evstats, EVSTATS_DESC, valid_start_args),
+	ACMD("vqstats", acrnctl_do_vqstats, VQSTATS_DESC, valid_start_args),
 };
 
 #define NCMD	(sizeof(acmds)/sizeof(struct acrnctl_cmd))
@@ -59,5 +59,7 @@ int continue_vm(const char *vmname);
 int suspend_vm(const char *vmname);
 int resume_vm(const char *vmname, unsigned reason);
 int blkrescan_vm(const char *vmname, char *devargs);
+int evstats_vm(const char *vmname);
+int vqstats_vm(const char *vmname);
 
 #endif				/* _ACRNCTL_H_ */
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * acrnstat - print the per-vCPU vmexit statistics kept by the hypervisor,
+ * or the page size distribution of the EPT of the VMs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+
+#include "types.h"
+#include "acrn_common.h"
+#include "vhm_ioctl_defs.h"
+
+#define VHM_DEV		"/dev/acrn_vhm"
+#define MAX_VM_NUM	16
+#define MAX_VCPU_NUM	64
+
+#define pr_err(fmt, ...)	fprintf(stderr, "acrnstat: " fmt, ##__VA_ARGS__)
+
+static const char *exit_reason_names[ACRN_VMEXIT_REASON_NUM] = {
+	[0] = "EXCEPTION_OR_NMI",
+	[1] = "EXTERNAL_INTERRUPT",
+	[2] = "TRIPLE_FAULT",
+	[7] = "INTERRUPT_WINDOW",
+	[8] = "NMI_WINDOW",
+	[9] = "TASK_SWITCH",
+	[10] = "CPUID",
+	[12] = "HLT",
+	[14] = "INVLPG",
+	[16] = "RDTSC",
+	[18] = "VMCALL",
+	[28] = "CR_ACCESS",
+	[29] = "DR_ACCESS",
+	[30] = "IO_INSTRUCTION",
+	[31] = "RDMSR",
+	[32] = "WRMSR",
+	[33] = "ENTRY_FAILURE_INVALID_GUEST_STATE",
+	[36] = "MWAIT",
+	[37] = "MONITOR_TRAP",
+	[39] = "MONITOR",
+	[40] = "PAUSE",
+	[43] = "TPR_BELOW_THRESHOLD",
+	[44] = "APICV_ACCESS",
+	[45] = "APICV_VIRT_EOI",
+	[48] = "EPT_VIOLATION",
+	[49] = "EPT_MISCONFIGURATION",
+	[51] = "RDTSCP",
+	[52] = "VMX_PREEMPTION_TIMER",
+	[53] = "INVVPID",
+	[54] = "WBINVD",
+	[55] = "XSETBV",
+	[56] = "APICV_WRITE",
+	[57] = "RDRAND",
+	[58] = "INVPCID",
+	[61] = "RDSEED",
+	[63] = "XSAVES",
+	[64] = "XRSTORS",
+};
+
+static int vm_id = -1;
+static int vcpu_id = -1;
+static bool show_hist;
+static bool do_clear;
+static bool show_ept;
+
+static void usage(void)
+{
+	printf("acrnstat - print the vmexit statistics of the vCPUs\n"
+	       "[Usage] acrnstat [-v vm_id] [-c vcpu_id] [-H] [-r] [-e]\n\n"
+	       "[Options]\n"
+	       "\t-h: print this message\n"
+	       "\t-v: only print the VM of vm_id, relative to the SOS\n"
+	       "\t-c: only print the vCPU of vcpu_id\n"
+	       "\t-H: print the latency histograms\n"
+	       "\t-r: clear the statistics after they are printed\n"
+	       "\t-e: print the EPT page sizes of the VMs instead\n");
+}
+
+static const char *exit_reason_name(uint32_t reason, char *buf, size_t len)
+{
+	if (exit_reason_names[reason])
+		return exit_reason_names[reason];
+
+	snprintf(buf, len, "REASON_%u", reason);
+	return buf;
+}
+
+/* bounds of the histogram bucket, in TSC cycles */
+static void hist_bounds(uint32_t bucket, uint64_t *from, uint64_t *to)
+{
+	*from = (bucket == 0) ? 0 : (1UL << (bucket + ACRN_VMEXIT_HIST_SHIFT - 1));
+	*to = (bucket == ACRN_VMEXIT_HIST_BUCKETS - 1) ? 0 :
+		(1UL << (bucket + ACRN_VMEXIT_HIST_SHIFT));
+}
+
+static void print_stats(const struct acrn_vmexit_stats *stats)
+{
+	const struct acrn_vmexit_reason_stats *rs;
+	double mhz = stats->hdr.tsc_khz / 1000.0;
+	uint64_t from, to, nr = 0;
+	char name_buf[16];
+	uint32_t r, b;
+
+	printf("VM %u vCPU %u (pCPU %u), time switched out excluded\n", stats->hdr.vmid,
+		stats->hdr.vcpu_id, stats->hdr.pcpu_id);
+	printf("  %-34s %12s %16s %12s %12s\n", "Exit_Reason", "NR_Exit",
+		"Time(us)", "Avg(us)", "Max(us)");
+
+	for (r = 0; r < ACRN_VMEXIT_REASON_NUM; r++) {
+		rs = &stats->reasons[r];
+		if (rs->count == 0)
+			continue;
+
+		nr += rs->count;
+		printf("  %-34s %12lu %16.1f %12.3f %12.3f\n",
+			exit_reason_name(r, name_buf, sizeof(name_buf)), rs->count,
+			rs->cycles / mhz, rs->cycles / mhz / rs->count, rs->max_cycles / mhz);
+
+		if (!show_hist)
+			continue;
+
+		for (b = 0; b < ACRN_VMEXIT_HIST_BUCKETS; b++) {
+			if (rs->hist[b] == 0)
+				continue;
+			hist_bounds(b, &from, &to);
+			if (to != 0)
+				printf("      [%10.3f, %10.3f) us %12u\n", from / mhz, to / mhz, rs->hist[b]);
+			else
+				printf("      [%10.3f,        inf) us %12u\n", from / mhz, rs->hist[b]);
+		}
+	}
+
+	if (nr == 0)
+		printf("  no vmexit\n");
+	printf("\n");
+}
+
+/* return -1 if the vCPU doesn't exist */
+static int dump_vcpu(int fd, int vm, int vcpu)
+{
+	struct acrn_vmexit_stats *stats;
+	int ret;
+
+	stats = calloc(1, sizeof(*stats));
+	if (!stats)
+		return -1;
+
+	stats->hdr.vmid = vm;
+	stats->hdr.vcpu_id = vcpu;
+	stats->hdr.flags = do_clear ? ACRN_VMEXIT_STATS_CLEAR : 0;
+
+	ret = ioctl(fd, IC_GET_VMEXIT_STATS, stats);
+	if (ret == 0)
+		print_stats(stats);
+
+	free(stats);
+	return ret;
+}
+
+/* return -1 if the VM doesn't exist */
+static int dump_ept(int fd, int vm)
+{
+	struct acrn_ept_stats stats;
+	uint64_t mapped;
+	int ret;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.vmid = vm;
+
+	ret = ioctl(fd, IC_GET_EPT_STATS, &stats);
+	if (ret == 0) {
+		mapped = (stats.pages_4k << 12) + (stats.pages_2m << 21) + (stats.pages_1g << 30);
+		printf("VM %d: %lu MB mapped\n", vm, mapped >> 20);
+		printf("  %-6s %12s %12s\n", "Size", "Pages", "MB");
+		printf("  %-6s %12lu %12lu\n", "4K", stats.pages_4k, stats.pages_4k >> 8);
+		printf("  %-6s %12lu %12lu\n", "2M", stats.pages_2m, stats.pages_2m << 1);
+		printf("  %-6s %12lu %12lu\n", "1G", stats.pages_1g, stats.pages_1g << 10);
+		printf("  %lu page tables of 4K pages\n\n", stats.page_tables);
+	}
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, fd, vm, vcpu, found = 0;
+
+	while ((opt = getopt(argc, argv, "hv:c:Hre")) != -1) {
+		switch (opt) {
+		case 'v':
+			vm = strtol(optarg, NULL, 0);
+			if ((vm < 0) || (vm >= MAX_VM_NUM)) {
+				pr_err("'-v' requires a vm_id in [0, %d)\n", MAX_VM_NUM);
+				return EXIT_FAILURE;
+			}
+			vm_id = vm;
+			break;
+		case 'c':
+			vcpu = strtol(optarg, NULL, 0);
+			if ((vcpu < 0) || (vcpu >= MAX_VCPU_NUM)) {
+				pr_err("'-c' requires a vcpu_id in [0, %d)\n", MAX_VCPU_NUM);
+				return EXIT_FAILURE;
+			}
+			vcpu_id = vcpu;
+			break;
+		case 'H':
+			show_hist = true;
+			break;
+		case 'r':
+			do_clear = true;
+			break;
+		case 'e':
+			show_ept = true;
+			break;
+		case 'h':
+		default:
+			usage();
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	fd = open(VHM_DEV, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		pr_err("failed to open %s, errno %d\n", VHM_DEV, errno);
+		return EXIT_FAILURE;
+	}
+
+	for (vm = 0; vm < MAX_VM_NUM; vm++) {
+		if ((vm_id >= 0) && (vm != vm_id))
+			continue;
+
+		if (show_ept) {
+			if (dump_ept(fd, vm) == 0)
+				found++;
+			continue;
+		}
+
+		for (vcpu = 0; vcpu < MAX_VCPU_NUM; vcpu++) {
+			if ((vcpu_id >= 0) && (vcpu != vcpu_id))
+				continue;
+			/* the vCPUs of a VM are numbered from 0 */
+			if (dump_vcpu(fd, vm, vcpu) < 0)
+				break;
+			found++;
+		}
+	}
+
+	close(fd);
+
+	if (found == 0) {
+		pr_err("no statistics, the hypervisor is a release build or the VM doesn't exist\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
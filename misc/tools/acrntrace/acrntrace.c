@@ -30,7 +30,7 @@ static int exiting = 0;
 
 /* for opt */
 static uint64_t period = 10000;
-static const char optString[] = "i:hcrt:a:";
+static const char optString[] = "i:hcrt:a:v";
 static const char dev_prefix[] = "acrn_trace_";
 
 static uint32_t flags = FLAG_CLEAR_BUF;
@@ -44,14 +44,15 @@ static struct bitmask *cpu_bitmask = NULL;
 static void display_usage(void)
 {
 	printf("acrntrace - tool to collect ACRN trace data\n"
-	       "[Usage] acrntrace [-i period] [-t max_time] [-ch]\n\n"
+	       "[Usage] acrntrace [-i period] [-t max_time] [-chv]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-i: period_in_ms: specify polling interval [1-999]\n"
 	       "\t-t: max time to capture trace data (in second)\n"
 	       "\t-c: clear the buffered old data (deprecated)\n"
 	       "\t-r: capture the buffered old data instead of clearing it\n"
-	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n");
+	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n"
+	       "\t-v: capture the trace data as variable-length records\n");
 }
 
 static void timer_handler(union sigval sv)
@@ -130,6 +131,9 @@ static int parse_opt(int argc, char *argv[])
 		case 'a':
 			cpu_bitmask = numa_parse_cpustring_all(optarg);
 			break;
+		case 'v':
+			flags |= FLAG_VARLEN;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -234,7 +238,17 @@ static void reader_fn(param_t * param)
 	if (flags & FLAG_CLEAR_BUF)
 		sbuf_clear_buffered(sbuf);
 
+	/* Keep the old data in the format it was captured */
+	if (!!(flags & FLAG_VARLEN) != !!(sbuf->flags & SBUF_VARLEN_EN)) {
+		while (sbuf_write(fd, sbuf) > 0)
+			;
+		if (sbuf_set_varlen(sbuf, flags & FLAG_VARLEN) < 0)
+			pr_err("Failed to switch the format of sbuf[%u]\n",
+				param->devid);
+	}
+
 	while (1) {
+		/* all the buffered data is flushed by one writev at most */
 		do {
 			ret = sbuf_write(fd, sbuf);
 		} while (ret > 0);
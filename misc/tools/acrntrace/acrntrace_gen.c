@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * acrntrace_gen - write a synthetic capture, laid out as the one of acrntrace
+ *
+ * One file per CPU, named after the CPU, is written in the output directory.
+ * Each VM exit is traced like the hypervisor does: a VM_EXIT entry with the
+ * exit reason, the TRACE_VMEXIT_* entry of the handler, and a VM_ENTER
+ * entry. It feeds acrntrace_stat and acrnalyze.py with the same data, to
+ * check that their reports agree and to compare their speed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define pr_err(fmt, ...)	fprintf(stderr, "acrntrace_gen: " fmt, ##__VA_ARGS__)
+
+#define MAX_CPUS		256
+#define BUF_RECS		4096
+
+#define TRACE_VM_EXIT		0x10UL
+#define TRACE_VM_ENTER		0x11UL
+#define TRACE_VMEXIT_ENTRY	0x10000UL
+
+/* records of the trace files captured with acrntrace -v */
+#define SBUF_REC_DATA		0
+
+struct trace_rec {
+	uint64_t tsc;
+	uint64_t id;		/* id:48, n_data:8, cpu:8 */
+	uint64_t d1;
+	uint64_t d2;
+};
+
+struct rec_hdr {
+	uint32_t size;
+	uint16_t type;
+	uint16_t len;
+};
+
+/* the exit reasons generated, with the trace event of their handler */
+struct exit_kind {
+	uint32_t reason;
+	uint64_t event;
+	uint32_t weight;
+	uint64_t min_cycles;	/* time from the VM exit to the VM entry */
+	uint64_t max_cycles;
+};
+
+static const struct exit_kind exit_kinds[] = {
+	{ 1U,  TRACE_VMEXIT_ENTRY + 0x01UL, 30U, 1000UL, 4000UL },	/* EXTERNAL_INTERRUPT */
+	{ 48U, TRACE_VMEXIT_ENTRY + 0x30UL, 20U, 3000UL, 60000UL },	/* EPT_VIOLATION */
+	{ 30U, TRACE_VMEXIT_ENTRY + 0x1eUL, 15U, 2000UL, 80000UL },	/* IO_INSTRUCTION */
+	{ 32U, TRACE_VMEXIT_ENTRY + 0x20UL, 10U, 800UL, 3000UL },	/* WRMSR */
+	{ 7U,  TRACE_VMEXIT_ENTRY + 0x02UL, 10U, 500UL, 1500UL },	/* INTERRUPT_WINDOW */
+	{ 31U, TRACE_VMEXIT_ENTRY + 0x1fUL, 5U, 800UL, 2000UL },	/* RDMSR */
+	{ 10U, TRACE_VMEXIT_ENTRY + 0x04UL, 5U, 600UL, 1200UL },	/* CPUID */
+	{ 56U, TRACE_VMEXIT_ENTRY + 0x38UL, 5U, 900UL, 2500UL },	/* APICV_WRITE */
+};
+
+static const uint64_t vectors[] = { 0xefUL, 0xf0UL, 0x22UL, 0x31UL };
+
+static struct trace_rec buf[BUF_RECS];
+static uint32_t nr_buf;
+static bool varlen;
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "Options:\n"
+	       "  -h             print this message\n"
+	       "  -o dir         output directory, created if needed (required)\n"
+	       "  -c cpus        number of CPU files (default 4)\n"
+	       "  -n exits       VM exits per CPU (default 100000)\n"
+	       "  -v             write the records of acrntrace -v\n"
+	       "  -s seed        seed of the random generator (default 1)\n",
+	       prog);
+}
+
+static uint64_t gen_rand(uint64_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+static int flush_buf(FILE *fp)
+{
+	struct rec_hdr hdr = {
+		.size = sizeof(struct rec_hdr) + sizeof(struct trace_rec),
+		.type = SBUF_REC_DATA,
+		.len = sizeof(struct trace_rec),
+	};
+	uint32_t i;
+
+	if (!varlen) {
+		if (fwrite(buf, sizeof(struct trace_rec), nr_buf, fp) != nr_buf)
+			return -1;
+	} else {
+		for (i = 0U; i < nr_buf; i++) {
+			if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+					(fwrite(&buf[i], sizeof(buf[i]), 1, fp) != 1))
+				return -1;
+		}
+	}
+	nr_buf = 0U;
+
+	return 0;
+}
+
+static int put_rec(FILE *fp, uint64_t tsc, uint64_t event, uint32_t cpu,
+		uint64_t d1, uint64_t d2)
+{
+	struct trace_rec *rec = &buf[nr_buf++];
+
+	rec->tsc = tsc;
+	rec->id = event | (2UL << 48) | ((uint64_t)cpu << 56);
+	rec->d1 = d1;
+	rec->d2 = d2;
+
+	return (nr_buf == BUF_RECS) ? flush_buf(fp) : 0;
+}
+
+static const struct exit_kind *pick_kind(uint64_t *seed)
+{
+	uint32_t i, total = 0U, r;
+
+	for (i = 0U; i < sizeof(exit_kinds) / sizeof(exit_kinds[0]); i++)
+		total += exit_kinds[i].weight;
+	r = (uint32_t)(gen_rand(seed) % total);
+	for (i = 0U; r >= exit_kinds[i].weight; i++)
+		r -= exit_kinds[i].weight;
+
+	return &exit_kinds[i];
+}
+
+static int gen_cpu(const char *dir, uint32_t cpu, uint64_t nr_exits, uint64_t *seed)
+{
+	const struct exit_kind *kind;
+	char path[PATH_MAX];
+	uint64_t tsc, i, d1;
+	FILE *fp;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%u", dir, cpu);
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		pr_err("failed to create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	tsc = 1000000UL + cpu;
+	for (i = 0UL; (i < nr_exits) && (ret == 0); i++) {
+		kind = pick_kind(seed);
+		d1 = (kind->reason == 1U) ? vectors[gen_rand(seed) % 4UL] : 0UL;
+		ret |= put_rec(fp, tsc, TRACE_VM_EXIT, cpu, kind->reason, 0xffffffff81000000UL);
+		ret |= put_rec(fp, tsc + 200UL, kind->event, cpu, d1, 0UL);
+		tsc += kind->min_cycles + (gen_rand(seed) % (kind->max_cycles - kind->min_cycles));
+		ret |= put_rec(fp, tsc, TRACE_VM_ENTER, cpu, 0UL, 0UL);
+		/* time in the guest */
+		tsc += 2000UL + (gen_rand(seed) % 20000UL);
+	}
+	if (ret == 0)
+		ret = flush_buf(fp);
+	if ((fclose(fp) != 0) || (ret != 0)) {
+		pr_err("failed to write %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = NULL;
+	uint64_t nr_exits = 100000UL, seed = 1UL;
+	int nr_cpus = 4, opt, i;
+
+	while ((opt = getopt(argc, argv, "ho:c:n:vs:")) != -1) {
+		switch (opt) {
+		case 'o':
+			dir = optarg;
+			break;
+		case 'c':
+			nr_cpus = atoi(optarg);
+			break;
+		case 'n':
+			nr_exits = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			varlen = true;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((dir == NULL) || (nr_cpus <= 0) || (nr_cpus > MAX_CPUS) || (seed == 0UL)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if ((mkdir(dir, 0755) != 0) && (errno != EEXIST)) {
+		pr_err("failed to create %s: %s\n", dir, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < nr_cpus; i++) {
+		if (gen_cpu(dir, (uint32_t)i, nr_exits, &seed) != 0)
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,640 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * acrntrace_stat - one pass analyzer of the trace data captured by acrntrace
+ *
+ * The per-CPU trace files are mmaped and merged by TSC, the vm_exit and irq
+ * reports are computed in one pass, and the merged trace can be saved in a
+ * columnar file for later queries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define pr_fmt(fmt)		"acrntrace_stat: " fmt
+#define pr_err(fmt, ...)	fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__)
+
+#define MAX_SRCS		256
+#define MAX_EXIT_REASONS	70
+#define MAX_VECTORS		256
+#define HIST_BUCKETS		40	/* log2 of the cycles */
+
+#define TRACE_VM_EXIT		0x10UL
+#define TRACE_VM_ENTER		0x11UL
+#define TRACE_VMEXIT_ENTRY	0x10000UL
+#define TRACE_VMEXIT_EXTERNAL_INTERRUPT	(TRACE_VMEXIT_ENTRY + 0x1UL)
+
+/* records of the trace files captured with acrntrace -v */
+#define SBUF_REC_DATA		0
+#define SBUF_REC_ALIGN		8
+
+#define COL_MAGIC		"ACRNCOL1"
+#define COL_BLOCK_ROWS		65536
+
+struct trace_rec {
+	uint64_t tsc;
+	uint64_t id;		/* id:48, n_data:8, cpu:8 */
+	uint64_t d1;
+	uint64_t d2;
+};
+
+struct rec_hdr {
+	uint32_t size;
+	uint16_t type;
+	uint16_t len;
+};
+
+struct trace_src {
+	const char *name;
+	const uint8_t *base;
+	size_t size;
+	size_t off;
+	bool varlen;
+	const struct trace_rec *cur;
+};
+
+struct exit_stat {
+	uint64_t nr;
+	uint64_t cycles;
+	uint64_t max;
+	uint64_t hist[HIST_BUCKETS];
+};
+
+struct cpu_state {
+	uint64_t exit_tsc;
+	uint32_t reason;
+	bool in_exit;
+	bool seen;
+};
+
+struct col_block {
+	uint32_t rows;
+	uint64_t tsc[COL_BLOCK_ROWS];
+	uint64_t event[COL_BLOCK_ROWS];
+	uint64_t d1[COL_BLOCK_ROWS];
+	uint64_t d2[COL_BLOCK_ROWS];
+	uint8_t cpu[COL_BLOCK_ROWS];
+};
+
+static const char *exit_reason_names[MAX_EXIT_REASONS] = {
+	[0] = "EXCEPTION_OR_NMI",
+	[1] = "EXTERNAL_INTERRUPT",
+	[2] = "TRIPLE_FAULT",
+	[7] = "INTERRUPT_WINDOW",
+	[8] = "NMI_WINDOW",
+	[9] = "TASK_SWITCH",
+	[10] = "CPUID",
+	[12] = "HLT",
+	[14] = "INVLPG",
+	[16] = "RDTSC",
+	[18] = "VMCALL",
+	[28] = "CR_ACCESS",
+	[29] = "DR_ACCESS",
+	[30] = "IO_INSTRUCTION",
+	[31] = "RDMSR",
+	[32] = "WRMSR",
+	[33] = "ENTRY_FAILURE_INVALID_GUEST_STATE",
+	[36] = "MWAIT",
+	[37] = "MONITOR_TRAP",
+	[39] = "MONITOR",
+	[40] = "PAUSE",
+	[43] = "TPR_BELOW_THRESHOLD",
+	[44] = "APICV_ACCESS",
+	[45] = "APICV_VIRT_EOI",
+	[48] = "EPT_VIOLATION",
+	[49] = "EPT_MISCONFIGURATION",
+	[51] = "RDTSCP",
+	[52] = "VMX_PREEMPTION_TIMER",
+	[53] = "INVVPID",
+	[54] = "WBINVD",
+	[55] = "XSETBV",
+	[56] = "APICV_WRITE",
+	[57] = "RDRAND",
+	[58] = "INVPCID",
+	[61] = "RDSEED",
+	[63] = "XSAVES",
+	[64] = "XRSTORS",
+};
+
+static struct trace_src srcs[MAX_SRCS];
+static int nr_srcs;
+
+static struct exit_stat exit_stats[MAX_EXIT_REASONS];
+static struct exit_stat exit_total;
+static uint64_t irq_exits[MAX_VECTORS];
+static struct cpu_state cpu_states[256];
+static uint64_t tsc_begin, tsc_end, nr_recs;
+static uint32_t nr_cpus;
+
+static double freq = 1881.6;	/* TSC frequency in MHz */
+static bool do_vm_exit, do_irq;
+static char *ofile, *colfile;
+
+static FILE *col_fp;
+static struct col_block *col_blk;
+
+static void usage(void)
+{
+	printf("acrntrace_stat - one pass analyzer of the acrntrace data\n"
+	       "[Usage] acrntrace_stat [options] -i <file|dir> [-i ...]\n\n"
+	       "[Options]\n"
+	       "\t-h: print this message\n"
+	       "\t-i, --ifile=string: trace file, or a dir of per-CPU trace files\n"
+	       "\t-o, --ofile=string: append the reports to <string>.csv\n"
+	       "\t-f, --frequency=unsigned int: TSC frequency in MHz\n"
+	       "\t-c, --columnar=string: save the merged trace in a columnar file\n"
+	       "\t--vm_exit: to generate vm_exit report\n"
+	       "\t--irq: to generate irq related report\n");
+}
+
+static int add_src(const char *name)
+{
+	struct trace_src *src;
+	const struct rec_hdr *hdr;
+	struct stat st;
+	void *base;
+	int fd;
+
+	if (nr_srcs == MAX_SRCS) {
+		pr_err("too many trace files, at most %d\n", MAX_SRCS);
+		return -1;
+	}
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		pr_err("failed to open %s, errno %d\n", name, errno);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		pr_err("failed to stat %s, errno %d\n", name, errno);
+		close(fd);
+		return -1;
+	}
+
+	/* nothing captured on this CPU */
+	if (st.st_size < (off_t)sizeof(struct trace_rec)) {
+		close(fd);
+		return 0;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		pr_err("failed to mmap %s, errno %d\n", name, errno);
+		return -1;
+	}
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+	src = &srcs[nr_srcs++];
+	src->name = name;
+	src->base = base;
+	src->size = st.st_size;
+	src->off = 0;
+
+	/* the low 32 bits of a TSC can't be the size of a record in practice */
+	hdr = base;
+	src->varlen = (hdr->type == SBUF_REC_DATA) &&
+			(hdr->len == sizeof(struct trace_rec)) &&
+			(hdr->size == sizeof(struct rec_hdr) + sizeof(struct trace_rec));
+
+	return 0;
+}
+
+static int add_dir(const char *dir)
+{
+	struct dirent *pdir;
+	char path[PATH_MAX];
+	char *name;
+	DIR *d;
+	int ret = 0;
+
+	d = opendir(dir);
+	if (!d) {
+		pr_err("failed to open %s, errno %d\n", dir, errno);
+		return -1;
+	}
+
+	while ((ret == 0) && ((pdir = readdir(d)) != NULL)) {
+		if (pdir->d_type != DT_REG)
+			continue;
+
+		if (snprintf(path, sizeof(path), "%s/%s", dir, pdir->d_name) >= (int)sizeof(path)) {
+			pr_err("path of %s is too long\n", pdir->d_name);
+			ret = -1;
+			break;
+		}
+
+		name = strdup(path);
+		if (!name) {
+			ret = -1;
+			break;
+		}
+		ret = add_src(name);
+	}
+
+	closedir(d);
+	return ret;
+}
+
+static int add_input(const char *name)
+{
+	struct stat st;
+
+	if (stat(name, &st) < 0) {
+		pr_err("failed to stat %s, errno %d\n", name, errno);
+		return -1;
+	}
+
+	return S_ISDIR(st.st_mode) ? add_dir(name) : add_src(name);
+}
+
+/* move src->cur to the next trace entry, NULL at the end of the file */
+static void src_next(struct trace_src *src)
+{
+	const struct rec_hdr *hdr;
+
+	src->cur = NULL;
+	if (!src->varlen) {
+		if (src->off + sizeof(struct trace_rec) <= src->size) {
+			src->cur = (const struct trace_rec *)(src->base + src->off);
+			src->off += sizeof(struct trace_rec);
+		}
+		return;
+	}
+
+	while (src->off + sizeof(struct rec_hdr) <= src->size) {
+		hdr = (const struct rec_hdr *)(src->base + src->off);
+		if ((hdr->size < sizeof(struct rec_hdr)) || (hdr->size % SBUF_REC_ALIGN) ||
+				(hdr->size > src->size - src->off)) {
+			pr_err("%s: corrupted record at %zu\n", src->name, src->off);
+			src->off = src->size;
+			break;
+		}
+
+		src->off += hdr->size;
+		if ((hdr->type == SBUF_REC_DATA) && (hdr->len == sizeof(struct trace_rec))) {
+			src->cur = (const struct trace_rec *)(hdr + 1);
+			break;
+		}
+	}
+}
+
+static inline uint32_t log2_bucket(uint64_t v)
+{
+	uint32_t b = (v == 0) ? 0 : (63 - __builtin_clzll(v));
+
+	return (b < HIST_BUCKETS) ? b : (HIST_BUCKETS - 1);
+}
+
+static inline void exit_account(struct exit_stat *stat, uint64_t cycles)
+{
+	stat->nr++;
+	stat->cycles += cycles;
+	if (cycles > stat->max)
+		stat->max = cycles;
+	stat->hist[log2_bucket(cycles)]++;
+}
+
+static int col_flush(void)
+{
+	uint32_t rows = col_blk->rows;
+	uint32_t pad = (8 - (rows % 8)) % 8;
+	static const uint8_t zero[8];
+	uint32_t hdr[2] = { rows, 0 };
+
+	if (rows == 0)
+		return 0;
+
+	if ((fwrite(hdr, sizeof(hdr), 1, col_fp) != 1) ||
+			(fwrite(col_blk->tsc, sizeof(uint64_t), rows, col_fp) != rows) ||
+			(fwrite(col_blk->event, sizeof(uint64_t), rows, col_fp) != rows) ||
+			(fwrite(col_blk->d1, sizeof(uint64_t), rows, col_fp) != rows) ||
+			(fwrite(col_blk->d2, sizeof(uint64_t), rows, col_fp) != rows) ||
+			(fwrite(col_blk->cpu, 1, rows, col_fp) != rows) ||
+			(fwrite(zero, 1, pad, col_fp) != pad)) {
+		pr_err("failed to write %s, errno %d\n", colfile, errno);
+		return -1;
+	}
+
+	col_blk->rows = 0;
+	return 0;
+}
+
+static int col_put(const struct trace_rec *rec)
+{
+	uint32_t i = col_blk->rows++;
+
+	col_blk->tsc[i] = rec->tsc;
+	col_blk->event[i] = rec->id & 0xffffffffffffUL;
+	col_blk->d1[i] = rec->d1;
+	col_blk->d2[i] = rec->d2;
+	col_blk->cpu[i] = (uint8_t)(rec->id >> 56);
+
+	return (col_blk->rows == COL_BLOCK_ROWS) ? col_flush() : 0;
+}
+
+static void handle_rec(const struct trace_rec *rec)
+{
+	uint64_t event = rec->id & 0xffffffffffffUL;
+	struct cpu_state *cs = &cpu_states[rec->id >> 56];
+	uint64_t cycles;
+
+	if (nr_recs++ == 0)
+		tsc_begin = rec->tsc;
+	tsc_end = rec->tsc;
+
+	if (!cs->seen) {
+		cs->seen = true;
+		nr_cpus++;
+	}
+
+	if (event == TRACE_VM_EXIT) {
+		cs->exit_tsc = rec->tsc;
+		cs->reason = (uint32_t)rec->d1;
+		cs->in_exit = true;
+	} else if (event == TRACE_VM_ENTER) {
+		/* the time consumed by a vmexit is from vm_exit to the next vm_enter */
+		if (cs->in_exit) {
+			cycles = rec->tsc - cs->exit_tsc;
+			if (cs->reason < MAX_EXIT_REASONS)
+				exit_account(&exit_stats[cs->reason], cycles);
+			exit_account(&exit_total, cycles);
+			cs->in_exit = false;
+		}
+	} else if (event == TRACE_VMEXIT_EXTERNAL_INTERRUPT) {
+		if (rec->d1 < MAX_VECTORS)
+			irq_exits[rec->d1]++;
+	}
+}
+
+static int process(void)
+{
+	struct trace_src *min;
+	int i, ret = 0;
+
+	for (i = 0; i < nr_srcs; i++)
+		src_next(&srcs[i]);
+
+	while (ret == 0) {
+		/* merge the per-CPU trace by TSC */
+		min = NULL;
+		for (i = 0; i < nr_srcs; i++) {
+			if (srcs[i].cur && (!min || (srcs[i].cur->tsc < min->cur->tsc)))
+				min = &srcs[i];
+		}
+		if (!min)
+			break;
+
+		handle_rec(min->cur);
+		if (col_fp)
+			ret = col_put(min->cur);
+		src_next(min);
+	}
+
+	return ret;
+}
+
+static const char *exit_reason_name(uint32_t reason, char *buf, size_t len)
+{
+	if (exit_reason_names[reason])
+		return exit_reason_names[reason];
+
+	snprintf(buf, len, "REASON_%u", reason);
+	return buf;
+}
+
+/* the time percentage is of the run time of all the CPUs */
+static void report_vm_exit(FILE *csv, double rt_sec, uint64_t rt_cycle)
+{
+	const struct exit_stat *stat;
+	char name_buf[16];
+	const char *name;
+	uint32_t r, b;
+
+	printf("%-32s\t%-12s\t%-12s\t%-24s\t%-16s\t%-12s\t%-12s\n", "Exit_Reason", "NR_Exit",
+		"NR_Exit/Sec", "Time Consumed(cycles)", "Time percentage", "Avg(cycles)", "Max(cycles)");
+	if (csv)
+		fprintf(csv, "Exit_Reason,NR_Exit,NR_Exit/Sec,Time Consumed(cycles),"
+			"Time Percentage,Avg(cycles),Max(cycles)\n");
+
+	for (r = 0; r <= MAX_EXIT_REASONS; r++) {
+		if (r == MAX_EXIT_REASONS) {
+			stat = &exit_total;
+			name = "Total";
+		} else {
+			stat = &exit_stats[r];
+			name = exit_reason_name(r, name_buf, sizeof(name_buf));
+		}
+
+		if (stat->nr == 0)
+			continue;
+
+		printf("%-32s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\t%-12lu\t%-12lu\n", name,
+			stat->nr, stat->nr / rt_sec, stat->cycles, stat->cycles * 100.0 / rt_cycle,
+			stat->cycles / stat->nr, stat->max);
+		if (csv)
+			fprintf(csv, "%s,%lu,%.2f,%lu,%.2f,%lu,%lu\n", name, stat->nr,
+				stat->nr / rt_sec, stat->cycles, stat->cycles * 100.0 / rt_cycle,
+				stat->cycles / stat->nr, stat->max);
+	}
+
+	printf("\nVM exit latency histogram (cycles):\n");
+	if (csv)
+		fprintf(csv, "Exit_Reason,From(cycles),To(cycles),From(us),Count\n");
+
+	for (r = 0; r < MAX_EXIT_REASONS; r++) {
+		stat = &exit_stats[r];
+		if (stat->nr == 0)
+			continue;
+
+		name = exit_reason_name(r, name_buf, sizeof(name_buf));
+		printf("%s:\n", name);
+		for (b = 0; b < HIST_BUCKETS; b++) {
+			if (stat->hist[b] == 0)
+				continue;
+			printf("\t[%12lu, %12lu) %10.3fus\t%lu\n", 1UL << b, 2UL << b,
+				(1UL << b) / freq, stat->hist[b]);
+			if (csv)
+				fprintf(csv, "%s,%lu,%lu,%.3f,%lu\n", name, 1UL << b, 2UL << b,
+					(1UL << b) / freq, stat->hist[b]);
+		}
+	}
+}
+
+static void report_irq(FILE *csv, double rt_sec)
+{
+	uint32_t v;
+
+	printf("%-8s\t%-8s\t%-8s\n", "Vector", "Count", "NR_Exit/Sec");
+	if (csv)
+		fprintf(csv, "Vector,NR_Exit,NR_Exit/Sec\n");
+
+	for (v = 0; v < MAX_VECTORS; v++) {
+		if (irq_exits[v] == 0)
+			continue;
+		printf("0x%08x\t%-8lu\t%-8.2f\n", v, irq_exits[v], irq_exits[v] / rt_sec);
+		if (csv)
+			fprintf(csv, "0x%08x,%lu,%.2f\n", v, irq_exits[v], irq_exits[v] / rt_sec);
+	}
+}
+
+static int report(void)
+{
+	char csv_name[PATH_MAX];
+	uint64_t rt_cycle = tsc_end - tsc_begin;
+	double rt_sec;
+	FILE *csv = NULL;
+
+	if (rt_cycle == 0) {
+		pr_err("total run time in cycle is 0, %lu records\n", nr_recs);
+		return -1;
+	}
+	rt_sec = rt_cycle / (freq * 1000 * 1000);
+
+	if (ofile) {
+		if (snprintf(csv_name, sizeof(csv_name), "%s.csv", ofile) >= (int)sizeof(csv_name)) {
+			pr_err("output file name is too long\n");
+			return -1;
+		}
+		csv = fopen(csv_name, "a");
+		if (!csv) {
+			pr_err("failed to open %s, errno %d\n", csv_name, errno);
+			return -1;
+		}
+	}
+
+	printf("Total run time: %lu cycles\n", rt_cycle);
+	printf("TSC Freq: %.1f MHz\n", freq);
+	printf("Total run time: %.6f sec\n", rt_sec);
+	printf("Total records: %lu on %u CPUs\n\n", nr_recs, nr_cpus);
+	if (csv)
+		fprintf(csv, "Run time(cycles),Run time(Sec),Freq(MHz)\n%lu,%.3f,%.1f\n",
+			rt_cycle, rt_sec, freq);
+
+	if (do_vm_exit)
+		report_vm_exit(csv, rt_sec, rt_cycle * nr_cpus);
+
+	if (do_irq) {
+		printf("\n");
+		report_irq(csv, rt_sec);
+	}
+
+	if (csv)
+		fclose(csv);
+
+	return 0;
+}
+
+static int col_open(void)
+{
+	col_blk = calloc(1, sizeof(*col_blk));
+	if (!col_blk)
+		return -1;
+
+	col_fp = fopen(colfile, "w");
+	if (!col_fp) {
+		pr_err("failed to open %s, errno %d\n", colfile, errno);
+		return -1;
+	}
+
+	if (fwrite(COL_MAGIC, strlen(COL_MAGIC), 1, col_fp) != 1) {
+		pr_err("failed to write %s, errno %d\n", colfile, errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int col_close(void)
+{
+	int ret = col_flush();
+
+	if (fclose(col_fp) != 0)
+		ret = -1;
+	col_fp = NULL;
+	free(col_blk);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{"ifile", required_argument, 0, 'i'},
+		{"ofile", required_argument, 0, 'o'},
+		{"frequency", required_argument, 0, 'f'},
+		{"columnar", required_argument, 0, 'c'},
+		{"vm_exit", no_argument, 0, 'v'},
+		{"irq", no_argument, 0, 'q'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0},
+	};
+	int opt, ret;
+
+	while ((opt = getopt_long(argc, argv, "hi:o:f:c:", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			if (add_input(optarg) < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'o':
+			ofile = optarg;
+			break;
+		case 'f':
+			freq = strtod(optarg, NULL);
+			if (freq <= 0) {
+				pr_err("'-f' requires a TSC frequency in MHz\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			colfile = optarg;
+			break;
+		case 'v':
+			do_vm_exit = true;
+			break;
+		case 'q':
+			do_irq = true;
+			break;
+		case 'h':
+		default:
+			usage();
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (nr_srcs == 0) {
+		pr_err("no trace data, '-i' is required\n");
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (colfile && (col_open() < 0))
+		return EXIT_FAILURE;
+
+	ret = process();
+
+	if (col_fp && (col_close() < 0))
+		ret = -1;
+
+	if ((ret == 0) && (do_vm_exit || do_irq))
+		ret = report();
+
+	return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -9,9 +9,17 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 #include "sbuf.h"
 #include <errno.h>
 
+/* max spans flushed by one sbuf_write() on a SBUF_VARLEN_EN buf */
+#define SBUF_MAX_SPANS	64
+
+/* the producers of the hypervisor put one entry at a time, 1s at most */
+#define SBUF_PAUSE_POLL_US	10
+#define SBUF_PAUSE_POLLS	100000
+
 static inline bool sbuf_is_empty(shared_buf_t *sbuf)
 {
 	return (sbuf->head == sbuf->tail);
@@ -46,11 +54,141 @@ int sbuf_get(shared_buf_t *sbuf, uint8_t *data)
 	return sbuf->ele_size;
 }
 
-int sbuf_write(int fd, shared_buf_t *sbuf)
+static int sbuf_writev(int fd, const struct iovec *iov, int iovcnt, size_t len)
+{
+	ssize_t written;
+
+	written = writev(fd, iov, iovcnt);
+	if (written != (ssize_t)len) {
+		printf("Failed to write: ret %zd (len %zu), errno %d\n",
+			written, len, (written == -1) ? errno : 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* zero the consumed space of a SBUF_VARLEN_EN buf and release it */
+static void sbuf_release(shared_buf_t *sbuf, uint32_t head)
+{
+	void *base = (void *)sbuf + SBUF_HEAD_SIZE;
+
+	if (head >= sbuf->head) {
+		memset(base + sbuf->head, 0, head - sbuf->head);
+	} else {
+		memset(base + sbuf->head, 0, sbuf->size - sbuf->head);
+		memset(base, 0, head);
+	}
+
+	__atomic_store_n(&sbuf->head, head, __ATOMIC_RELEASE);
+}
+
+static int sbuf_write_fixed(int fd, shared_buf_t *sbuf)
+{
+	struct iovec iov[2];
+	uint32_t head = sbuf->head;
+	uint32_t tail = __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE);
+	size_t len;
+	int iovcnt = 1;
+
+	iov[0].iov_base = (void *)sbuf + SBUF_HEAD_SIZE + head;
+	iov[0].iov_len = ((tail > head) ? tail : sbuf->size) - head;
+	if ((tail < head) && (tail != 0)) {
+		iov[1].iov_base = (void *)sbuf + SBUF_HEAD_SIZE;
+		iov[1].iov_len = tail;
+		iovcnt = 2;
+	}
+	len = iov[0].iov_len + ((iovcnt == 2) ? iov[1].iov_len : 0);
+
+	if (sbuf_writev(fd, iov, iovcnt, len) < 0)
+		return -1;
+
+	__atomic_store_n(&sbuf->head, tail, __ATOMIC_RELEASE);
+
+	return len;
+}
+
+static int sbuf_write_varlen(int fd, shared_buf_t *sbuf)
 {
-	const void *start;
-	int written;
+	struct iovec iov[SBUF_MAX_SPANS];
+	void *base = (void *)sbuf + SBUF_HEAD_SIZE;
+	uint32_t tail = __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE);
+	uint32_t pos = sbuf->head, start = pos;
+	uint64_t hdr;
+	uint32_t size;
+	size_t len = 0;
+	int iovcnt = 0;
+
+	while ((pos != tail) && (iovcnt < SBUF_MAX_SPANS)) {
+		hdr = __atomic_load_n((uint64_t *)(base + pos), __ATOMIC_ACQUIRE);
+		size = (uint32_t)hdr;
+		/* not committed yet */
+		if (size == 0)
+			break;
+
+		if ((size % SBUF_REC_ALIGN) || (size > sbuf->size - pos)) {
+			printf("Corrupted record at %u (size %u), drop the buffered data\n",
+				pos, size);
+			sbuf_release(sbuf, tail);
+			return 0;
+		}
+
+		if (((hdr >> 32) & 0xffff) == SBUF_REC_PAD) {
+			if (pos != start) {
+				iov[iovcnt].iov_base = base + start;
+				iov[iovcnt].iov_len = pos - start;
+				len += iov[iovcnt++].iov_len;
+			}
+			start = pos + size;
+		}
+
+		pos += size;
+		if (pos == sbuf->size) {
+			if (start != pos) {
+				if (iovcnt == SBUF_MAX_SPANS) {
+					pos = start;
+					break;
+				}
+				iov[iovcnt].iov_base = base + start;
+				iov[iovcnt].iov_len = pos - start;
+				len += iov[iovcnt++].iov_len;
+			}
+			pos = 0;
+			start = 0;
+		}
+	}
+
+	/* the span is flushed next time if iov runs out */
+	if ((pos != start) && (iovcnt < SBUF_MAX_SPANS)) {
+		iov[iovcnt].iov_base = base + start;
+		iov[iovcnt].iov_len = pos - start;
+		len += iov[iovcnt++].iov_len;
+	} else if (pos != start) {
+		pos = start;
+	}
+
+	if (pos == sbuf->head)
+		return 0;
+
+	if ((iovcnt != 0) && (sbuf_writev(fd, iov, iovcnt, len) < 0))
+		return -1;
+
+	sbuf_release(sbuf, pos);
 
+	return len;
+}
+
+/*
+ * Flush all the data in sbuf to fd, each contiguous span of data is
+ * written by one writev.
+ *
+ * return:
+ * > 0:	bytes written
+ * 0:	no data available
+ * < 0:	failed
+ */
+int sbuf_write(int fd, shared_buf_t *sbuf)
+{
 	if (sbuf == NULL)
 		return -EINVAL;
 
@@ -58,17 +196,10 @@ int sbuf_write(int fd, shared_buf_t *sbuf)
 		return 0;
 	}
 
-	start = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
-        written = write(fd, start, sbuf->ele_size);
-	if (written != sbuf->ele_size) {
-		printf("Failed to write: ret %d (ele_size %d), errno %d\n",
-			written, sbuf->ele_size, (written == -1) ? errno : 0);
-		return -1;
-	}
+	if (sbuf->flags & SBUF_VARLEN_EN)
+		return sbuf_write_varlen(fd, sbuf);
 
-	sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
-
-	return sbuf->ele_size;
+	return sbuf_write_fixed(fd, sbuf);
 }
 
 int sbuf_clear_buffered(shared_buf_t *sbuf)
@@ -80,3 +211,61 @@ int sbuf_clear_buffered(shared_buf_t *sbuf)
 
 	return 0;
 }
+
+/*
+ * Stop the producers: the ones coming drop their data once SBUF_PAUSED is
+ * set, wait for the ones already putting data to leave.
+ */
+static int sbuf_pause(shared_buf_t *sbuf)
+{
+	int i;
+
+	__atomic_or_fetch(&sbuf->flags, SBUF_PAUSED, __ATOMIC_SEQ_CST);
+	for (i = 0; __atomic_load_n(&sbuf->writers, __ATOMIC_SEQ_CST) != 0; i++) {
+		if (i == SBUF_PAUSE_POLLS) {
+			__atomic_and_fetch(&sbuf->flags, ~SBUF_PAUSED, __ATOMIC_SEQ_CST);
+			return -EBUSY;
+		}
+		usleep(SBUF_PAUSE_POLL_US);
+	}
+
+	return 0;
+}
+
+/*
+ * Switch sbuf between elements and variable-length records, the buffered
+ * data is dropped. The producers are paused meanwhile.
+ */
+int sbuf_set_varlen(shared_buf_t *sbuf, bool enable)
+{
+	uint32_t flags;
+	int ret;
+
+	if (sbuf == NULL)
+		return -EINVAL;
+
+	if (enable && (sbuf->size % SBUF_REC_ALIGN))
+		return -EINVAL;
+
+	if (!!enable == !!(sbuf->flags & SBUF_VARLEN_EN))
+		return 0;
+
+	ret = sbuf_pause(sbuf);
+	if (ret < 0)
+		return ret;
+
+	/*
+	 * A zero header is an uncommitted record, and the tail of a
+	 * variable-length buf isn't aligned to ele_size, so start over.
+	 */
+	memset((void *)sbuf + SBUF_HEAD_SIZE, 0, sbuf->size);
+	sbuf->tail = 0;
+	sbuf->head = 0;
+
+	flags = sbuf->flags & ~(SBUF_VARLEN_EN | SBUF_PAUSED);
+	if (enable)
+		flags |= SBUF_VARLEN_EN;
+	__atomic_store_n(&sbuf->flags, flags, __ATOMIC_SEQ_CST);
+
+	return 0;
+}
@@ -8,6 +8,7 @@
 #define SHARED_BUF_H
 
 #include <linux/types.h>
+#include <stdbool.h>
 
 #define SBUF_MAGIC 0x5aa57aa71aa13aa3
 #define SBUF_MAX_SIZE   (1ULL << 22)
@@ -16,9 +17,15 @@
 /* sbuf flags */
 #define OVERRUN_CNT_EN  (1ULL << 0) /* whether overrun counting is enabled */
 #define OVERWRITE_EN    (1ULL << 1) /* whether overwrite is enabled */
+#define SBUF_VARLEN_EN  (1ULL << 2) /* whether the buf holds variable-length records */
+#define SBUF_PAUSED     (1ULL << 3) /* whether the consumer is resetting the buf */
+
+#define SBUF_REC_ALIGN  8
+#define SBUF_REC_PAD    0xffff
 
 typedef unsigned char uint8_t;
 typedef unsigned int uint32_t;
+typedef unsigned short uint16_t;
 typedef unsigned long uint64_t;
 
 /**
@@ -35,6 +42,16 @@ typedef unsigned long uint64_t;
  * |
  * |
  * shared_buf_t *buf
+ *
+ * If SBUF_VARLEN_EN is set, the buf holds variable-length records, each one
+ * starts with a sbuf_rec_hdr_t and is SBUF_REC_ALIGN aligned. A zero header
+ * means the record is not committed yet, so the consumed space is zeroed
+ * before head moves forward. SBUF_REC_PAD records carry no data and are not
+ * written to the trace file.
+ *
+ * The producers count themselves in writers while they put data, and drop
+ * the data if SBUF_PAUSED is set. The buf is only reset or switched to another
+ * mode with SBUF_PAUSED set and no writers left.
  */
 
 /* Make sure sizeof(shared_buf_t) == SBUF_HEAD_SIZE */
@@ -44,23 +61,30 @@ typedef struct shared_buf {
         uint32_t ele_size;      /* sizeof of elements */
         uint32_t head;          /* offset from base, to read */
         uint32_t tail;          /* offset from base, to write */
-        uint64_t flags;
+        uint32_t flags;
+        uint32_t writers;       /* number of producers putting data */
         uint32_t overrun_cnt;   /* count of overrun */
         uint32_t size;          /* ele_num * ele_size */
         uint32_t padding[6];
 } shared_buf_t;
 
-static inline void sbuf_clear_flags(shared_buf_t *sbuf, uint64_t flags)
+typedef struct sbuf_rec_hdr {
+        uint32_t size;          /* size of the record including the header */
+        uint16_t type;          /* record type */
+        uint16_t len;           /* length of data */
+} sbuf_rec_hdr_t;
+
+static inline void sbuf_clear_flags(shared_buf_t *sbuf, uint32_t flags)
 {
         sbuf->flags &= ~flags;
 }
 
-static inline void sbuf_set_flags(shared_buf_t *sbuf, uint64_t flags)
+static inline void sbuf_set_flags(shared_buf_t *sbuf, uint32_t flags)
 {
         sbuf->flags = flags;
 }
 
-static inline void sbuf_add_flags(shared_buf_t *sbuf, uint64_t flags)
+static inline void sbuf_add_flags(shared_buf_t *sbuf, uint32_t flags)
 {
         sbuf->flags |= flags;
 }
@@ -68,4 +92,5 @@ static inline void sbuf_add_flags(shared_buf_t *sbuf, uint64_t flags)
 int sbuf_get(shared_buf_t *sbuf, uint8_t *data);
 int sbuf_write(int fd, shared_buf_t *sbuf);
 int sbuf_clear_buffered(shared_buf_t *sbuf);
+int sbuf_set_varlen(shared_buf_t *sbuf, bool enable);
 #endif /* SHARED_BUF_H */
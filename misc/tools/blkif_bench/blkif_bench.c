@@ -0,0 +1,525 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * blkif_bench - fio-style throughput and latency benchmark of the device
+ * model block_if against a file-backed image
+ *
+ * It is linked with the block_if of the device model and opens the image
+ * with the same option string as the virtio-blk and AHCI devices, so every
+ * engine and image format of block_if can be measured without a guest.
+ * A fixed number of requests is kept in flight: each completion callback
+ * hands its request back to the submitting thread, which resubmits it at
+ * the next offset.
+ *
+ * "-w check" checks the data instead: random reads, writes and flushes
+ * go to the image and to a blockif_dup() of it, e.g. with the shared
+ * wbcache, and every read and the image at the end are compared with a
+ * reference copy of the area.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "block_if.h"
+#include "log.h"
+
+#define MAX_SAMPLES		(1 << 20)
+#define CHECK_CTXS		2
+#define CHECK_CHUNK		(1 << 20)
+
+enum check_op {
+	CHECK_READ,
+	CHECK_WRITE,
+	CHECK_FLUSH,
+};
+
+struct bench_req {
+	struct blockif_req	breq;	/* keep breq as the first item */
+	uint64_t		start;
+	int			err;
+	struct bench_req	*next;
+
+	/* -w check */
+	enum check_op		op;
+	bool			busy;
+	uint8_t			*buf;
+	size_t			len;
+};
+
+static pthread_mutex_t done_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct bench_req *done_list;
+
+static uint64_t *samples;
+static uint32_t nr_samples;
+
+/* block_if logs through the device model logger */
+void
+output_log(uint8_t level, const char *fmt, ...)
+{
+	va_list args;
+
+	if (level <= LOG_WARNING) {
+		va_start(args, fmt);
+		vfprintf(stderr, fmt, args);
+		va_end(args);
+	}
+}
+
+static void
+usage(const char *prog)
+{
+	printf("Usage: %s [options] image[,block_if options]\n"
+	       "Options:\n"
+	       "  -h                 print this message\n"
+	       "  -w pattern         read, write, randread, randwrite or\n"
+	       "                     check (default read)\n"
+	       "  -b bytes           request size, the maximum one with\n"
+	       "                     check (default 4096)\n"
+	       "  -q depth           requests in flight (default 1)\n"
+	       "  -s bytes           size of the area accessed from offset 0\n"
+	       "                     (default the whole image)\n"
+	       "  -t seconds         duration of the run (default 10)\n"
+	       "The image and its options are given as to the virtio-blk\n"
+	       "device, e.g. /tmp/disk.img,writeback,aio=io_uring\n",
+	       prog);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+/* called by the block_if threads */
+static void
+bench_done(struct blockif_req *breq, int err)
+{
+	struct bench_req *req = (struct bench_req *)breq;
+
+	pthread_mutex_lock(&done_mtx);
+	req->err = err;
+	req->next = done_list;
+	done_list = req;
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_mtx);
+}
+
+static struct bench_req *
+wait_done(void)
+{
+	struct bench_req *list;
+
+	pthread_mutex_lock(&done_mtx);
+	while (done_list == NULL)
+		pthread_cond_wait(&done_cond, &done_mtx);
+	list = done_list;
+	done_list = NULL;
+	pthread_mutex_unlock(&done_mtx);
+
+	return list;
+}
+
+static uint64_t
+xorshift(uint64_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+/* one request at a time, for the reference copy */
+static int
+check_rw_sync(struct blockif_ctxt *bc, bool write, uint8_t *buf, off_t off,
+		size_t len)
+{
+	struct bench_req req;
+	int err;
+
+	memset(&req, 0, sizeof(req));
+	req.breq.iov[0].iov_base = buf;
+	req.breq.iov[0].iov_len = len;
+	req.breq.iovcnt = 1;
+	req.breq.offset = off;
+	req.breq.resid = (ssize_t)len;
+	req.breq.callback = bench_done;
+	err = write ? blockif_write(bc, &req.breq) : blockif_read(bc, &req.breq);
+	if (err == 0) {
+		wait_done();
+		err = req.err;
+	}
+	return err;
+}
+
+static int
+check_area(struct blockif_ctxt *bc, uint8_t *ref, uint64_t size, bool fill)
+{
+	uint8_t *buf;
+	uint64_t off, len;
+	int err = 0;
+
+	buf = malloc(CHECK_CHUNK);
+	if (buf == NULL)
+		return ENOMEM;
+	for (off = 0; off < size && err == 0; off += len) {
+		len = (size - off < CHECK_CHUNK) ? size - off : CHECK_CHUNK;
+		err = check_rw_sync(bc, false, fill ? ref + off : buf, (off_t)off, len);
+		if ((err == 0) && !fill && (memcmp(buf, ref + off, len) != 0)) {
+			fprintf(stderr, "image differs at [%lu, %lu)\n", off, off + len);
+			err = EIO;
+		}
+	}
+	free(buf);
+	return err;
+}
+
+/* a read or a write must not overlap one in flight, their order is undefined */
+static bool
+check_overlaps(const struct bench_req *reqs, int depth, off_t off, size_t len)
+{
+	int i;
+
+	for (i = 0; i < depth; i++) {
+		if (reqs[i].busy && (reqs[i].op != CHECK_FLUSH) &&
+				(off < reqs[i].breq.offset + (off_t)reqs[i].len) &&
+				(reqs[i].breq.offset < off + (off_t)len))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Random reads, writes and flushes through two contexts sharing the image,
+ * checked against a reference copy of the first size bytes. The image is
+ * read back through a new context at the end.
+ */
+static int
+run_check(const char *opts, uint64_t bs, uint64_t size, int depth, int duration)
+{
+	struct blockif_ctxt *bc[CHECK_CTXS];
+	struct bench_req *reqs, *req, *list;
+	uint64_t seed = 0x2545f4914f6cdd1dUL;
+	uint64_t end, sectsz, nr_sectors, max_sectors, split, a, last = 0;
+	off_t last_off = 0;
+	uint64_t nr_ops[CHECK_FLUSH + 1] = { 0 }, nr_bad = 0, nr_errors = 0;
+	uint8_t *ref;
+	off_t off;
+	size_t len, i;
+	int inflight = 0, n, err;
+
+	bc[0] = blockif_open(opts, "check0");
+	if (bc[0] == NULL) {
+		fprintf(stderr, "failed to open %s\n", opts);
+		return EXIT_FAILURE;
+	}
+	bc[1] = blockif_dup(bc[0], "check1");
+	if (bc[1] == NULL) {
+		fprintf(stderr, "failed to dup %s\n", opts);
+		return EXIT_FAILURE;
+	}
+	sectsz = (uint64_t)blockif_sectsz(bc[0]);
+	if ((size == 0) || (size > (uint64_t)blockif_size(bc[0])))
+		size = (uint64_t)blockif_size(bc[0]);
+	nr_sectors = size / sectsz;
+	max_sectors = bs / sectsz;
+	size = nr_sectors * sectsz;
+	if ((nr_sectors == 0) || (max_sectors == 0)) {
+		fprintf(stderr, "invalid request or area size\n");
+		return EXIT_FAILURE;
+	}
+	if (depth > blockif_queuesz(bc[0]))
+		depth = blockif_queuesz(bc[0]);
+
+	reqs = calloc(depth, sizeof(struct bench_req));
+	ref = malloc(size);
+	if ((reqs == NULL) || (ref == NULL)) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	for (n = 0; n < depth; n++) {
+		if (posix_memalign((void **)&reqs[n].buf, 4096, max_sectors * sectsz) != 0) {
+			fprintf(stderr, "out of memory\n");
+			return EXIT_FAILURE;
+		}
+		reqs[n].breq.callback = bench_done;
+	}
+
+	/* the reference starts as a copy of the area */
+	err = check_area(bc[0], ref, size, true);
+	if (err != 0) {
+		fprintf(stderr, "failed to read the image: %s\n", strerror(err));
+		return EXIT_FAILURE;
+	}
+
+	end = now_ns() + (uint64_t)duration * 1000000000UL;
+	do {
+		for (n = 0; (n < depth) && (now_ns() < end); n++) {
+			req = &reqs[n];
+			if (req->busy)
+				continue;
+
+			req->op = ((xorshift(&seed) % 64) == 0) ? CHECK_FLUSH :
+				((xorshift(&seed) & 1) ? CHECK_WRITE : CHECK_READ);
+			if ((req->op == CHECK_WRITE) && (last >= 3) &&
+					((xorshift(&seed) % 4) == 0)) {
+				/* strictly within the last write, the cache splits its extent */
+				a = 1 + xorshift(&seed) % (last - 2);
+				off = last_off + (off_t)(a * sectsz);
+				len = (1 + xorshift(&seed) % (last - 1 - a)) * sectsz;
+			} else {
+				off = (off_t)((xorshift(&seed) % nr_sectors) * sectsz);
+				len = (1 + xorshift(&seed) % max_sectors) * sectsz;
+				if (len > size - (uint64_t)off)
+					len = size - (uint64_t)off;
+			}
+			if ((req->op != CHECK_FLUSH) && check_overlaps(reqs, depth, off, len))
+				continue;
+
+			/* two iovs, split at a random sector, for the overlay of the reads */
+			split = (xorshift(&seed) % (len / sectsz + 1)) * sectsz;
+			req->breq.iov[0].iov_base = req->buf;
+			req->breq.iov[0].iov_len = split;
+			req->breq.iov[1].iov_base = req->buf + split;
+			req->breq.iov[1].iov_len = len - split;
+			req->breq.iovcnt = 2;
+			req->breq.offset = off;
+			req->breq.resid = (ssize_t)len;
+			req->len = len;
+
+			i = xorshift(&seed) % CHECK_CTXS;
+			if (req->op == CHECK_WRITE) {
+				for (split = 0; split < len; split += sizeof(uint64_t))
+					*(uint64_t *)(req->buf + split) = xorshift(&seed);
+				memcpy(ref + off, req->buf, len);
+				last_off = off;
+				last = len / sectsz;
+				err = blockif_write(bc[i], &req->breq);
+			} else if (req->op == CHECK_READ)
+				err = blockif_read(bc[i], &req->breq);
+			else {
+				req->breq.iovcnt = 0;
+				req->breq.resid = 0;
+				req->len = 0;
+				err = blockif_flush(bc[i], &req->breq);
+			}
+			if (err != 0) {
+				fprintf(stderr, "request failed: %s\n", strerror(err));
+				return EXIT_FAILURE;
+			}
+			req->busy = true;
+			nr_ops[req->op]++;
+			inflight++;
+		}
+		if (inflight == 0)
+			break;
+
+		for (list = wait_done(); list != NULL; inflight--) {
+			req = list;
+			list = req->next;
+			req->busy = false;
+			if (req->err != 0)
+				nr_errors++;
+			else if ((req->op == CHECK_READ) &&
+					(memcmp(req->buf, ref + req->breq.offset, req->len) != 0)) {
+				if (nr_bad++ == 0)
+					fprintf(stderr, "read of [%ld, %ld) differs\n",
+						req->breq.offset,
+						req->breq.offset + (off_t)req->len);
+			}
+		}
+	} while ((inflight > 0) || (now_ns() < end));
+
+	/* the cache is written back by the close of the last context */
+	blockif_close(bc[1]);
+	blockif_close(bc[0]);
+	bc[0] = blockif_open(opts, "check0");
+	if (bc[0] == NULL) {
+		fprintf(stderr, "failed to reopen %s\n", opts);
+		return EXIT_FAILURE;
+	}
+	err = check_area(bc[0], ref, size, false);
+	blockif_close(bc[0]);
+
+	printf("check: %lu reads, %lu writes, %lu flushes over %lu bytes, "
+		"%lu bad reads, %lu errors, image %s\n",
+		nr_ops[CHECK_READ], nr_ops[CHECK_WRITE], nr_ops[CHECK_FLUSH], size,
+		nr_bad, nr_errors, (err == 0) ? "ok" : "differs");
+
+	return ((nr_bad == 0) && (nr_errors == 0) && (err == 0)) ?
+		EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct blockif_ctxt *bc;
+	struct bench_req *reqs, *req, *next, *list;
+	const char *pattern = "read";
+	bool is_write, is_rand;
+	uint64_t bs = 4096, size = 0, off = 0, nr_blocks;
+	uint64_t seed = 0x2545f4914f6cdd1dUL;
+	uint64_t start, end, elapsed, sum = 0, nr_ios = 0, nr_errors = 0;
+	int depth = 1, duration = 10, inflight = 0;
+	int opt, i, err;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "hw:b:q:s:t:")) != -1) {
+		switch (opt) {
+		case 'w':
+			pattern = optarg;
+			break;
+		case 'b':
+			bs = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 's':
+			size = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((optind == argc - 1) && (bs != 0) && (depth > 0) && (duration > 0) &&
+			!strcmp(pattern, "check"))
+		return run_check(argv[optind], bs, size, depth, duration);
+
+	is_write = !strcmp(pattern, "write") || !strcmp(pattern, "randwrite");
+	is_rand = !strcmp(pattern, "randread") || !strcmp(pattern, "randwrite");
+	if ((optind != argc - 1) || (bs == 0) || (depth <= 0) || (duration <= 0) ||
+			(!is_write && !is_rand && strcmp(pattern, "read"))) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	bc = blockif_open(argv[optind], "bench");
+	if (bc == NULL) {
+		fprintf(stderr, "failed to open %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	if ((size == 0) || (size > (uint64_t)blockif_size(bc)))
+		size = (uint64_t)blockif_size(bc);
+	nr_blocks = size / bs;
+	if ((nr_blocks == 0) || ((bs % (uint64_t)blockif_sectsz(bc)) != 0)) {
+		fprintf(stderr, "invalid request size %lu\n", bs);
+		return EXIT_FAILURE;
+	}
+	if (depth > blockif_queuesz(bc)) {
+		fprintf(stderr, "queue depth limited to %d\n", blockif_queuesz(bc));
+		depth = blockif_queuesz(bc);
+	}
+
+	reqs = calloc(depth, sizeof(struct bench_req));
+	samples = calloc(MAX_SAMPLES, sizeof(uint64_t));
+	if ((reqs == NULL) || (samples == NULL)) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < depth; i++) {
+		/* aligned for the "direct" option */
+		if (posix_memalign(&reqs[i].breq.iov[0].iov_base, 4096, bs) != 0) {
+			fprintf(stderr, "out of memory\n");
+			return EXIT_FAILURE;
+		}
+		memset(reqs[i].breq.iov[0].iov_base, 0xa5, bs);
+		reqs[i].breq.iov[0].iov_len = bs;
+		reqs[i].breq.iovcnt = 1;
+		reqs[i].breq.callback = bench_done;
+		reqs[i].next = (i + 1 < depth) ? &reqs[i + 1] : NULL;
+	}
+
+	start = now_ns();
+	end = start + (uint64_t)duration * 1000000000UL;
+	next = &reqs[0];
+	do {
+		/* (re)submit the idle requests */
+		while (next != NULL) {
+			req = next;
+			next = req->next;
+			if (is_rand) {
+				req->breq.offset = (off_t)((xorshift(&seed) % nr_blocks) * bs);
+			} else {
+				req->breq.offset = (off_t)off;
+				off = (off + bs + bs <= size) ? off + bs : 0;
+			}
+			req->breq.resid = (ssize_t)bs;
+			req->start = now_ns();
+			err = is_write ? blockif_write(bc, &req->breq) : blockif_read(bc, &req->breq);
+			if (err != 0) {
+				fprintf(stderr, "request failed: %s\n", strerror(err));
+				return EXIT_FAILURE;
+			}
+			inflight++;
+		}
+
+		/* reap the completed ones, they are resubmitted until the time is up */
+		for (list = wait_done(); list != NULL; inflight--) {
+			req = list;
+			list = req->next;
+			elapsed = now_ns() - req->start;
+			if (req->err != 0)
+				nr_errors++;
+			if (nr_samples < MAX_SAMPLES)
+				samples[nr_samples++] = elapsed;
+			sum += elapsed;
+			nr_ios++;
+			if (now_ns() < end) {
+				req->next = next;
+				next = req;
+			}
+		}
+	} while ((inflight > 0) || (next != NULL));
+	secs = (double)(now_ns() - start) / 1e9;
+
+	if (is_write)
+		blockif_flush_all(bc);
+	blockif_close(bc);
+
+	qsort(samples, nr_samples, sizeof(uint64_t), cmp_u64);
+	printf("%s bs=%lu qd=%d: %.0f IOPS, %.1f MB/s, lat avg %lu p50 %lu p99 %lu max %lu us",
+		pattern, bs, depth, (double)nr_ios / secs,
+		(double)(nr_ios * bs) / secs / 1e6, sum / nr_ios / 1000,
+		samples[nr_samples / 2] / 1000,
+		samples[(uint64_t)nr_samples * 99 / 100] / 1000,
+		samples[nr_samples - 1] / 1000);
+	if (nr_errors != 0)
+		printf(", %lu errors", nr_errors);
+	printf("\n");
+
+	return (nr_errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HVSIM_H
+#define HVSIM_H
+
+#include <types.h>
+
+/*
+ * The hvsim programs are built against the hypervisor headers, so they
+ * declare the few C library functions they use themselves. printf() and
+ * vprintf() are declared by logmsg.h and resolve to the C library ones.
+ */
+void *calloc(size_t nmemb, size_t size);
+void free(void *ptr);
+int atoi(const char *nptr);
+void abort(void);
+void qsort(void *base, size_t nmemb, size_t size, int (*compar)(const void *, const void *));
+
+/* a small xorshift generator, so runs are reproducible */
+static inline uint64_t hvsim_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13U;
+	x ^= x >> 7U;
+	x ^= x << 17U;
+	*state = x;
+
+	return x;
+}
+
+#define HVSIM_CHECK(cond)							\
+	do {									\
+		if (!(cond)) {							\
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);	\
+			hvsim_failures++;					\
+		}								\
+	} while (0)
+
+extern uint32_t hvsim_failures;
+
+#endif /* HVSIM_H */
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * The hypervisor configuration the hvsim programs are built with, in place
+ * of the one generated by Kconfig. The values only size the data structures
+ * under test, and are set to the maximum the Kconfig ranges allow where the
+ * programs need room.
+ */
+
+#ifndef HVSIM_CONFIG_H
+#define HVSIM_CONFIG_H
+
+#define CONFIG_MAX_EMULATED_MMIO_REGIONS	128
+#define CONFIG_MAX_PT_IRQ_ENTRIES		256
+#define CONFIG_STACK_SIZE			0x2000
+#define CONFIG_LOG_BUF_SIZE			0x40000
+#define CONFIG_LOG_DESTINATION			7
+#define CONFIG_CONSOLE_LOGLEVEL_DEFAULT		3
+#define CONFIG_MEM_LOGLEVEL_DEFAULT		5
+#define CONFIG_NPK_LOGLEVEL_DEFAULT		5
+#define CONFIG_LOW_RAM_SIZE			0x00010000
+#define CONFIG_HV_RAM_START			0x60000000
+#define CONFIG_HV_RAM_SIZE			0x0b800000
+#define CONFIG_PLATFORM_RAM_SIZE		0x400000000
+#define CONFIG_SOS_RAM_SIZE			0x400000000
+#define CONFIG_UOS_RAM_SIZE			0x200000000
+#define CONFIG_HYPERV_ENABLED			1
+#define CONFIG_MAX_IOAPIC_NUM			1
+#define CONFIG_MAX_IOAPIC_LINES			120
+#define CONFIG_MAX_IR_ENTRIES			256
+#define CONFIG_IOMMU_BUS_NUM			0x100
+#define CONFIG_MAX_PCI_DEV_NUM			96
+#define CONFIG_MAX_MSIX_TABLE_NUM		16
+#define CONFIG_MAX_KATA_VM_NUM			0
+#define CONFIG_UEFI_OS_LOADER_NAME		"\\EFI\\org.clearlinux\\bootloaderx64.efi"
+
+#endif /* HVSIM_CONFIG_H */
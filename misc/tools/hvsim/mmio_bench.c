@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * mmio_bench - cost of the emulated MMIO handler lookup of hv_emulate_mmio()
+ * as the number of registered regions grows from 8 to 128
+ *
+ * The regions are registered through register_mmio_emulation_handler(), in
+ * a shuffled order, and looked up through hv_emulate_mmio() with a handler
+ * which does nothing. "hint" accesses hit the region the vCPU hit last,
+ * "random" ones go to a random region every time. "scan" is the linear
+ * scan over emul_mmio[] which the sorted index replaced, for reference, on
+ * the same random accesses.
+ */
+
+#include "dm/io_req.c"
+#include "hvsim.h"
+
+#define REGION_SIZE	0x1000UL
+#define REGION_STRIDE	0x3000UL
+#define REGION_BASE	0xc0000000UL
+#define NR_LOOKUPS	1000000U
+
+static struct acrn_vm sim_vm;
+static struct acrn_vcpu sim_vcpu;
+static uint64_t addrs[NR_LOOKUPS];
+
+/* Hypervisor services io_req.c links against, none is reached here */
+bool is_sos_vm(__unused const struct acrn_vm *vm) { return false; }
+bool is_prelaunched_vm(__unused const struct acrn_vm *vm) { return false; }
+struct acrn_vm_config *get_vm_config(__unused uint16_t vm_id) { return NULL; }
+uint16_t pcpuid_from_vcpu(__unused const struct acrn_vcpu *vcpu) { return 0U; }
+void emulate_pio_complete(__unused struct acrn_vcpu *vcpu, __unused const struct io_request *io_req) {}
+void deny_guest_pio_access(__unused struct acrn_vm *vm, __unused uint16_t port_address,
+		__unused uint32_t nbytes) {}
+void arch_fire_vhm_interrupt(void) {}
+int32_t emulate_instruction(__unused struct acrn_vcpu *vcpu) { return 0; }
+bool need_reschedule(__unused uint16_t pcpu_id) { return false; }
+void wait_event(__unused struct sched_event *event) {}
+void schedule(void) {}
+
+static int32_t null_mmio_handler(__unused struct io_request *io_req, __unused void *data)
+{
+	return 0;
+}
+
+/*
+ * hv_emulate_mmio() as it was before the sorted index, scanning up to the
+ * highest slot in use
+ */
+static int32_t scan_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req, uint32_t nr_slots)
+{
+	int32_t status = -ENODEV;
+	uint32_t idx;
+	uint64_t address, size, base, end;
+	struct mmio_request *mmio_req = &io_req->reqs.mmio;
+	struct mem_io_node *mmio_handler = NULL;
+	hv_mem_io_handler_t read_write = NULL;
+	void *handler_private_data = NULL;
+
+	address = mmio_req->address;
+	size = mmio_req->size;
+
+	spinlock_obtain(&vcpu->vm->emul_mmio_lock);
+	for (idx = 0U; idx < nr_slots; idx++) {
+		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
+		if (mmio_handler->read_write != NULL) {
+			base = mmio_handler->range_start;
+			end = mmio_handler->range_end;
+
+			if (((address + size) <= base) || (address >= end)) {
+				continue;
+			} else {
+				if ((address >= base) && ((address + size) <= end)) {
+					read_write = mmio_handler->read_write;
+					handler_private_data = mmio_handler->handler_private_data;
+				} else {
+					status = -EIO;
+				}
+				break;
+			}
+		}
+	}
+
+	if ((status == -ENODEV) && (read_write != NULL)) {
+		status = read_write(io_req, handler_private_data);
+	}
+	spinlock_release(&vcpu->vm->emul_mmio_lock);
+
+	return status;
+}
+
+static void setup_regions(uint32_t nr_regions, uint64_t *seed)
+{
+	uint32_t order[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	uint32_t i, j, tmp;
+	uint64_t start;
+
+	(void)memset(&sim_vm, 0U, sizeof(sim_vm));
+	spinlock_init(&sim_vm.emul_mmio_lock);
+	sim_vcpu.vm = &sim_vm;
+	sim_vcpu.mmio_hint = 0U;
+
+	for (i = 0U; i < nr_regions; i++) {
+		order[i] = i;
+	}
+	for (i = nr_regions - 1U; i > 0U; i--) {
+		j = (uint32_t)(hvsim_rand(seed) % (i + 1U));
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (i = 0U; i < nr_regions; i++) {
+		start = REGION_BASE + ((uint64_t)order[i] * REGION_STRIDE);
+		HVSIM_CHECK(register_mmio_emulation_handler(&sim_vm, null_mmio_handler,
+			start, start + REGION_SIZE, NULL) == 0);
+	}
+	/* an overlapping region is refused and leaves the index alone */
+	HVSIM_CHECK(register_mmio_emulation_handler(&sim_vm, null_mmio_handler,
+		REGION_BASE + 1UL, REGION_BASE + REGION_SIZE + 1UL, NULL) == -EINVAL);
+	HVSIM_CHECK(sim_vm.nr_emul_mmio_regions == nr_regions);
+}
+
+/* nr_slots == 0: the real hv_emulate_mmio(), otherwise the old scan */
+static uint64_t run_lookups(uint32_t nr_slots)
+{
+	struct io_request *io_req = &sim_vcpu.req;
+	uint64_t start;
+	uint32_t i;
+	int32_t ret = 0;
+
+	io_req->io_type = REQ_MMIO;
+	io_req->reqs.mmio.size = 4UL;
+	io_req->reqs.mmio.direction = REQUEST_READ;
+
+	start = rdtsc();
+	if (nr_slots == 0U) {
+		for (i = 0U; i < NR_LOOKUPS; i++) {
+			io_req->reqs.mmio.address = addrs[i];
+			ret |= hv_emulate_mmio(&sim_vcpu, io_req);
+		}
+	} else {
+		for (i = 0U; i < NR_LOOKUPS; i++) {
+			io_req->reqs.mmio.address = addrs[i];
+			ret |= scan_emulate_mmio(&sim_vcpu, io_req, nr_slots);
+		}
+	}
+	start = rdtsc() - start;
+
+	HVSIM_CHECK(ret == 0);
+
+	return start / NR_LOOKUPS;
+}
+
+int main(void)
+{
+	static const uint32_t counts[] = { 8U, 16U, 32U, 64U, 128U };
+	uint64_t seed = 0x2545f4914f6cdd1dUL;
+	uint64_t hint, random, scan;
+	uint32_t c, i, n;
+
+	printf("%8s %16s %16s %16s\n", "regions", "hint (cycles)", "random (cycles)", "scan (cycles)");
+	for (c = 0U; c < ARRAY_SIZE(counts); c++) {
+		n = counts[c];
+		setup_regions(n, &seed);
+
+		/* the same region over and over: the per-vCPU hint hits */
+		for (i = 0U; i < NR_LOOKUPS; i++) {
+			addrs[i] = REGION_BASE + ((uint64_t)(n / 2U) * REGION_STRIDE) + ((i * 4UL) % REGION_SIZE);
+		}
+		hint = run_lookups(0U);
+
+		/* a random region every time: the binary search does the job */
+		for (i = 0U; i < NR_LOOKUPS; i++) {
+			addrs[i] = REGION_BASE + ((hvsim_rand(&seed) % n) * REGION_STRIDE) +
+				((hvsim_rand(&seed) % (REGION_SIZE / 4UL)) * 4UL);
+		}
+		random = run_lookups(0U);
+		scan = run_lookups(n);
+
+		printf("%8u %16lu %16lu %16lu\n", n, hint, random, scan);
+	}
+
+	return (hvsim_failures == 0U) ? 0 : 1;
+}
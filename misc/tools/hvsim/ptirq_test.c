@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * ptirq_test - check of the ptirq entry hash tables of ptdev.c, and cost of
+ * a lookup with 16 to 256 active entries
+ *
+ * Random allocations, activations, moves to another VM or virtual sid
+ * through ptirq_update_virt_sid(), deactivations and releases are applied
+ * to ptirq_entries[]. After each of them, lookups of random sids by
+ * ptirq_lookup_entry_by_sid() must find what the linear scan over all the
+ * entries, which the hash tables replaced, finds. At the end every entry
+ * id, 64 and up included, must be allocatable again.
+ *
+ * Interrupts can't be masked in a Linux process, so the interrupt lock
+ * around the softirq list and timer updates is a no-op here.
+ */
+
+#include <cpu.h>
+
+#undef CPU_INT_ALL_DISABLE
+#undef CPU_INT_ALL_RESTORE
+#define CPU_INT_ALL_DISABLE(p_rflags)	do { *(p_rflags) = 0UL; } while (0)
+#define CPU_INT_ALL_RESTORE(rflags)	do { (void)(rflags); } while (0)
+
+#include "common/ptdev.c"
+#include "hvsim.h"
+
+#define NR_VMS		3U
+#define NR_OPS		200000U
+#define NR_LOOKUPS	1000000U
+#define NR_BDFS		64U	/* few sids, so they collide within a VM */
+
+/* Hypervisor services ptdev.c links against, none is reached here */
+void fire_softirq(__unused uint16_t nr) {}
+void register_softirq(__unused uint16_t nr, __unused softirq_handler func) {}
+void ptirq_softirq(__unused uint16_t pcpu_id) {}
+int32_t add_timer(__unused struct hv_timer *timer) { return 0; }
+void del_timer(__unused struct hv_timer *timer) {}
+bool is_sos_vm(__unused const struct acrn_vm *vm) { return false; }
+int32_t request_irq(uint32_t req_irq, __unused irq_action_t action_fn,
+		__unused void *priv_data, __unused uint32_t flags) { return (int32_t)req_irq; }
+void free_irq(__unused uint32_t irq) {}
+
+struct per_cpu_region per_cpu_data[MAX_PCPU_NUM];
+
+static struct acrn_vm sim_vms[NR_VMS];
+
+/* the lookup as it was before the hash tables */
+static struct ptirq_remapping_info *scan_lookup_entry_by_sid(uint32_t intr_type,
+		const union source_id *sid, const struct acrn_vm *vm)
+{
+	uint16_t idx;
+	struct ptirq_remapping_info *entry;
+	struct ptirq_remapping_info *entry_found = NULL;
+
+	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
+		entry = &ptirq_entries[idx];
+		if (!is_entry_active(entry)) {
+			continue;
+		}
+		if ((intr_type == entry->intr_type) &&
+			((vm == NULL) ? (sid->value == entry->phys_sid.value) :
+			((vm == entry->vm) && (sid->value == entry->virt_sid.value)))) {
+			entry_found = entry;
+			break;
+		}
+	}
+	return entry_found;
+}
+
+static uint32_t rand_type(uint64_t *seed)
+{
+	return ((hvsim_rand(seed) & 1UL) != 0UL) ? PTDEV_INTR_MSI : PTDEV_INTR_INTX;
+}
+
+static void rand_sid(uint64_t *seed, union source_id *sid)
+{
+	sid->value = 0UL;
+	sid->msi_id.bdf = (uint16_t)(hvsim_rand(seed) % NR_BDFS);
+	sid->msi_id.entry_nr = (uint16_t)(hvsim_rand(seed) % 4UL);
+}
+
+/*
+ * A sid is used by one active entry at most, as the callers of ptdev.c
+ * check with a lookup before they activate an entry.
+ */
+static bool sid_in_use(uint32_t type, const union source_id *phys_sid,
+		const struct acrn_vm *vm, const union source_id *virt_sid)
+{
+	return (scan_lookup_entry_by_sid(type, phys_sid, NULL) != NULL) ||
+		(scan_lookup_entry_by_sid(type, virt_sid, vm) != NULL);
+}
+
+static void check_lookups(uint64_t *seed)
+{
+	union source_id sid;
+	struct acrn_vm *vm;
+	uint32_t i, type;
+
+	for (i = 0U; i < 16U; i++) {
+		type = rand_type(seed);
+		rand_sid(seed, &sid);
+		HVSIM_CHECK(ptirq_lookup_entry_by_sid(type, &sid, NULL) ==
+			scan_lookup_entry_by_sid(type, &sid, NULL));
+		vm = &sim_vms[hvsim_rand(seed) % NR_VMS];
+		HVSIM_CHECK(ptirq_lookup_entry_by_sid(type, &sid, vm) ==
+			scan_lookup_entry_by_sid(type, &sid, vm));
+	}
+}
+
+/* every active entry must be found from both of its sids */
+static void check_all_active(void)
+{
+	struct ptirq_remapping_info *entry;
+	uint16_t idx;
+
+	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
+		entry = &ptirq_entries[idx];
+		if (is_entry_active(entry)) {
+			HVSIM_CHECK(ptirq_lookup_entry_by_sid(entry->intr_type, &entry->phys_sid, NULL) == entry);
+			HVSIM_CHECK(ptirq_lookup_entry_by_sid(entry->intr_type, &entry->virt_sid, entry->vm) == entry);
+		}
+	}
+}
+
+static void random_ops(uint64_t *seed)
+{
+	struct ptirq_remapping_info *entry;
+	union source_id phys_sid, virt_sid;
+	struct acrn_vm *vm;
+	uint32_t i, type, op;
+	uint32_t nr_activated = 0U, nr_moved = 0U, nr_released = 0U;
+
+	for (i = 0U; i < NR_OPS; i++) {
+		entry = &ptirq_entries[hvsim_rand(seed) % CONFIG_MAX_PT_IRQ_ENTRIES];
+		op = (uint32_t)(hvsim_rand(seed) % 4UL);
+
+		if (entry->vm == NULL) {
+			/* a free entry: allocate the next free id and activate it */
+			type = rand_type(seed);
+			vm = &sim_vms[hvsim_rand(seed) % NR_VMS];
+			rand_sid(seed, &phys_sid);
+			rand_sid(seed, &virt_sid);
+			if (sid_in_use(type, &phys_sid, vm, &virt_sid)) {
+				continue;
+			}
+			entry = ptirq_alloc_entry(vm, type);
+			HVSIM_CHECK(entry != NULL);
+			if (entry == NULL) {
+				break;
+			}
+			entry->phys_sid.value = phys_sid.value;
+			entry->virt_sid.value = virt_sid.value;
+			HVSIM_CHECK(ptirq_activate_entry(entry, entry->ptdev_entry_id) >= 0);
+			nr_activated++;
+		} else if (op == 0U) {
+			/* handed to another VM and/or virtual sid, as from the SOS to a UOS */
+			vm = &sim_vms[hvsim_rand(seed) % NR_VMS];
+			rand_sid(seed, &virt_sid);
+			if (scan_lookup_entry_by_sid(entry->intr_type, &virt_sid, vm) == NULL) {
+				ptirq_update_virt_sid(entry, vm, &virt_sid);
+				nr_moved++;
+			}
+		} else if ((op == 1U) && is_entry_active(entry)) {
+			ptirq_deactivate_entry(entry);
+		} else if (op == 1U) {
+			/* an inactive entry is moved too, without being hashed */
+			rand_sid(seed, &virt_sid);
+			ptirq_update_virt_sid(entry, entry->vm, &virt_sid);
+		} else if ((op == 2U) && !is_entry_active(entry) &&
+				!sid_in_use(entry->intr_type, &entry->phys_sid, entry->vm, &entry->virt_sid)) {
+			HVSIM_CHECK(ptirq_activate_entry(entry, entry->ptdev_entry_id) >= 0);
+		} else if (op == 3U) {
+			if (is_entry_active(entry)) {
+				ptirq_deactivate_entry(entry);
+			}
+			ptirq_release_entry(entry);
+			nr_released++;
+		} else {
+			/* nothing to do */
+		}
+		check_lookups(seed);
+		if ((i % 1000U) == 0U) {
+			check_all_active();
+		}
+	}
+
+	printf("%u random operations: %u activations, %u moves, %u releases\n",
+		NR_OPS, nr_activated, nr_moved, nr_released);
+}
+
+/* all the ids must be allocatable once every entry is released */
+static void check_release_all(void)
+{
+	struct ptirq_remapping_info *entry;
+	uint16_t idx;
+
+	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
+		entry = &ptirq_entries[idx];
+		if (entry->vm != NULL) {
+			if (is_entry_active(entry)) {
+				ptirq_deactivate_entry(entry);
+			}
+			ptirq_release_entry(entry);
+		}
+	}
+	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
+		entry = ptirq_alloc_entry(&sim_vms[0], PTDEV_INTR_MSI);
+		HVSIM_CHECK((entry != NULL) && (entry->ptdev_entry_id == idx));
+	}
+	HVSIM_CHECK(ptirq_alloc_entry(&sim_vms[0], PTDEV_INTR_MSI) == NULL);
+	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
+		ptirq_release_entry(&ptirq_entries[idx]);
+	}
+}
+
+/* cycles per lookup of a random active entry, by virtual sid as on MSI-X remaps */
+static void bench_lookups(uint64_t *seed)
+{
+	static struct ptirq_remapping_info *picks[NR_LOOKUPS];
+	struct ptirq_remapping_info *entry, *found;
+	const uint32_t counts[] = { 16U, 64U, 256U };
+	uint64_t start, hash_cycles, scan_cycles;
+	union source_id sid;
+	uint32_t c, i, n;
+
+	printf("%8s %12s %12s\n", "entries", "hash", "scan");
+	for (c = 0U; c < (sizeof(counts) / sizeof(counts[0])); c++) {
+		n = counts[c];
+		for (i = 0U; i < n; i++) {
+			entry = ptirq_alloc_entry(&sim_vms[i % NR_VMS], PTDEV_INTR_MSI);
+			sid.value = 0UL;
+			sid.msi_id.bdf = (uint16_t)(i / 8U);
+			sid.msi_id.entry_nr = (uint16_t)(i % 8U);
+			entry->phys_sid.value = sid.value;
+			entry->virt_sid.value = sid.value;
+			(void)ptirq_activate_entry(entry, i);
+		}
+		for (i = 0U; i < NR_LOOKUPS; i++) {
+			picks[i] = &ptirq_entries[hvsim_rand(seed) % n];
+		}
+
+		start = rdtsc();
+		for (i = 0U; i < NR_LOOKUPS; i++) {
+			found = ptirq_lookup_entry_by_sid(PTDEV_INTR_MSI, &picks[i]->virt_sid, picks[i]->vm);
+			HVSIM_CHECK(found == picks[i]);
+		}
+		hash_cycles = rdtsc() - start;
+
+		start = rdtsc();
+		for (i = 0U; i < NR_LOOKUPS; i++) {
+			found = scan_lookup_entry_by_sid(PTDEV_INTR_MSI, &picks[i]->virt_sid, picks[i]->vm);
+			HVSIM_CHECK(found == picks[i]);
+		}
+		scan_cycles = rdtsc() - start;
+
+		printf("%8u %12lu %12lu\n", n, hash_cycles / NR_LOOKUPS, scan_cycles / NR_LOOKUPS);
+		check_release_all();
+	}
+}
+
+int main(void)
+{
+	uint64_t seed = 0x2545f4914f6cdd1dUL;
+	uint16_t i;
+
+	for (i = 0U; i < NR_VMS; i++) {
+		sim_vms[i].vm_id = i;
+	}
+
+	random_ops(&seed);
+	check_release_all();
+	bench_lookups(&seed);
+
+	if (hvsim_failures != 0U) {
+		printf("%u checks failed\n", hvsim_failures);
+	}
+	return (hvsim_failures == 0U) ? 0 : 1;
+}
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * sbuf_bench - trace throughput of the shared buffer, from the hypervisor
+ * producer to the acrntrace consumer
+ *
+ * Every simulated pCPU has a 4 MB trace buffer like the one acrntrace maps.
+ * Producer threads put 32-byte trace entries into it with sbuf_put() of the
+ * hypervisor at a fixed rate, and a consumer thread flushes it to a file
+ * with sbuf_write() of acrntrace every polling period, as the acrntrace
+ * reader threads do. At the end the file is read back: every entry must be
+ * there, in order, and none may have been dropped.
+ *
+ * With -s the consumer also switches the mode of the buffer after every
+ * flush, while the producer keeps putting entries. The entries buffered or
+ * put during a switch are dropped, the others must be read back intact and in
+ * order, and the buffer must still work after the last switch.
+ *
+ * It is built against the C library, the producer lives in sbuf_hv.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include "sbuf.h"
+
+#define MAX_CPUS		8
+#define MAX_PRODUCERS		4
+#define SBUF_SIZE		(4 * 1024 * 1024)
+#define ENTRY_SIZE		32
+#define SBUF_REC_DATA		0
+#define MAX_SEGS		4096
+
+/* hypervisor producer, from sbuf_hv.c */
+uint32_t sbuf_put(shared_buf_t *sbuf, uint8_t *data);
+
+struct trace_entry {
+	uint64_t tsc;
+	uint32_t cpu;
+	uint32_t producer;
+	uint64_t seq;
+	uint64_t payload;
+};
+
+struct bench_cpu;
+
+struct producer {
+	pthread_t tid;
+	struct bench_cpu *cpu;
+	uint32_t id;
+	uint64_t rate;		/* entries per second */
+	uint64_t put;
+	uint64_t dropped;
+};
+
+/* a part of the trace file captured in one mode */
+struct segment {
+	uint64_t off;
+	bool varlen;
+};
+
+struct bench_cpu {
+	uint32_t id;
+	shared_buf_t *sbuf;
+	int fd;
+	pthread_t consumer;
+	uint64_t written;
+	int write_err;
+	struct producer producers[MAX_PRODUCERS];
+	struct segment segs[MAX_SEGS];
+	int nr_segs;
+};
+
+static struct bench_cpu cpus[MAX_CPUS];
+static int nr_cpus = 1, nr_producers = 1, duration;
+static uint64_t rate = 1000000, period_us = 10000;
+static bool varlen, switch_mode;
+static volatile bool producers_done;
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "Options:\n"
+	       "  -h             print this message\n"
+	       "  -c cpus        simulated pCPUs, each with its buffer (default 1)\n"
+	       "  -r rate        trace entries per second and pCPU (default 1000000)\n"
+	       "  -t seconds     duration of the run (default 2 per mode)\n"
+	       "  -i us          polling period of the consumer (default 10000,\n"
+	       "                 the acrntrace default)\n"
+	       "  -v             variable-length records only, default is both modes\n"
+	       "  -f             fixed-size elements only\n"
+	       "  -p producers   producers sharing each buffer, with -v (default 1)\n"
+	       "  -s             switch the mode of the buffers after every flush,\n"
+	       "                 default is both modes and then the switches\n",
+	       prog);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+/* put the entries due at the current time, then sleep a bit */
+static void *producer_fn(void *arg)
+{
+	struct producer *p = arg;
+	struct trace_entry entry;
+	struct timespec pause = { 0, 20000 };
+	uint64_t start = now_ns(), end = start + (uint64_t)duration * 1000000000UL;
+	uint64_t now, due;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.cpu = p->cpu->id;
+	entry.producer = p->id;
+	while ((now = now_ns()) < end) {
+		due = (now - start) * p->rate / 1000000000UL;
+		while (p->put + p->dropped < due) {
+			entry.tsc = now;
+			entry.seq = p->put;
+			entry.payload = ~p->put;
+			if (sbuf_put(p->cpu->sbuf, (uint8_t *)&entry) != 0)
+				p->put++;
+			else
+				p->dropped++;
+		}
+		nanosleep(&pause, NULL);
+	}
+
+	return NULL;
+}
+
+/* the acrntrace reader loop */
+static void *consumer_fn(void *arg)
+{
+	struct bench_cpu *c = arg;
+	bool done;
+	int ret;
+
+	do {
+		done = producers_done;
+		do {
+			ret = sbuf_write(c->fd, c->sbuf);
+			if (ret > 0)
+				c->written += ret;
+		} while (ret > 0);
+		if (ret < 0) {
+			c->write_err = 1;
+			break;
+		}
+		if (switch_mode && !done && (c->nr_segs < MAX_SEGS)) {
+			if (sbuf_set_varlen(c->sbuf, !c->segs[c->nr_segs - 1].varlen) < 0) {
+				c->write_err = 1;
+				break;
+			}
+			c->segs[c->nr_segs].off = c->written;
+			c->segs[c->nr_segs].varlen = !c->segs[c->nr_segs - 1].varlen;
+			c->nr_segs++;
+		}
+		if (!done)
+			usleep(period_us);
+	} while (!done);
+
+	return NULL;
+}
+
+static shared_buf_t *sbuf_alloc(void)
+{
+	shared_buf_t *sbuf;
+
+	if (posix_memalign((void **)&sbuf, 4096, SBUF_SIZE) != 0)
+		return NULL;
+	memset(sbuf, 0, SBUF_SIZE);
+	sbuf->magic = SBUF_MAGIC;
+	sbuf->ele_size = ENTRY_SIZE;
+	sbuf->ele_num = (SBUF_SIZE - SBUF_HEAD_SIZE) / ENTRY_SIZE;
+	sbuf->size = sbuf->ele_num * sbuf->ele_size;
+	sbuf->flags = OVERRUN_CNT_EN;
+
+	return sbuf;
+}
+
+/*
+ * read the file back: all the entries of every producer, in order, or only
+ * in order with switch_mode
+ */
+static int verify(struct bench_cpu *c)
+{
+	uint64_t next[MAX_PRODUCERS] = { 0 }, read = 0, last_read = 0;
+	sbuf_rec_hdr_t hdr;
+	struct trace_entry entry;
+	FILE *fp;
+	int i, seg = 0, err = 0;
+
+	fp = fdopen(dup(c->fd), "r");
+	if ((fp == NULL) || (fseek(fp, 0, SEEK_SET) != 0)) {
+		printf("cpu%u: failed to read the trace back\n", c->id);
+		return -1;
+	}
+
+	while (!err) {
+		while ((seg + 1 < c->nr_segs) && (ftell(fp) >= (long)c->segs[seg + 1].off)) {
+			seg++;
+			last_read = 0;
+		}
+		if (c->segs[seg].varlen) {
+			if (fread(&hdr, sizeof(hdr), 1, fp) != 1)
+				break;
+			if ((hdr.type != SBUF_REC_DATA) || (hdr.len != ENTRY_SIZE) ||
+					(hdr.size != sizeof(hdr) + ENTRY_SIZE)) {
+				printf("cpu%u: bad record header %u/%u/%u\n", c->id,
+					hdr.size, hdr.type, hdr.len);
+				err = -1;
+				break;
+			}
+		}
+		if (fread(&entry, sizeof(entry), 1, fp) != 1)
+			break;
+		if ((entry.cpu != c->id) || (entry.producer >= (uint32_t)nr_producers) ||
+				(entry.payload != ~entry.seq) || (entry.seq < next[entry.producer]) ||
+				(!switch_mode && (entry.seq != next[entry.producer]))) {
+			printf("cpu%u: bad entry, producer %u seq %lu\n", c->id,
+				entry.producer, entry.seq);
+			err = -1;
+			break;
+		}
+		next[entry.producer] = entry.seq + 1;
+		read++;
+		last_read++;
+	}
+	fclose(fp);
+
+	if (switch_mode && !err) {
+		printf("  cpu%u: %d mode switches, %lu entries read back, %lu after the last switch\n",
+			c->id, c->nr_segs - 1, read, last_read);
+		/*
+		 * the buffer works after the switches, and only the few entries
+		 * put between the last flush and a switch are dropped
+		 */
+		if ((last_read == 0) || (read < c->producers[0].put / 10 * 9))
+			err = -1;
+	}
+
+	for (i = 0; (i < nr_producers) && !err && !switch_mode; i++) {
+		if (next[i] != c->producers[i].put) {
+			printf("cpu%u: producer %d put %lu entries, %lu read back\n",
+				c->id, i, c->producers[i].put, next[i]);
+			err = -1;
+		}
+	}
+
+	return err;
+}
+
+static int run(void)
+{
+	char path[] = "/tmp/sbuf_bench.XXXXXX";
+	struct bench_cpu *c;
+	struct producer *p;
+	uint64_t start, put, dropped;
+	double secs;
+	int i, j, failed = 0;
+
+	producers_done = false;
+	for (i = 0; i < nr_cpus; i++) {
+		c = &cpus[i];
+		memset(c, 0, sizeof(*c));
+		c->id = i;
+		c->sbuf = sbuf_alloc();
+		c->fd = mkstemp(path);
+		if ((c->sbuf == NULL) || (c->fd < 0)) {
+			printf("failed to set up cpu%d: %s\n", i, strerror(errno));
+			return -1;
+		}
+		unlink(path);
+		strcpy(path, "/tmp/sbuf_bench.XXXXXX");
+		if (varlen && (sbuf_set_varlen(c->sbuf, true) < 0)) {
+			printf("failed to switch cpu%d to variable-length records\n", i);
+			return -1;
+		}
+		c->segs[0].off = 0;
+		c->segs[0].varlen = varlen;
+		c->nr_segs = 1;
+		for (j = 0; j < nr_producers; j++) {
+			c->producers[j].cpu = c;
+			c->producers[j].id = j;
+			c->producers[j].rate = rate / nr_producers;
+		}
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_cpus; i++) {
+		c = &cpus[i];
+		pthread_create(&c->consumer, NULL, consumer_fn, c);
+		for (j = 0; j < nr_producers; j++)
+			pthread_create(&c->producers[j].tid, NULL, producer_fn, &c->producers[j]);
+	}
+	for (i = 0; i < nr_cpus; i++)
+		for (j = 0; j < nr_producers; j++)
+			pthread_join(cpus[i].producers[j].tid, NULL);
+	secs = (double)(now_ns() - start) / 1e9;
+	producers_done = true;
+	for (i = 0; i < nr_cpus; i++)
+		pthread_join(cpus[i].consumer, NULL);
+
+	printf("%s records, %d pCPU(s), %d producer(s) per buffer, %lu entries/s per pCPU, "
+		"polled every %lu us\n", switch_mode ? "switched" : varlen ? "variable-length" : "fixed-size",
+		nr_cpus, nr_producers, rate, period_us);
+	for (i = 0; i < nr_cpus; i++) {
+		c = &cpus[i];
+		put = 0;
+		dropped = 0;
+		for (j = 0; j < nr_producers; j++) {
+			p = &c->producers[j];
+			put += p->put;
+			dropped += p->dropped;
+		}
+		printf("  cpu%d: %lu entries (%.0f/s), %lu dropped, overrun_cnt %u, %lu bytes written\n",
+			i, put, (double)put / secs, dropped, c->sbuf->overrun_cnt, c->written);
+		/* the entries put while the buffer is paused are dropped */
+		if (((dropped != 0) && !switch_mode) || c->write_err || (verify(c) != 0) ||
+				((double)(put + dropped) < (double)rate * (double)duration * 0.99)) {
+			printf("  cpu%d: FAILED\n", i);
+			failed = 1;
+		}
+		close(c->fd);
+		free(c->sbuf);
+	}
+
+	return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	bool only_varlen = false, only_fixed = false, only_switch = false;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "hc:r:t:i:vfp:s")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_cpus = atoi(optarg);
+			break;
+		case 'r':
+			rate = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'i':
+			period_us = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			only_varlen = true;
+			break;
+		case 'f':
+			only_fixed = true;
+			break;
+		case 'p':
+			nr_producers = atoi(optarg);
+			break;
+		case 's':
+			only_switch = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((nr_cpus <= 0) || (nr_cpus > MAX_CPUS) || (nr_producers <= 0) ||
+			(nr_producers > MAX_PRODUCERS) || (rate == 0) || (duration < 0) ||
+			((only_varlen + only_fixed + only_switch) > 1) ||
+			((nr_producers > 1) && !only_varlen)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (duration == 0)
+		duration = 2;
+
+	if (!only_varlen && !only_switch) {
+		varlen = false;
+		ret |= run();
+	}
+	if (!only_fixed && !only_switch) {
+		varlen = true;
+		ret |= run();
+	}
+	if (!only_varlen && !only_fixed) {
+		varlen = false;
+		switch_mode = true;
+		ret |= run();
+	}
+
+	return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * The producer side of the shared buffer, debug/sbuf.c, built for
+ * sbuf_bench. sbuf_bench itself is built against the C library and the
+ * acrntrace consumer, and calls the functions of this file.
+ */
+
+#include <cpu.h>
+
+/* STAC and CLAC fault outside of ring 0, and the buffer is plain memory here */
+#define stac()
+#define clac()
+
+#include "debug/sbuf.c"
+#include "hvsim.h"
+
+struct per_cpu_region per_cpu_data[MAX_PCPU_NUM];
+
+uint16_t get_pcpu_nums(void)
+{
+	return 1U;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * sched_fs_sim - CPU shares and wakeup latencies of sched_fs on wake/sleep
+ * traces of CPU bound and IO bound vCPUs, see sched_sim.h
+ *
+ * It fails if a CPU bound vCPU doesn't get the share its weight and cap
+ * give it.
+ */
+
+#include <per_cpu.h>
+
+/* everything runs on the one simulated pCPU */
+#define get_pcpu_id()	0U
+
+#include "common/sched_fs.c"
+#include "sched_sim.h"
+
+int main(void)
+{
+	return run_scenarios(&sched_fs, true);
+}
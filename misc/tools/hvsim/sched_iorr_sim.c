@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * sched_iorr_sim - the sched_fs_sim traces replayed on sched_iorr, for
+ * reference. sched_iorr ignores the weights and caps, so the shares are
+ * not checked.
+ */
+
+#include <per_cpu.h>
+
+/* everything runs on the one simulated pCPU */
+#define get_pcpu_id()	0U
+
+#include "common/sched_iorr.c"
+#include "sched_sim.h"
+
+int main(void)
+{
+	return run_scenarios(&sched_iorr, false);
+}
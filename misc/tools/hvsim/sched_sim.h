@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Replay of wake/sleep traces on one simulated pCPU, shared by the
+ * scheduler simulations. The program includes the scheduler under test
+ * first, then this file, and calls run_scenarios() with its acrn_scheduler.
+ *
+ * Time is a virtual TSC which only moves forward when the simulation says
+ * so: rdtsc() returns it and the scheduler tick fires every millisecond of
+ * it. sim_wake(), sim_sleep() and sim_schedule() do what wake_thread(),
+ * sleep_thread() and schedule() of schedule.c do, without the locks and
+ * the context switch.
+ */
+
+#ifndef SCHED_SIM_H
+#define SCHED_SIM_H
+
+#include <per_cpu.h>
+#include <schedule.h>
+#include "hvsim.h"
+
+#define SIM_TSC_MHZ		2000UL
+#define SIM_DURATION_MS		10000UL
+#define SIM_MAX_THREADS		4U
+#define SIM_MAX_SAMPLES		100000U
+#define SIM_CPU_BOUND		(~0UL >> 1U)
+/* tolerance of the CPU share of a thread, in percent */
+#define SIM_SHARE_TOLERANCE	2U
+
+struct per_cpu_region per_cpu_data[MAX_PCPU_NUM];
+
+static uint64_t sim_now;
+
+/*
+ * A thread runs for run_us, then sleeps between sleep_min_us and
+ * sleep_max_us and runs again. run_us == 0 means it never sleeps.
+ */
+struct sim_thread_desc {
+	const char *name;
+	uint16_t weight;
+	uint16_t cap;
+	uint32_t run_us;
+	uint32_t sleep_min_us;
+	uint32_t sleep_max_us;
+	uint32_t expected_share;	/* in percent, 0: not checked */
+};
+
+struct sim_scenario {
+	const char *name;
+	uint32_t nr_threads;
+	struct sim_thread_desc threads[SIM_MAX_THREADS];
+};
+
+struct sim_thread {
+	/* keep obj as the first item */
+	struct thread_object obj;
+	const struct sim_thread_desc *desc;
+	uint64_t left;		/* cycles left in the current burst */
+	uint64_t wake_at;	/* when a blocked thread wakes up */
+	uint64_t woken_at;	/* when the thread was woken */
+	bool waiting;		/* woken and not run yet */
+	uint64_t ran;
+	uint32_t nr_samples;
+	uint64_t samples[SIM_MAX_SAMPLES];	/* wakeup latencies */
+};
+
+static struct sim_thread sim_threads[SIM_MAX_THREADS];
+
+/* Hypervisor services the schedulers link against */
+uint64_t rdtsc(void)
+{
+	return sim_now;
+}
+
+uint64_t us_to_ticks(uint32_t us)
+{
+	return (uint64_t)us * SIM_TSC_MHZ;
+}
+
+int32_t add_timer(__unused struct hv_timer *timer)
+{
+	return 0;
+}
+
+void del_timer(__unused struct hv_timer *timer) {}
+void obtain_schedule_lock(__unused uint16_t pcpu_id, __unused uint64_t *rflag) {}
+void release_schedule_lock(__unused uint16_t pcpu_id, __unused uint64_t rflag) {}
+
+bool is_idle_thread(const struct thread_object *obj)
+{
+	return (obj == &per_cpu(idle, obj->pcpu_id));
+}
+
+void make_reschedule_request(uint16_t pcpu_id, __unused uint16_t delmode)
+{
+	per_cpu(sched_ctl, pcpu_id).flags |= NEED_RESCHEDULE;
+}
+
+static void sim_wake(struct sim_thread *t)
+{
+	struct sched_control *ctl = t->obj.sched_ctl;
+
+	if (t->obj.status == THREAD_STS_BLOCKED) {
+		ctl->scheduler->wake(&t->obj);
+		t->obj.status = THREAD_STS_RUNNABLE;
+		make_reschedule_request(ctl->pcpu_id, DEL_MODE_IPI);
+	}
+}
+
+static void sim_sleep(struct sim_thread *t)
+{
+	struct sched_control *ctl = t->obj.sched_ctl;
+
+	ctl->scheduler->sleep(&t->obj);
+	if (t->obj.status == THREAD_STS_RUNNING) {
+		make_reschedule_request(ctl->pcpu_id, DEL_MODE_IPI);
+	}
+	t->obj.status = THREAD_STS_BLOCKED;
+}
+
+static void sim_schedule(struct sched_control *ctl)
+{
+	struct thread_object *prev = ctl->curr_obj;
+	struct thread_object *next;
+	struct sim_thread *t;
+
+	next = ctl->scheduler->pick_next(ctl);
+	ctl->flags &= ~NEED_RESCHEDULE;
+
+	if (prev->status == THREAD_STS_RUNNING) {
+		prev->status = THREAD_STS_RUNNABLE;
+	}
+	next->status = THREAD_STS_RUNNING;
+	ctl->curr_obj = next;
+
+	if (!is_idle_thread(next)) {
+		t = (struct sim_thread *)next;
+		if (t->waiting) {
+			if (t->nr_samples < SIM_MAX_SAMPLES) {
+				t->samples[t->nr_samples] = sim_now - t->woken_at;
+				t->nr_samples++;
+			}
+			t->waiting = false;
+		}
+	}
+}
+
+static void sim_start_burst(struct sim_thread *t)
+{
+	t->left = (t->desc->run_us == 0U) ? SIM_CPU_BOUND : us_to_ticks(t->desc->run_us);
+	t->woken_at = sim_now;
+	t->waiting = true;
+}
+
+static uint64_t sim_sleep_cycles(const struct sim_thread_desc *desc, uint64_t *seed)
+{
+	uint32_t span = desc->sleep_max_us - desc->sleep_min_us;
+
+	return us_to_ticks(desc->sleep_min_us + (uint32_t)(hvsim_rand(seed) % (span + 1U)));
+}
+
+static void sim_replay(struct acrn_scheduler *scheduler, const struct sim_scenario *sc, uint64_t *seed)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, 0U);
+	struct thread_object *idle = &per_cpu(idle, 0U);
+	uint64_t end = SIM_DURATION_MS * us_to_ticks(1000U);
+	uint64_t next_tick, next, delta;
+	struct sim_thread *t, *curr;
+	uint32_t i;
+
+	(void)memset(per_cpu_data, 0U, sizeof(per_cpu_data));
+	(void)memset(sim_threads, 0U, sizeof(sim_threads));
+	sim_now = 0UL;
+
+	ctl->pcpu_id = 0U;
+	ctl->scheduler = scheduler;
+	HVSIM_CHECK(scheduler->init(ctl) == 0);
+	idle->pcpu_id = 0U;
+	idle->sched_ctl = ctl;
+	idle->status = THREAD_STS_RUNNING;
+	ctl->curr_obj = idle;
+
+	for (i = 0U; i < sc->nr_threads; i++) {
+		t = &sim_threads[i];
+		t->desc = &sc->threads[i];
+		t->obj.pcpu_id = 0U;
+		t->obj.sched_ctl = ctl;
+		t->obj.sched_weight = t->desc->weight;
+		t->obj.sched_cap = t->desc->cap;
+		scheduler->init_data(&t->obj);
+		t->obj.status = THREAD_STS_BLOCKED;
+		sim_start_burst(t);
+		sim_wake(t);
+	}
+
+	next_tick = us_to_ticks(1000U);
+	while (sim_now < end) {
+		if ((ctl->flags & NEED_RESCHEDULE) != 0UL) {
+			sim_schedule(ctl);
+		}
+		curr = is_idle_thread(ctl->curr_obj) ? NULL : (struct sim_thread *)ctl->curr_obj;
+
+		/* the next event: a tick, a wakeup or the end of the running burst */
+		next = next_tick;
+		for (i = 0U; i < sc->nr_threads; i++) {
+			t = &sim_threads[i];
+			if ((t->obj.status == THREAD_STS_BLOCKED) && (t->wake_at < next)) {
+				next = t->wake_at;
+			}
+		}
+		if ((curr != NULL) && ((sim_now + curr->left) < next)) {
+			next = sim_now + curr->left;
+		}
+
+		delta = next - sim_now;
+		sim_now = next;
+		if (curr != NULL) {
+			curr->ran += delta;
+			curr->left -= delta;
+			if (curr->left == 0UL) {
+				curr->wake_at = sim_now + sim_sleep_cycles(curr->desc, seed);
+				sim_sleep(curr);
+			}
+		}
+
+		for (i = 0U; i < sc->nr_threads; i++) {
+			t = &sim_threads[i];
+			if ((t->obj.status == THREAD_STS_BLOCKED) && (t->wake_at <= sim_now)) {
+				sim_start_burst(t);
+				sim_wake(t);
+			}
+		}
+
+		if (sim_now == next_tick) {
+			sched_tick_handler(ctl);
+			next_tick += us_to_ticks(1000U);
+		}
+	}
+
+	scheduler->deinit(ctl);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Print the CPU share and wakeup latencies of every thread, and the Jain
+ * fairness index of the shares relative to the expected ones: 1 is fair,
+ * 1/n is as unfair as it gets.
+ */
+static void sim_report(const struct sim_scenario *sc, bool check_shares)
+{
+	uint64_t total = SIM_DURATION_MS * us_to_ticks(1000U);
+	uint64_t share, sum, ratio;
+	uint64_t ratio_sum = 0UL, ratio_sq_sum = 0UL;
+	uint32_t i, j, n, nr_ratios = 0U;
+	struct sim_thread *t;
+
+	printf("%s\n", sc->name);
+	printf("  %-8s %6s %4s %8s %9s %9s %9s %9s\n", "thread", "weight", "cap",
+		"share %", "expect %", "lat avg", "lat p99", "lat max");
+	for (i = 0U; i < sc->nr_threads; i++) {
+		t = &sim_threads[i];
+		n = t->nr_samples;
+		/* in units of 0.1% */
+		share = (t->ran * 1000UL) / total;
+
+		sum = 0UL;
+		qsort(t->samples, n, sizeof(uint64_t), cmp_u64);
+		for (j = 0U; j < n; j++) {
+			sum += t->samples[j];
+		}
+
+		printf("  %-8s %6u %4u %6lu.%lu ", t->desc->name, t->desc->weight, t->desc->cap,
+			share / 10UL, share % 10UL);
+		if (t->desc->expected_share != 0U) {
+			printf("%9u ", t->desc->expected_share);
+		} else {
+			printf("%9s ", "-");
+		}
+		/* latencies in us, only the threads which sleep wake up more than once */
+		if ((t->desc->run_us != 0U) && (n != 0U)) {
+			printf("%9lu %9lu %9lu\n", (sum / n) / SIM_TSC_MHZ,
+				t->samples[((uint64_t)n * 99UL) / 100UL] / SIM_TSC_MHZ,
+				t->samples[n - 1U] / SIM_TSC_MHZ);
+		} else {
+			printf("%9s %9s %9s\n", "-", "-", "-");
+		}
+
+		if (t->desc->expected_share != 0U) {
+			ratio = (share * 1000UL) / t->desc->expected_share;
+			ratio_sum += ratio;
+			ratio_sq_sum += ratio * ratio;
+			nr_ratios++;
+			if (check_shares) {
+				HVSIM_CHECK((share + (SIM_SHARE_TOLERANCE * 10UL) >= (t->desc->expected_share * 10UL)) &&
+					(share <= (t->desc->expected_share + SIM_SHARE_TOLERANCE) * 10UL));
+			}
+		}
+	}
+	if (nr_ratios != 0U) {
+		/* Jain index in units of 0.001 */
+		printf("  fairness %lu.%03lu\n", (ratio_sum * ratio_sum) / (nr_ratios * ratio_sq_sum),
+			((ratio_sum * ratio_sum * 1000UL) / (nr_ratios * ratio_sq_sum)) % 1000UL);
+	}
+}
+
+static const struct sim_scenario sim_scenarios[] = {
+	{
+		.name = "two CPU bound vCPUs, weight 1:1",
+		.nr_threads = 2U,
+		.threads = {
+			{ .name = "cpu0", .weight = 256U, .expected_share = 50U },
+			{ .name = "cpu1", .weight = 256U, .expected_share = 50U },
+		},
+	},
+	{
+		.name = "two CPU bound vCPUs, weight 3:1",
+		.nr_threads = 2U,
+		.threads = {
+			{ .name = "cpu0", .weight = 768U, .expected_share = 75U },
+			{ .name = "cpu1", .weight = 256U, .expected_share = 25U },
+		},
+	},
+	{
+		.name = "two CPU bound vCPUs, one capped at 30%",
+		.nr_threads = 2U,
+		.threads = {
+			{ .name = "capped", .weight = 256U, .cap = 30U, .expected_share = 30U },
+			{ .name = "cpu1", .weight = 256U, .expected_share = 70U },
+		},
+	},
+	{
+		.name = "one IO bound vCPU, two CPU bound vCPUs",
+		.nr_threads = 3U,
+		.threads = {
+			{ .name = "io", .weight = 256U, .run_us = 50U, .sleep_min_us = 500U, .sleep_max_us = 2000U },
+			{ .name = "cpu0", .weight = 256U },
+			{ .name = "cpu1", .weight = 256U },
+		},
+	},
+	{
+		.name = "one IO bound vCPU at a low weight, one CPU bound vCPU",
+		.nr_threads = 2U,
+		.threads = {
+			{ .name = "io", .weight = 64U, .run_us = 200U, .sleep_min_us = 100U, .sleep_max_us = 1000U },
+			{ .name = "cpu0", .weight = 1024U },
+		},
+	},
+};
+
+/*
+ * check_shares: the scheduler honors the weights and caps, fail if a share
+ * is off the expected one by more than SIM_SHARE_TOLERANCE
+ */
+static int run_scenarios(struct acrn_scheduler *scheduler, bool check_shares)
+{
+	uint64_t seed = 0x853c49e6748fea9bUL;
+	uint32_t i;
+
+	printf("%s, %lu ms per scenario, latencies in us\n", scheduler->name, SIM_DURATION_MS);
+	for (i = 0U; i < ARRAY_SIZE(sim_scenarios); i++) {
+		sim_replay(scheduler, &sim_scenarios[i], &seed);
+		sim_report(&sim_scenarios[i], check_shares);
+	}
+
+	return (hvsim_failures == 0U) ? 0 : 1;
+}
+
+#endif /* SCHED_SIM_H */
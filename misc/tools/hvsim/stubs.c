@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Host versions of the hypervisor services used by the code under test.
+ * They are weak, so a program which pulls in the real implementation, or
+ * needs a different behavior, simply defines its own.
+ */
+
+#include <types.h>
+#include <rtl.h>
+#include <util.h>
+#include <logmsg.h>
+#include "hvsim.h"
+
+uint32_t hvsim_failures;
+
+__attribute__((weak)) void do_logmsg(uint32_t severity, const char *fmt, ...)
+{
+	va_list args;
+
+	/* only the errors, the benchmarks would drown in the rest */
+	if (severity <= LOG_ERROR) {
+		va_start(args, fmt);
+		vprintf(fmt, args);
+		va_end(args);
+		printf("\n");
+	}
+}
+
+__attribute__((weak)) void asm_assert(int32_t line, const char *file, const char *txt)
+{
+	printf("assertion failed in file %s,line %d: %s\n", file, line, txt);
+	abort();
+}
+
+__attribute__((weak)) void *memcpy_s(void *d, size_t dmax, const void *s, size_t slen)
+{
+	uint8_t *dest = (uint8_t *)d;
+	const uint8_t *src = (const uint8_t *)s;
+	size_t i;
+
+	if (slen > dmax) {
+		asm_assert(__LINE__, __FILE__, "memcpy_s overflow");
+	}
+	for (i = 0U; i < slen; i++) {
+		dest[i] = src[i];
+	}
+
+	return d;
+}
+
+__attribute__((weak)) uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32U) | lo;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * timer_bench - cost of re-arming a timer on a pCPU with 1 to 256 active
+ * timers, and a check of the timer queue order
+ *
+ * A re-arm deletes a random active timer and adds it back with a new random
+ * deadline, through local_del_timer() and local_add_timer() of timer.c.
+ * The locked add_timer()/del_timer() wrappers and the TSC deadline MSR
+ * write can't run in a Linux process and cost the same for both queues.
+ * "list" is the sorted list which the min-heap replaced, for reference, on
+ * the same sequence of re-arms.
+ */
+
+#include "arch/x86/timer.c"
+#include "hvsim.h"
+
+#define NR_REARMS	1000000U
+#define NR_CHECK_OPS	200000U
+#define DEADLINE_RANGE	1000000UL
+
+struct per_cpu_region per_cpu_data[MAX_PCPU_NUM];
+
+/* Hypervisor services timer.c links against, none is reached here */
+void fire_softirq(__unused uint16_t nr) {}
+void register_softirq(__unused uint16_t nr, __unused softirq_handler func) {}
+int32_t request_irq(__unused uint32_t req_irq, __unused irq_action_t action_fn,
+		__unused void *priv_data, __unused uint32_t flags) { return 0; }
+void TRACE_2L(__unused uint32_t evid, __unused uint64_t e, __unused uint64_t f) {}
+struct cpuinfo_x86 *get_pcpu_info(void) { return NULL; }
+
+/* the sorted list of the old per-cpu timers */
+struct list_timer {
+	struct list_head node;
+	uint64_t fire_tsc;
+};
+
+static struct per_cpu_timers sim_timers;
+static struct hv_timer timers[MAX_TIMERS_PER_PCPU];
+static struct list_head timer_list;
+static struct list_timer list_timers[MAX_TIMERS_PER_PCPU];
+static uint32_t picks[NR_REARMS];
+static uint64_t deadlines[NR_REARMS];
+
+static void list_add_timer(struct list_timer *timer)
+{
+	struct list_head *pos, *prev;
+	struct list_timer *tmp;
+
+	prev = &timer_list;
+	list_for_each(pos, &timer_list) {
+		tmp = list_entry(pos, struct list_timer, node);
+		if (tmp->fire_tsc < timer->fire_tsc) {
+			prev = &tmp->node;
+		} else {
+			break;
+		}
+	}
+	list_add(&timer->node, prev);
+}
+
+static void timer_fn(__unused void *data) {}
+
+static void check_heap(void)
+{
+	uint32_t i;
+
+	for (i = 1U; i <= sim_timers.nr_timers; i++) {
+		HVSIM_CHECK(sim_timers.queue[i]->queue_idx == i);
+		if (i > 1U) {
+			HVSIM_CHECK(sim_timers.queue[i / 2U]->fire_tsc <= sim_timers.queue[i]->fire_tsc);
+		}
+	}
+}
+
+/* random adds and deletes, then the timers must come out in deadline order */
+static void check_queue(uint64_t *seed)
+{
+	struct hv_timer *timer;
+	uint64_t last = 0UL;
+	uint32_t i;
+
+	(void)memset(&sim_timers, 0U, sizeof(sim_timers));
+	for (i = 0U; i < MAX_TIMERS_PER_PCPU; i++) {
+		initialize_timer(&timers[i], timer_fn, NULL, 1UL, TICK_MODE_ONESHOT, 0UL);
+	}
+
+	for (i = 0U; i < NR_CHECK_OPS; i++) {
+		timer = &timers[hvsim_rand(seed) % MAX_TIMERS_PER_PCPU];
+		if (timer_is_started(timer)) {
+			local_del_timer(&sim_timers, timer);
+		} else {
+			/* few distinct deadlines, so equal keys are covered too */
+			timer->fire_tsc = 1UL + (hvsim_rand(seed) % 64UL);
+			HVSIM_CHECK(local_add_timer(&sim_timers, timer) ==
+				(sim_timers.queue[1U] == timer));
+		}
+		if ((i % 64U) == 0U) {
+			check_heap();
+		}
+	}
+	check_heap();
+
+	while (sim_timers.nr_timers != 0U) {
+		timer = sim_timers.queue[1U];
+		HVSIM_CHECK(timer->fire_tsc >= last);
+		last = timer->fire_tsc;
+		local_del_timer(&sim_timers, timer);
+		HVSIM_CHECK(!timer_is_started(timer));
+	}
+}
+
+static void setup(uint32_t nr_timers, uint64_t *seed)
+{
+	uint64_t fire_tsc;
+	uint32_t i;
+
+	(void)memset(&sim_timers, 0U, sizeof(sim_timers));
+	INIT_LIST_HEAD(&timer_list);
+	for (i = 0U; i < nr_timers; i++) {
+		fire_tsc = 1UL + (hvsim_rand(seed) % DEADLINE_RANGE);
+		initialize_timer(&timers[i], timer_fn, NULL, fire_tsc, TICK_MODE_ONESHOT, 0UL);
+		(void)local_add_timer(&sim_timers, &timers[i]);
+		list_timers[i].fire_tsc = fire_tsc;
+		list_add_timer(&list_timers[i]);
+	}
+
+	for (i = 0U; i < NR_REARMS; i++) {
+		picks[i] = (uint32_t)(hvsim_rand(seed) % nr_timers);
+		deadlines[i] = 1UL + (hvsim_rand(seed) % DEADLINE_RANGE);
+	}
+}
+
+static uint64_t rearm_heap(void)
+{
+	struct hv_timer *timer;
+	uint64_t start;
+	uint32_t i;
+
+	start = rdtsc();
+	for (i = 0U; i < NR_REARMS; i++) {
+		timer = &timers[picks[i]];
+		local_del_timer(&sim_timers, timer);
+		timer->fire_tsc = deadlines[i];
+		(void)local_add_timer(&sim_timers, timer);
+	}
+	start = rdtsc() - start;
+	check_heap();
+
+	return start / NR_REARMS;
+}
+
+static uint64_t rearm_list(void)
+{
+	struct list_timer *timer;
+	uint64_t start;
+	uint32_t i;
+
+	start = rdtsc();
+	for (i = 0U; i < NR_REARMS; i++) {
+		timer = &list_timers[picks[i]];
+		list_del(&timer->node);
+		timer->fire_tsc = deadlines[i];
+		list_add_timer(timer);
+	}
+
+	return (rdtsc() - start) / NR_REARMS;
+}
+
+int main(void)
+{
+	static const uint32_t counts[] = { 1U, 16U, 64U, 256U };
+	uint64_t seed = 0x9e3779b97f4a7c15UL;
+	uint64_t heap, list;
+	uint32_t c;
+
+	check_queue(&seed);
+
+	printf("%8s %16s %16s\n", "timers", "heap (cycles)", "list (cycles)");
+	for (c = 0U; c < ARRAY_SIZE(counts); c++) {
+		setup(counts[c], &seed);
+		heap = rearm_heap();
+		list = rearm_list();
+		printf("%8u %16lu %16lu\n", counts[c], heap, list);
+	}
+
+	return (hvsim_failures == 0U) ? 0 : 1;
+}
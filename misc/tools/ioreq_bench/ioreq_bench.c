@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * ioreq_bench - measure the round trip latency of emulated I/O from inside
+ * a User VM, optionally while other vCPUs keep a slow emulated device busy
+ *
+ * Each probe thread is pinned to one vCPU and times the accesses to a
+ * device emulated by the device model. Each load thread is pinned to
+ * another vCPU and reads the registers of a slow device (e.g. AHCI or
+ * xHCI) in a loop. Running it against a device model with and without
+ * "--ioreq_dispatch" shows how much the load on one vCPU delays the I/O
+ * of the others.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/io.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_THREADS		64
+#define MAX_SAMPLES		(1 << 20)
+
+#define pr_err(fmt, ...)	fprintf(stderr, "ioreq_bench: " fmt, ##__VA_ARGS__)
+
+/* one emulated register: a port, or an offset in a mmapped PCI BAR */
+struct io_target {
+	bool		is_pio;
+	uint16_t	port;
+	const char	*res_path;
+	uint64_t	offset;
+	volatile uint32_t *mmio;
+};
+
+struct bench_thread {
+	pthread_t	tid;
+	int		cpu;
+	bool		is_probe;
+	struct io_target *target;
+	uint64_t	*samples;	/* probe threads: latencies in ns */
+	uint32_t	nr_samples;
+	uint64_t	nr_accesses;
+};
+
+static struct io_target probe_target, load_target;
+static struct bench_thread threads[MAX_THREADS];
+static int nr_threads;
+static volatile bool stop;
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "Options:\n"
+	       "  -h                 print this message\n"
+	       "  -p port            probe the I/O port\n"
+	       "  -m res_file@off    probe the MMIO register at offset off of the\n"
+	       "                     PCI BAR res_file, e.g.\n"
+	       "                     /sys/bus/pci/devices/0000:00:03.0/resource5@0x0\n"
+	       "  -P cpu[,cpu...]    vCPUs running a probe thread (default 0)\n"
+	       "  -l res_file@off    load: read this MMIO register in a loop\n"
+	       "  -L cpu[,cpu...]    vCPUs running a load thread (default none)\n"
+	       "  -t seconds         duration of the run (default 10)\n",
+	       prog);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+static int parse_mmio_target(char *arg, struct io_target *target)
+{
+	char *at = strrchr(arg, '@');
+	char *end;
+
+	if (at == NULL)
+		return -1;
+	*at = '\0';
+	target->is_pio = false;
+	target->res_path = arg;
+	target->offset = strtoull(at + 1, &end, 0);
+	if ((*end != '\0') || ((target->offset & 3UL) != 0UL))
+		return -1;
+	return 0;
+}
+
+static int map_target(struct io_target *target)
+{
+	struct stat st;
+	uint64_t page_off = target->offset & ~0xfffUL;
+	void *base;
+	int fd;
+
+	if (target->is_pio) {
+		if (ioperm(target->port, 1, 1) != 0) {
+			pr_err("ioperm(0x%x): %s\n", target->port, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	fd = open(target->res_path, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		pr_err("open %s: %s\n", target->res_path, strerror(errno));
+		return -1;
+	}
+	if ((fstat(fd, &st) != 0) || (target->offset + 4UL > (uint64_t)st.st_size)) {
+		pr_err("offset 0x%lx is out of %s\n", target->offset, target->res_path);
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, 0x1000, PROT_READ, MAP_SHARED, fd, (off_t)page_off);
+	close(fd);
+	if (base == MAP_FAILED) {
+		pr_err("mmap %s: %s\n", target->res_path, strerror(errno));
+		return -1;
+	}
+	target->mmio = (volatile uint32_t *)((char *)base + (target->offset - page_off));
+	return 0;
+}
+
+static inline void access_target(const struct io_target *target)
+{
+	if (target->is_pio)
+		(void)inb(target->port);
+	else
+		(void)*target->mmio;
+}
+
+static void *bench_thread_fn(void *arg)
+{
+	struct bench_thread *t = arg;
+	cpu_set_t set;
+	uint64_t start;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		pr_err("failed to pin a thread to vCPU %d\n", t->cpu);
+
+	/* the port permissions are per thread */
+	if (t->target->is_pio && (ioperm(t->target->port, 1, 1) != 0)) {
+		pr_err("ioperm(0x%x): %s\n", t->target->port, strerror(errno));
+		return NULL;
+	}
+
+	while (!stop) {
+		if (t->is_probe) {
+			start = now_ns();
+			access_target(t->target);
+			if (t->nr_samples < MAX_SAMPLES)
+				t->samples[t->nr_samples++] = now_ns() - start;
+		} else {
+			access_target(t->target);
+		}
+		t->nr_accesses++;
+	}
+
+	return NULL;
+}
+
+static int add_threads(char *cpus, bool is_probe)
+{
+	char *tok, *save = NULL;
+	struct bench_thread *t;
+
+	for (tok = strtok_r(cpus, ",", &save); tok != NULL;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (nr_threads >= MAX_THREADS)
+			return -1;
+		t = &threads[nr_threads++];
+		t->cpu = atoi(tok);
+		t->is_probe = is_probe;
+		t->target = is_probe ? &probe_target : &load_target;
+	}
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const struct bench_thread *t, double secs)
+{
+	uint64_t sum = 0UL;
+	uint32_t i, n = t->nr_samples;
+
+	if (!t->is_probe) {
+		printf("load  vCPU%-3d %10.0f accesses/s\n", t->cpu,
+				(double)t->nr_accesses / secs);
+		return;
+	}
+	if (n == 0U) {
+		printf("probe vCPU%-3d no samples\n", t->cpu);
+		return;
+	}
+
+	qsort(t->samples, n, sizeof(uint64_t), cmp_u64);
+	for (i = 0U; i < n; i++)
+		sum += t->samples[i];
+
+	printf("probe vCPU%-3d %10u samples  min %6lu  avg %6lu  p50 %6lu  "
+		"p99 %7lu  p99.9 %8lu  max %8lu ns\n", t->cpu, n,
+		t->samples[0], sum / n, t->samples[n / 2U],
+		t->samples[(uint64_t)n * 99UL / 100UL],
+		t->samples[(uint64_t)n * 999UL / 1000UL], t->samples[n - 1U]);
+}
+
+int main(int argc, char *argv[])
+{
+	char default_cpus[] = "0";
+	char *probe_cpus = default_cpus, *load_cpus = NULL;
+	bool has_probe = false, has_load = false;
+	int duration = 10;
+	uint64_t start;
+	double secs;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "hp:m:P:l:L:t:")) != -1) {
+		switch (opt) {
+		case 'p':
+			probe_target.is_pio = true;
+			probe_target.port = (uint16_t)strtoul(optarg, NULL, 0);
+			has_probe = true;
+			break;
+		case 'm':
+			if (parse_mmio_target(optarg, &probe_target) != 0) {
+				pr_err("invalid MMIO register %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			has_probe = true;
+			break;
+		case 'P':
+			probe_cpus = optarg;
+			break;
+		case 'l':
+			if (parse_mmio_target(optarg, &load_target) != 0) {
+				pr_err("invalid MMIO register %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			has_load = true;
+			break;
+		case 'L':
+			load_cpus = optarg;
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!has_probe || (duration <= 0) || ((load_cpus != NULL) && !has_load)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if ((map_target(&probe_target) != 0) || (has_load && (map_target(&load_target) != 0)))
+		return EXIT_FAILURE;
+
+	if ((add_threads(probe_cpus, true) != 0) ||
+			((load_cpus != NULL) && (add_threads(load_cpus, false) != 0))) {
+		pr_err("too many threads\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		if (threads[i].is_probe) {
+			threads[i].samples = calloc(MAX_SAMPLES, sizeof(uint64_t));
+			if (threads[i].samples == NULL) {
+				pr_err("out of memory\n");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i].tid, NULL, bench_thread_fn, &threads[i]) != 0) {
+			pr_err("failed to create thread %d\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	sleep((unsigned int)duration);
+	stop = true;
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i].tid, NULL);
+	secs = (double)(now_ns() - start) / 1e9;
+
+	for (i = 0; i < nr_threads; i++)
+		report(&threads[i], secs);
+
+	return EXIT_SUCCESS;
+}
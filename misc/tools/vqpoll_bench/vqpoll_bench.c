@@ -0,0 +1,799 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * vqpoll_bench - cost of the virtio poll modes of the device model at
+ * different request rates, without a guest
+ *
+ * It is linked with the virtio core of the device model and brings up one
+ * legacy virtio device with one queue through the same register writes as
+ * a guest driver. A guest thread then puts requests on the split ring at a
+ * fixed rate and kicks the queue through QUEUE_NOTIFY, unless the device
+ * has set VRING_USED_F_NO_NOTIFY. The device completes every request at
+ * once and stamps its completion time into the buffer. The poll timer runs
+ * in its own thread, as it does on the mevent thread of the device model.
+ *
+ * A kick is a VM exit and a round trip through the device model on a real
+ * system, which is not reproduced here: the number of kicks per request is
+ * reported instead, ioreq_bench measures their cost on a target.
+ *
+ * With -x, the ring throughput of the split and the packed layouts is
+ * compared instead. The device is set up through the modern registers,
+ * with and without VIRTIO_F_RING_PACKED, and the guest puts batches of
+ * chains on the ring, has the device process them, and reaps them, all
+ * in one thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "vmmapi.h"
+#include "mevent.h"
+#include "virtio.h"
+#include "timer.h"
+#include "log.h"
+
+#define BENCH_QSIZE		256
+#define RING_GPA		0x1000UL
+#define BUF_GPA			0x10000UL
+#define BUF_SIZE		64
+#define GUEST_MEM_SIZE		(BUF_GPA + BENCH_QSIZE * BUF_SIZE)
+#define MAX_RATES		16
+#define LAT_BUCKET_NS		100
+#define LAT_BUCKETS		10000	/* up to 1ms */
+#define RING_BATCH		32
+#define RING_MAX_CHAIN		4
+
+struct bench_dev {
+	struct virtio_base	base;	/* keep base as the first item */
+	struct virtio_vq_info	queue;
+	pthread_mutex_t		mtx;
+};
+
+/* the guest side of the split ring */
+struct bench_guest {
+	struct vring_desc	*desc;
+	struct vring_avail	*avail;
+	struct vring_used	*used;
+	uint16_t		free_ids[BENCH_QSIZE];
+	int			nr_free;
+	uint16_t		last_used;
+	uint64_t		post_ns[BENCH_QSIZE];
+};
+
+/* the guest side of the packed ring, chain k has the positions k * len on */
+struct bench_packed_guest {
+	struct vring_packed_desc	*desc;
+	struct vring_packed_desc_event	*driver_event;
+	uint16_t			next_avail;
+	bool				avail_wrap;
+	uint16_t			last_used;
+	bool				used_wrap;
+};
+
+struct bench_phase {
+	uint64_t		rate;
+	uint64_t		posted;
+	uint64_t		full;
+	uint64_t		kicks;
+	uint64_t		kicks_avoided;
+	uint64_t		poll_enter;
+	uint64_t		poll_exit;
+	uint64_t		irqs;
+	uint64_t		timer_runs;
+	uint64_t		cpu_ns;
+	uint64_t		lat_sum;
+	uint64_t		nr_lat;
+	uint32_t		lat_hist[LAT_BUCKETS];
+	double			secs;
+	bool			polling;
+	int			lost;
+};
+
+struct bench_timer {
+	struct acrn_timer	*timer;
+	pthread_t		tid;
+};
+
+static uint8_t guest_mem[GUEST_MEM_SIZE] __attribute__((aligned(4096)));
+static struct bench_dev dev;
+static struct pci_vdev pdev;
+static struct bench_guest guest;
+static struct bench_packed_guest pguest;
+static struct bench_timer poll_timer;
+
+static volatile uint64_t nr_irqs, nr_timer_runs;
+static bool adaptive;
+static struct bench_phase phases[MAX_RATES];
+static struct bench_phase *cur_phase;
+
+bool virtio_eventfd_enabled;
+
+/* virtio.c logs through the device model logger */
+void
+output_log(uint8_t level, const char *fmt, ...)
+{
+	va_list args;
+
+	if (level <= LOG_WARNING) {
+		va_start(args, fmt);
+		vfprintf(stderr, fmt, args);
+		va_end(args);
+	}
+}
+
+/* guest memory, the ring and the buffers live in guest_mem */
+void *
+paddr_guest2host(struct vmctx *ctx, uintptr_t gaddr, size_t len)
+{
+	if ((gaddr + len) > GUEST_MEM_SIZE)
+		return NULL;
+	return guest_mem + gaddr;
+}
+
+/* legacy INTx/MSI device without capabilities, the interrupts are counted */
+void pci_generate_msi(struct pci_vdev *pi, int index) { nr_irqs++; }
+void pci_generate_msix(struct pci_vdev *pi, int index) { nr_irqs++; }
+void pci_lintr_assert(struct pci_vdev *pi) {}
+void pci_lintr_deassert(struct pci_vdev *pi) {}
+void pci_lintr_request(struct pci_vdev *pi) {}
+int pci_msix_enabled(struct pci_vdev *pi) { return 0; }
+int pci_msix_table_bar(struct pci_vdev *pi) { return -1; }
+int pci_msix_pba_bar(struct pci_vdev *pi) { return -1; }
+int pci_emul_alloc_bar(struct pci_vdev *pi, int idx, enum pcibar_type type,
+		uint64_t size) { return 0; }
+int pci_emul_add_capability(struct pci_vdev *pi, u_char *capdata,
+		int caplen) { return 0; }
+int pci_emul_find_capability(struct pci_vdev *pi, uint8_t capid,
+		int *p_capoff) { return -1; }
+int pci_emul_add_msicap(struct pci_vdev *pi, int msgnum) { return 0; }
+int pci_emul_add_msixcap(struct pci_vdev *pi, int msgnum, int barnum) { return 0; }
+int pci_emul_msix_twrite(struct pci_vdev *pi, uint64_t offset, int size,
+		uint64_t value) { return 0; }
+uint64_t pci_emul_msix_tread(struct pci_vdev *pi, uint64_t offset,
+		int size) { return 0; }
+
+/* --virtio_eventfd is not used */
+int vm_ioeventfd(struct vmctx *ctx, struct acrn_ioeventfd *args) { return -1; }
+int vm_irqfd(struct vmctx *ctx, struct acrn_irqfd *args) { return -1; }
+struct mevent *mevent_add_class(int fd, enum ev_type type,
+		void (*run)(int, enum ev_type, void *), void *param,
+		void (*teardown)(void *), void *teardown_param,
+		enum mevent_class cls) { return NULL; }
+int mevent_delete_close(struct mevent *evp) { return 0; }
+
+/* the timers of the device model, on a thread instead of the mevent loop */
+static void *
+timer_thread(void *arg)
+{
+	struct acrn_timer *timer = arg;
+	uint64_t nexp;
+
+	while (read(timer->fd, &nexp, sizeof(nexp)) == sizeof(nexp)) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		nr_timer_runs++;
+		(*timer->callback)(timer->callback_param, nexp);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	}
+
+	return NULL;
+}
+
+int32_t
+acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *, uint64_t), void *param)
+{
+	if (poll_timer.timer != NULL)
+		return -1;
+
+	timer->fd = timerfd_create(timer->clockid, 0);
+	if (timer->fd < 0)
+		return -1;
+	timer->callback = cb;
+	timer->callback_param = param;
+	poll_timer.timer = timer;
+
+	return pthread_create(&poll_timer.tid, NULL, timer_thread, timer);
+}
+
+void
+acrn_timer_deinit(struct acrn_timer *timer)
+{
+	if (poll_timer.timer != timer)
+		return;
+
+	/* may be called under the device lock, which the callback takes */
+	pthread_cancel(poll_timer.tid);
+	pthread_detach(poll_timer.tid);
+	close(timer->fd);
+	timer->fd = -1;
+	poll_timer.timer = NULL;
+}
+
+int32_t
+acrn_timer_settime(struct acrn_timer *timer, const struct itimerspec *new_value)
+{
+	return timerfd_settime(timer->fd, 0, new_value, NULL);
+}
+
+static void
+usage(const char *prog)
+{
+	printf("Usage: %s [options]\n"
+	       "Options:\n"
+	       "  -h                 print this message\n"
+	       "  -p poll            poll mode, as --virtio_poll of the device\n"
+	       "                     model: interval or adaptive[,interval]\n"
+	       "                     (default notify only)\n"
+	       "  -r rate[,rate...]  requests per second of each phase, 0 for\n"
+	       "                     an idle phase (default 0,100,1000,10000,50000)\n"
+	       "  -t seconds         duration of each phase (default 2)\n"
+	       "  -x                 compare the ring throughput of the split\n"
+	       "                     and the packed layouts instead\n",
+	       prog);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+/* the device completes each request at once */
+static void
+bench_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	struct iovec iov;
+	uint64_t done;
+	uint16_t idx;
+
+	while (vq_has_descs(vq)) {
+		if (vq_getchain(vq, &idx, &iov, 1, NULL) < 1)
+			break;
+		done = now_ns();
+		memcpy(iov.iov_base, &done, sizeof(done));
+		vq_relchain(vq, idx, sizeof(done));
+	}
+	vq_endchains(vq, 1);
+}
+
+static void
+bench_reset(void *vdev)
+{
+	virtio_reset_dev(&dev.base);
+}
+
+static struct virtio_ops bench_ops = {
+	"vqpoll_bench",		/* our name */
+	1,			/* we support 1 virtqueue */
+	0,			/* config reg size */
+	bench_reset,		/* reset */
+	bench_notify,		/* device-wide qnotify */
+	NULL,			/* read PCI config */
+	NULL,			/* write PCI config */
+	NULL,			/* apply negotiated features */
+	NULL,			/* called on guest set status */
+};
+
+static void
+guest_write(uint64_t offset, int size, uint64_t value)
+{
+	virtio_pci_write(NULL, 0, &pdev, 0, offset, size, value);
+}
+
+static void
+bench_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&dev.mtx, &attr);
+
+	virtio_linkup(&dev.base, &bench_ops, &dev, &pdev, &dev.queue, BACKEND_VBSU);
+	dev.base.mtx = &dev.mtx;
+	dev.queue.qsize = BENCH_QSIZE;
+	virtio_set_io_bar(&dev.base, 0);
+}
+
+/* the split ring of BENCH_QSIZE entries at RING_GPA, as a legacy guest lays it out */
+static void
+guest_split_layout(void)
+{
+	uint8_t *ring = guest_mem + RING_GPA;
+	int i;
+
+	guest.desc = (struct vring_desc *)ring;
+	guest.avail = (struct vring_avail *)(ring + BENCH_QSIZE * sizeof(struct vring_desc));
+	guest.used = (struct vring_used *)(ring + ((BENCH_QSIZE * sizeof(struct vring_desc) +
+		(3 + BENCH_QSIZE) * sizeof(uint16_t) + VIRTIO_PCI_VRING_ALIGN - 1) &
+		~(VIRTIO_PCI_VRING_ALIGN - 1UL)));
+	for (i = 0; i < BENCH_QSIZE; i++)
+		guest.free_ids[i] = i;
+	guest.nr_free = BENCH_QSIZE;
+	guest.last_used = 0;
+}
+
+/* the register writes of a legacy guest driver */
+static void
+bench_setup(void)
+{
+	bench_init();
+
+	guest_write(VIRTIO_PCI_STATUS, 1, VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER);
+	guest_write(VIRTIO_PCI_GUEST_FEATURES, 4, 0);
+	guest_write(VIRTIO_PCI_QUEUE_SEL, 2, 0);
+	guest_write(VIRTIO_PCI_QUEUE_PFN, 4, RING_GPA >> VRING_PAGE_BITS);
+	guest_write(VIRTIO_PCI_STATUS, 1, VIRTIO_CONFIG_S_ACKNOWLEDGE |
+		VIRTIO_CONFIG_S_DRIVER | VIRTIO_CONFIG_S_DRIVER_OK);
+
+	guest_split_layout();
+}
+
+static void
+guest_post(void)
+{
+	uint16_t id = guest.free_ids[--guest.nr_free];
+	uint16_t avail_idx = guest.avail->idx;
+
+	guest.desc[id].addr = BUF_GPA + id * BUF_SIZE;
+	guest.desc[id].len = BUF_SIZE;
+	guest.desc[id].flags = VRING_DESC_F_WRITE;
+	guest.desc[id].next = 0;
+	guest.avail->ring[avail_idx % BENCH_QSIZE] = id;
+	guest.post_ns[id] = now_ns();
+	__atomic_store_n(&guest.avail->idx, (uint16_t)(avail_idx + 1), __ATOMIC_RELEASE);
+
+	/* as virtqueue_kick_prepare() of a guest without EVENT_IDX */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!(__atomic_load_n(&guest.used->flags, __ATOMIC_RELAXED) & VRING_USED_F_NO_NOTIFY))
+		guest_write(VIRTIO_PCI_QUEUE_NOTIFY, 2, 0);
+}
+
+static void
+guest_reap(void)
+{
+	struct vring_used_elem *elem;
+	uint64_t done, lat;
+	uint16_t id;
+
+	while (guest.last_used != __atomic_load_n(&guest.used->idx, __ATOMIC_ACQUIRE)) {
+		elem = &guest.used->ring[guest.last_used % BENCH_QSIZE];
+		id = (uint16_t)elem->id;
+		memcpy(&done, guest_mem + BUF_GPA + id * BUF_SIZE, sizeof(done));
+		lat = done - guest.post_ns[id];
+		cur_phase->lat_sum += lat;
+		cur_phase->lat_hist[MIN(lat / LAT_BUCKET_NS, LAT_BUCKETS - 1)]++;
+		cur_phase->nr_lat++;
+		guest.free_ids[guest.nr_free++] = id;
+		guest.last_used++;
+	}
+}
+
+static void
+modern_write(uint64_t reg, int size, uint64_t value)
+{
+	virtio_pci_write(NULL, 0, &pdev, VIRTIO_MODERN_MMIO_BAR_IDX,
+		VIRTIO_CAP_COMMON_OFFSET + reg, size, value);
+}
+
+/*
+ * The register writes of a modern guest driver, after a reset. The
+ * modern BAR is used without its PCI capabilities, which the stubs of
+ * pci_core don't keep.
+ */
+static void
+ring_setup(bool packed)
+{
+	uint64_t desc = RING_GPA, avail, used;
+	uint32_t features = 1U << (VIRTIO_F_VERSION_1 - 32);
+	uint8_t status = VIRTIO_CONFIG_S_ACKNOWLEDGE | VIRTIO_CONFIG_S_DRIVER;
+
+	if (packed) {
+		features |= 1U << (VIRTIO_F_RING_PACKED - 32);
+		avail = desc + BENCH_QSIZE * sizeof(struct vring_packed_desc);
+		used = avail + sizeof(struct vring_packed_desc_event);
+	} else {
+		guest_split_layout();
+		avail = (uint64_t)((uint8_t *)guest.avail - guest_mem);
+		used = (uint64_t)((uint8_t *)guest.used - guest_mem);
+	}
+	memset(guest_mem + RING_GPA, 0, BUF_GPA - RING_GPA);
+
+	modern_write(VIRTIO_PCI_COMMON_STATUS, 1, 0);
+	modern_write(VIRTIO_PCI_COMMON_STATUS, 1, status);
+	modern_write(VIRTIO_PCI_COMMON_GFSELECT, 4, 0);
+	modern_write(VIRTIO_PCI_COMMON_GF, 4, 0);
+	modern_write(VIRTIO_PCI_COMMON_GFSELECT, 4, 1);
+	modern_write(VIRTIO_PCI_COMMON_GF, 4, features);
+	status |= VIRTIO_CONFIG_S_FEATURES_OK;
+	modern_write(VIRTIO_PCI_COMMON_STATUS, 1, status);
+	modern_write(VIRTIO_PCI_COMMON_Q_SELECT, 2, 0);
+	modern_write(VIRTIO_PCI_COMMON_Q_SIZE, 2, BENCH_QSIZE);
+	modern_write(VIRTIO_PCI_COMMON_Q_DESCLO, 4, desc);
+	modern_write(VIRTIO_PCI_COMMON_Q_DESCHI, 4, 0);
+	modern_write(VIRTIO_PCI_COMMON_Q_AVAILLO, 4, avail);
+	modern_write(VIRTIO_PCI_COMMON_Q_AVAILHI, 4, 0);
+	modern_write(VIRTIO_PCI_COMMON_Q_USEDLO, 4, used);
+	modern_write(VIRTIO_PCI_COMMON_Q_USEDHI, 4, 0);
+	modern_write(VIRTIO_PCI_COMMON_Q_ENABLE, 2, 1);
+	modern_write(VIRTIO_PCI_COMMON_STATUS, 1, status | VIRTIO_CONFIG_S_DRIVER_OK);
+
+	/* the guest polls for completions, without interrupts */
+	if (packed) {
+		pguest.desc = (struct vring_packed_desc *)(guest_mem + desc);
+		pguest.driver_event = (struct vring_packed_desc_event *)(guest_mem + avail);
+		pguest.driver_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+		pguest.next_avail = 0;
+		pguest.avail_wrap = true;
+		pguest.last_used = 0;
+		pguest.used_wrap = true;
+	} else
+		guest.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+/* chain k of len descriptors is made of the descriptors k * len on */
+static void
+ring_post_split(uint16_t k, int len)
+{
+	uint16_t head = k * len, avail_idx = guest.avail->idx;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		guest.desc[head + i].addr = BUF_GPA + (head + i) * BUF_SIZE;
+		guest.desc[head + i].len = BUF_SIZE;
+		guest.desc[head + i].flags = VRING_DESC_F_WRITE |
+			((i < len - 1) ? VRING_DESC_F_NEXT : 0);
+		guest.desc[head + i].next = head + i + 1;
+	}
+	guest.avail->ring[avail_idx % BENCH_QSIZE] = head;
+	__atomic_store_n(&guest.avail->idx, (uint16_t)(avail_idx + 1), __ATOMIC_RELEASE);
+}
+
+static int
+ring_reap_split(int len)
+{
+	int n = 0;
+
+	while (guest.last_used != __atomic_load_n(&guest.used->idx, __ATOMIC_ACQUIRE)) {
+		guest.free_ids[guest.nr_free++] =
+			guest.used->ring[guest.last_used % BENCH_QSIZE].id / len;
+		guest.last_used++;
+		n++;
+	}
+	return n;
+}
+
+/* the positions of a chain don't wrap, len divides BENCH_QSIZE */
+static void
+ring_post_packed(uint16_t k, int len)
+{
+	struct vring_packed_desc *d = &pguest.desc[pguest.next_avail];
+	uint16_t avail = pguest.avail_wrap ? (1 << VRING_PACKED_DESC_F_AVAIL) :
+		(1 << VRING_PACKED_DESC_F_USED);
+	int i;
+
+	for (i = 0; i < len; i++) {
+		d[i].addr = BUF_GPA + (pguest.next_avail + i) * BUF_SIZE;
+		d[i].len = BUF_SIZE;
+		d[i].id = k;
+		if (i > 0)
+			d[i].flags = avail | VRING_DESC_F_WRITE |
+				((i < len - 1) ? VRING_DESC_F_NEXT : 0);
+	}
+	/* the flags of the first descriptor make the chain available */
+	__atomic_store_n(&d[0].flags, avail | VRING_DESC_F_WRITE |
+		((len > 1) ? VRING_DESC_F_NEXT : 0), __ATOMIC_RELEASE);
+
+	pguest.next_avail += len;
+	if (pguest.next_avail == BENCH_QSIZE) {
+		pguest.next_avail = 0;
+		pguest.avail_wrap = !pguest.avail_wrap;
+	}
+}
+
+static int
+ring_reap_packed(int len)
+{
+	struct vring_packed_desc *d;
+	uint16_t flags, used;
+	int n = 0;
+
+	for (;;) {
+		d = &pguest.desc[pguest.last_used];
+		flags = __atomic_load_n(&d->flags, __ATOMIC_ACQUIRE);
+		used = pguest.used_wrap ? ((1 << VRING_PACKED_DESC_F_AVAIL) |
+			(1 << VRING_PACKED_DESC_F_USED)) : 0;
+		if ((flags & ((1 << VRING_PACKED_DESC_F_AVAIL) |
+				(1 << VRING_PACKED_DESC_F_USED))) != used)
+			break;
+		guest.free_ids[guest.nr_free++] = d->id;
+		pguest.last_used += len;
+		if (pguest.last_used == BENCH_QSIZE) {
+			pguest.last_used = 0;
+			pguest.used_wrap = !pguest.used_wrap;
+		}
+		n++;
+	}
+	return n;
+}
+
+/* what the backends do on a notify, without touching the buffers */
+static void
+ring_device_run(void)
+{
+	struct iovec iov[RING_MAX_CHAIN];
+	uint16_t idx;
+	int n;
+
+	while (vq_has_descs(&dev.queue)) {
+		n = vq_getchain(&dev.queue, &idx, iov, RING_MAX_CHAIN, NULL);
+		if (n < 1)
+			break;
+		vq_relchain(&dev.queue, idx, sizeof(uint64_t));
+	}
+	vq_endchains(&dev.queue, 1);
+}
+
+/* requests per second with chains of len descriptors */
+static double
+ring_run(bool packed, int len, int duration)
+{
+	uint64_t start, end, done = 0;
+	int i, nr_chains = BENCH_QSIZE / len, lost;
+
+	ring_setup(packed);
+	for (i = 0; i < nr_chains; i++)
+		guest.free_ids[i] = nr_chains - 1 - i;
+	guest.nr_free = nr_chains;
+
+	start = now_ns();
+	end = start + (uint64_t)duration * 1000000000UL;
+	do {
+		for (i = 0; i < 1000; i++) {
+			while ((guest.nr_free > nr_chains - RING_BATCH) && (guest.nr_free > 0)) {
+				if (packed)
+					ring_post_packed(guest.free_ids[--guest.nr_free], len);
+				else
+					ring_post_split(guest.free_ids[--guest.nr_free], len);
+			}
+			ring_device_run();
+			done += packed ? ring_reap_packed(len) : ring_reap_split(len);
+		}
+	} while (now_ns() < end);
+	end = now_ns();
+
+	lost = nr_chains - guest.nr_free;
+	if (lost != 0)
+		fprintf(stderr, "%s ring: %d chains not completed\n",
+			packed ? "packed" : "split", lost);
+	return (double)done * 1e9 / (double)(end - start);
+}
+
+static int
+ring_compare(int duration)
+{
+	const int lens[] = { 1, 2, 4 };
+	double split, packed;
+	int i;
+
+	bench_init();
+	dev.base.device_caps |= 1UL << VIRTIO_F_VERSION_1;
+	dev.base.modern_mmio_bar_idx = VIRTIO_MODERN_MMIO_BAR_IDX;
+
+	printf("ring throughput, %d entries, batches of %d chains\n", BENCH_QSIZE, RING_BATCH);
+	printf("%9s %12s %12s %8s %8s %7s\n", "desc/req", "split req/s", "packed req/s",
+		"split ns", "packed ns", "packed");
+	for (i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); i++) {
+		split = ring_run(false, lens[i], duration);
+		packed = ring_run(true, lens[i], duration);
+		printf("%9d %12.0f %12.0f %8.1f %8.1f %+6.1f%%\n", lens[i], split, packed,
+			1e9 / split, 1e9 / packed, (packed / split - 1.0) * 100.0);
+	}
+	if (dev.queue.packed != true) {
+		fprintf(stderr, "the packed ring was not negotiated\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static uint64_t
+poll_cpu_ns(void)
+{
+	struct timespec ts;
+	clockid_t cid;
+
+	if ((poll_timer.timer == NULL) || (pthread_getcpuclockid(poll_timer.tid, &cid) != 0) ||
+			(clock_gettime(cid, &ts) != 0))
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+/* one phase of requests at a fixed rate, reported after the last phase */
+static void
+run_phase(struct bench_phase *ph, int duration)
+{
+	struct timespec pause = { 0, 20000 };
+	struct virtio_vq_stats st0, st1;
+	uint64_t start, end, now, due, irqs0, runs0, cpu0;
+
+	pthread_mutex_lock(&dev.mtx);
+	st0 = dev.queue.stats;
+	pthread_mutex_unlock(&dev.mtx);
+	irqs0 = nr_irqs;
+	runs0 = nr_timer_runs;
+	cpu0 = poll_cpu_ns();
+	cur_phase = ph;
+
+	start = now_ns();
+	end = start + (uint64_t)duration * 1000000000UL;
+	while ((now = now_ns()) < end) {
+		due = (now - start) * ph->rate / 1000000000UL;
+		while (ph->posted < due) {
+			guest_reap();
+			if (guest.nr_free == 0) {
+				ph->full++;
+				break;
+			}
+			guest_post();
+			ph->posted++;
+		}
+		guest_reap();
+		nanosleep(&pause, NULL);
+	}
+	/* the last requests may wait for a poll */
+	while ((guest.nr_free != BENCH_QSIZE) && (now_ns() < end + 1000000000UL)) {
+		guest_reap();
+		nanosleep(&pause, NULL);
+	}
+	ph->secs = (double)(now_ns() - start) / 1e9;
+
+	pthread_mutex_lock(&dev.mtx);
+	st1 = dev.queue.stats;
+	ph->polling = (poll_timer.timer != NULL) && (!adaptive || dev.queue.polling);
+	pthread_mutex_unlock(&dev.mtx);
+
+	ph->kicks = st1.kicks - st0.kicks;
+	ph->kicks_avoided = st1.kicks_avoided - st0.kicks_avoided;
+	ph->poll_enter = st1.poll_enter - st0.poll_enter;
+	ph->poll_exit = st1.poll_exit - st0.poll_exit;
+	ph->irqs = nr_irqs - irqs0;
+	ph->timer_runs = nr_timer_runs - runs0;
+	ph->cpu_ns = poll_cpu_ns() - cpu0;
+	ph->lost = BENCH_QSIZE - guest.nr_free;
+}
+
+static double
+lat_p99(const struct bench_phase *ph)
+{
+	uint64_t n = 0;
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		n += ph->lat_hist[i];
+		if (n * 100 >= ph->nr_lat * 99)
+			break;
+	}
+	return (double)(i + 1) * LAT_BUCKET_NS / 1000.0;
+}
+
+static void
+report(const struct bench_phase *ph)
+{
+	double posted = ph->posted ? (double)ph->posted : 1.0;
+
+	printf("%8lu %9lu %8.3f %8.3f %9.0f %7.2f %8.3f",
+		ph->rate, ph->posted, ph->kicks / posted, ph->irqs / posted,
+		ph->timer_runs / ph->secs, ph->cpu_ns / ph->secs / 1e7,
+		ph->kicks_avoided / posted);
+	if (ph->nr_lat != 0)
+		printf(" %8.1f %8.1f", (double)ph->lat_sum / ph->nr_lat / 1000.0,
+			lat_p99(ph));
+	else
+		printf(" %8s %8s", "-", "-");
+	printf(" %5lu %5lu %s", ph->poll_enter, ph->poll_exit,
+		ph->polling ? "poll" : "notify");
+	if (ph->full != 0)
+		printf(", ring full %lu times", ph->full);
+	if (ph->lost != 0)
+		printf(", %d requests not completed", ph->lost);
+	printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t rates[MAX_RATES] = { 0, 100, 1000, 10000, 50000 };
+	struct virtio_vq_stats_info info;
+	char *poll = NULL, *tok, *save = NULL;
+	int nr_rates = 5, duration = 2;
+	bool ring = false;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "hp:r:t:x")) != -1) {
+		switch (opt) {
+		case 'p':
+			poll = optarg;
+			break;
+		case 'r':
+			nr_rates = 0;
+			for (tok = strtok_r(optarg, ",", &save); tok != NULL;
+					tok = strtok_r(NULL, ",", &save)) {
+				if (nr_rates == MAX_RATES) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				rates[nr_rates++] = strtoull(tok, NULL, 0);
+			}
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'x':
+			ring = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((nr_rates == 0) || (duration <= 0) ||
+			((poll != NULL) && (acrn_parse_virtio_poll_interval(poll) != 0))) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (ring)
+		return ring_compare(duration);
+
+	adaptive = (poll != NULL) && (strncmp(poll, "adaptive", 8) == 0);
+	bench_setup();
+	if (poll != NULL) {
+		/* virtio_poll_start() arms the timer 5s after DRIVER_OK */
+		printf("poll mode %s, waiting for the poll timer to start\n", poll);
+		sleep(6);
+	} else
+		printf("notify mode\n");
+
+	/* back to back, a pause between the phases would be an idle window */
+	for (i = 0; i < nr_rates; i++) {
+		phases[i].rate = rates[i];
+		run_phase(&phases[i], duration);
+	}
+
+	printf("%8s %9s %8s %8s %9s %7s %8s %8s %8s %5s %5s %s\n",
+		"req/s", "requests", "kick/req", "irq/req", "timer/s", "cpu%",
+		"poll/req", "lat_avg", "lat_p99", "enter", "exit", "mode");
+	for (i = 0; i < nr_rates; i++)
+		report(&phases[i]);
+
+	/* the device is removed without a reset, as on a DM teardown */
+	virtio_release_dev(&pdev);
+	if ((poll != NULL) && (virtio_get_vq_stats(0, &info) == 0)) {
+		fprintf(stderr, "device still polled after its removal\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}